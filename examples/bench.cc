@@ -0,0 +1,614 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <array>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "mpsc_queue.h"
+#include "conn_id_map.h"
+#include "timer_wheel.h"
+#include "send_batch.h"
+
+// bench runs micro-benchmarks of the data structures, the transmit
+// path, and the worker routing which the example server is built on,
+// and prints the average time per operation.
+//
+// Usage: bench [ITERATIONS]
+
+using namespace ngtcp2;
+
+namespace {
+void report(const char *name, size_t n, std::chrono::nanoseconds elapsed) {
+  printf("%-24s %10zu iterations %10.1f ns/op\n", name, n,
+         static_cast<double>(elapsed.count()) / n);
+}
+} // namespace
+
+namespace {
+struct Packet {
+  uint8_t *data;
+  size_t datalen;
+  BufferPool *pool;
+};
+} // namespace
+
+namespace {
+// bench_handoff sends |n| buffers in total from |nproducers| threads
+// to this thread in the same way server workers forward datagrams.
+void bench_handoff(size_t n, size_t nproducers) {
+  constexpr size_t QUEUE_SIZE = 1024;
+  MPSCQueue<Packet> q(QUEUE_SIZE);
+  QueueNotifier notifier;
+
+  if (notifier.init() != 0) {
+    fprintf(stderr, "QueueNotifier::init: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  std::vector<std::unique_ptr<BufferPool>> pools;
+  for (size_t i = 0; i < nproducers; ++i) {
+    pools.push_back(std::make_unique<BufferPool>(QUEUE_SIZE, 1500));
+  }
+
+  auto nper = n / nproducers;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> producers;
+  for (auto &p : pools) {
+    producers.emplace_back([&q, &notifier, pool = p.get(), nper]() {
+      for (size_t i = 0; i < nper;) {
+        auto buf = pool->get();
+        if (buf == nullptr) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        while (!q.push({buf, 0, pool})) {
+          std::this_thread::yield();
+        }
+
+        notifier.notify();
+        ++i;
+      }
+    });
+  }
+
+  size_t nrecv = 0;
+  for (pollfd pfd{notifier.fd(), POLLIN, 0}; nrecv < nper * nproducers;) {
+    if (poll(&pfd, 1, -1) <= 0) {
+      continue;
+    }
+
+    notifier.reset();
+
+    Packet pkt;
+    while (q.pop(pkt)) {
+      pkt.pool->put(pkt.data);
+      ++nrecv;
+    }
+  }
+
+  for (auto &t : producers) {
+    t.join();
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "mpsc_handoff/%zu", nproducers);
+  report(name, nrecv, std::chrono::steady_clock::now() - start);
+}
+} // namespace
+
+namespace {
+// sink keeps the results of lookups from being optimized away.
+volatile uint64_t sink;
+} // namespace
+
+namespace {
+template <typename F>
+void measure(const char *name, const std::vector<uint64_t> &keys, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (auto key : keys) {
+    f(key);
+  }
+  report(name, keys.size(), std::chrono::steady_clock::now() - start);
+}
+} // namespace
+
+namespace {
+// bench_conn_id_map looks up |n| random connection IDs among
+// |nconns| connections, both present and absent, in ConnectionIDMap
+// and std::map.
+void bench_conn_id_map(size_t n, size_t nconns) {
+  std::mt19937_64 gen(1);
+  std::vector<uint64_t> conn_ids(nconns);
+  std::generate(std::begin(conn_ids), std::end(conn_ids), std::ref(gen));
+
+  ConnectionIDMap<uint64_t> m;
+  std::map<uint64_t, uint64_t> ref;
+  for (auto conn_id : conn_ids) {
+    m.emplace(conn_id, conn_id);
+    ref.emplace(conn_id, conn_id);
+  }
+
+  std::vector<uint64_t> hits(n), misses(n);
+  std::uniform_int_distribution<size_t> idxdis(0, nconns - 1);
+  for (size_t i = 0; i < n; ++i) {
+    hits[i] = conn_ids[idxdis(gen)];
+    misses[i] = gen();
+  }
+
+  char name[64];
+  uint64_t sum = 0;
+
+  snprintf(name, sizeof(name), "conn_id_map_hit/%zu", nconns);
+  measure(name, hits, [&](uint64_t k) { sum += *m.find(k); });
+  snprintf(name, sizeof(name), "conn_id_map_miss/%zu", nconns);
+  measure(name, misses, [&](uint64_t k) { sum += m.find(k) != nullptr; });
+  snprintf(name, sizeof(name), "std_map_hit/%zu", nconns);
+  measure(name, hits, [&](uint64_t k) { sum += ref.find(k)->second; });
+  snprintf(name, sizeof(name), "std_map_miss/%zu", nconns);
+  measure(name, misses, [&](uint64_t k) { sum += ref.count(k); });
+
+  sink = sum;
+}
+} // namespace
+
+namespace {
+void noop(TimerWheel::Timer *) {}
+} // namespace
+
+namespace {
+// bench_timer_wheel pushes back the idle timer of a random one of
+// |ntimers| connections |n| times as if a packet arrives on it, and
+// advances the clock by a microsecond each time.
+void bench_timer_wheel(size_t n, size_t ntimers) {
+  TimerWheel wheel;
+  std::vector<TimerWheel::Timer> timers(ntimers, {noop, nullptr});
+  uint64_t ts = 1000000000;
+
+  for (auto &t : timers) {
+    wheel.start(&t, ts + 30000000, ts);
+  }
+
+  std::mt19937_64 gen(1);
+  std::vector<size_t> idx(n);
+  std::generate(std::begin(idx), std::end(idx),
+                [&]() { return gen() % ntimers; });
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto i : idx) {
+    ++ts;
+    wheel.start(&timers[i], ts + 30000000, ts);
+    if (ts % TimerWheel::TICK == 0) {
+      wheel.expire(ts);
+    }
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "timer_wheel_start/%zu", ntimers);
+  report(name, n, std::chrono::steady_clock::now() - start);
+}
+} // namespace
+
+namespace {
+// bench_send_batch sends |n| packets of 1200 bytes over loopback from
+// |nconns| connections, each to its own socket, in the same way as
+// Server::write_dirty_handlers does.  Each connection fills a
+// SendBuffer, and a SendBatch sends all of them.  If |gso| is true,
+// the packets of each connection take a single message with
+// UDP_SEGMENT.  Only the send calls are timed.
+void bench_send_batch(size_t n, size_t nconns, bool gso) {
+  constexpr size_t PKTLEN = 1200;
+  auto npkts = std::min(MAX_SEND_PKTS, MAX_SEND_BATCH / nconns);
+  auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+  std::vector<int> rfds;
+  std::vector<Address> addrs(nconns);
+  std::vector<std::unique_ptr<SendBuffer>> sendbufs;
+  SendBatch batch;
+  int rcvbuf = 4 * 1024 * 1024;
+
+  for (auto &addr : addrs) {
+    auto rfd = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    addr.len = sizeof(addr.su.in);
+    addr.su.in = sockaddr_in{};
+    addr.su.in.sin_family = AF_INET;
+    addr.su.in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(rfd, &addr.su.sa, addr.len) != 0 ||
+        getsockname(rfd, &addr.su.sa, &addr.len) != 0) {
+      fprintf(stderr, "bind: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    rfds.push_back(rfd);
+    sendbufs.push_back(std::make_unique<SendBuffer>(PKTLEN));
+  }
+
+  std::chrono::nanoseconds elapsed{};
+  size_t i;
+
+  for (i = 0; i < n; i += npkts * nconns) {
+    batch.clear();
+    for (size_t j = 0; j < nconns; ++j) {
+      auto &sendbuf = *sendbufs[j];
+      for (size_t k = 0; k < npkts; ++k) {
+        sendbuf.push(PKTLEN);
+      }
+      batch.add(addrs[j], sendbuf, gso);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    if (batch.send(fd) != 0) {
+      if (gso && (errno == EIO || errno == EINVAL)) {
+        printf("%-24s not supported\n", "send_batch_gso");
+        break;
+      }
+      fprintf(stderr, "sendmmsg: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    elapsed += std::chrono::steady_clock::now() - start;
+
+    std::array<uint8_t, 64 * 1024> buf;
+    for (auto rfd : rfds) {
+      while (recv(rfd, buf.data(), buf.size(), MSG_DONTWAIT) != -1)
+        ;
+    }
+  }
+
+  if (i >= n) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%zu",
+             gso ? "send_batch_gso" : "send_batch", nconns);
+    report(name, i, elapsed);
+  }
+
+  for (auto rfd : rfds) {
+    close(rfd);
+  }
+  close(fd);
+}
+} // namespace
+
+namespace {
+// WORKER_ID_SHIFT is the position of the worker index in a server
+// chosen connection ID as in server.h.
+constexpr size_t WORKER_ID_SHIFT = 56;
+} // namespace
+
+namespace {
+// BenchWorker is a worker of bench_workers.  Like a server worker, it
+// has its own socket bound with SO_REUSEPORT, connection table, and
+// queue of the datagrams forwarded from the other workers.
+struct BenchWorker {
+  BenchWorker(size_t id) : id(id), fd(-1), q(1024), pool(1024, 1500) {}
+  ~BenchWorker() {
+    if (fd != -1) {
+      close(fd);
+    }
+  }
+
+  size_t id;
+  int fd;
+  MPSCQueue<Packet> q;
+  QueueNotifier notifier;
+  BufferPool pool;
+  ConnectionIDMap<uint64_t> conns;
+  std::atomic<size_t> nrecv{0};
+  // sum keeps the results of lookups from being optimized away.
+  uint64_t sum{0};
+};
+} // namespace
+
+namespace {
+// Datagrams of bench_workers start with one of these types.  A probe
+// asks the worker which receives it for a connection ID, like Client
+// Initial does.  The other datagrams carry the connection ID.
+enum : uint8_t { BENCH_PKT_PROBE, BENCH_PKT_DATA };
+} // namespace
+
+namespace {
+// run_worker receives datagrams on w.fd, and the ones forwarded to w
+// until |stop| becomes true.  A data datagram for a connection which
+// another worker owns is forwarded to it.
+void run_worker(BenchWorker &w,
+                std::vector<std::unique_ptr<BenchWorker>> &workers,
+                const std::atomic<bool> &stop) {
+  std::array<uint8_t, 1500> buf;
+  uint64_t next_conn_id = 0;
+
+  auto process = [&w](const uint8_t *data, size_t datalen) {
+    uint64_t conn_id;
+    memcpy(&conn_id, data + 1, sizeof(conn_id));
+    auto p = w.conns.find(conn_id);
+    if (p) {
+      w.sum += *p + data[datalen - 1];
+    }
+    w.nrecv.fetch_add(1, std::memory_order_relaxed);
+  };
+
+  std::array<pollfd, 2> pfds{
+      pollfd{w.fd, POLLIN, 0},
+      pollfd{w.notifier.fd(), POLLIN, 0},
+  };
+
+  while (!stop.load(std::memory_order_relaxed)) {
+    if (poll(pfds.data(), pfds.size(), 10) <= 0) {
+      continue;
+    }
+
+    if (pfds[1].revents) {
+      w.notifier.reset();
+
+      Packet pkt;
+      while (w.q.pop(pkt)) {
+        process(pkt.data, pkt.datalen);
+        pkt.pool->put(pkt.data);
+      }
+    }
+
+    for (;;) {
+      sockaddr_storage ss;
+      socklen_t sslen = sizeof(ss);
+      auto nread = recvfrom(w.fd, buf.data(), buf.size(), MSG_DONTWAIT,
+                            reinterpret_cast<sockaddr *>(&ss), &sslen);
+      if (nread == -1) {
+        break;
+      }
+
+      if (buf[0] == BENCH_PKT_PROBE) {
+        auto conn_id = (static_cast<uint64_t>(w.id) << WORKER_ID_SHIFT) |
+                       next_conn_id++;
+        w.conns.emplace(conn_id, conn_id);
+        sendto(w.fd, &conn_id, sizeof(conn_id), 0,
+               reinterpret_cast<sockaddr *>(&ss), sslen);
+        continue;
+      }
+
+      if (static_cast<size_t>(nread) <= sizeof(uint64_t)) {
+        continue;
+      }
+
+      uint64_t conn_id;
+      memcpy(&conn_id, buf.data() + 1, sizeof(conn_id));
+
+      auto worker_id = static_cast<size_t>(conn_id >> WORKER_ID_SHIFT);
+      if (worker_id == w.id || worker_id >= workers.size()) {
+        process(buf.data(), nread);
+        continue;
+      }
+
+      auto fwdbuf = w.pool.get();
+      if (fwdbuf == nullptr) {
+        continue;
+      }
+
+      auto &peer = *workers[worker_id];
+      std::copy_n(buf.data(), nread, fwdbuf);
+      if (!peer.q.push({fwdbuf, static_cast<size_t>(nread), &w.pool})) {
+        w.pool.put(fwdbuf);
+        continue;
+      }
+      peer.notifier.notify();
+    }
+  }
+}
+} // namespace
+
+namespace {
+// bench_workers sends |n| datagrams of 1200 bytes over loopback to
+// |nworkers| workers which share a port with SO_REUSEPORT, from
+// |nworkers| sender threads with 4 connections each.  Each worker
+// runs in its own thread, and routes datagrams by connection ID in
+// the same way as the server workers.  It measures the socket and
+// routing path only, not QUIC or TLS processing.  It reports the
+// time per datagram received; lost datagrams are not counted.
+void bench_workers(size_t n, size_t nworkers) {
+  constexpr size_t PKTLEN = 1200;
+  constexpr size_t CONNS_PER_SENDER = 4;
+  int val = 1;
+  int rcvbuf = 4 * 1024 * 1024;
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  std::vector<std::unique_ptr<BenchWorker>> workers;
+  for (size_t i = 0; i < nworkers; ++i) {
+    auto w = std::make_unique<BenchWorker>(i);
+    auto addrlen = static_cast<socklen_t>(sizeof(addr));
+
+    w->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    if (setsockopt(w->fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) != 0 ||
+        bind(w->fd, reinterpret_cast<sockaddr *>(&addr), addrlen) != 0 ||
+        getsockname(w->fd, reinterpret_cast<sockaddr *>(&addr), &addrlen) !=
+            0) {
+      fprintf(stderr, "bind: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    if (w->notifier.init() != 0) {
+      fprintf(stderr, "QueueNotifier::init: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    workers.push_back(std::move(w));
+  }
+
+  std::atomic<bool> stop(false);
+  std::vector<std::thread> worker_threads;
+  for (auto &w : workers) {
+    worker_threads.emplace_back(
+        [&w, &workers, &stop]() { run_worker(*w, workers, stop); });
+  }
+
+  // Each connection gets its connection ID from the worker which the
+  // kernel chooses for its 4-tuple.
+  std::vector<int> fds(nworkers * CONNS_PER_SENDER);
+  std::vector<uint64_t> conn_ids(fds.size());
+  for (size_t i = 0; i < fds.size(); ++i) {
+    auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+    timeval tv{1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      fprintf(stderr, "connect: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    uint8_t probe = BENCH_PKT_PROBE;
+    if (send(fd, &probe, sizeof(probe), 0) == -1 ||
+        recv(fd, &conn_ids[i], sizeof(conn_ids[i]), 0) !=
+            static_cast<ssize_t>(sizeof(conn_ids[i]))) {
+      fprintf(stderr, "probe: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+
+    fds[i] = fd;
+  }
+
+  auto nper = n / nworkers;
+  auto start = std::chrono::steady_clock::now();
+
+  std::vector<std::thread> senders;
+  for (size_t i = 0; i < nworkers; ++i) {
+    senders.emplace_back([&fds, &conn_ids, i, nper]() {
+      std::array<uint8_t, PKTLEN> buf{};
+      buf[0] = BENCH_PKT_DATA;
+
+      for (size_t j = 0; j < nper;) {
+        auto k = i * CONNS_PER_SENDER + j % CONNS_PER_SENDER;
+        memcpy(buf.data() + 1, &conn_ids[k], sizeof(conn_ids[k]));
+        if (send(fds[k], buf.data(), buf.size(), 0) == -1) {
+          std::this_thread::yield();
+          continue;
+        }
+        ++j;
+      }
+    });
+  }
+
+  for (auto &t : senders) {
+    t.join();
+  }
+
+  // Wait for the datagrams in flight.  Stop when they all have
+  // arrived, or no datagram has arrived for 100ms.
+  size_t nrecv = 0;
+  auto end = std::chrono::steady_clock::now();
+  for (;;) {
+    size_t total = 0;
+    for (auto &w : workers) {
+      total += w->nrecv.load(std::memory_order_relaxed);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (total != nrecv) {
+      nrecv = total;
+      end = now;
+    }
+
+    if (nrecv == nper * nworkers ||
+        now - end > std::chrono::milliseconds(100)) {
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  for (auto &t : worker_threads) {
+    t.join();
+  }
+
+  uint64_t sum = 0;
+  for (auto &w : workers) {
+    sum += w->sum;
+  }
+  sink = sum;
+
+  for (auto fd : fds) {
+    close(fd);
+  }
+
+  char name[64];
+  snprintf(name, sizeof(name), "workers/%zu", nworkers);
+  report(name, nrecv, end - start);
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  size_t n = 1000000;
+
+  if (argc > 1) {
+    n = strtoul(argv[1], nullptr, 10);
+    if (n == 0) {
+      fprintf(stderr, "Usage: %s [ITERATIONS]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  for (size_t nproducers : {1, 2, 4}) {
+    bench_handoff(n, nproducers);
+  }
+  for (size_t nconns : {1000, 100000, 500000}) {
+    bench_conn_id_map(n, nconns);
+  }
+  for (size_t ntimers : {1000, 100000, 300000}) {
+    bench_timer_wheel(n, ntimers);
+  }
+  for (size_t nconns : {1, 4}) {
+    bench_send_batch(n, nconns, false);
+    bench_send_batch(n, nconns, true);
+  }
+  for (size_t nworkers : {1, 2, 4}) {
+    bench_workers(n, nworkers);
+  }
+
+  return 0;
+}
@@ -231,6 +231,22 @@ void retransmitcb(struct ev_loop *loop, ev_timer *w, int revents) {
 }
 } // namespace
 
+namespace {
+void keyupdatecb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto c = static_cast<Client *>(w->data);
+
+  if (c->initiate_key_update() != 0) {
+    c->disconnect();
+    return;
+  }
+
+  auto rv = c->on_write();
+  if (rv == NETWORK_ERR_SEND_FATAL) {
+    c->disconnect();
+  }
+}
+} // namespace
+
 namespace {
 void siginthandler(struct ev_loop *loop, ev_signal *w, int revents) {
   ev_break(loop, EVBREAK_ALL);
@@ -248,6 +264,7 @@ Client::Client(struct ev_loop *loop, SSL_CTX *ssl_ctx)
       chandshake_idx_(0),
       nsread_(0),
       conn_(nullptr),
+      hs_crypto_ctx_{},
       crypto_ctx_{},
       sendbuf_{NGTCP2_MAX_PKTLEN_IPV4},
       next_stream_id_(1),
@@ -263,6 +280,8 @@ Client::Client(struct ev_loop *loop, SSL_CTX *ssl_ctx)
   timer_.data = this;
   ev_timer_init(&rttimer_, retransmitcb, 0., 0.);
   rttimer_.data = this;
+  ev_timer_init(&kutimer_, keyupdatecb, config.key_update, config.key_update);
+  kutimer_.data = this;
   ev_signal_init(&sigintev_, siginthandler, SIGINT);
 }
 
@@ -276,6 +295,7 @@ void Client::disconnect() { disconnect(0); }
 void Client::disconnect(int liberr) {
   config.tx_loss_prob = 0;
 
+  ev_timer_stop(loop_, &kutimer_);
   ev_timer_stop(loop_, &rttimer_);
   ev_timer_stop(loop_, &timer_);
 
@@ -295,6 +315,19 @@ void Client::close() {
     conn_ = nullptr;
   }
 
+  for (auto ctx : {&hs_crypto_ctx_, &crypto_ctx_}) {
+    crypto::aead_ctx_free(ctx->tx_aead_ctx);
+    ctx->tx_aead_ctx = nullptr;
+    crypto::aead_ctx_free(ctx->rx_aead_ctx);
+    ctx->rx_aead_ctx = nullptr;
+    crypto::aead_ctx_free(ctx->next_tx_aead_ctx);
+    ctx->next_tx_aead_ctx = nullptr;
+    crypto::aead_ctx_free(ctx->next_rx_aead_ctx);
+    ctx->next_rx_aead_ctx = nullptr;
+    crypto::aead_ctx_free(ctx->old_rx_aead_ctx);
+    ctx->old_rx_aead_ctx = nullptr;
+  }
+
   if (ssl_) {
     SSL_free(ssl_);
     ssl_ = nullptr;
@@ -390,6 +423,8 @@ int handshake_completed(ngtcp2_conn *conn, void *user_data) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
 
+  c->start_key_update();
+
   return 0;
 }
 } // namespace
@@ -425,16 +460,33 @@ int extend_max_stream_id(ngtcp2_conn *conn, uint32_t max_stream_id,
 
 } // namespace
 
+namespace {
+int update_key(ngtcp2_conn *conn, void *user_data) {
+  auto c = static_cast<Client *>(user_data);
+
+  if (c->update_key() != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+} // namespace
+
 namespace {
 ssize_t do_hs_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                       const uint8_t *plaintext, size_t plaintextlen,
-                      const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                      size_t noncelen, const uint8_t *ad, size_t adlen,
-                      void *user_data) {
+                      const uint8_t *key, size_t keylen, void *aead_ctx,
+                      const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                      size_t adlen, void *user_data) {
   auto c = static_cast<Client *>(user_data);
 
-  auto nwrite = c->hs_encrypt_data(dest, destlen, plaintext, plaintextlen, key,
-                                   keylen, nonce, noncelen, ad, adlen);
+  // Every key installed by this program comes with its context.
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  auto nwrite = c->hs_encrypt_data(dest, destlen, plaintext, plaintextlen,
+                                   aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -446,13 +498,17 @@ ssize_t do_hs_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 namespace {
 ssize_t do_hs_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                       const uint8_t *ciphertext, size_t ciphertextlen,
-                      const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                      size_t noncelen, const uint8_t *ad, size_t adlen,
-                      void *user_data) {
+                      const uint8_t *key, size_t keylen, void *aead_ctx,
+                      const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                      size_t adlen, void *user_data) {
   auto c = static_cast<Client *>(user_data);
 
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
   auto nwrite = c->hs_decrypt_data(dest, destlen, ciphertext, ciphertextlen,
-                                   key, keylen, nonce, noncelen, ad, adlen);
+                                   aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_TLS_DECRYPT;
   }
@@ -464,13 +520,17 @@ ssize_t do_hs_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 namespace {
 ssize_t do_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    const uint8_t *plaintext, size_t plaintextlen,
-                   const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                   size_t noncelen, const uint8_t *ad, size_t adlen,
-                   void *user_data) {
+                   const uint8_t *key, size_t keylen, void *aead_ctx,
+                   const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                   size_t adlen, void *user_data) {
   auto c = static_cast<Client *>(user_data);
 
-  auto nwrite = c->encrypt_data(dest, destlen, plaintext, plaintextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  auto nwrite = c->encrypt_data(dest, destlen, plaintext, plaintextlen,
+                                aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -482,13 +542,17 @@ ssize_t do_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 namespace {
 ssize_t do_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    const uint8_t *ciphertext, size_t ciphertextlen,
-                   const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                   size_t noncelen, const uint8_t *ad, size_t adlen,
-                   void *user_data) {
+                   const uint8_t *key, size_t keylen, void *aead_ctx,
+                   const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                   size_t adlen, void *user_data) {
   auto c = static_cast<Client *>(user_data);
 
-  auto nwrite = c->decrypt_data(dest, destlen, ciphertext, ciphertextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  auto nwrite = c->decrypt_data(dest, destlen, ciphertext, ciphertextlen,
+                                aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_TLS_DECRYPT;
   }
@@ -572,6 +636,10 @@ int Client::init(int fd, const Address &remote_addr, const char *addr,
       config.quiet ? nullptr : debug::recv_stateless_reset,
       recv_server_stateless_retry,
       extend_max_stream_id,
+      nullptr,
+      nullptr,
+      nullptr,
+      ::update_key,
   };
 
   auto conn_id = std::uniform_int_distribution<uint64_t>(
@@ -627,8 +695,14 @@ int Client::init(int fd, const Address &remote_addr, const char *addr,
     return -1;
   }
 
-  ngtcp2_conn_set_handshake_tx_keys(conn_, key.data(), keylen, iv.data(),
-                                    ivlen);
+  hs_crypto_ctx_.tx_aead_ctx =
+      crypto::aead_ctx_new(hs_crypto_ctx_, key.data(), keylen, ivlen, true);
+  if (hs_crypto_ctx_.tx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_set_handshake_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    hs_crypto_ctx_.tx_aead_ctx);
 
   rv = crypto::derive_server_cleartext_secret(secret.data(), secret.size(),
                                               cleartext_secret.data(),
@@ -650,8 +724,14 @@ int Client::init(int fd, const Address &remote_addr, const char *addr,
     return -1;
   }
 
-  ngtcp2_conn_set_handshake_rx_keys(conn_, key.data(), keylen, iv.data(),
-                                    ivlen);
+  hs_crypto_ctx_.rx_aead_ctx =
+      crypto::aead_ctx_new(hs_crypto_ctx_, key.data(), keylen, ivlen, false);
+  if (hs_crypto_ctx_.rx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_set_handshake_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    hs_crypto_ctx_.rx_aead_ctx);
 
   ev_io_set(&wev_, fd_, EV_WRITE);
   ev_io_set(&rev_, fd_, EV_READ);
@@ -945,7 +1025,14 @@ int Client::setup_crypto_context() {
     return -1;
   }
 
-  ngtcp2_conn_update_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
+  crypto_ctx_.tx_aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, true);
+  if (crypto_ctx_.tx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_update_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                             crypto_ctx_.tx_aead_ctx);
 
   rv = crypto::export_server_secret(crypto_ctx_.rx_secret.data(),
                                     crypto_ctx_.secretlen, ssl_);
@@ -967,48 +1054,181 @@ int Client::setup_crypto_context() {
     return -1;
   }
 
-  ngtcp2_conn_update_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
+  crypto_ctx_.rx_aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, false);
+  if (crypto_ctx_.rx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_update_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                             crypto_ctx_.rx_aead_ctx);
 
   ngtcp2_conn_set_aead_overhead(conn_, crypto::aead_max_overhead(crypto_ctx_));
 
+  return prepare_next_keys();
+}
+
+int Client::prepare_next_keys() {
+  int rv;
+  std::array<uint8_t, 64> secret, key, iv;
+
+  rv = crypto::update_client_secret(secret.data(), crypto_ctx_.secretlen,
+                                    crypto_ctx_.tx_secret.data(),
+                                    crypto_ctx_.secretlen, crypto_ctx_);
+  if (rv != 0) {
+    return -1;
+  }
+
+  auto keylen = crypto::derive_packet_protection_key(
+      key.data(), key.size(), secret.data(), crypto_ctx_.secretlen,
+      crypto_ctx_);
+  if (keylen < 0) {
+    return -1;
+  }
+
+  auto ivlen = crypto::derive_packet_protection_iv(
+      iv.data(), iv.size(), secret.data(), crypto_ctx_.secretlen, crypto_ctx_);
+  if (ivlen < 0) {
+    return -1;
+  }
+
+  auto aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, true);
+  if (aead_ctx == nullptr) {
+    return -1;
+  }
+
+  rv = ngtcp2_conn_set_next_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    aead_ctx);
+  if (rv != 0) {
+    std::cerr << "ngtcp2_conn_set_next_tx_keys: " << ngtcp2_strerror(rv)
+              << std::endl;
+    crypto::aead_ctx_free(aead_ctx);
+    return -1;
+  }
+
+  crypto_ctx_.next_tx_aead_ctx = aead_ctx;
+  crypto_ctx_.tx_secret = secret;
+
+  rv = crypto::update_server_secret(secret.data(), crypto_ctx_.secretlen,
+                                    crypto_ctx_.rx_secret.data(),
+                                    crypto_ctx_.secretlen, crypto_ctx_);
+  if (rv != 0) {
+    return -1;
+  }
+
+  keylen = crypto::derive_packet_protection_key(
+      key.data(), key.size(), secret.data(), crypto_ctx_.secretlen,
+      crypto_ctx_);
+  if (keylen < 0) {
+    return -1;
+  }
+
+  ivlen = crypto::derive_packet_protection_iv(
+      iv.data(), iv.size(), secret.data(), crypto_ctx_.secretlen, crypto_ctx_);
+  if (ivlen < 0) {
+    return -1;
+  }
+
+  aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, false);
+  if (aead_ctx == nullptr) {
+    return -1;
+  }
+
+  rv = ngtcp2_conn_set_next_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    aead_ctx);
+  if (rv != 0) {
+    std::cerr << "ngtcp2_conn_set_next_rx_keys: " << ngtcp2_strerror(rv)
+              << std::endl;
+    crypto::aead_ctx_free(aead_ctx);
+    return -1;
+  }
+
+  crypto_ctx_.next_rx_aead_ctx = aead_ctx;
+  crypto_ctx_.rx_secret = secret;
+
+  return 0;
+}
+
+int Client::update_key() {
+  auto &ctx = crypto_ctx_;
+
+  // ngtcp2_conn has promoted the next keys.  It no longer uses the
+  // previous encryption key, and the decryption key of two key
+  // phases before.
+  crypto::aead_ctx_free(ctx.tx_aead_ctx);
+  ctx.tx_aead_ctx = ctx.next_tx_aead_ctx;
+  ctx.next_tx_aead_ctx = nullptr;
+
+  crypto::aead_ctx_free(ctx.old_rx_aead_ctx);
+  ctx.old_rx_aead_ctx = ctx.rx_aead_ctx;
+  ctx.rx_aead_ctx = ctx.next_rx_aead_ctx;
+  ctx.next_rx_aead_ctx = nullptr;
+
+  return prepare_next_keys();
+}
+
+void Client::start_key_update() {
+  if (config.key_update > 0.) {
+    ev_timer_start(loop_, &kutimer_);
+  }
+}
+
+int Client::initiate_key_update() {
+  if (!config.quiet) {
+    debug::print_timestamp();
+    std::cerr << "Initiate key update" << std::endl;
+  }
+
+  auto rv = ngtcp2_conn_initiate_key_update(conn_);
+  if (rv == NGTCP2_ERR_INVALID_STATE) {
+    // The server has not confirmed the previous key update yet.  Try
+    // again next time.
+    return 0;
+  }
+  if (rv != 0) {
+    std::cerr << "ngtcp2_conn_initiate_key_update: " << ngtcp2_strerror(rv)
+              << std::endl;
+    return -1;
+  }
+
   return 0;
 }
 
 ssize_t Client::hs_encrypt_data(uint8_t *dest, size_t destlen,
                                 const uint8_t *plaintext, size_t plaintextlen,
-                                const uint8_t *key, size_t keylen,
-                                const uint8_t *nonce, size_t noncelen,
-                                const uint8_t *ad, size_t adlen) {
+                                void *aead_ctx, const uint8_t *nonce,
+                                size_t noncelen, const uint8_t *ad,
+                                size_t adlen) {
   return crypto::encrypt(dest, destlen, plaintext, plaintextlen, hs_crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         aead_ctx, nonce, noncelen, ad, adlen);
 }
 
 ssize_t Client::hs_decrypt_data(uint8_t *dest, size_t destlen,
                                 const uint8_t *ciphertext, size_t ciphertextlen,
-                                const uint8_t *key, size_t keylen,
-                                const uint8_t *nonce, size_t noncelen,
-                                const uint8_t *ad, size_t adlen) {
+                                void *aead_ctx, const uint8_t *nonce,
+                                size_t noncelen, const uint8_t *ad,
+                                size_t adlen) {
   return crypto::decrypt(dest, destlen, ciphertext, ciphertextlen,
-                         hs_crypto_ctx_, key, keylen, nonce, noncelen, ad,
+                         hs_crypto_ctx_, aead_ctx, nonce, noncelen, ad,
                          adlen);
 }
 
 ssize_t Client::encrypt_data(uint8_t *dest, size_t destlen,
                              const uint8_t *plaintext, size_t plaintextlen,
-                             const uint8_t *key, size_t keylen,
-                             const uint8_t *nonce, size_t noncelen,
-                             const uint8_t *ad, size_t adlen) {
+                             void *aead_ctx, const uint8_t *nonce,
+                             size_t noncelen, const uint8_t *ad, size_t adlen) {
   return crypto::encrypt(dest, destlen, plaintext, plaintextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         aead_ctx, nonce, noncelen, ad, adlen);
 }
 
 ssize_t Client::decrypt_data(uint8_t *dest, size_t destlen,
                              const uint8_t *ciphertext, size_t ciphertextlen,
-                             const uint8_t *key, size_t keylen,
-                             const uint8_t *nonce, size_t noncelen,
-                             const uint8_t *ad, size_t adlen) {
+                             void *aead_ctx, const uint8_t *nonce,
+                             size_t noncelen, const uint8_t *ad, size_t adlen) {
   return crypto::decrypt(dest, destlen, ciphertext, ciphertextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         aead_ctx, nonce, noncelen, ad, adlen);
 }
 
 ngtcp2_conn *Client::conn() const { return conn_; }
@@ -1461,6 +1681,7 @@ void config_set_default(Config &config) {
   config.datalen = 0;
   config.version = NGTCP2_PROTO_VER_D7;
   config.timeout = 30;
+  config.key_update = 0.;
 }
 } // namespace
 
@@ -1498,6 +1719,11 @@ Options:
               Specify idle timeout in seconds.
               Default: )"
             << config.timeout << R"(
+  --key-update=<T>
+              Initiate key update every <T> seconds after handshake.
+              0 disables it.
+              Default: )"
+            << config.key_update << R"(
   --ciphers=<CIPHERS>
               Specify the cipher suite list to enable.
               Default: )"
@@ -1529,6 +1755,7 @@ int main(int argc, char **argv) {
         {"ciphers", required_argument, &flag, 1},
         {"groups", required_argument, &flag, 2},
         {"timeout", required_argument, &flag, 3},
+        {"key-update", required_argument, &flag, 4},
         {nullptr, 0, nullptr, 0},
     };
 
@@ -1588,6 +1815,14 @@ int main(int argc, char **argv) {
         // --timeout
         config.timeout = strtol(optarg, nullptr, 10);
         break;
+      case 4:
+        // --key-update
+        config.key_update = strtod(optarg, nullptr);
+        if (config.key_update < 0.) {
+          std::cerr << "key-update: must not be negative" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
       }
       break;
     default:
@@ -1633,6 +1868,13 @@ int main(int argc, char **argv) {
   auto ssl_ctx = create_ssl_ctx();
   auto ssl_ctx_d = defer(SSL_CTX_free, ssl_ctx);
 
+  if (crypto::prepare_cleartext_salt(
+          reinterpret_cast<const uint8_t *>(NGTCP2_QUIC_V1_SALT),
+          str_size(NGTCP2_QUIC_V1_SALT)) != 0) {
+    std::cerr << "crypto::prepare_cleartext_salt() failed" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   auto ev_loop_d = defer(ev_loop_destroy, EV_DEFAULT);
 
   debug::reset_timestamp();
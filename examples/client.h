@@ -72,6 +72,9 @@ struct Config {
   bool quiet;
   // timeout is an idle timeout for QUIC connection.
   uint32_t timeout;
+  // key_update is the interval in seconds to initiate key update.
+  // 0 disables it.
+  double key_update;
 };
 
 struct Buffer {
@@ -147,22 +150,26 @@ public:
   void write_server_handshake(const uint8_t *data, size_t datalen);
 
   int setup_crypto_context();
+  int prepare_next_keys();
+  int update_key();
+  // start_key_update starts the timer to initiate key update
+  // periodically if it is enabled.
+  void start_key_update();
+  int initiate_key_update();
   ssize_t hs_encrypt_data(uint8_t *dest, size_t destlen,
                           const uint8_t *plaintext, size_t plaintextlen,
-                          const uint8_t *key, size_t keylen,
-                          const uint8_t *nonce, size_t noncelen,
+                          void *aead_ctx, const uint8_t *nonce, size_t noncelen,
                           const uint8_t *ad, size_t adlen);
   ssize_t hs_decrypt_data(uint8_t *dest, size_t destlen,
                           const uint8_t *ciphertext, size_t ciphertextlen,
-                          const uint8_t *key, size_t keylen,
-                          const uint8_t *nonce, size_t noncelen,
+                          void *aead_ctx, const uint8_t *nonce, size_t noncelen,
                           const uint8_t *ad, size_t adlen);
   ssize_t encrypt_data(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                       size_t plaintextlen, const uint8_t *key, size_t keylen,
+                       size_t plaintextlen, void *aead_ctx,
                        const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
                        size_t adlen);
   ssize_t decrypt_data(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                       size_t ciphertextlen, const uint8_t *key, size_t keylen,
+                       size_t ciphertextlen, void *aead_ctx,
                        const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
                        size_t adlen);
   ngtcp2_conn *conn() const;
@@ -184,6 +191,7 @@ private:
   ev_io stdinrev_;
   ev_timer timer_;
   ev_timer rttimer_;
+  ev_timer kutimer_;
   ev_signal sigintev_;
   struct ev_loop *loop_;
   SSL_CTX *ssl_ctx_;
@@ -0,0 +1,209 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef CONN_ID_MAP_H
+#define CONN_ID_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <random>
+
+namespace ngtcp2 {
+
+// ConnectionIDMap is a hash table keyed by connection ID.  It uses
+// open addressing with linear probing, and an entry is erased by
+// shifting the following entries of the same cluster back, so that
+// no tombstone is left and a lookup never probes past an empty slot.
+// The table is kept at most half full.
+template <typename T> class ConnectionIDMap {
+public:
+  struct Slot {
+    uint64_t key;
+    bool used;
+    T value;
+  };
+
+  // iterator visits the used slots.  The map must not be modified
+  // while it is iterated over.
+  class iterator {
+  public:
+    iterator(Slot *p, Slot *end) : p_(p), end_(end) { skip(); }
+    Slot &operator*() const { return *p_; }
+    Slot *operator->() const { return p_; }
+    iterator &operator++() {
+      ++p_;
+      skip();
+      return *this;
+    }
+    bool operator==(const iterator &other) const { return p_ == other.p_; }
+    bool operator!=(const iterator &other) const { return p_ != other.p_; }
+
+  private:
+    void skip() {
+      for (; p_ != end_ && !p_->used; ++p_)
+        ;
+    }
+
+    Slot *p_;
+    Slot *end_;
+  };
+
+  ConnectionIDMap()
+      : slots_(MIN_SLOTS),
+        size_(0),
+        shift_(64 - MIN_SLOTS_BITS) {
+    // Client chooses its own connection ID.  The random seed makes it
+    // hard to make them collide on purpose.
+    std::random_device rd;
+    seed_ = (static_cast<uint64_t>(rd()) << 32) | rd();
+  }
+
+  iterator begin() {
+    return iterator(slots_.data(), slots_.data() + slots_.size());
+  }
+  iterator end() {
+    auto end = slots_.data() + slots_.size();
+    return iterator(end, end);
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // find returns the pointer to the value associated to |key|, or
+  // nullptr if there is no such entry.  The pointer is invalidated by
+  // emplace and erase.
+  T *find(uint64_t key) {
+    for (auto i = index(key);; i = next(i)) {
+      auto &slot = slots_[i];
+      if (!slot.used) {
+        return nullptr;
+      }
+      if (slot.key == key) {
+        return &slot.value;
+      }
+    }
+  }
+
+  // emplace associates |value| to |key|.  It returns false and does
+  // nothing if |key| already exists.
+  bool emplace(uint64_t key, T value) {
+    if ((size_ + 1) * 2 > slots_.size()) {
+      grow();
+    }
+
+    for (auto i = index(key);; i = next(i)) {
+      auto &slot = slots_[i];
+      if (!slot.used) {
+        slot.key = key;
+        slot.used = true;
+        slot.value = std::move(value);
+        ++size_;
+        return true;
+      }
+      if (slot.key == key) {
+        return false;
+      }
+    }
+  }
+
+  // erase removes the entry of |key|.  It returns false if there is
+  // no such entry.
+  bool erase(uint64_t key) {
+    auto i = index(key);
+    for (;; i = next(i)) {
+      auto &slot = slots_[i];
+      if (!slot.used) {
+        return false;
+      }
+      if (slot.key == key) {
+        break;
+      }
+    }
+
+    // Move each following entry of the cluster into the hole unless
+    // its home slot lies cyclically in (hole, its slot].
+    for (auto j = next(i);; j = next(j)) {
+      auto &slot = slots_[j];
+      if (!slot.used) {
+        break;
+      }
+      auto k = index(slot.key);
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) {
+        continue;
+      }
+      slots_[i].key = slot.key;
+      slots_[i].value = std::move(slot.value);
+      i = j;
+    }
+
+    slots_[i].used = false;
+    slots_[i].value = T{};
+    --size_;
+
+    return true;
+  }
+
+private:
+  static constexpr size_t MIN_SLOTS_BITS = 4;
+  static constexpr size_t MIN_SLOTS = 1 << MIN_SLOTS_BITS;
+
+  // index returns the home slot of |key|.  Connection IDs are random,
+  // so multiplicative hashing of the seeded key is good enough.
+  size_t index(uint64_t key) const {
+    return static_cast<size_t>(((key ^ seed_) * 0x9e3779b97f4a7c15ULL) >>
+                               shift_);
+  }
+
+  size_t next(size_t i) const { return (i + 1) & (slots_.size() - 1); }
+
+  void grow() {
+    std::vector<Slot> slots(slots_.size() * 2);
+    slots.swap(slots_);
+    --shift_;
+
+    for (auto &slot : slots) {
+      if (!slot.used) {
+        continue;
+      }
+      auto i = index(slot.key);
+      for (; slots_[i].used; i = next(i))
+        ;
+      slots_[i].key = slot.key;
+      slots_[i].used = true;
+      slots_[i].value = std::move(slot.value);
+    }
+  }
+
+  std::vector<Slot> slots_;
+  size_t size_;
+  // shift_ is 64 minus log2 of the number of slots.
+  size_t shift_;
+  uint64_t seed_;
+};
+
+} // namespace ngtcp2
+
+#endif // CONN_ID_MAP_H
@@ -0,0 +1,111 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "conn_id_map_test.h"
+
+#include <map>
+#include <memory>
+#include <random>
+
+#include <CUnit/CUnit.h>
+
+#include "conn_id_map.h"
+
+namespace ngtcp2 {
+
+namespace {
+void check(ConnectionIDMap<std::unique_ptr<uint64_t>> &m,
+           const std::map<uint64_t, uint64_t> &ref) {
+  CU_ASSERT(ref.size() == m.size());
+
+  size_t n = 0;
+  for (auto &slot : m) {
+    auto it = ref.find(slot.key);
+    CU_ASSERT(it != std::end(ref));
+    if (it != std::end(ref)) {
+      CU_ASSERT((*it).second == *slot.value);
+    }
+    ++n;
+  }
+
+  CU_ASSERT(ref.size() == n);
+}
+} // namespace
+
+void test_conn_id_map_random() {
+  std::mt19937_64 gen(1);
+  ConnectionIDMap<std::unique_ptr<uint64_t>> m;
+  std::map<uint64_t, uint64_t> ref;
+
+  // Keys are drawn from a small range so that insertions, erasures
+  // and lookups hit existing entries often, and clusters wrap around.
+  std::uniform_int_distribution<uint64_t> keydis(0, 4095);
+
+  for (size_t round = 0; round < 200000; ++round) {
+    auto key = keydis(gen);
+    auto it = ref.find(key);
+
+    switch (gen() % 3) {
+    case 0: {
+      auto inserted = m.emplace(key, std::make_unique<uint64_t>(round));
+      CU_ASSERT((it == std::end(ref)) == inserted);
+      if (inserted) {
+        ref.emplace(key, round);
+      }
+      break;
+    }
+    case 1: {
+      auto erased = m.erase(key);
+      CU_ASSERT((it != std::end(ref)) == erased);
+      if (erased) {
+        ref.erase(it);
+      }
+      break;
+    }
+    case 2: {
+      auto p = m.find(key);
+      CU_ASSERT((it == std::end(ref)) == (p == nullptr));
+      if (p && it != std::end(ref)) {
+        CU_ASSERT((*it).second == **p);
+      }
+      break;
+    }
+    }
+
+    if (round % 1000 == 0) {
+      check(m, ref);
+    }
+  }
+
+  check(m, ref);
+
+  while (!ref.empty()) {
+    CU_ASSERT(m.erase((*std::begin(ref)).first));
+    ref.erase(std::begin(ref));
+  }
+
+  check(m, ref);
+}
+
+} // namespace ngtcp2
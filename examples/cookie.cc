@@ -0,0 +1,177 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cookie.h"
+
+#include <algorithm>
+#include <array>
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/ssl.h>
+
+namespace ngtcp2 {
+
+namespace {
+// cookie_mac computes HMAC-SHA256 keyed with |secret| of length
+// |secretlen| over the issue time |t| of cookie and the client
+// address |addr|, and writes it to |dest| which must be at least
+// COOKIE_MACLEN bytes long.  It returns 0 if it succeeds, or -1.
+int cookie_mac(uint8_t *dest, const uint8_t *secret, size_t secretlen,
+               uint64_t t, const Address &addr) {
+  std::array<uint8_t, 8 + sizeof(in6_addr) + sizeof(uint16_t)> data;
+  auto p = std::begin(data);
+
+  for (auto i = 7; i >= 0; --i) {
+    *p++ = static_cast<uint8_t>(t >> (i * 8));
+  }
+
+  switch (addr.su.storage.ss_family) {
+  case AF_INET:
+    p = std::copy_n(reinterpret_cast<const uint8_t *>(&addr.su.in.sin_addr),
+                    sizeof(addr.su.in.sin_addr), p);
+    p = std::copy_n(reinterpret_cast<const uint8_t *>(&addr.su.in.sin_port),
+                    sizeof(addr.su.in.sin_port), p);
+    break;
+  case AF_INET6:
+    p = std::copy_n(reinterpret_cast<const uint8_t *>(&addr.su.in6.sin6_addr),
+                    sizeof(addr.su.in6.sin6_addr), p);
+    p = std::copy_n(reinterpret_cast<const uint8_t *>(&addr.su.in6.sin6_port),
+                    sizeof(addr.su.in6.sin6_port), p);
+    break;
+  default:
+    return -1;
+  }
+
+  unsigned int maclen = COOKIE_MACLEN;
+  if (HMAC(EVP_sha256(), secret, static_cast<int>(secretlen), data.data(),
+           p - std::begin(data), dest, &maclen) == nullptr) {
+    return -1;
+  }
+
+  return 0;
+}
+} // namespace
+
+int generate_cookie(uint8_t *dest, const uint8_t *secret, size_t secretlen,
+                    const Address &addr, uint64_t t) {
+  for (auto i = 0; i < 8; ++i) {
+    dest[i] = static_cast<uint8_t>(t >> ((7 - i) * 8));
+  }
+
+  return cookie_mac(dest + 8, secret, secretlen, t, addr);
+}
+
+bool verify_cookie(const uint8_t *cookie, size_t cookielen,
+                   const uint8_t *secret, size_t secretlen,
+                   const Address &addr, uint64_t now) {
+  if (cookielen != COOKIE_LEN) {
+    return false;
+  }
+
+  uint64_t t = 0;
+
+  for (auto i = 0; i < 8; ++i) {
+    t = (t << 8) + cookie[i];
+  }
+
+  if (t > now || now - t > COOKIE_LIFETIME) {
+    return false;
+  }
+
+  std::array<uint8_t, COOKIE_MACLEN> mac;
+  if (cookie_mac(mac.data(), secret, secretlen, t, addr) != 0) {
+    return false;
+  }
+
+  return CRYPTO_memcmp(mac.data(), cookie + 8, mac.size()) == 0;
+}
+
+ssize_t find_client_hello_with_cookie(const uint8_t *data, size_t datalen) {
+  constexpr uint16_t TLSEXT_COOKIE = 44;
+  auto p = data;
+  auto end = data + datalen;
+
+  auto skip = [&p, end](size_t nlen) {
+    if (static_cast<size_t>(end - p) < nlen) {
+      return false;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < nlen; ++i) {
+      n = (n << 8) + *p++;
+    }
+    if (static_cast<size_t>(end - p) < n) {
+      return false;
+    }
+    p += n;
+    return true;
+  };
+
+  if (end - p >= 5 && *p == SSL3_RT_CHANGE_CIPHER_SPEC) {
+    p += 3;
+    if (!skip(2)) {
+      return -1;
+    }
+  }
+
+  auto offset = p - data;
+
+  // TLS record header
+  if (end - p < 5 || *p != SSL3_RT_HANDSHAKE) {
+    return -1;
+  }
+  p += 5;
+
+  // msg_type, length, legacy_version, and random
+  if (end - p < 38 || *p != SSL3_MT_CLIENT_HELLO) {
+    return -1;
+  }
+  p += 38;
+
+  // legacy_session_id, cipher_suites, and legacy_compression_methods
+  if (!skip(1) || !skip(2) || !skip(1)) {
+    return -1;
+  }
+
+  if (end - p < 2) {
+    return -1;
+  }
+  p += 2;
+
+  while (end - p >= 4) {
+    auto ext_type = static_cast<uint16_t>((p[0] << 8) + p[1]);
+    if (ext_type == TLSEXT_COOKIE) {
+      return offset;
+    }
+    p += 2;
+    if (!skip(2)) {
+      return -1;
+    }
+  }
+
+  return -1;
+}
+
+} // namespace ngtcp2
@@ -0,0 +1,79 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef COOKIE_H
+#define COOKIE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "network.h"
+
+namespace ngtcp2 {
+
+// COOKIE_LIFETIME is the duration in seconds that a stateless cookie
+// is accepted after it is issued.
+constexpr uint64_t COOKIE_LIFETIME = 60;
+// COOKIE_MACLEN is the length of HMAC-SHA256 which authenticates a
+// stateless cookie.
+constexpr size_t COOKIE_MACLEN = 32;
+// COOKIE_LEN is the length of a stateless cookie.
+constexpr size_t COOKIE_LEN = 8 + COOKIE_MACLEN;
+
+// generate_cookie writes stateless cookie for the client address
+// |addr| issued at |t| seconds since the epoch to |dest| which must
+// be at least COOKIE_LEN bytes long.  The cookie consists of 8 bytes
+// issue time followed by HMAC-SHA256 keyed with |secret| of length
+// |secretlen| over the issue time and |addr|.  This function returns
+// 0 if it succeeds, or -1.
+int generate_cookie(uint8_t *dest, const uint8_t *secret, size_t secretlen,
+                    const Address &addr, uint64_t t);
+
+// verify_cookie returns true if |cookie| of length |cookielen| has
+// been generated by generate_cookie with |secret| of length
+// |secretlen| for |addr| at most COOKIE_LIFETIME seconds before
+// |now|.
+bool verify_cookie(const uint8_t *cookie, size_t cookielen,
+                   const uint8_t *secret, size_t secretlen,
+                   const Address &addr, uint64_t now);
+
+// find_client_hello_with_cookie returns the offset of TLS record in
+// |data| of length |datalen| which contains ClientHello with cookie
+// extension.  The cookie is only present in the second ClientHello
+// after Server Stateless Retry.  ChangeCipherSpec record which a
+// client may send before it for middlebox compatibility is skipped.
+// This function returns -1 if no such ClientHello is found.
+ssize_t find_client_hello_with_cookie(const uint8_t *data, size_t datalen);
+
+} // namespace ngtcp2
+
+#endif // COOKIE_H
@@ -0,0 +1,198 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cookie_test.h"
+
+#include <array>
+#include <vector>
+
+#include <arpa/inet.h>
+
+#include <CUnit/CUnit.h>
+
+#include "cookie.h"
+
+namespace ngtcp2 {
+
+namespace {
+Address make_addr4(const char *host, uint16_t port) {
+  Address addr{};
+  addr.len = sizeof(addr.su.in);
+  addr.su.in.sin_family = AF_INET;
+  addr.su.in.sin_port = htons(port);
+  inet_pton(AF_INET, host, &addr.su.in.sin_addr);
+  return addr;
+}
+} // namespace
+
+namespace {
+Address make_addr6(const char *host, uint16_t port) {
+  Address addr{};
+  addr.len = sizeof(addr.su.in6);
+  addr.su.in6.sin6_family = AF_INET6;
+  addr.su.in6.sin6_port = htons(port);
+  inet_pton(AF_INET6, host, &addr.su.in6.sin6_addr);
+  return addr;
+}
+} // namespace
+
+void test_cookie_verify() {
+  std::array<uint8_t, 32> secret;
+  for (size_t i = 0; i < secret.size(); ++i) {
+    secret[i] = static_cast<uint8_t>(i);
+  }
+  auto addr = make_addr4("192.0.2.1", 4433);
+  uint64_t t = 1500000000;
+  std::array<uint8_t, COOKIE_LEN> cookie;
+
+  CU_ASSERT(0 == generate_cookie(cookie.data(), secret.data(), secret.size(),
+                                 addr, t));
+
+  auto verify = [&](const uint8_t *c, size_t clen, const Address &a,
+                    uint64_t now) {
+    return verify_cookie(c, clen, secret.data(), secret.size(), a, now);
+  };
+
+  // Valid cookie
+  CU_ASSERT(verify(cookie.data(), cookie.size(), addr, t));
+  CU_ASSERT(verify(cookie.data(), cookie.size(), addr, t + COOKIE_LIFETIME));
+
+  // Expired, or issued in the future
+  CU_ASSERT(!verify(cookie.data(), cookie.size(), addr,
+                    t + COOKIE_LIFETIME + 1));
+  CU_ASSERT(!verify(cookie.data(), cookie.size(), addr, t - 1));
+
+  // Tampered cookie
+  for (size_t i = 0; i < cookie.size(); ++i) {
+    auto c = cookie;
+    c[i] ^= 0x01;
+    CU_ASSERT(!verify(c.data(), c.size(), addr, t + 1));
+  }
+  CU_ASSERT(!verify(cookie.data(), cookie.size() - 1, addr, t));
+
+  // Cookie generated with another secret
+  auto secret2 = secret;
+  secret2[0] ^= 0x01;
+  CU_ASSERT(!verify_cookie(cookie.data(), cookie.size(), secret2.data(),
+                           secret2.size(), addr, t));
+
+  // Address mismatch
+  CU_ASSERT(!verify(cookie.data(), cookie.size(),
+                    make_addr4("192.0.2.2", 4433), t));
+  CU_ASSERT(!verify(cookie.data(), cookie.size(),
+                    make_addr4("192.0.2.1", 4434), t));
+
+  // IPv6
+  auto addr6 = make_addr6("2001:db8::1", 4433);
+
+  CU_ASSERT(0 == generate_cookie(cookie.data(), secret.data(), secret.size(),
+                                 addr6, t));
+  CU_ASSERT(verify(cookie.data(), cookie.size(), addr6, t));
+  CU_ASSERT(!verify(cookie.data(), cookie.size(),
+                    make_addr6("2001:db8::2", 4433), t));
+  CU_ASSERT(!verify(cookie.data(), cookie.size(), addr, t));
+}
+
+namespace {
+void put_uint16(std::vector<uint8_t> &v, size_t n) {
+  v.push_back(static_cast<uint8_t>(n >> 8));
+  v.push_back(static_cast<uint8_t>(n));
+}
+} // namespace
+
+namespace {
+// make_client_hello returns TLS record which contains ClientHello with
+// the extensions of |ext_types|, each of which has 2 bytes data.
+std::vector<uint8_t> make_client_hello(const std::vector<uint16_t> &ext_types) {
+  std::vector<uint8_t> exts;
+  for (auto type : ext_types) {
+    put_uint16(exts, type);
+    put_uint16(exts, 2);
+    exts.insert(std::end(exts), {0xff, 0xff});
+  }
+
+  std::vector<uint8_t> body;
+  // legacy_version and random
+  put_uint16(body, 0x0303);
+  body.insert(std::end(body), 32, 0x5a);
+  // legacy_session_id
+  body.push_back(0);
+  // cipher_suites
+  put_uint16(body, 2);
+  put_uint16(body, 0x1301);
+  // legacy_compression_methods
+  body.insert(std::end(body), {1, 0});
+  put_uint16(body, exts.size());
+  body.insert(std::end(body), std::begin(exts), std::end(exts));
+
+  std::vector<uint8_t> rec{22};
+  put_uint16(rec, 0x0301);
+  put_uint16(rec, 4 + body.size());
+  rec.insert(std::end(rec), {1, 0});
+  put_uint16(rec, body.size());
+  rec.insert(std::end(rec), std::begin(body), std::end(body));
+
+  return rec;
+}
+} // namespace
+
+void test_cookie_find_client_hello() {
+  constexpr uint16_t TLSEXT_SUPPORTED_VERSIONS = 43;
+  constexpr uint16_t TLSEXT_COOKIE = 44;
+  constexpr uint16_t TLSEXT_KEY_SHARE = 51;
+
+  // ClientHello without cookie
+  auto ch = make_client_hello({TLSEXT_SUPPORTED_VERSIONS, TLSEXT_KEY_SHARE});
+
+  CU_ASSERT(-1 == find_client_hello_with_cookie(ch.data(), ch.size()));
+
+  // ClientHello with cookie
+  ch = make_client_hello(
+      {TLSEXT_SUPPORTED_VERSIONS, TLSEXT_COOKIE, TLSEXT_KEY_SHARE});
+
+  CU_ASSERT(0 == find_client_hello_with_cookie(ch.data(), ch.size()));
+
+  // ChangeCipherSpec before ClientHello is skipped.
+  std::vector<uint8_t> data{20, 3, 3, 0, 1, 1};
+  data.insert(std::end(data), std::begin(ch), std::end(ch));
+
+  CU_ASSERT(6 == find_client_hello_with_cookie(data.data(), data.size()));
+
+  // ClientHello truncated before the type of cookie extension
+  ch = make_client_hello(
+      {TLSEXT_SUPPORTED_VERSIONS, TLSEXT_KEY_SHARE, TLSEXT_COOKIE});
+
+  CU_ASSERT(0 == find_client_hello_with_cookie(ch.data(), ch.size()));
+
+  for (size_t len = 0; len < ch.size() - 2; ++len) {
+    CU_ASSERT(-1 == find_client_hello_with_cookie(ch.data(), len));
+  }
+
+  // Not a ClientHello
+  ch[5] = 2;
+
+  CU_ASSERT(-1 == find_client_hello_with_cookie(ch.data(), ch.size()));
+}
+
+} // namespace ngtcp2
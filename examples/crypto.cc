@@ -60,6 +60,20 @@ int export_server_secret(uint8_t *dest, size_t destlen, SSL *ssl) {
   return export_secret(dest, destlen, ssl, label, str_size(label));
 }
 
+int update_client_secret(uint8_t *dest, size_t destlen, const uint8_t *secret,
+                         size_t secretlen, const Context &ctx) {
+  static constexpr uint8_t LABEL[] = "QUIC client 1-RTT Secret";
+  return hkdf_expand_label(dest, destlen, secret, secretlen, LABEL,
+                           str_size(LABEL), ctx);
+}
+
+int update_server_secret(uint8_t *dest, size_t destlen, const uint8_t *secret,
+                         size_t secretlen, const Context &ctx) {
+  static constexpr uint8_t LABEL[] = "QUIC server 1-RTT Secret";
+  return hkdf_expand_label(dest, destlen, secret, secretlen, LABEL,
+                           str_size(LABEL), ctx);
+}
+
 #ifdef WORDS_BIGENDIAN
 #define bswap64(N) (N)
 #else /* !WORDS_BIGENDIAN */
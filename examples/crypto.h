@@ -46,8 +46,21 @@ struct Context {
   const EVP_CIPHER *aead;
 #endif // !OPENSSL_IS_BORINGSSL
   const EVP_MD *prf;
+  // tx_secret and rx_secret are the secrets of the latest key phase
+  // derived so far.  They are used to derive the secrets of the next
+  // key phase.
   std::array<uint8_t, 64> tx_secret, rx_secret;
   size_t secretlen;
+  // tx_aead_ctx and rx_aead_ctx are the AEAD contexts keyed with the
+  // packet protection key for each direction.  They are created by
+  // aead_ctx_new, and must be freed by aead_ctx_free.
+  void *tx_aead_ctx, *rx_aead_ctx;
+  // next_tx_aead_ctx and next_rx_aead_ctx are the AEAD contexts of
+  // the next key phase, which are prepared ahead of key update.
+  void *next_tx_aead_ctx, *next_rx_aead_ctx;
+  // old_rx_aead_ctx is the AEAD context of the previous key phase to
+  // decrypt packets reordered across key update.
+  void *old_rx_aead_ctx;
 };
 
 // negotiated_prf stores the negotiated PRF by TLS into |ctx|.  This
@@ -71,6 +84,26 @@ int export_client_secret(uint8_t *dest, size_t destlen, SSL *ssl);
 // for server.  It returns 0 if it succeeds, or -1.
 int export_server_secret(uint8_t *dest, size_t destlen, SSL *ssl);
 
+// prepare_cleartext_salt precomputes HKDF-Extract state keyed with
+// the version specific handshake |salt| of length |saltlen|.  After
+// this call, derive_cleartext_secret with the same salt only has to
+// hash the connection ID.  This function must be called once at
+// startup before any other threads are created.  It returns 0 if it
+// succeeds, or -1.
+int prepare_cleartext_salt(const uint8_t *salt, size_t saltlen);
+
+// update_client_secret derives the client secret of the next key
+// phase from the current client secret |secret| of length
+// |secretlen|.  It returns 0 if it succeeds, or -1.
+int update_client_secret(uint8_t *dest, size_t destlen, const uint8_t *secret,
+                         size_t secretlen, const Context &ctx);
+
+// update_server_secret derives the server secret of the next key
+// phase from the current server secret |secret| of length
+// |secretlen|.  It returns 0 if it succeeds, or -1.
+int update_server_secret(uint8_t *dest, size_t destlen, const uint8_t *secret,
+                         size_t secretlen, const Context &ctx);
+
 // derive_cleartext_secret dervies cleartext_secret.  |secret| is
 // client connection ID.
 int derive_cleartext_secret(uint8_t *dest, size_t destlen, uint64_t secret,
@@ -105,25 +138,41 @@ ssize_t derive_packet_protection_iv(uint8_t *dest, size_t destlen,
                                     const uint8_t *secret, size_t secretlen,
                                     const Context &ctx);
 
+// aead_ctx_new creates AEAD context for ctx.aead, and sets up |key|
+// of length |keylen|, and nonce length |noncelen| so that encrypt or
+// decrypt only has to set nonce per packet.  If |encrypt| is true,
+// the context is for encryption, otherwise decryption.  This function
+// returns the new context if it succeeds, or nullptr.
+void *aead_ctx_new(const Context &ctx, const uint8_t *key, size_t keylen,
+                   size_t noncelen, bool encrypt);
+
+// aead_ctx_free frees |aead_ctx| created by aead_ctx_new.  It does
+// nothing if |aead_ctx| is nullptr.
+void aead_ctx_free(void *aead_ctx);
+
 // encrypt encrypts |plaintext| of length |plaintextlen| and writes
 // the encrypted data in the buffer pointed by |dest| of length
-// |destlen|.  This function can encrypt data in-place.  In other
-// words, |dest| == |plaintext| is allowed.  This function returns the
-// number of bytes written if it succeeds, or -1.
+// |destlen|.  |aead_ctx| must be created by aead_ctx_new for
+// encryption, and must not be nullptr.  This function can encrypt
+// data in-place.  In other words, |dest| == |plaintext| is allowed.
+// This function returns the number of bytes written if it succeeds,
+// or -1.
 ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                size_t plaintextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen);
+                size_t plaintextlen, const Context &ctx, void *aead_ctx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen);
 
 // decrypt decrypts |ciphertext| of length |ciphertextlen| and writes
 // the decrypted data in the buffer pointed by |dest| of length
-// |destlen|.  This function can decrypt data in-place.  In other
-// words, |dest| == |ciphertext| is allowed.  This function returns
-// the number of bytes written if it succeeds, or -1.
+// |destlen|.  |aead_ctx| must be created by aead_ctx_new for
+// decryption, and must not be nullptr.  This function can decrypt
+// data in-place.  In other words, |dest| == |ciphertext| is allowed.
+// This function returns the number of bytes written if it succeeds,
+// or -1.
 ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                size_t ciphertextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen);
+                size_t ciphertextlen, const Context &ctx, void *aead_ctx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen);
 
 // aead_max_overhead returns the maximum overhead of ctx.aead.
 size_t aead_max_overhead(const Context &ctx);
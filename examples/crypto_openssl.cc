@@ -26,10 +26,17 @@
 
 #if !defined(OPENSSL_IS_BORINGSSL)
 
+#include <algorithm>
 #include <cassert>
+#include <memory>
 
 #include <openssl/evp.h>
-#include <openssl/kdf.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+#else  // OPENSSL_VERSION_NUMBER < 0x30000000L
+#include <openssl/hmac.h>
+#endif // OPENSSL_VERSION_NUMBER < 0x30000000L
 
 #include "template.h"
 
@@ -77,33 +84,43 @@ static size_t aead_tag_length(const Context &ctx) {
   assert(0);
 }
 
-ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                size_t plaintextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen) {
-  auto taglen = aead_tag_length(ctx);
-
-  if (destlen < plaintextlen + taglen) {
-    return -1;
-  }
-
+void *aead_ctx_new(const Context &ctx, const uint8_t *key, size_t keylen,
+                   size_t noncelen, bool encrypt) {
   auto actx = EVP_CIPHER_CTX_new();
   if (actx == nullptr) {
-    return -1;
+    return nullptr;
   }
 
-  auto actx_d = defer(EVP_CIPHER_CTX_free, actx);
-
-  if (EVP_EncryptInit_ex(actx, ctx.aead, nullptr, nullptr, nullptr) != 1) {
-    return -1;
+  if (EVP_CipherInit_ex(actx, ctx.aead, nullptr, nullptr, nullptr, encrypt) !=
+          1 ||
+      EVP_CIPHER_CTX_ctrl(actx, EVP_CTRL_AEAD_SET_IVLEN, noncelen, nullptr) !=
+          1 ||
+      EVP_CipherInit_ex(actx, nullptr, nullptr, key, nullptr, encrypt) != 1) {
+    EVP_CIPHER_CTX_free(actx);
+    return nullptr;
   }
 
-  if (EVP_CIPHER_CTX_ctrl(actx, EVP_CTRL_AEAD_SET_IVLEN, noncelen, nullptr) !=
-      1) {
+  return actx;
+}
+
+void aead_ctx_free(void *aead_ctx) {
+  EVP_CIPHER_CTX_free(static_cast<EVP_CIPHER_CTX *>(aead_ctx));
+}
+
+ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
+                size_t plaintextlen, const Context &ctx, void *aead_ctx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen) {
+  auto taglen = aead_tag_length(ctx);
+
+  if (destlen < plaintextlen + taglen) {
     return -1;
   }
 
-  if (EVP_EncryptInit_ex(actx, nullptr, nullptr, key, nonce) != 1) {
+  auto actx = static_cast<EVP_CIPHER_CTX *>(aead_ctx);
+
+  // The key schedule is done in aead_ctx_new.  Only set nonce here.
+  if (EVP_EncryptInit_ex(actx, nullptr, nullptr, nullptr, nonce) != 1) {
     return -1;
   }
 
@@ -139,9 +156,9 @@ ssize_t encrypt(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
 }
 
 ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                size_t ciphertextlen, const Context &ctx, const uint8_t *key,
-                size_t keylen, const uint8_t *nonce, size_t noncelen,
-                const uint8_t *ad, size_t adlen) {
+                size_t ciphertextlen, const Context &ctx, void *aead_ctx,
+                const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                size_t adlen) {
   auto taglen = aead_tag_length(ctx);
 
   if (taglen > ciphertextlen || destlen + taglen < ciphertextlen) {
@@ -151,23 +168,9 @@ ssize_t decrypt(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
   ciphertextlen -= taglen;
   auto tag = ciphertext + ciphertextlen;
 
-  auto actx = EVP_CIPHER_CTX_new();
-  if (actx == nullptr) {
-    return -1;
-  }
-
-  auto actx_d = defer(EVP_CIPHER_CTX_free, actx);
-
-  if (EVP_DecryptInit_ex(actx, ctx.aead, nullptr, nullptr, nullptr) != 1) {
-    return -1;
-  }
+  auto actx = static_cast<EVP_CIPHER_CTX *>(aead_ctx);
 
-  if (EVP_CIPHER_CTX_ctrl(actx, EVP_CTRL_AEAD_SET_IVLEN, noncelen, nullptr) !=
-      1) {
-    return -1;
-  }
-
-  if (EVP_DecryptInit_ex(actx, nullptr, nullptr, key, nonce) != 1) {
+  if (EVP_DecryptInit_ex(actx, nullptr, nullptr, nullptr, nonce) != 1) {
     return -1;
   }
 
@@ -208,78 +211,235 @@ size_t aead_nonce_length(const Context &ctx) {
   return EVP_CIPHER_iv_length(ctx.aead);
 }
 
-int hkdf_expand(uint8_t *dest, size_t destlen, const uint8_t *secret,
-                size_t secretlen, const uint8_t *info, size_t infolen,
-                const Context &ctx) {
-  auto pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
-  if (pctx == nullptr) {
-    return -1;
-  }
+namespace {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+using HMACContext = EVP_MAC_CTX;
 
-  auto pctx_d = defer(EVP_PKEY_CTX_free, pctx);
+// hmac returns HMAC implementation, which is fetched only once.
+EVP_MAC *hmac() {
+  static auto mac = std::unique_ptr<EVP_MAC, decltype(&EVP_MAC_free)>(
+      EVP_MAC_fetch(nullptr, "HMAC", nullptr), EVP_MAC_free);
+  return mac.get();
+}
 
-  if (EVP_PKEY_derive_init(pctx) != 1) {
-    return -1;
+HMACContext *hmac_ctx_new() {
+  auto mac = hmac();
+  if (mac == nullptr) {
+    return nullptr;
   }
+  return EVP_MAC_CTX_new(mac);
+}
 
-  if (EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) != 1) {
-    return -1;
-  }
+void hmac_ctx_free(HMACContext *ctx) { EVP_MAC_CTX_free(ctx); }
 
-  if (EVP_PKEY_CTX_set_hkdf_md(pctx, ctx.prf) != 1) {
-    return -1;
+HMACContext *hmac_ctx_dup(const HMACContext *ctx) {
+  return EVP_MAC_CTX_dup(ctx);
+}
+
+// hmac_init starts HMAC with |key| and |md|.
+int hmac_init(HMACContext *ctx, const uint8_t *key, size_t keylen,
+              const EVP_MD *md) {
+  std::array<OSSL_PARAM, 2> params{
+      OSSL_PARAM_construct_utf8_string(
+          OSSL_MAC_PARAM_DIGEST, const_cast<char *>(EVP_MD_get0_name(md)),
+          0),
+      OSSL_PARAM_construct_end(),
+  };
+
+  return EVP_MAC_init(ctx, key, keylen, params.data());
+}
+
+// hmac_reinit restarts HMAC with the key and the hash function set
+// by hmac_init.
+int hmac_reinit(HMACContext *ctx) {
+  return EVP_MAC_init(ctx, nullptr, 0, nullptr);
+}
+
+int hmac_update(HMACContext *ctx, const uint8_t *data, size_t datalen) {
+  return EVP_MAC_update(ctx, data, datalen);
+}
+
+int hmac_final(HMACContext *ctx, uint8_t *dest, size_t destlen,
+               size_t *plen) {
+  return EVP_MAC_final(ctx, dest, plen, destlen);
+}
+#else  // OPENSSL_VERSION_NUMBER < 0x30000000L
+using HMACContext = HMAC_CTX;
+
+HMACContext *hmac_ctx_new() { return HMAC_CTX_new(); }
+
+void hmac_ctx_free(HMACContext *ctx) { HMAC_CTX_free(ctx); }
+
+HMACContext *hmac_ctx_dup(const HMACContext *ctx) {
+  auto dctx = HMAC_CTX_new();
+  if (dctx == nullptr) {
+    return nullptr;
+  }
+  if (HMAC_CTX_copy(dctx, const_cast<HMACContext *>(ctx)) != 1) {
+    HMAC_CTX_free(dctx);
+    return nullptr;
   }
+  return dctx;
+}
 
-  if (EVP_PKEY_CTX_set1_hkdf_salt(pctx, "", 0) != 1) {
-    return -1;
+// hmac_init starts HMAC with |key| and |md|.
+int hmac_init(HMACContext *ctx, const uint8_t *key, size_t keylen,
+              const EVP_MD *md) {
+  return HMAC_Init_ex(ctx, key, keylen, md, nullptr);
+}
+
+// hmac_reinit restarts HMAC with the key and the hash function set
+// by hmac_init.
+int hmac_reinit(HMACContext *ctx) {
+  return HMAC_Init_ex(ctx, nullptr, 0, nullptr, nullptr);
+}
+
+int hmac_update(HMACContext *ctx, const uint8_t *data, size_t datalen) {
+  return HMAC_Update(ctx, data, datalen);
+}
+
+int hmac_final(HMACContext *ctx, uint8_t *dest, size_t destlen,
+               size_t *plen) {
+  unsigned int len;
+  if (HMAC_Final(ctx, dest, &len) != 1) {
+    return 0;
   }
+  *plen = len;
+  return 1;
+}
+#endif // OPENSSL_VERSION_NUMBER < 0x30000000L
+
+using HMACContextPtr =
+    std::unique_ptr<HMACContext, decltype(&hmac_ctx_free)>;
+} // namespace
+
+namespace {
+// hmac_key returns |key|, or a dummy pointer if |key| is nullptr
+// because HMAC takes nullptr key as a request to reuse the previous
+// key.  HMAC with an empty key is valid, e.g., HKDF without salt.
+const uint8_t *hmac_key(const uint8_t *key) {
+  static constexpr uint8_t empty_key = 0;
+  return key ? key : &empty_key;
+}
+} // namespace
+
+namespace {
+// hmac_ctx returns HMAC context owned by the calling thread.  HKDF
+// reuses it for every HMAC invocation so that key derivation does
+// not allocate after the first call.
+HMACContext *hmac_ctx() {
+  static thread_local auto ctx = HMACContextPtr(hmac_ctx_new(), hmac_ctx_free);
+  return ctx.get();
+}
+} // namespace
 
-  if (EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secretlen) != 1) {
+namespace {
+// CleartextSalt is HMAC state keyed with the handshake salt.  It is
+// prepared once by prepare_cleartext_salt, and is only read
+// afterwards.
+struct CleartextSalt {
+  HMACContextPtr ctx{nullptr, hmac_ctx_free};
+  const EVP_MD *md;
+  std::array<uint8_t, 64> salt;
+  size_t saltlen;
+} cleartext_salt;
+} // namespace
+
+int prepare_cleartext_salt(const uint8_t *salt, size_t saltlen) {
+  auto &cs = cleartext_salt;
+
+  if (saltlen > cs.salt.size()) {
     return -1;
   }
 
-  if (EVP_PKEY_CTX_add1_hkdf_info(pctx, info, infolen) != 1) {
-    return -1;
+  if (!cs.ctx) {
+    cs.ctx.reset(hmac_ctx_new());
+    if (!cs.ctx) {
+      return -1;
+    }
   }
 
-  if (EVP_PKEY_derive(pctx, dest, &destlen) != 1) {
+  cs.md = EVP_sha256();
+
+  if (hmac_init(cs.ctx.get(), hmac_key(salt), saltlen, cs.md) != 1) {
+    cs.md = nullptr;
     return -1;
   }
 
+  std::copy_n(salt, saltlen, std::begin(cs.salt));
+  cs.saltlen = saltlen;
+
   return 0;
 }
 
-int hkdf_extract(uint8_t *dest, size_t destlen, const uint8_t *secret,
-                 size_t secretlen, const uint8_t *salt, size_t saltlen,
-                 const Context &ctx) {
-  auto pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
-  if (pctx == nullptr) {
+int hkdf_expand(uint8_t *dest, size_t destlen, const uint8_t *secret,
+                size_t secretlen, const uint8_t *info, size_t infolen,
+                const Context &ctx) {
+  auto hctx = hmac_ctx();
+  if (hctx == nullptr) {
     return -1;
   }
 
-  auto pctx_d = defer(EVP_PKEY_CTX_free, pctx);
-
-  if (EVP_PKEY_derive_init(pctx) != 1) {
+  auto mdlen = static_cast<size_t>(EVP_MD_size(ctx.prf));
+  if (destlen > 255 * mdlen) {
     return -1;
   }
 
-  if (EVP_PKEY_CTX_hkdf_mode(pctx, EVP_PKEY_HKDEF_MODE_EXTRACT_ONLY) != 1) {
+  if (hmac_init(hctx, hmac_key(secret), secretlen, ctx.prf) != 1) {
     return -1;
   }
 
-  if (EVP_PKEY_CTX_set_hkdf_md(pctx, ctx.prf) != 1) {
-    return -1;
-  }
+  // T(i) = HMAC-Hash(PRK, T(i-1) | info | i)
+  std::array<uint8_t, EVP_MAX_MD_SIZE> t;
+  uint8_t i = 1;
+  for (size_t tlen = 0; destlen; ++i) {
+    if ((i > 1 && hmac_reinit(hctx) != 1) ||
+        hmac_update(hctx, t.data(), tlen) != 1 ||
+        hmac_update(hctx, info, infolen) != 1 ||
+        hmac_update(hctx, &i, 1) != 1 ||
+        hmac_final(hctx, t.data(), t.size(), &tlen) != 1) {
+      return -1;
+    }
 
-  if (EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, saltlen) != 1) {
-    return -1;
+    auto n = std::min(destlen, tlen);
+    dest = std::copy_n(t.data(), n, dest);
+    destlen -= n;
   }
 
-  if (EVP_PKEY_CTX_set1_hkdf_key(pctx, secret, secretlen) != 1) {
-    return -1;
-  }
+  return 0;
+}
 
-  if (EVP_PKEY_derive(pctx, dest, &destlen) != 1) {
+int hkdf_extract(uint8_t *dest, size_t destlen, const uint8_t *secret,
+                 size_t secretlen, const uint8_t *salt, size_t saltlen,
+                 const Context &ctx) {
+  if (destlen < static_cast<size_t>(EVP_MD_size(ctx.prf))) {
+    return -1;
+  }
+
+  auto &cs = cleartext_salt;
+  auto sctx = HMACContextPtr(nullptr, hmac_ctx_free);
+  HMACContext *hctx;
+
+  // PRK = HMAC-Hash(salt, IKM).  If |salt| is the prepared handshake
+  // salt, start from the keyed state instead of hashing salt again.
+  if (cs.md == ctx.prf && cs.saltlen == saltlen &&
+      std::equal(salt, salt + saltlen, std::begin(cs.salt))) {
+    sctx.reset(hmac_ctx_dup(cs.ctx.get()));
+    hctx = sctx.get();
+    if (hctx == nullptr) {
+      return -1;
+    }
+  } else {
+    hctx = hmac_ctx();
+    if (hctx == nullptr ||
+        hmac_init(hctx, hmac_key(salt), saltlen, ctx.prf) != 1) {
+      return -1;
+    }
+  }
+
+  size_t len;
+  if (hmac_update(hctx, secret, secretlen) != 1 ||
+      hmac_final(hctx, dest, destlen, &len) != 1) {
     return -1;
   }
 
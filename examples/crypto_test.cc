@@ -0,0 +1,141 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "crypto_test.h"
+
+#include <string>
+#include <vector>
+
+#include <CUnit/CUnit.h>
+
+#include "crypto.h"
+
+namespace ngtcp2 {
+
+namespace {
+std::vector<uint8_t> from_hex(const std::string &s) {
+  std::vector<uint8_t> res;
+  for (size_t i = 0; i + 1 < s.size(); i += 2) {
+    res.push_back(std::stoi(s.substr(i, 2), nullptr, 16));
+  }
+  return res;
+}
+} // namespace
+
+namespace {
+// seq returns |n| bytes which start with |first| and increase by 1.
+std::vector<uint8_t> seq(uint8_t first, size_t n) {
+  std::vector<uint8_t> res(n);
+  for (auto &c : res) {
+    c = first++;
+  }
+  return res;
+}
+} // namespace
+
+namespace {
+// HKDFVector is a test case of HKDF with SHA-256 in RFC 5869.
+struct HKDFVector {
+  std::vector<uint8_t> ikm;
+  std::vector<uint8_t> salt;
+  std::vector<uint8_t> info;
+  std::vector<uint8_t> prk;
+  std::vector<uint8_t> okm;
+};
+} // namespace
+
+void test_crypto_hkdf() {
+  crypto::Context ctx{};
+  crypto::prf_sha256(ctx);
+
+  std::vector<HKDFVector> vecs{
+      // A.1. Basic test case
+      {
+          std::vector<uint8_t>(22, 0x0b),
+          seq(0x00, 13),
+          seq(0xf0, 10),
+          from_hex("077709362c2e32df0ddc3f0dc47bba63"
+                   "90b6c73bb50f9c3122ec844ad7c2b3e5"),
+          from_hex("3cb25f25faacd57a90434f64d0362f2a"
+                   "2d2d0a90cf1a5a4c5db02d56ecc4c5bf"
+                   "34007208d5b887185865"),
+      },
+      // A.2. Test with longer inputs/outputs
+      {
+          seq(0x00, 80),
+          seq(0x60, 80),
+          seq(0xb0, 80),
+          from_hex("06a6b88c5853361a06104c9ceb35b45c"
+                   "ef760014904671014a193f40c15fc244"),
+          from_hex("b11e398dc80327a1c8e7f78c596a4934"
+                   "4f012eda2d4efad8a050cc4c19afa97c"
+                   "59045a99cac7827271cb41c65e590e09"
+                   "da3275600c2f09b8367793a9aca3db71"
+                   "cc30c58179ec3e87c14c01d5c1f3434f"
+                   "1d87"),
+      },
+      // A.3. Test with zero-length salt/info
+      {
+          std::vector<uint8_t>(22, 0x0b),
+          {},
+          {},
+          from_hex("19ef24a32c717b167f33a91d6f648bdf"
+                   "96596776afdb6377ac434c1c293ccb04"),
+          from_hex("8da4e775a563c18f715f802a063c5a31"
+                   "b8a11f5c5ee1879ec3454e5f3c738d2d"
+                   "9d201395faa4b61a96c8"),
+      },
+  };
+
+  for (auto &v : vecs) {
+    std::vector<uint8_t> prk(v.prk.size());
+    std::vector<uint8_t> okm(v.okm.size());
+
+    CU_ASSERT(0 == crypto::hkdf_extract(prk.data(), prk.size(), v.ikm.data(),
+                                        v.ikm.size(), v.salt.data(),
+                                        v.salt.size(), ctx));
+    CU_ASSERT(v.prk == prk);
+    CU_ASSERT(0 == crypto::hkdf_expand(okm.data(), okm.size(), prk.data(),
+                                       prk.size(), v.info.data(),
+                                       v.info.size(), ctx));
+    CU_ASSERT(v.okm == okm);
+  }
+
+  // HKDF-Extract starts from the prepared HMAC state if salt is the
+  // one passed to prepare_cleartext_salt.
+  auto &v = vecs[0];
+  std::vector<uint8_t> prk(v.prk.size());
+
+  CU_ASSERT(0 == crypto::prepare_cleartext_salt(v.salt.data(), v.salt.size()));
+
+  for (size_t i = 0; i < 2; ++i) {
+    std::fill(std::begin(prk), std::end(prk), 0);
+    CU_ASSERT(0 == crypto::hkdf_extract(prk.data(), prk.size(), v.ikm.data(),
+                                        v.ikm.size(), v.salt.data(),
+                                        v.salt.size(), ctx));
+    CU_ASSERT(v.prk == prk);
+  }
+}
+
+} // namespace ngtcp2
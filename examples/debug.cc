@@ -33,7 +33,9 @@ namespace ngtcp2 {
 namespace debug {
 
 namespace {
-auto randgen = util::make_mt19937();
+// randgen is thread local so that packet_lost can be called from
+// any worker thread.
+thread_local auto randgen = util::make_mt19937();
 } // namespace
 
 namespace {
@@ -0,0 +1,237 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <utility>
+
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif // HAVE_SYS_EVENTFD_H
+
+namespace ngtcp2 {
+
+// MPSCQueue is a bounded lock-free queue which any number of threads
+// push to, and a single thread pops from.  Each slot has a sequence
+// number which tells whether it is free for the producer which
+// claimed the position, or filled for the consumer.
+template <typename T> class MPSCQueue {
+public:
+  // |size| must be a power of 2.
+  explicit MPSCQueue(size_t size)
+      : cells_(size), mask_(size - 1), tail_(0), head_(0) {
+    assert(size && (size & mask_) == 0);
+
+    for (size_t i = 0; i < size; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // push appends |v| to the queue.  It returns false if the queue is
+  // full, and |v| is left untouched.  It is safe to call from any
+  // thread.
+  bool push(T &&v) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto &cell = cells_[pos & mask_];
+      auto seq = cell.seq.load(std::memory_order_acquire);
+      auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1,
+                                        std::memory_order_relaxed)) {
+          cell.data = std::move(v);
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // pop removes the first element of the queue and assigns it to
+  // |v|.  It returns false if the queue is empty.  It must be called
+  // only from the consumer thread.
+  bool pop(T &v) {
+    auto &cell = cells_[head_ & mask_];
+    if (cell.seq.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    v = std::move(cell.data);
+    cell.seq.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  std::vector<Cell> cells_;
+  size_t mask_;
+  // tail_ and head_ are written by different threads.  Keep them in
+  // separate cache lines.
+  alignas(64) std::atomic<size_t> tail_;
+  alignas(64) size_t head_;
+};
+
+// BufferPool is a fixed number of buffers of the same length.  Only
+// the owner thread takes buffers from the pool, but any thread can
+// return them, so a buffer can be handed to another thread with its
+// data, and be released there without copying.
+class BufferPool {
+public:
+  // |nbufs| must be a power of 2.
+  BufferPool(size_t nbufs, size_t buflen)
+      : mem_(nbufs * buflen), free_(nbufs), buflen_(buflen) {
+    for (size_t i = 0; i < nbufs; ++i) {
+      auto buf = mem_.data() + i * buflen;
+      free_.push(std::move(buf));
+    }
+  }
+
+  // get returns a free buffer, or nullptr if all buffers are in use.
+  // It must be called only from the owner thread.
+  uint8_t *get() {
+    uint8_t *buf;
+    if (!free_.pop(buf)) {
+      return nullptr;
+    }
+    return buf;
+  }
+
+  // put returns |buf| to the pool.  It is safe to call from any
+  // thread.
+  void put(uint8_t *buf) {
+    auto rv = free_.push(std::move(buf));
+    (void)rv;
+    assert(rv);
+  }
+
+  size_t buflen() const { return buflen_; }
+
+private:
+  std::vector<uint8_t> mem_;
+  MPSCQueue<uint8_t *> free_;
+  size_t buflen_;
+};
+
+// QueueNotifier wakes up the consumer of a queue which polls fd() for
+// reading.  A producer writes to the file descriptor only if the
+// consumer has not been notified since it last called reset, so that
+// there is at most one wakeup each time the queue becomes non-empty.
+class QueueNotifier {
+public:
+  QueueNotifier() : rfd_(-1), wfd_(-1), notified_(false) {}
+  ~QueueNotifier() {
+    if (rfd_ != -1) {
+      close(rfd_);
+    }
+    if (wfd_ != -1 && wfd_ != rfd_) {
+      close(wfd_);
+    }
+  }
+
+  // init creates eventfd, or a pipe if eventfd is not available.  It
+  // returns 0 if it succeeds, or -1.
+  int init() {
+#ifdef HAVE_SYS_EVENTFD_H
+    rfd_ = wfd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (rfd_ == -1) {
+      return -1;
+    }
+#else  // !HAVE_SYS_EVENTFD_H
+    int fds[2];
+    if (pipe(fds) == -1) {
+      return -1;
+    }
+    rfd_ = fds[0];
+    wfd_ = fds[1];
+    for (auto fd : fds) {
+      if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1 ||
+          fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        return -1;
+      }
+    }
+#endif // !HAVE_SYS_EVENTFD_H
+    return 0;
+  }
+
+  int fd() const { return rfd_; }
+
+  // notify is called by a producer after it pushes an element to the
+  // queue.
+  void notify() {
+    // Pairs with the fence in reset so that either the consumer sees
+    // the element, or this producer sees notified_ cleared.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (notified_.exchange(true, std::memory_order_acq_rel)) {
+      return;
+    }
+    uint64_t n = 1;
+    while (write(wfd_, &n, sizeof(n)) == -1 && errno == EINTR)
+      ;
+  }
+
+  // reset is called by the consumer when fd() becomes readable, and
+  // before it drains the queue.
+  void reset() {
+    uint64_t n[8];
+    for (;;) {
+      auto nread = read(rfd_, n, sizeof(n));
+      if (nread > 0 || (nread == -1 && errno == EINTR)) {
+        continue;
+      }
+      break;
+    }
+    notified_.store(false, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+private:
+  int rfd_;
+  int wfd_;
+  std::atomic<bool> notified_;
+};
+
+} // namespace ngtcp2
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,151 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "mpsc_queue_test.h"
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+#include <CUnit/CUnit.h>
+
+#include "mpsc_queue.h"
+
+namespace ngtcp2 {
+
+namespace {
+constexpr size_t QUEUE_SIZE = 1024;
+constexpr size_t BUFLEN = 1500;
+} // namespace
+
+namespace {
+// Packet is a descriptor passed through the queue.
+struct Packet {
+  uint8_t *data;
+  size_t datalen;
+  BufferPool *pool;
+};
+} // namespace
+
+namespace {
+// Payload is written at the beginning of each buffer.
+struct Payload {
+  size_t producer;
+  uint64_t seq;
+};
+} // namespace
+
+namespace {
+// handoff sends |n| buffers from each of |nproducers| threads to this
+// thread through MPSCQueue, BufferPool and QueueNotifier in the same
+// way server workers forward datagrams.  It checks that each buffer
+// arrives exactly once and in order per producer.
+void handoff(size_t nproducers, size_t n) {
+  MPSCQueue<Packet> q(QUEUE_SIZE);
+  QueueNotifier notifier;
+
+  CU_ASSERT(0 == notifier.init());
+
+  std::vector<std::unique_ptr<BufferPool>> pools;
+  for (size_t i = 0; i < nproducers; ++i) {
+    pools.push_back(std::make_unique<BufferPool>(QUEUE_SIZE, BUFLEN));
+  }
+
+  std::vector<std::thread> producers;
+  for (size_t i = 0; i < nproducers; ++i) {
+    producers.emplace_back([&q, &notifier, &pools, i, n]() {
+      auto pool = pools[i].get();
+      for (uint64_t seq = 0; seq < n;) {
+        auto buf = pool->get();
+        if (buf == nullptr) {
+          std::this_thread::yield();
+          continue;
+        }
+
+        Payload payload{i, seq};
+        memcpy(buf, &payload, sizeof(payload));
+
+        while (!q.push({buf, sizeof(payload), pool})) {
+          std::this_thread::yield();
+        }
+
+        notifier.notify();
+        ++seq;
+      }
+    });
+  }
+
+  std::vector<uint64_t> next(nproducers);
+  size_t nrecv = 0;
+
+  for (pollfd pfd{notifier.fd(), POLLIN, 0}; nrecv < nproducers * n;) {
+    auto nev = poll(&pfd, 1, 5000);
+    if (nev == -1 && errno == EINTR) {
+      continue;
+    }
+
+    // A lost wakeup shows up as a timeout.
+    CU_ASSERT(nev > 0);
+    if (nev <= 0) {
+      break;
+    }
+
+    notifier.reset();
+
+    Packet pkt;
+    while (q.pop(pkt)) {
+      Payload payload;
+      memcpy(&payload, pkt.data, sizeof(payload));
+
+      CU_ASSERT(sizeof(payload) == pkt.datalen);
+      CU_ASSERT(payload.producer < nproducers);
+      if (payload.producer < nproducers) {
+        CU_ASSERT(next[payload.producer] == payload.seq);
+        next[payload.producer] = payload.seq + 1;
+      }
+
+      pkt.pool->put(pkt.data);
+      ++nrecv;
+    }
+  }
+
+  for (auto &t : producers) {
+    t.join();
+  }
+
+  CU_ASSERT(nproducers * n == nrecv);
+}
+} // namespace
+
+void test_mpsc_queue_handoff() {
+  for (size_t nproducers : {1, 2, 4, 8}) {
+    handoff(nproducers, 100000);
+  }
+}
+
+} // namespace ngtcp2
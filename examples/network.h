@@ -49,6 +49,9 @@ enum {
   NETWORK_ERR_SEND_FATAL = -10,
   NETWORK_ERR_SEND_NON_FATAL = -11,
   NETWORK_ERR_CLOSE_WAIT = -12,
+  // NETWORK_ERR_SEND_YIELD indicates that a connection has used up
+  // its share of the socket, and may have more packets to write.
+  NETWORK_ERR_SEND_YIELD = -13,
 } network_error;
 
 union sockaddr_union {
@@ -0,0 +1,171 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "send_batch.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+
+#include <netinet/udp.h>
+
+namespace ngtcp2 {
+
+SendBuffer::SendBuffer(size_t max_pktlen)
+    : buf(max_pktlen * MAX_SEND_PKTS), head(0), tail(0), idx(0), npkts(0) {}
+
+void SendBuffer::push(size_t len) {
+  assert(!full());
+  assert(len <= left());
+  tail += len;
+  pktlens[npkts++] = len;
+}
+
+void SendBuffer::consume(size_t n) {
+  for (; n; --n) {
+    head += pktlens[idx++];
+  }
+  if (empty()) {
+    reset();
+  }
+}
+
+void SendBuffer::reset() {
+  head = tail = 0;
+  idx = npkts = 0;
+}
+
+SendBatch::SendBatch() : idx_(0), nmsgs_(0), npkts_(0) {}
+
+msghdr &SendBatch::hdr(size_t i) {
+#ifdef HAVE_SENDMMSG
+  return msgs_[i].msg_hdr;
+#else  // !HAVE_SENDMMSG
+  return msgs_[i];
+#endif // !HAVE_SENDMMSG
+}
+
+bool SendBatch::add(const Address &remote_addr, SendBuffer &sendbuf,
+                    bool gso) {
+  auto npkts = sendbuf.npkts - sendbuf.idx;
+  if (npkts_ + npkts > MAX_SEND_BATCH) {
+    return false;
+  }
+
+#ifndef UDP_SEGMENT
+  gso = false;
+#endif // !UDP_SEGMENT
+
+  auto &pktlens = sendbuf.pktlens;
+  auto p = sendbuf.rpos();
+
+  for (auto i = sendbuf.idx; i < sendbuf.npkts;) {
+    auto segsize = pktlens[i];
+    auto end = i + 1;
+    size_t len = segsize;
+
+    if (gso) {
+      for (; end < sendbuf.npkts && pktlens[end] == segsize; ++end) {
+        len += segsize;
+      }
+      if (end < sendbuf.npkts && pktlens[end] < segsize) {
+        len += pktlens[end++];
+      }
+    }
+
+    auto &iov = iovs_[nmsgs_];
+    iov.iov_base = const_cast<uint8_t *>(p);
+    iov.iov_len = len;
+    p += len;
+
+    auto &msg = hdr(nmsgs_);
+    msg = msghdr{};
+    msg.msg_name = const_cast<sockaddr *>(&remote_addr.su.sa);
+    msg.msg_namelen = remote_addr.len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+#ifdef UDP_SEGMENT
+    if (end - i > 1) {
+      auto &cmsgbuf = cmsgbufs_[nmsgs_];
+      msg.msg_control = cmsgbuf.data();
+      msg.msg_controllen = cmsgbuf.size();
+      auto cm = CMSG_FIRSTHDR(&msg);
+      cm->cmsg_level = SOL_UDP;
+      cm->cmsg_type = UDP_SEGMENT;
+      cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+      auto n = static_cast<uint16_t>(segsize);
+      memcpy(CMSG_DATA(cm), &n, sizeof(n));
+    }
+#endif // UDP_SEGMENT
+
+    entries_[nmsgs_++] = {&sendbuf, end - i};
+    i = end;
+  }
+
+  npkts_ += npkts;
+
+  return true;
+}
+
+int SendBatch::send(int fd) {
+  while (!empty()) {
+    int eintr_retries = 5;
+    int nsent;
+
+#ifdef HAVE_SENDMMSG
+    do {
+      nsent = sendmmsg(fd, msgs_.data() + idx_, nmsgs_ - idx_, 0);
+    } while ((nsent == -1) && (errno == EINTR) && (eintr_retries-- > 0));
+#else  // !HAVE_SENDMMSG
+    ssize_t nwrite;
+
+    do {
+      nwrite = sendmsg(fd, &msgs_[idx_], 0);
+    } while ((nwrite == -1) && (errno == EINTR) && (eintr_retries-- > 0));
+
+    nsent = nwrite == -1 ? -1 : 1;
+#endif // !HAVE_SENDMMSG
+
+    if (nsent == -1) {
+      return -1;
+    }
+
+    for (; nsent; --nsent, ++idx_) {
+      auto &ent = entries_[idx_];
+      ent.sendbuf->consume(ent.npkts);
+    }
+  }
+
+  return 0;
+}
+
+SendBuffer *SendBatch::front() const {
+  assert(!empty());
+  return entries_[idx_].sendbuf;
+}
+
+void SendBatch::clear() { idx_ = nmsgs_ = npkts_ = 0; }
+
+} // namespace ngtcp2
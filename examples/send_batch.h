@@ -0,0 +1,147 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef SEND_BATCH_H
+#define SEND_BATCH_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "network.h"
+
+namespace ngtcp2 {
+
+// MAX_SEND_PKTS is the maximum number of packets which SendBuffer
+// holds.
+constexpr size_t MAX_SEND_PKTS = 16;
+
+// SendBuffer accumulates packets to the same destination so that
+// they are sent by a single system call.
+struct SendBuffer {
+  explicit SendBuffer(size_t max_pktlen);
+
+  // full returns true if no more packet can be added.
+  bool full() const { return npkts == pktlens.size(); }
+  // empty returns true if there is no packet to send.
+  bool empty() const { return idx == npkts; }
+  // left returns the number of bytes which can be written at wpos().
+  size_t left() const { return buf.size() - tail; }
+  uint8_t *wpos() { return buf.data() + tail; }
+  // rpos returns the position of the first packet not sent yet.
+  const uint8_t *rpos() const { return buf.data() + head; }
+  // push adds a packet of length |len| which is written at wpos().
+  void push(size_t len);
+  // consume removes |n| packets from the front as they are sent.
+  void consume(size_t n);
+  void reset();
+
+  std::vector<uint8_t> buf;
+  // head is the offset in buf of the first packet not sent yet.
+  size_t head;
+  // tail is the offset in buf where the next packet is written.
+  size_t tail;
+  // pktlens contains the length of each packet in buf.
+  std::array<size_t, MAX_SEND_PKTS> pktlens;
+  // idx is the index in pktlens of the first packet not sent yet.
+  size_t idx;
+  // npkts is the number of packets in buf.
+  size_t npkts;
+};
+
+// MAX_SEND_BATCH is the maximum number of packets which SendBatch
+// holds.
+constexpr size_t MAX_SEND_BATCH = 4 * MAX_SEND_PKTS;
+
+// SendBatch sends the packets of several SendBuffers, each to its own
+// destination, by a single sendmmsg.  Where sendmmsg is missing, it
+// falls back to a sendmsg per message.
+class SendBatch {
+public:
+  SendBatch();
+
+  // add adds the packets in |sendbuf| which are not sent yet to the
+  // batch, to be sent to |remote_addr|.  If |gso| is true, each run
+  // of packets of the same size, which may end with a shorter one,
+  // takes a single message with UDP_SEGMENT.  Otherwise, each packet
+  // takes its own message.  It returns false, and adds nothing, if
+  // the batch has no room for all of them.  |remote_addr| and
+  // |sendbuf| must stay alive until the batch is cleared.
+  bool add(const Address &remote_addr, SendBuffer &sendbuf, bool gso);
+  // send sends the messages in the batch which are not sent yet, and
+  // removes the packets sent from their SendBuffers.  It returns 0 if
+  // all of them are sent.  Otherwise, it returns -1 and sets errno,
+  // and front() returns the SendBuffer whose message failed.
+  int send(int fd);
+  // front returns the SendBuffer of the first message not sent yet.
+  SendBuffer *front() const;
+  // empty returns true if all messages in the batch are sent.
+  bool empty() const { return idx_ == nmsgs_; }
+  // size returns the number of messages which are not sent yet.
+  size_t size() const { return nmsgs_ - idx_; }
+  void clear();
+
+private:
+  // Message is the part of a SendBuffer which a message carries.
+  struct Message {
+    SendBuffer *sendbuf;
+    // npkts is the number of packets in the message.
+    size_t npkts;
+  };
+
+  msghdr &hdr(size_t i);
+
+#ifdef HAVE_SENDMMSG
+  std::array<mmsghdr, MAX_SEND_BATCH> msgs_;
+#else  // !HAVE_SENDMMSG
+  std::array<msghdr, MAX_SEND_BATCH> msgs_;
+#endif // !HAVE_SENDMMSG
+  std::array<iovec, MAX_SEND_BATCH> iovs_;
+  // entries_ tells which SendBuffer each message belongs to.
+  std::array<Message, MAX_SEND_BATCH> entries_;
+  // cmsgbufs_ contains UDP_SEGMENT control message of each message.
+  std::array<std::array<uint8_t, CMSG_SPACE(sizeof(uint16_t))>,
+             MAX_SEND_BATCH>
+      cmsgbufs_;
+  // idx_ is the index of the first message not sent yet.
+  size_t idx_;
+  // nmsgs_ is the number of messages in the batch.
+  size_t nmsgs_;
+  // npkts_ is the number of packets in the batch.
+  size_t npkts_;
+};
+
+} // namespace ngtcp2
+
+#endif // SEND_BATCH_H
@@ -0,0 +1,211 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "send_batch_test.h"
+
+#include <cerrno>
+#include <cstring>
+#include <array>
+#include <memory>
+#include <vector>
+
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+
+#include <CUnit/CUnit.h>
+
+#include "send_batch.h"
+
+namespace ngtcp2 {
+
+namespace {
+// Receiver is a UDP socket bound to a loopback address.
+struct Receiver {
+  Receiver() : fd(socket(AF_INET, SOCK_DGRAM, 0)) {
+    addr.len = sizeof(addr.su.in);
+    addr.su.in = sockaddr_in{};
+    addr.su.in.sin_family = AF_INET;
+    addr.su.in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    CU_ASSERT(-1 != fd);
+    CU_ASSERT(0 == bind(fd, &addr.su.sa, addr.len));
+    CU_ASSERT(0 == getsockname(fd, &addr.su.sa, &addr.len));
+  }
+  ~Receiver() { close(fd); }
+
+  // recv_all returns the datagrams which have arrived.
+  std::vector<std::vector<uint8_t>> recv_all() {
+    std::vector<std::vector<uint8_t>> dgrams;
+    std::array<uint8_t, 64 * 1024> buf;
+
+    for (;;) {
+      auto nread = recv(fd, buf.data(), buf.size(), MSG_DONTWAIT);
+      if (nread == -1) {
+        break;
+      }
+      dgrams.emplace_back(buf.data(), buf.data() + nread);
+    }
+
+    return dgrams;
+  }
+
+  int fd;
+  Address addr;
+};
+} // namespace
+
+namespace {
+// push_pkts adds a packet of each length in |pktlens| to |sendbuf|.
+// Each packet is filled with |tag| plus its index.
+void push_pkts(SendBuffer &sendbuf, const std::vector<size_t> &pktlens,
+               uint8_t tag) {
+  for (size_t i = 0; i < pktlens.size(); ++i) {
+    memset(sendbuf.wpos(), tag + i, pktlens[i]);
+    sendbuf.push(pktlens[i]);
+  }
+}
+} // namespace
+
+namespace {
+// check_dgrams checks that |dgrams| are the packets which push_pkts
+// has added with |pktlens| and |tag|.
+void check_dgrams(const std::vector<std::vector<uint8_t>> &dgrams,
+                  const std::vector<size_t> &pktlens, uint8_t tag) {
+  CU_ASSERT(pktlens.size() == dgrams.size());
+
+  for (size_t i = 0; i < pktlens.size() && i < dgrams.size(); ++i) {
+    CU_ASSERT(pktlens[i] == dgrams[i].size());
+    CU_ASSERT(std::vector<uint8_t>(pktlens[i], tag + i) == dgrams[i]);
+  }
+}
+} // namespace
+
+namespace {
+// send_all sends |batch| to |fd|.  If the kernel does not support
+// GSO, it retries without GSO in the same way as server.
+int send_all(int fd, SendBatch &batch, const Address &addr,
+             SendBuffer &sendbuf) {
+  if (batch.send(fd) == 0) {
+    return 0;
+  }
+  if (errno != EIO && errno != EINVAL) {
+    return -1;
+  }
+
+  batch.clear();
+  batch.add(addr, sendbuf, false);
+
+  return batch.send(fd);
+}
+} // namespace
+
+void test_send_batch_gso_runs() {
+  Receiver rcv;
+  auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+  SendBuffer sendbuf(1200);
+  SendBatch batch;
+
+  // A run of the same size ends with a shorter packet, and a larger
+  // packet starts a new run.
+  std::vector<size_t> pktlens{1200, 1200, 1200, 800, 1200, 500, 500};
+  push_pkts(sendbuf, pktlens, 1);
+
+  CU_ASSERT(batch.add(rcv.addr, sendbuf, true));
+#ifdef UDP_SEGMENT
+  CU_ASSERT(3 == batch.size());
+#else  // !UDP_SEGMENT
+  CU_ASSERT(pktlens.size() == batch.size());
+#endif // !UDP_SEGMENT
+
+  CU_ASSERT(0 == send_all(fd, batch, rcv.addr, sendbuf));
+  CU_ASSERT(batch.empty());
+  CU_ASSERT(sendbuf.empty());
+
+  check_dgrams(rcv.recv_all(), pktlens, 1);
+
+  // Without GSO, each packet is a message of its own.
+  push_pkts(sendbuf, pktlens, 1);
+
+  batch.clear();
+  CU_ASSERT(batch.add(rcv.addr, sendbuf, false));
+  CU_ASSERT(pktlens.size() == batch.size());
+  CU_ASSERT(0 == batch.send(fd));
+
+  check_dgrams(rcv.recv_all(), pktlens, 1);
+
+  close(fd);
+}
+
+void test_send_batch_destinations() {
+  Receiver rcv1, rcv2;
+  auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+  SendBuffer sendbuf1(1200), sendbuf2(1200);
+  SendBatch batch;
+
+  std::vector<size_t> pktlens1{1200, 1200, 300};
+  std::vector<size_t> pktlens2{100, 200};
+  push_pkts(sendbuf1, pktlens1, 1);
+  push_pkts(sendbuf2, pktlens2, 101);
+
+  // The packets already sent are not added again.
+  sendbuf1.consume(1);
+  pktlens1.erase(std::begin(pktlens1));
+
+  CU_ASSERT(batch.add(rcv1.addr, sendbuf1, false));
+  CU_ASSERT(batch.add(rcv2.addr, sendbuf2, false));
+  CU_ASSERT(4 == batch.size());
+  CU_ASSERT(&sendbuf1 == batch.front());
+
+  CU_ASSERT(0 == batch.send(fd));
+  CU_ASSERT(sendbuf1.empty());
+  CU_ASSERT(sendbuf2.empty());
+
+  auto dgrams1 = rcv1.recv_all();
+  CU_ASSERT(2 == dgrams1.size());
+  if (dgrams1.size() == 2) {
+    CU_ASSERT(std::vector<uint8_t>(1200, 2) == dgrams1[0]);
+    CU_ASSERT(std::vector<uint8_t>(300, 3) == dgrams1[1]);
+  }
+  check_dgrams(rcv2.recv_all(), pktlens2, 101);
+
+  // A batch takes at most MAX_SEND_BATCH packets, and rejects a
+  // SendBuffer which does not fit as a whole.
+  std::vector<std::unique_ptr<SendBuffer>> sendbufs;
+  batch.clear();
+  for (size_t n = 0; n < MAX_SEND_BATCH; n += MAX_SEND_PKTS) {
+    sendbufs.push_back(std::make_unique<SendBuffer>(100));
+    push_pkts(*sendbufs.back(), std::vector<size_t>(MAX_SEND_PKTS, 100), 0);
+    CU_ASSERT(batch.add(rcv1.addr, *sendbufs.back(), false));
+  }
+
+  push_pkts(sendbuf1, {100}, 0);
+  CU_ASSERT(!batch.add(rcv1.addr, sendbuf1, false));
+  CU_ASSERT(MAX_SEND_BATCH == batch.size());
+
+  close(fd);
+}
+
+} // namespace ngtcp2
@@ -27,11 +27,13 @@
 #include <iostream>
 #include <algorithm>
 #include <memory>
+#include <chrono>
 
 #include <unistd.h>
 #include <getopt.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <netinet/udp.h>
 #include <netdb.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -39,6 +41,7 @@
 
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 
 #include "server.h"
 #include "network.h"
@@ -47,11 +50,13 @@
 #include "crypto.h"
 #include "shared.h"
 #include "http.h"
+#include "cookie.h"
 
 using namespace ngtcp2;
 
 namespace {
-auto randgen = util::make_mt19937();
+// randgen is per thread because each worker runs in its own thread.
+thread_local auto randgen = util::make_mt19937();
 } // namespace
 
 namespace {
@@ -62,6 +67,27 @@ namespace {
 constexpr size_t MAX_BYTES_IN_FLIGHT = 1460 * 10;
 } // namespace
 
+namespace {
+// DRAINING_PERIOD is the duration in microseconds that a closed
+// connection responds to incoming packets with CONNECTION_CLOSE.
+constexpr ngtcp2_tstamp DRAINING_PERIOD = 15 * 1000000;
+// MAX_CONN_CLOSE_TOKENS is the size of the token bucket which limits
+// the number of CONNECTION_CLOSE a closed connection sends.
+constexpr size_t MAX_CONN_CLOSE_TOKENS = 3;
+// CONN_CLOSE_TOKEN_INTERVAL is the interval in microseconds at which
+// a token is added to the bucket.
+constexpr ngtcp2_tstamp CONN_CLOSE_TOKEN_INTERVAL = 1000000;
+} // namespace
+
+namespace {
+// cookie_secret is the key to generate and verify stateless cookies.
+// It is initialized in create_ssl_ctx.
+std::array<uint8_t, 32> cookie_secret;
+// remote_addr_index is the index of SSL ex_data which points to the
+// Address of the client.  The address is bound to stateless cookie.
+int remote_addr_index = -1;
+} // namespace
+
 Buffer::Buffer(const uint8_t *data, size_t datalen)
     : buf{data, data + datalen},
       begin(buf.data()),
@@ -224,6 +250,8 @@ Stream::Stream(uint32_t stream_id)
       streambuf_idx(0),
       tx_stream_offset(0),
       should_send_fin(false),
+      blocked(false),
+      in_sendq(false),
       http_major(0),
       http_minor(0),
       resp_state(RESP_IDLE),
@@ -468,12 +496,21 @@ int Stream::start_response() {
 }
 
 namespace {
-void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
+void timeoutcb(TimerWheel::Timer *w) {
   int rv;
 
   auto h = static_cast<Handler *>(w->data);
   auto s = h->server();
 
+  if (h->orphaned()) {
+    return;
+  }
+
+  if (h->handshake_pending()) {
+    s->remove(h);
+    return;
+  }
+
   if (ngtcp2_conn_closed(h->conn())) {
     if (!config.quiet) {
       debug::print_timestamp();
@@ -492,28 +529,46 @@ void timeoutcb(struct ev_loop *loop, ev_timer *w, int revents) {
   rv = h->start_drain_period(0);
   if (rv != 0) {
     s->remove(h);
+    return;
   }
+
+  s->drain(h);
 }
 } // namespace
 
 namespace {
-void retransmitcb(struct ev_loop *loop, ev_timer *w, int revents) {
-  int rv;
+void closedcb(TimerWheel::Timer *w) {
+  auto cc = static_cast<ClosedConnection *>(w->data);
 
+  if (!config.quiet) {
+    debug::print_timestamp();
+    std::cerr << "Draining Period is over" << std::endl;
+  }
+
+  cc->server->remove_closed_conn(cc->conn_id);
+}
+} // namespace
+
+ClosedConnection::ClosedConnection(Server *server, uint64_t conn_id,
+                                   uint64_t client_conn_id,
+                                   const Address &remote_addr)
+    : server(server),
+      conn_id(conn_id),
+      client_conn_id(client_conn_id),
+      remote_addr(remote_addr),
+      timer(closedcb, this),
+      nrecv(0),
+      tokens(MAX_CONN_CLOSE_TOKENS),
+      token_ts(util::timestamp()) {}
+
+ClosedConnection::~ClosedConnection() { server->stop_timer(&timer); }
+
+namespace {
+void retransmitcb(TimerWheel::Timer *w) {
   auto h = static_cast<Handler *>(w->data);
   auto s = h->server();
 
-  rv = h->on_write();
-  switch (rv) {
-  case 0:
-  case NETWORK_ERR_CLOSE_WAIT:
-    break;
-  case NETWORK_ERR_SEND_NON_FATAL:
-    s->start_wev();
-    break;
-  default:
-    s->remove(h);
-  }
+  s->schedule_write(h);
 }
 } // namespace
 
@@ -526,20 +581,23 @@ Handler::Handler(struct ev_loop *loop, SSL_CTX *ssl_ctx, Server *server,
       ssl_(nullptr),
       server_(server),
       fd_(-1),
+      timer_(timeoutcb, this),
+      rttimer_(retransmitcb, this),
+      idle_timeout_(static_cast<ngtcp2_tstamp>(config.timeout) * 1000000),
       ncread_(0),
       shandshake_idx_(0),
       conn_(nullptr),
+      hs_crypto_ctx_{},
       crypto_ctx_{},
-      sendbuf_{NGTCP2_MAX_PKTLEN_IPV4},
-      conn_id_(std::uniform_int_distribution<uint64_t>(
-          0, std::numeric_limits<uint64_t>::max())(randgen)),
+      conn_id_(server->generate_conn_id()),
       client_conn_id_(client_conn_id),
-      tx_stream0_offset_(0) {
-  ev_timer_init(&timer_, timeoutcb, 0., config.timeout);
-  timer_.data = this;
-  ev_timer_init(&rttimer_, retransmitcb, 0., 0.);
-  rttimer_.data = this;
-}
+      tx_stream0_offset_(0),
+      hs_result_(0),
+      quantum_(0),
+      hs_pending_(false),
+      orphaned_(false),
+      dirty_(false),
+      blocked_(false) {}
 
 Handler::~Handler() {
   if (!config.quiet) {
@@ -547,13 +605,29 @@ Handler::~Handler() {
     std::cerr << "Closing QUIC connection" << std::endl;
   }
 
-  ev_timer_stop(loop_, &rttimer_);
-  ev_timer_stop(loop_, &timer_);
+  server_->stop_timer(&rttimer_);
+  server_->stop_timer(&timer_);
+
+  if (dirty_ || blocked_) {
+    server_->cancel_write(this);
+  }
+
+  if (sendbuf_) {
+    server_->put_sendbuf(std::move(sendbuf_));
+  }
 
   if (conn_) {
     ngtcp2_conn_del(conn_);
   }
 
+  for (auto ctx : {&hs_crypto_ctx_, &crypto_ctx_}) {
+    crypto::aead_ctx_free(ctx->tx_aead_ctx);
+    crypto::aead_ctx_free(ctx->rx_aead_ctx);
+    crypto::aead_ctx_free(ctx->next_tx_aead_ctx);
+    crypto::aead_ctx_free(ctx->next_rx_aead_ctx);
+    crypto::aead_ctx_free(ctx->old_rx_aead_ctx);
+  }
+
   if (ssl_) {
     SSL_free(ssl_);
   }
@@ -585,8 +659,9 @@ ssize_t send_server_cleartext(ngtcp2_conn *conn, uint32_t flags,
   auto len = h->read_server_handshake(pdest);
 
   // If Client Initial does not have complete ClientHello, then drop
-  // connection.
-  if (ppkt_num && len == 0) {
+  // connection.  If TLS handshake is still running on a handshake
+  // worker, the data will be available later.
+  if (ppkt_num && len == 0 && !h->handshake_pending()) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
 
@@ -610,16 +685,33 @@ int handshake_completed(ngtcp2_conn *conn, void *user_data) {
 }
 } // namespace
 
+namespace {
+int update_key(ngtcp2_conn *conn, void *user_data) {
+  auto h = static_cast<Handler *>(user_data);
+
+  if (h->update_key() != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+} // namespace
+
 namespace {
 ssize_t do_hs_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                       const uint8_t *plaintext, size_t plaintextlen,
-                      const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                      size_t noncelen, const uint8_t *ad, size_t adlen,
-                      void *user_data) {
+                      const uint8_t *key, size_t keylen, void *aead_ctx,
+                      const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                      size_t adlen, void *user_data) {
   auto h = static_cast<Handler *>(user_data);
 
-  auto nwrite = h->hs_encrypt_data(dest, destlen, plaintext, plaintextlen, key,
-                                   keylen, nonce, noncelen, ad, adlen);
+  // Every key installed by this program comes with its context.
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  auto nwrite = h->hs_encrypt_data(dest, destlen, plaintext, plaintextlen,
+                                   aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -631,13 +723,17 @@ ssize_t do_hs_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 namespace {
 ssize_t do_hs_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                       const uint8_t *ciphertext, size_t ciphertextlen,
-                      const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                      size_t noncelen, const uint8_t *ad, size_t adlen,
-                      void *user_data) {
+                      const uint8_t *key, size_t keylen, void *aead_ctx,
+                      const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                      size_t adlen, void *user_data) {
   auto h = static_cast<Handler *>(user_data);
 
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
   auto nwrite = h->hs_decrypt_data(dest, destlen, ciphertext, ciphertextlen,
-                                   key, keylen, nonce, noncelen, ad, adlen);
+                                   aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_TLS_DECRYPT;
   }
@@ -649,13 +745,17 @@ ssize_t do_hs_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 namespace {
 ssize_t do_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    const uint8_t *plaintext, size_t plaintextlen,
-                   const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                   size_t noncelen, const uint8_t *ad, size_t adlen,
-                   void *user_data) {
+                   const uint8_t *key, size_t keylen, void *aead_ctx,
+                   const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                   size_t adlen, void *user_data) {
   auto h = static_cast<Handler *>(user_data);
 
-  auto nwrite = h->encrypt_data(dest, destlen, plaintext, plaintextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  auto nwrite = h->encrypt_data(dest, destlen, plaintext, plaintextlen,
+                                aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -667,13 +767,17 @@ ssize_t do_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 namespace {
 ssize_t do_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                    const uint8_t *ciphertext, size_t ciphertextlen,
-                   const uint8_t *key, size_t keylen, const uint8_t *nonce,
-                   size_t noncelen, const uint8_t *ad, size_t adlen,
-                   void *user_data) {
+                   const uint8_t *key, size_t keylen, void *aead_ctx,
+                   const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                   size_t adlen, void *user_data) {
   auto h = static_cast<Handler *>(user_data);
 
-  auto nwrite = h->decrypt_data(dest, destlen, ciphertext, ciphertextlen, key,
-                                keylen, nonce, noncelen, ad, adlen);
+  if (aead_ctx == nullptr) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  auto nwrite = h->decrypt_data(dest, destlen, ciphertext, ciphertextlen,
+                                aead_ctx, nonce, noncelen, ad, adlen);
   if (nwrite < 0) {
     return NGTCP2_ERR_TLS_DECRYPT;
   }
@@ -756,6 +860,7 @@ int Handler::init(int fd, const sockaddr *sa, socklen_t salen,
   BIO_set_data(bio, this);
   SSL_set_bio(ssl_, bio, bio);
   SSL_set_app_data(ssl_, this);
+  SSL_set_ex_data(ssl_, remote_addr_index, &remote_addr_);
   SSL_set_accept_state(ssl_);
 
   auto callbacks = ngtcp2_conn_callbacks{
@@ -777,6 +882,13 @@ int Handler::init(int fd, const sockaddr *sa, socklen_t salen,
       ::recv_stream_data,
       acked_stream_data_offset,
       stream_close,
+      nullptr,
+      nullptr,
+      nullptr,
+      nullptr,
+      nullptr,
+      nullptr,
+      ::update_key,
   };
 
   ngtcp2_settings settings;
@@ -800,15 +912,49 @@ int Handler::init(int fd, const sockaddr *sa, socklen_t salen,
     return -1;
   }
 
-  ev_timer_again(loop_, &timer_);
+  auto &decrypt_buf = server_->decrypt_buf();
+  ngtcp2_conn_set_decrypt_buffer(conn_, decrypt_buf.data(), decrypt_buf.size());
+
+  reset_idle_timer();
 
   return 0;
 }
 
 int Handler::tls_handshake() {
+  if (server_->handshake_worker_pool()) {
+    // TLS handshake is submitted to a handshake worker after
+    // ngtcp2_conn_recv returns.
+    hs_pending_ = true;
+    return 0;
+  }
+
+  return finish_tls_handshake(do_tls_handshake());
+}
+
+int Handler::do_tls_handshake() {
+  int rv;
+
   ERR_clear_error();
 
-  auto rv = SSL_do_handshake(ssl_);
+  // The second ClientHello after Server Stateless Retry must be
+  // processed in stateless mode so that OpenSSL restores the
+  // transcript of the first ClientHello and HelloRetryRequest from
+  // the cookie.
+  if (SSL_in_before(ssl_)) {
+    auto offset =
+        find_client_hello_with_cookie(chandshake_.data(), chandshake_.size());
+    if (offset >= 0) {
+      ncread_ += offset;
+      rv = SSL_stateless(ssl_);
+      if (rv != 1) {
+        std::cerr << "TLS handshake error: invalid stateless cookie"
+                  << std::endl;
+        return -1;
+      }
+    }
+  }
+
+  rv = SSL_do_handshake(ssl_);
   if (rv <= 0) {
     auto err = SSL_get_error(ssl_, rv);
     switch (err) {
@@ -825,6 +971,14 @@ int Handler::tls_handshake() {
     }
   }
 
+  return 1;
+}
+
+int Handler::finish_tls_handshake(int rv) {
+  if (rv <= 0) {
+    return rv;
+  }
+
   // SSL_do_handshake returns 1 if TLS handshake has completed.  With
   // boringSSL, it may return 1 if we have 0-RTT early data.  This is
   // a problem, but for First Implementation draft, 0-RTT early data
@@ -851,6 +1005,60 @@ int Handler::tls_handshake() {
   return 0;
 }
 
+int Handler::on_tls_handshake_done() {
+  int rv;
+
+  hs_pending_ = false;
+
+  rv = finish_tls_handshake(hs_result_);
+  if (rv != 0) {
+    // Send TLS alert in CONNECTION_CLOSE as recv_stream0_data does
+    // when TLS handshake fails in the event loop.
+    return handle_error(NGTCP2_ERR_TLS_ALERT);
+  }
+
+  while (!hs_pending_ && !pending_pkts_.empty()) {
+    auto buf = std::move(pending_pkts_.front());
+    pending_pkts_.pop_front();
+
+    rv = feed_data(buf.head, buf.size());
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  server_->schedule_write(this);
+
+  return 0;
+}
+
+bool Handler::handshake_pending() const { return hs_pending_; }
+
+void Handler::orphan() {
+  orphaned_ = true;
+
+  server_->stop_timer(&rttimer_);
+  server_->stop_timer(&timer_);
+
+  if (dirty_ || blocked_) {
+    server_->cancel_write(this);
+    dirty_ = false;
+    blocked_ = false;
+  }
+}
+
+bool Handler::orphaned() const { return orphaned_; }
+
+bool Handler::dirty() const { return dirty_; }
+
+bool Handler::blocked() const { return blocked_; }
+
+void Handler::set_blocked(bool blocked) { blocked_ = blocked; }
+
+void Handler::set_dirty(bool dirty) { dirty_ = dirty; }
+
+void Handler::set_tls_handshake_result(int rv) { hs_result_ = rv; }
+
 int Handler::write_server_handshake(const uint8_t *data, size_t datalen) {
   shandshake_.emplace_back(data, datalen);
   return 0;
@@ -913,8 +1121,14 @@ int Handler::recv_client_initial(uint64_t conn_id) {
     return -1;
   }
 
-  ngtcp2_conn_set_handshake_tx_keys(conn_, key.data(), keylen, iv.data(),
-                                    ivlen);
+  hs_crypto_ctx_.tx_aead_ctx =
+      crypto::aead_ctx_new(hs_crypto_ctx_, key.data(), keylen, ivlen, true);
+  if (hs_crypto_ctx_.tx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_set_handshake_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    hs_crypto_ctx_.tx_aead_ctx);
 
   rv = crypto::derive_client_cleartext_secret(secret.data(), secret.size(),
                                               cleartext_secret.data(),
@@ -936,8 +1150,14 @@ int Handler::recv_client_initial(uint64_t conn_id) {
     return -1;
   }
 
-  ngtcp2_conn_set_handshake_rx_keys(conn_, key.data(), keylen, iv.data(),
-                                    ivlen);
+  hs_crypto_ctx_.rx_aead_ctx =
+      crypto::aead_ctx_new(hs_crypto_ctx_, key.data(), keylen, ivlen, false);
+  if (hs_crypto_ctx_.rx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_set_handshake_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    hs_crypto_ctx_.rx_aead_ctx);
 
   return 0;
 }
@@ -980,7 +1200,14 @@ int Handler::setup_crypto_context() {
     return -1;
   }
 
-  ngtcp2_conn_update_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
+  crypto_ctx_.tx_aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, true);
+  if (crypto_ctx_.tx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_update_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                             crypto_ctx_.tx_aead_ctx);
 
   rv = crypto::export_client_secret(crypto_ctx_.rx_secret.data(),
                                     crypto_ctx_.secretlen, ssl_);
@@ -1002,57 +1229,165 @@ int Handler::setup_crypto_context() {
     return -1;
   }
 
-  ngtcp2_conn_update_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen);
+  crypto_ctx_.rx_aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, false);
+  if (crypto_ctx_.rx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  ngtcp2_conn_update_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                             crypto_ctx_.rx_aead_ctx);
 
   ngtcp2_conn_set_aead_overhead(conn_, crypto::aead_max_overhead(crypto_ctx_));
 
+  return prepare_next_keys();
+}
+
+int Handler::prepare_next_keys() {
+  int rv;
+  std::array<uint8_t, 64> secret, key, iv;
+
+  rv = crypto::update_server_secret(secret.data(), crypto_ctx_.secretlen,
+                                    crypto_ctx_.tx_secret.data(),
+                                    crypto_ctx_.secretlen, crypto_ctx_);
+  if (rv != 0) {
+    return -1;
+  }
+
+  auto keylen = crypto::derive_packet_protection_key(
+      key.data(), key.size(), secret.data(), crypto_ctx_.secretlen,
+      crypto_ctx_);
+  if (keylen < 0) {
+    return -1;
+  }
+
+  auto ivlen = crypto::derive_packet_protection_iv(
+      iv.data(), iv.size(), secret.data(), crypto_ctx_.secretlen, crypto_ctx_);
+  if (ivlen < 0) {
+    return -1;
+  }
+
+  auto aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, true);
+  if (aead_ctx == nullptr) {
+    return -1;
+  }
+
+  rv = ngtcp2_conn_set_next_tx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    aead_ctx);
+  if (rv != 0) {
+    std::cerr << "ngtcp2_conn_set_next_tx_keys: " << ngtcp2_strerror(rv)
+              << std::endl;
+    crypto::aead_ctx_free(aead_ctx);
+    return -1;
+  }
+
+  crypto_ctx_.next_tx_aead_ctx = aead_ctx;
+  crypto_ctx_.tx_secret = secret;
+
+  rv = crypto::update_client_secret(secret.data(), crypto_ctx_.secretlen,
+                                    crypto_ctx_.rx_secret.data(),
+                                    crypto_ctx_.secretlen, crypto_ctx_);
+  if (rv != 0) {
+    return -1;
+  }
+
+  keylen = crypto::derive_packet_protection_key(
+      key.data(), key.size(), secret.data(), crypto_ctx_.secretlen,
+      crypto_ctx_);
+  if (keylen < 0) {
+    return -1;
+  }
+
+  ivlen = crypto::derive_packet_protection_iv(
+      iv.data(), iv.size(), secret.data(), crypto_ctx_.secretlen, crypto_ctx_);
+  if (ivlen < 0) {
+    return -1;
+  }
+
+  aead_ctx =
+      crypto::aead_ctx_new(crypto_ctx_, key.data(), keylen, ivlen, false);
+  if (aead_ctx == nullptr) {
+    return -1;
+  }
+
+  rv = ngtcp2_conn_set_next_rx_keys(conn_, key.data(), keylen, iv.data(), ivlen,
+                                    aead_ctx);
+  if (rv != 0) {
+    std::cerr << "ngtcp2_conn_set_next_rx_keys: " << ngtcp2_strerror(rv)
+              << std::endl;
+    crypto::aead_ctx_free(aead_ctx);
+    return -1;
+  }
+
+  crypto_ctx_.next_rx_aead_ctx = aead_ctx;
+  crypto_ctx_.rx_secret = secret;
+
   return 0;
 }
 
+int Handler::update_key() {
+  auto &ctx = crypto_ctx_;
+
+  // ngtcp2_conn has promoted the next keys.  It no longer uses the
+  // previous encryption key, and the decryption key of two key
+  // phases before.
+  crypto::aead_ctx_free(ctx.tx_aead_ctx);
+  ctx.tx_aead_ctx = ctx.next_tx_aead_ctx;
+  ctx.next_tx_aead_ctx = nullptr;
+
+  crypto::aead_ctx_free(ctx.old_rx_aead_ctx);
+  ctx.old_rx_aead_ctx = ctx.rx_aead_ctx;
+  ctx.rx_aead_ctx = ctx.next_rx_aead_ctx;
+  ctx.next_rx_aead_ctx = nullptr;
+
+  return prepare_next_keys();
+}
+
 ssize_t Handler::hs_encrypt_data(uint8_t *dest, size_t destlen,
                                  const uint8_t *plaintext, size_t plaintextlen,
-                                 const uint8_t *key, size_t keylen,
-                                 const uint8_t *nonce, size_t noncelen,
-                                 const uint8_t *ad, size_t adlen) {
+                                 void *aead_ctx, const uint8_t *nonce,
+                                 size_t noncelen, const uint8_t *ad,
+                                 size_t adlen) {
   return crypto::encrypt(dest, destlen, plaintext, plaintextlen, hs_crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         aead_ctx, nonce, noncelen, ad, adlen);
 }
 
 ssize_t Handler::hs_decrypt_data(uint8_t *dest, size_t destlen,
                                  const uint8_t *ciphertext,
-                                 size_t ciphertextlen, const uint8_t *key,
-                                 size_t keylen, const uint8_t *nonce,
-                                 size_t noncelen, const uint8_t *ad,
-                                 size_t adlen) {
+                                 size_t ciphertextlen, void *aead_ctx,
+                                 const uint8_t *nonce, size_t noncelen,
+                                 const uint8_t *ad, size_t adlen) {
   return crypto::decrypt(dest, destlen, ciphertext, ciphertextlen,
-                         hs_crypto_ctx_, key, keylen, nonce, noncelen, ad,
+                         hs_crypto_ctx_, aead_ctx, nonce, noncelen, ad,
                          adlen);
 }
 
 ssize_t Handler::encrypt_data(uint8_t *dest, size_t destlen,
                               const uint8_t *plaintext, size_t plaintextlen,
-                              const uint8_t *key, size_t keylen,
-                              const uint8_t *nonce, size_t noncelen,
-                              const uint8_t *ad, size_t adlen) {
+                              void *aead_ctx, const uint8_t *nonce,
+                              size_t noncelen, const uint8_t *ad,
+                              size_t adlen) {
   return crypto::encrypt(dest, destlen, plaintext, plaintextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         aead_ctx, nonce, noncelen, ad, adlen);
 }
 
 ssize_t Handler::decrypt_data(uint8_t *dest, size_t destlen,
                               const uint8_t *ciphertext, size_t ciphertextlen,
-                              const uint8_t *key, size_t keylen,
-                              const uint8_t *nonce, size_t noncelen,
-                              const uint8_t *ad, size_t adlen) {
+                              void *aead_ctx, const uint8_t *nonce,
+                              size_t noncelen, const uint8_t *ad,
+                              size_t adlen) {
   return crypto::decrypt(dest, destlen, ciphertext, ciphertextlen, crypto_ctx_,
-                         key, keylen, nonce, noncelen, ad, adlen);
+                         aead_ctx, nonce, noncelen, ad, adlen);
 }
 
 int Handler::feed_data(uint8_t *data, size_t datalen) {
   int rv;
 
-  rv = ngtcp2_conn_recv(conn_, data, datalen, util::timestamp());
+  rv = ngtcp2_conn_recv_inplace(conn_, data, datalen, util::timestamp());
   if (rv != 0) {
-    std::cerr << "ngtcp2_conn_recv: " << ngtcp2_strerror(rv) << std::endl;
+    std::cerr << "ngtcp2_conn_recv_inplace: " << ngtcp2_strerror(rv)
+              << std::endl;
     if (rv != NGTCP2_ERR_TLS_DECRYPT) {
       return handle_error(rv);
     }
@@ -1065,45 +1400,79 @@ int Handler::feed_data(uint8_t *data, size_t datalen) {
     return -1;
   }
 
+  if (hs_pending_) {
+    if (server_->handshake_worker_pool()->submit(this)) {
+      return 0;
+    }
+    // The queue is full.  Run TLS handshake here.
+    hs_pending_ = false;
+    if (finish_tls_handshake(do_tls_handshake()) != 0) {
+      return handle_error(NGTCP2_ERR_TLS_ALERT);
+    }
+  }
+
   return 0;
 }
 
+namespace {
+constexpr size_t MAX_PENDING_PKTS = 16;
+} // namespace
+
 int Handler::on_read(uint8_t *data, size_t datalen) {
   int rv;
 
+  if (hs_pending_) {
+    if (pending_pkts_.size() < MAX_PENDING_PKTS) {
+      pending_pkts_.emplace_back(data, datalen);
+    }
+    return 0;
+  }
+
   rv = feed_data(data, datalen);
   if (rv != 0) {
     return rv;
   }
 
-  ev_timer_again(loop_, &timer_);
+  reset_idle_timer();
 
   return 0;
 }
 
-int Handler::on_write() {
+int Handler::on_write(size_t quantum) {
   int rv;
 
-  if (ngtcp2_conn_closed(conn_)) {
+  if (hs_pending_) {
     return 0;
   }
 
-  if (sendbuf_.size() > 0) {
-    auto rv = server_->send_packet(remote_addr_, sendbuf_);
+  auto sendbuf_d = defer(&Handler::release_sendbuf, this);
+
+  // Packets left by EAGAIN go first.  They might contain
+  // CONNECTION_CLOSE.
+  if (sendbuf_ && !sendbuf_->empty()) {
+    auto rv = server_->send_packets(remote_addr_, *sendbuf_);
     if (rv != NETWORK_ERR_OK) {
       return rv;
     }
   }
 
-  assert(sendbuf_.left() >= max_pktlen_);
+  if (ngtcp2_conn_closed(conn_)) {
+    return NETWORK_ERR_CLOSE_WAIT;
+  }
 
-  for (;;) {
+  acquire_sendbuf();
+
+  assert(sendbuf_->left() >= max_pktlen_);
+
+  quantum_ = quantum;
+
+  while (quantum_) {
     ssize_t n;
     if (ngtcp2_conn_bytes_in_flight(conn_) < MAX_BYTES_IN_FLIGHT) {
-      n = ngtcp2_conn_write_pkt(conn_, sendbuf_.wpos(), max_pktlen_,
+      n = ngtcp2_conn_write_pkt(conn_, sendbuf_->wpos(), max_pktlen_,
                                 util::timestamp());
     } else {
-      n = ngtcp2_conn_write_ack_pkt(conn_, sendbuf_.wpos(), max_pktlen_,
+      n = ngtcp2_conn_write_ack_pkt(conn_, sendbuf_->wpos(), max_pktlen_,
                                     util::timestamp());
     }
     if (n < 0) {
@@ -1114,61 +1483,139 @@ int Handler::on_write() {
       break;
     }
 
-    sendbuf_.push(n);
+    --quantum_;
 
-    auto rv = server_->send_packet(remote_addr_, sendbuf_);
-    if (rv == NETWORK_ERR_SEND_NON_FATAL) {
-      break;
-    }
+    auto rv = push_pkt(n);
     if (rv != NETWORK_ERR_OK) {
       return rv;
     }
   }
 
-  for (auto &p : streams_) {
-    auto &stream = p.second;
+  uint32_t stream_id;
+  while (ngtcp2_conn_pop_writable_stream(conn_, &stream_id)) {
+    auto it = streams_.find(stream_id);
+    if (it == std::end(streams_)) {
+      continue;
+    }
+    auto &stream = (*it).second;
+    stream->blocked = false;
+    schedule_stream(*stream);
+  }
+
+  for (auto n = sendq_.size();
+       n && quantum_ &&
+       ngtcp2_conn_bytes_in_flight(conn_) < MAX_BYTES_IN_FLIGHT;
+       --n) {
+    auto it = streams_.find(sendq_.front());
+    sendq_.pop_front();
+    if (it == std::end(streams_)) {
+      continue;
+    }
+    auto &stream = (*it).second;
+    stream->in_sendq = false;
     rv = on_write_stream(*stream);
+    // Put the stream back first so that it is not forgotten if the
+    // socket is blocked.
+    schedule_stream(*stream);
     if (rv != 0) {
       return rv;
     }
   }
 
   schedule_retransmit();
-  return 0;
-}
-
-int Handler::on_write_stream(Stream &stream) {
-  if (stream.streambuf_idx == stream.streambuf.size()) {
-    if (stream.should_send_fin) {
-      if (ngtcp2_conn_bytes_in_flight(conn_) >= MAX_BYTES_IN_FLIGHT) {
-        return 0;
-      }
-
-      stream.should_send_fin = false;
-      auto v = Buffer{};
-      if (write_stream_data(stream, 1, v) != 0) {
-        return -1;
-      }
-    }
-    return 0;
-  }
 
-  for (auto it = std::begin(stream.streambuf) + stream.streambuf_idx;
-       it != std::end(stream.streambuf); ++it) {
-    auto &v = *it;
-    auto fin = stream.should_send_fin &&
-               stream.streambuf_idx == stream.streambuf.size() - 1;
-    auto rv = write_stream_data(stream, fin, v);
-    if (rv != 0) {
-      return rv;
-    }
-    if (v.size() > 0) {
-      break;
-    }
-    ++stream.streambuf_idx;
-    if (fin) {
-      stream.should_send_fin = false;
-    }
+  if (quantum_ == 0) {
+    return NETWORK_ERR_SEND_YIELD;
+  }
+
+  return 0;
+}
+
+int Handler::push_pkt(size_t n) {
+  if (debug::packet_lost(config.tx_loss_prob)) {
+    if (!config.quiet) {
+      std::cerr << "** Simulated outgoing packet loss **" << std::endl;
+    }
+  } else {
+    sendbuf_->push(n);
+  }
+
+  if (!sendbuf_->full()) {
+    return NETWORK_ERR_OK;
+  }
+
+  return server_->send_packets(remote_addr_, *sendbuf_);
+}
+
+int Handler::send_packets() {
+  auto sendbuf_d = defer(&Handler::release_sendbuf, this);
+
+  if (!sendbuf_) {
+    return NETWORK_ERR_OK;
+  }
+
+  return server_->send_packets(remote_addr_, *sendbuf_);
+}
+
+void Handler::acquire_sendbuf() {
+  if (!sendbuf_) {
+    sendbuf_ = server_->get_sendbuf();
+  }
+}
+
+void Handler::release_sendbuf() {
+  if (sendbuf_ && sendbuf_->empty()) {
+    server_->put_sendbuf(std::move(sendbuf_));
+  }
+}
+
+SendBuffer *Handler::sendbuf() const { return sendbuf_.get(); }
+
+void Handler::schedule_stream(Stream &stream) {
+  if (stream.blocked || stream.in_sendq ||
+      (stream.streambuf_idx == stream.streambuf.size() &&
+       !stream.should_send_fin)) {
+    return;
+  }
+
+  stream.in_sendq = true;
+  sendq_.push_back(stream.stream_id);
+}
+
+int Handler::on_write_stream(Stream &stream) {
+  if (stream.streambuf_idx == stream.streambuf.size()) {
+    if (stream.should_send_fin) {
+      if (quantum_ == 0 ||
+          ngtcp2_conn_bytes_in_flight(conn_) >= MAX_BYTES_IN_FLIGHT) {
+        return 0;
+      }
+
+      stream.should_send_fin = false;
+      auto v = Buffer{};
+      auto rv = write_stream_data(stream, 1, v);
+      if (rv != 0) {
+        return rv;
+      }
+    }
+    return 0;
+  }
+
+  for (auto it = std::begin(stream.streambuf) + stream.streambuf_idx;
+       it != std::end(stream.streambuf); ++it) {
+    auto &v = *it;
+    auto fin = stream.should_send_fin &&
+               stream.streambuf_idx == stream.streambuf.size() - 1;
+    auto rv = write_stream_data(stream, fin, v);
+    if (rv != 0) {
+      return rv;
+    }
+    if (v.size() > 0) {
+      break;
+    }
+    ++stream.streambuf_idx;
+    if (fin) {
+      stream.should_send_fin = false;
+    }
   }
 
   return 0;
@@ -1177,18 +1624,19 @@ int Handler::on_write_stream(Stream &stream) {
 int Handler::write_stream_data(Stream &stream, int fin, Buffer &data) {
   size_t ndatalen;
 
-  for (;;) {
+  while (quantum_) {
     if (ngtcp2_conn_bytes_in_flight(conn_) >= MAX_BYTES_IN_FLIGHT) {
       break;
     }
 
     auto n = ngtcp2_conn_write_stream(
-        conn_, sendbuf_.wpos(), max_pktlen_, &ndatalen, stream.stream_id, fin,
+        conn_, sendbuf_->wpos(), max_pktlen_, &ndatalen, stream.stream_id, fin,
         data.rpos(), data.size(), util::timestamp());
     if (n < 0) {
       switch (n) {
       case NGTCP2_ERR_STREAM_DATA_BLOCKED:
       case NGTCP2_ERR_STREAM_SHUT_WR:
+        stream.blocked = true;
         return 0;
       }
       std::cerr << "ngtcp2_conn_write_stream: " << ngtcp2_strerror(n)
@@ -1197,10 +1645,9 @@ int Handler::write_stream_data(Stream &stream, int fin, Buffer &data) {
     }
 
     data.seek(ndatalen);
+    --quantum_;
 
-    sendbuf_.push(n);
-
-    auto rv = server_->send_packet(remote_addr_, sendbuf_);
+    auto rv = push_pkt(n);
     if (rv != NETWORK_ERR_OK) {
       return rv;
     }
@@ -1220,26 +1667,28 @@ int Handler::start_drain_period(int liberr) {
     return 0;
   }
 
-  ev_timer_stop(loop_, &rttimer_);
+  server_->stop_timer(&rttimer_);
 
-  timer_.repeat = 15.;
-  ev_timer_again(loop_, &timer_);
+  idle_timeout_ = DRAINING_PERIOD;
+  reset_idle_timer();
 
-  sendbuf_.reset();
-  assert(sendbuf_.left() >= max_pktlen_);
+  if (sendbuf_) {
+    sendbuf_->reset();
+  }
 
-  conn_closebuf_ = std::make_unique<Buffer>(NGTCP2_MAX_PKTLEN_IPV4);
+  std::array<uint8_t, NGTCP2_MAX_PKTLEN_IPV4> buf;
 
-  auto n = ngtcp2_conn_write_connection_close(conn_, conn_closebuf_->wpos(),
-                                              max_pktlen_,
-                                              infer_quic_error_code(liberr));
+  auto n = ngtcp2_conn_write_connection_close(
+      conn_, buf.data(), max_pktlen_, infer_quic_error_code(liberr));
   if (n < 0) {
     std::cerr << "ngtcp2_conn_write_connection_close: " << ngtcp2_strerror(n)
               << std::endl;
     return -1;
   }
 
-  conn_closebuf_->push(n);
+  // The packet is kept for the whole draining period, so allocate
+  // only what it needs.
+  conn_closebuf_ = std::make_unique<Buffer>(buf.data(), n);
 
   return 0;
 }
@@ -1270,13 +1719,19 @@ int Handler::send_conn_close() {
 
   assert(conn_closebuf_ && conn_closebuf_->size());
 
-  if (sendbuf_.size() == 0) {
+  acquire_sendbuf();
+  auto sendbuf_d = defer(&Handler::release_sendbuf, this);
+
+  if (sendbuf_->empty()) {
     std::copy_n(conn_closebuf_->rpos(), conn_closebuf_->size(),
-                sendbuf_.wpos());
-    sendbuf_.push(conn_closebuf_->size());
+                sendbuf_->wpos());
+    rv = push_pkt(conn_closebuf_->size());
+    if (rv != NETWORK_ERR_OK) {
+      return rv;
+    }
   }
 
-  return server_->send_packet(remote_addr_, sendbuf_);
+  return server_->send_packets(remote_addr_, *sendbuf_);
 }
 
 void Handler::schedule_retransmit() {
@@ -1285,16 +1740,11 @@ void Handler::schedule_retransmit() {
     return;
   }
 
-  ev_tstamp t;
-  auto now = util::timestamp();
-  if (now >= expiry) {
-    t = 0.;
-  } else {
-    t = static_cast<ev_tstamp>(expiry - now) / 1000000;
-  }
-  ev_timer_stop(loop_, &rttimer_);
-  ev_timer_set(&rttimer_, t, 0.);
-  ev_timer_start(loop_, &rttimer_);
+  server_->start_timer(&rttimer_, expiry);
+}
+
+void Handler::reset_idle_timer() {
+  server_->start_timer(&timer_, util::timestamp() + idle_timeout_);
 }
 
 int Handler::recv_stream_data(uint32_t stream_id, uint8_t fin,
@@ -1318,6 +1768,7 @@ int Handler::recv_stream_data(uint32_t stream_id, uint8_t fin,
   if (stream->recv_data(fin, data, datalen) != 0) {
     if (stream->resp_state == RESP_IDLE) {
       stream->send_status_response(400);
+      schedule_stream(*stream);
       return 0;
     }
     rv = ngtcp2_conn_shutdown_stream(conn_, stream_id, NGTCP2_APP_PROTO);
@@ -1328,6 +1779,8 @@ int Handler::recv_stream_data(uint32_t stream_id, uint8_t fin,
     }
   }
 
+  schedule_stream(*stream);
+
   return 0;
 }
 
@@ -1339,6 +1792,8 @@ Server *Handler::server() const { return server_; }
 
 const Address &Handler::remote_addr() const { return remote_addr_; }
 
+const Buffer *Handler::conn_closebuf() const { return conn_closebuf_.get(); }
+
 ngtcp2_conn *Handler::conn() const { return conn_; }
 
 namespace {
@@ -1394,16 +1849,9 @@ void Handler::on_stream_close(uint32_t stream_id) {
 
 namespace {
 void swritecb(struct ev_loop *loop, ev_io *w, int revents) {
-  ev_io_stop(loop, w);
-
   auto s = static_cast<Server *>(w->data);
 
-  auto rv = s->on_write();
-  if (rv != 0) {
-    if (rv == NETWORK_ERR_SEND_NON_FATAL) {
-      s->start_wev();
-    }
-  }
+  s->on_write();
 }
 } // namespace
 
@@ -1421,12 +1869,52 @@ void siginthandler(struct ev_loop *loop, ev_signal *watcher, int revents) {
 }
 } // namespace
 
+namespace {
+void prepcb(struct ev_loop *loop, ev_prepare *w, int revents) {
+  auto s = static_cast<Server *>(w->data);
+
+  s->write_dirty_handlers();
+}
+} // namespace
+
+namespace {
+void timercb(struct ev_loop *loop, ev_timer *w, int revents) {
+  auto s = static_cast<Server *>(w->data);
+
+  s->on_timer();
+}
+} // namespace
+
+namespace {
+void fwdcb(struct ev_loop *loop, ev_io *w, int revents) {
+  auto s = static_cast<Server *>(w->data);
+
+  s->on_forward();
+}
+} // namespace
+
 Server::Server(struct ev_loop *loop, SSL_CTX *ssl_ctx)
-    : loop_(loop), ssl_ctx_(ssl_ctx), fd_(-1) {
+    : timer_expiry_(std::numeric_limits<ngtcp2_tstamp>::max()),
+      rx_pkts_(RECV_BATCH),
+      gso_(!config.no_gso),
+      ninitial_(0),
+      initial_ts_(0.),
+      loop_(loop),
+      ssl_ctx_(ssl_ctx),
+      fd_(-1),
+      worker_id_(0),
+      peers_(nullptr),
+      fwdq_(FORWARD_QUEUE_SIZE) {
   ev_io_init(&wev_, swritecb, 0, EV_WRITE);
   ev_io_init(&rev_, sreadcb, 0, EV_READ);
   wev_.data = this;
   rev_.data = this;
+  ev_io_init(&fwdev_, fwdcb, 0, EV_READ);
+  fwdev_.data = this;
+  ev_timer_init(&timerev_, timercb, 0., 0.);
+  timerev_.data = this;
+  ev_prepare_init(&prepev_, prepcb);
+  prepev_.data = this;
   ev_signal_init(&sigintev_, siginthandler, SIGINT);
 }
 
@@ -1435,23 +1923,112 @@ Server::~Server() {
   close();
 }
 
+namespace {
+void hsdonecb(struct ev_loop *loop, ev_async *w, int revents) {
+  auto pool = static_cast<HandshakeWorkerPool *>(w->data);
+
+  pool->on_done();
+}
+} // namespace
+
+HandshakeWorkerPool::HandshakeWorkerPool(struct ev_loop *loop, Server *server,
+                                         size_t nworkers)
+    : loop_(loop), server_(server), max_jobs_(nworkers * 16), shutdown_(false) {
+  ev_async_init(&doneev_, hsdonecb);
+  doneev_.data = this;
+  ev_async_start(loop_, &doneev_);
+
+  for (size_t i = 0; i < nworkers; ++i) {
+    workers_.emplace_back([this]() { run(); });
+  }
+}
+
+HandshakeWorkerPool::~HandshakeWorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    shutdown_ = true;
+  }
+  cv_.notify_all();
+
+  for (auto &t : workers_) {
+    t.join();
+  }
+
+  ev_async_stop(loop_, &doneev_);
+}
+
+bool HandshakeWorkerPool::submit(Handler *h) {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (jobq_.size() >= max_jobs_) {
+      return false;
+    }
+    jobq_.push_back(h);
+  }
+  cv_.notify_one();
+
+  return true;
+}
+
+void HandshakeWorkerPool::run() {
+  for (;;) {
+    Handler *h;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [this]() { return shutdown_ || !jobq_.empty(); });
+      if (shutdown_) {
+        return;
+      }
+      h = jobq_.front();
+      jobq_.pop_front();
+    }
+
+    h->set_tls_handshake_result(h->do_tls_handshake());
+
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      doneq_.push_back(h);
+    }
+    ev_async_send(loop_, &doneev_);
+  }
+}
+
+void HandshakeWorkerPool::on_done() {
+  std::deque<Handler *> q;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    q.swap(doneq_);
+  }
+
+  for (auto h : q) {
+    server_->on_tls_handshake_done(h);
+  }
+}
+
 void Server::disconnect() { disconnect(0); }
 
 void Server::disconnect(int liberr) {
   config.tx_loss_prob = 0;
 
+  // Join handshake workers first so that no Handler is used by them.
+  hs_pool_.reset();
+
   ev_io_stop(loop_, &rev_);
 
   ev_signal_stop(loop_, &sigintev_);
 
+  ev_io_stop(loop_, &fwdev_);
+
   while (!handlers_.empty()) {
-    auto it = std::begin(handlers_);
-    auto &h = (*it).second;
+    auto h = std::begin(handlers_)->value.get();
 
     h->handle_error(0);
 
-    remove(it);
+    remove(h);
   }
+
+  ev_timer_stop(loop_, &timerev_);
+  ev_prepare_stop(loop_, &prepev_);
 }
 
 void Server::close() {
@@ -1463,6 +2040,23 @@ void Server::close() {
   }
 }
 
+int Server::set_worker(size_t worker_id, const std::vector<Server *> *peers) {
+  worker_id_ = worker_id;
+  peers_ = peers;
+
+  if (fwd_notifier_.init() != 0) {
+    std::cerr << "Could not create forward notifier: " << strerror(errno)
+              << std::endl;
+    return -1;
+  }
+
+  fwd_pool_ = std::make_unique<BufferPool>(FORWARD_QUEUE_SIZE, FORWARD_BUFLEN);
+
+  ev_io_set(&fwdev_, fwd_notifier_.fd(), EV_READ);
+
+  return 0;
+}
+
 int Server::init(int fd) {
   fd_ = fd;
 
@@ -1470,207 +2064,786 @@ int Server::init(int fd) {
   ev_io_set(&rev_, fd_, EV_READ);
 
   ev_io_start(loop_, &rev_);
+  ev_prepare_start(loop_, &prepev_);
 
-  ev_signal_start(loop_, &sigintev_);
+  // A signal can be watched by only one event loop.  The first worker
+  // stops the others.
+  if (worker_id_ == 0) {
+    ev_signal_start(loop_, &sigintev_);
+  }
+
+  if (peers_) {
+    ev_io_start(loop_, &fwdev_);
+  }
+
+  if (config.handshake_workers) {
+    hs_pool_ = std::make_unique<HandshakeWorkerPool>(loop_, this,
+                                                     config.handshake_workers);
+  }
 
   return 0;
 }
 
-int Server::on_write() {
-  for (auto it = std::cbegin(handlers_); it != std::cend(handlers_);) {
-    auto h = it->second.get();
-    auto rv = h->on_write();
+void Server::on_write() {
+  // Each Handler blocked before this call gets one turn.  The ones
+  // which yield go to the back, and are resumed on the next writable
+  // event so that reads are not starved.
+  for (auto n = blocked_handlers_.size(); n && !blocked_handlers_.empty();
+       --n) {
+    auto h = blocked_handlers_.front();
+    blocked_handlers_.pop_front();
+    h->set_blocked(false);
+
+    auto rv = h->on_write(WRITE_QUANTUM);
+    if (rv == 0 || rv == NETWORK_ERR_SEND_YIELD) {
+      auto nrv = h->send_packets();
+      if (nrv != NETWORK_ERR_OK) {
+        rv = nrv;
+      }
+    }
     switch (rv) {
     case 0:
+      break;
     case NETWORK_ERR_CLOSE_WAIT:
-      ++it;
-      continue;
+      drain(h);
+      break;
     case NETWORK_ERR_SEND_NON_FATAL:
-      return NETWORK_ERR_SEND_NON_FATAL;
+      // The socket is full again.  h keeps its place.
+      h->set_blocked(true);
+      blocked_handlers_.push_front(h);
+      return;
+    case NETWORK_ERR_SEND_YIELD:
+      block_write(h);
+      break;
+    default:
+      remove(h);
     }
-    it = remove(it);
   }
 
-  return NETWORK_ERR_OK;
+  if (blocked_handlers_.empty()) {
+    ev_io_stop(loop_, &wev_);
+  }
 }
 
-int Server::on_read() {
-  sockaddr_union su;
-  socklen_t addrlen = sizeof(su);
-  std::array<uint8_t, 64_k> buf;
-  int rv;
-  ngtcp2_pkt_hd hd;
+size_t Server::recv_pkts() {
+#ifdef HAVE_RECVMMSG
+  std::array<mmsghdr, RECV_BATCH> msgs{};
+  std::array<iovec, RECV_BATCH> iovs;
 
-  auto nread =
-      recvfrom(fd_, buf.data(), buf.size(), MSG_DONTWAIT, &su.sa, &addrlen);
-  if (nread == -1) {
-    std::cerr << "recvfrom: " << strerror(errno) << std::endl;
+  for (size_t i = 0; i < RECV_BATCH; ++i) {
+    auto &pkt = rx_pkts_[i];
+    iovs[i].iov_base = pkt.buf.data();
+    iovs[i].iov_len = pkt.buf.size();
+    auto &msg = msgs[i].msg_hdr;
+    msg.msg_name = &pkt.remote_addr.su;
+    msg.msg_namelen = sizeof(pkt.remote_addr.su);
+    msg.msg_iov = &iovs[i];
+    msg.msg_iovlen = 1;
+  }
+
+  auto npkts = recvmmsg(fd_, msgs.data(), msgs.size(), MSG_DONTWAIT, nullptr);
+  if (npkts == -1) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+      std::cerr << "recvmmsg: " << strerror(errno) << std::endl;
+    }
     // TODO Handle running out of fd
     return 0;
   }
 
-  if (debug::packet_lost(config.rx_loss_prob)) {
+  for (auto i = 0; i < npkts; ++i) {
+    auto &pkt = rx_pkts_[i];
+    pkt.remote_addr.len = msgs[i].msg_hdr.msg_namelen;
+    pkt.pktlen = msgs[i].msg_len;
+  }
+
+  return static_cast<size_t>(npkts);
+#else  // !HAVE_RECVMMSG
+  size_t npkts = 0;
+
+  for (; npkts < RECV_BATCH; ++npkts) {
+    auto &pkt = rx_pkts_[npkts];
+    pkt.remote_addr.len = sizeof(pkt.remote_addr.su);
+    auto nread =
+        recvfrom(fd_, pkt.buf.data(), pkt.buf.size(), MSG_DONTWAIT,
+                 &pkt.remote_addr.su.sa, &pkt.remote_addr.len);
+    if (nread == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        std::cerr << "recvfrom: " << strerror(errno) << std::endl;
+      }
+      break;
+    }
+    pkt.pktlen = nread;
+  }
+
+  return npkts;
+#endif // !HAVE_RECVMMSG
+}
+
+int Server::on_read() {
+  for (size_t nbatches = 0; nbatches < MAX_RECV_BATCHES; ++nbatches) {
+    auto npkts = recv_pkts();
+    if (npkts == 0) {
+      return 0;
+    }
+
+    // Consecutive datagrams which have the same connection ID are
+    // fed to the Handler found for the first one of them.
+    Handler *h = nullptr;
+    uint64_t conn_id = 0;
+
+    for (size_t i = 0; i < npkts; ++i) {
+      auto &pkt = rx_pkts_[i];
+
+      if (debug::packet_lost(config.rx_loss_prob)) {
+        if (!config.quiet) {
+          std::cerr << "** Simulated incoming packet loss **" << std::endl;
+        }
+        continue;
+      }
+
+      ngtcp2_pkt_hd hd;
+
+      auto rv = ngtcp2_pkt_decode_hd(&hd, pkt.buf.data(), pkt.pktlen);
+      if (rv < 0) {
+        std::cerr << "Could not decode QUIC packet header: "
+                  << ngtcp2_strerror(rv) << std::endl;
+        continue;
+      }
+
+      // conn_ of h must not be read while a handshake worker uses
+      // it.  h->on_read queues the packet in that case.
+      if (h == nullptr || hd.conn_id != conn_id ||
+          (!h->handshake_pending() && ngtcp2_conn_closed(h->conn()))) {
+        conn_id = hd.conn_id;
+        h = on_pkt(pkt.buf.data(), pkt.pktlen, pkt.remote_addr, hd,
+                   static_cast<size_t>(rv));
+        continue;
+      }
+
+      rv = h->on_read(pkt.buf.data(), pkt.pktlen);
+      if (rv != 0) {
+        if (rv == NETWORK_ERR_CLOSE_WAIT) {
+          drain(h);
+        } else {
+          remove(h);
+        }
+        h = nullptr;
+      }
+    }
+
+    if (npkts < RECV_BATCH) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+void Server::schedule_write(Handler *h) {
+  // A blocked Handler writes when its turn comes.
+  if (h->dirty() || h->blocked()) {
+    return;
+  }
+
+  h->set_dirty(true);
+  dirty_handlers_.push_back(h);
+}
+
+std::unique_ptr<SendBuffer> Server::get_sendbuf() {
+  if (sendbuf_pool_.empty()) {
+    return std::make_unique<SendBuffer>(NGTCP2_MAX_PKTLEN_IPV4);
+  }
+
+  auto sendbuf = std::move(sendbuf_pool_.back());
+  sendbuf_pool_.pop_back();
+
+  return sendbuf;
+}
+
+void Server::put_sendbuf(std::unique_ptr<SendBuffer> sendbuf) {
+  if (sendbuf_pool_.size() == MAX_SENDBUF_POOL) {
+    return;
+  }
+
+  sendbuf->reset();
+  sendbuf_pool_.push_back(std::move(sendbuf));
+}
+
+void Server::block_write(Handler *h) {
+  if (h->blocked()) {
+    return;
+  }
+
+  h->set_blocked(true);
+  blocked_handlers_.push_back(h);
+  start_wev();
+}
+
+void Server::cancel_write(const Handler *h) {
+  if (h->dirty()) {
+    dirty_handlers_.erase(
+        std::find(std::begin(dirty_handlers_), std::end(dirty_handlers_), h));
+  }
+  if (h->blocked()) {
+    blocked_handlers_.erase(std::find(std::begin(blocked_handlers_),
+                                      std::end(blocked_handlers_), h));
+  }
+}
+
+void Server::write_dirty_handlers() {
+  while (!dirty_handlers_.empty()) {
+    auto h = dirty_handlers_.back();
+    dirty_handlers_.pop_back();
+    h->set_dirty(false);
+
+    if (!blocked_handlers_.empty()) {
+      // The socket is congested.  Do not generate packets which
+      // cannot be sent now.  h writes when its turn comes.
+      block_write(h);
+      continue;
+    }
+
+    auto rv = h->on_write();
+    switch (rv) {
+    case 0:
+      queue_packets(h);
+      break;
+    case NETWORK_ERR_CLOSE_WAIT:
+      drain(h);
+      break;
+    case NETWORK_ERR_SEND_YIELD:
+      queue_packets(h);
+      block_write(h);
+      break;
+    case NETWORK_ERR_SEND_NON_FATAL:
+      block_write(h);
+      break;
+    default:
+      remove(h);
+    }
+  }
+
+  send_queued_packets();
+}
+
+void Server::queue_packets(Handler *h) {
+  auto sendbuf = h->sendbuf();
+  if (!sendbuf || sendbuf->empty()) {
+    return;
+  }
+
+  if (!tx_batch_.add(h->remote_addr(), *sendbuf, gso_)) {
+    send_queued_packets();
+
+    if (!blocked_handlers_.empty()) {
+      block_write(h);
+      return;
+    }
+
+    auto added = tx_batch_.add(h->remote_addr(), *sendbuf, gso_);
+    assert(added);
+    (void)added;
+  }
+
+  tx_handlers_.push_back(h);
+}
+
+void Server::send_queued_packets() {
+  while (!tx_batch_.empty()) {
+    if (tx_batch_.send(fd_) == 0) {
+      break;
+    }
+
+    if (errno == EAGAIN || errno == EINTR || errno == 0) {
+      break;
+    }
+
+    if (gso_ && (errno == EIO || errno == EINVAL)) {
+      // The kernel or the network interface does not support GSO.
+      if (!config.quiet) {
+        std::cerr << "GSO is not available: " << strerror(errno) << std::endl;
+      }
+      gso_ = false;
+    } else {
+      std::cerr << "sendmmsg: " << strerror(errno) << std::endl;
+
+      auto sendbuf = tx_batch_.front();
+      auto it = std::find_if(
+          std::begin(tx_handlers_), std::end(tx_handlers_),
+          [sendbuf](const Handler *h) { return h->sendbuf() == sendbuf; });
+      assert(it != std::end(tx_handlers_));
+      auto h = *it;
+      tx_handlers_.erase(it);
+      remove(h);
+    }
+
+    // Put the packets not sent yet in a new batch.
+    tx_batch_.clear();
+    for (auto h : tx_handlers_) {
+      auto sendbuf = h->sendbuf();
+      if (!sendbuf->empty()) {
+        tx_batch_.add(h->remote_addr(), *sendbuf, gso_);
+      }
+    }
+  }
+
+  for (auto h : tx_handlers_) {
+    // The packets left by EAGAIN are sent first when h gets its turn.
+    if (!h->sendbuf()->empty()) {
+      block_write(h);
+    }
+    h->release_sendbuf();
+  }
+
+  tx_batch_.clear();
+  tx_handlers_.clear();
+}
+
+uint64_t Server::generate_conn_id() {
+  auto conn_id = std::uniform_int_distribution<uint64_t>(
+      0, (1ULL << WORKER_ID_SHIFT) - 1)(randgen);
+  return conn_id | (static_cast<uint64_t>(worker_id_) << WORKER_ID_SHIFT);
+}
+
+void Server::forward(size_t worker_id, const uint8_t *data, size_t datalen,
+                     const Address &remote_addr) {
+  if (datalen > fwd_pool_->buflen()) {
+    return;
+  }
+
+  auto buf = fwd_pool_->get();
+  if (buf == nullptr) {
     if (!config.quiet) {
-      std::cerr << "** Simulated incoming packet loss **" << std::endl;
+      std::cerr << "No buffer to forward packet: drop packet" << std::endl;
     }
-    return 0;
+    return;
   }
 
-  rv = ngtcp2_pkt_decode_hd(&hd, buf.data(), nread);
-  if (rv < 0) {
-    std::cerr << "Could not decode QUIC packet header: " << ngtcp2_strerror(rv)
-              << std::endl;
-    return 0;
+  std::copy_n(data, datalen, buf);
+
+  auto dest = (*peers_)[worker_id];
+
+  if (!dest->fwdq_.push({buf, datalen, remote_addr, fwd_pool_.get()})) {
+    fwd_pool_->put(buf);
+    if (!config.quiet) {
+      std::cerr << "Forward queue of worker " << worker_id
+                << " is full: drop packet" << std::endl;
+    }
+    return;
   }
 
+  dest->fwd_notifier_.notify();
+}
+
+void Server::on_forward() {
+  fwd_notifier_.reset();
+
+  ForwardedPacket pkt;
+
+  while (fwdq_.pop(pkt)) {
+    ngtcp2_pkt_hd hd;
+
+    auto rv = ngtcp2_pkt_decode_hd(&hd, pkt.data, pkt.datalen);
+    if (rv >= 0) {
+      on_pkt(pkt.data, pkt.datalen, pkt.remote_addr, hd,
+             static_cast<size_t>(rv));
+    }
+
+    pkt.pool->put(pkt.data);
+  }
+}
+
+Handler *Server::on_pkt(uint8_t *data, size_t datalen,
+                        const Address &remote_addr, const ngtcp2_pkt_hd &hd,
+                        size_t hdlen) {
+  int rv;
+  auto sa = &remote_addr.su.sa;
+  auto salen = remote_addr.len;
   auto conn_id = hd.conn_id;
 
-  auto handler_it = handlers_.find(conn_id);
-  if (handler_it == std::end(handlers_)) {
-    auto ctos_it = ctos_.find(conn_id);
-    if (ctos_it == std::end(ctos_)) {
+  auto hp = handlers_.find(conn_id);
+  if (hp == nullptr) {
+    auto cc = closed_conns_.find(conn_id);
+    if (cc) {
+      send_conn_close(**cc);
+      return nullptr;
+    }
+
+    auto sconn_id = ctos_.find(conn_id);
+    if (sconn_id == nullptr) {
+      // Packets other than Client Initial for a connection which this
+      // worker does not know are passed to the worker which chose its
+      // connection ID.
+      if (peers_ && ((data[0] & 0x80) == 0 ||
+                     (data[0] & 0x7f) != NGTCP2_PKT_CLIENT_INITIAL)) {
+        auto worker_id = static_cast<size_t>(conn_id >> WORKER_ID_SHIFT);
+        if (worker_id != worker_id_) {
+          if (worker_id < peers_->size()) {
+            forward(worker_id, data, datalen, remote_addr);
+          }
+          return nullptr;
+        }
+      }
+
       auto client_conn_id = conn_id;
       constexpr size_t MIN_PKT_SIZE = 1200;
-      if (static_cast<size_t>(nread) < MIN_PKT_SIZE) {
+      if (datalen < MIN_PKT_SIZE) {
         if (!config.quiet) {
-          std::cerr << "Client Initial packet is too short: " << nread << " < "
-                    << MIN_PKT_SIZE << std::endl;
+          std::cerr << "Client Initial packet is too short: " << datalen
+                    << " < " << MIN_PKT_SIZE << std::endl;
         }
-        return 0;
+        return nullptr;
       }
 
-      rv = ngtcp2_accept(&hd, buf.data(), nread);
+      auto chd = hd;
+      rv = ngtcp2_accept(&chd, data, datalen);
       if (rv == -1) {
         if (!config.quiet) {
           std::cerr << "Unexpected packet received" << std::endl;
         }
-        return 0;
+        return nullptr;
       }
       if (rv == 1) {
         if (!config.quiet) {
           std::cerr << "Unsupported version: Send Version Negotiation"
                     << std::endl;
         }
-        send_version_negotiation(&hd, &su.sa, addrlen);
-        return 0;
+        send_version_negotiation(&chd, sa, salen);
+        return nullptr;
       }
 
-      if ((buf[0] & 0x7f) != NGTCP2_PKT_CLIENT_INITIAL) {
-        return 0;
+      if ((data[0] & 0x7f) != NGTCP2_PKT_CLIENT_INITIAL) {
+        return nullptr;
+      }
+
+      if (stateless_retry_required()) {
+        rv = verify_client_initial(&chd, hdlen, data, datalen, sa, salen);
+        if (rv != 1) {
+          return nullptr;
+        }
       }
 
       auto h = std::make_unique<Handler>(loop_, ssl_ctx_, this, client_conn_id);
-      h->init(fd_, &su.sa, addrlen, hd.version);
+      h->init(fd_, sa, salen, chd.version);
 
-      if (h->on_read(buf.data(), nread) != 0) {
-        return 0;
-      }
-      rv = h->on_write();
-      switch (rv) {
-      case 0:
-        break;
-      case NETWORK_ERR_SEND_NON_FATAL:
-        start_wev();
-        break;
-      default:
-        return 0;
+      if (h->on_read(data, datalen) != 0) {
+        return nullptr;
       }
 
+      auto p = h.get();
       conn_id = h->conn_id();
       handlers_.emplace(conn_id, std::move(h));
       ctos_.emplace(client_conn_id, conn_id);
-      return 0;
+      schedule_write(p);
+      return p;
     }
     if (!config.quiet) {
       debug::print_timestamp();
       fprintf(stderr, "Forward CID=%016" PRIx64 " to CID=%016" PRIx64 "\n",
-              (*ctos_it).first, (*ctos_it).second);
+              conn_id, *sconn_id);
+    }
+    hp = handlers_.find(*sconn_id);
+    if (hp == nullptr) {
+      auto cc = closed_conns_.find(*sconn_id);
+      assert(cc);
+      send_conn_close(**cc);
+      return nullptr;
     }
-    handler_it = handlers_.find((*ctos_it).second);
-    assert(handler_it != std::end(handlers_));
   }
 
-  auto h = (*handler_it).second.get();
-  if (ngtcp2_conn_closed(h->conn())) {
-    // TODO do exponential backoff.
-    rv = h->send_conn_close();
-    switch (rv) {
-    case 0:
-    case NETWORK_ERR_SEND_NON_FATAL:
+  auto h = hp->get();
+  if (!h->handshake_pending() && ngtcp2_conn_closed(h->conn())) {
+    // h is still waiting for the socket to send CONNECTION_CLOSE.
+    conn_id = h->conn_id();
+    drain(h);
+    send_conn_close(**closed_conns_.find(conn_id));
+    return nullptr;
+  }
+
+  rv = h->on_read(data, datalen);
+  if (rv != 0) {
+    if (rv == NETWORK_ERR_CLOSE_WAIT) {
+      drain(h);
+    } else {
+      remove(h);
+    }
+    return nullptr;
+  }
+
+  schedule_write(h);
+
+  return h;
+}
+
+namespace {
+uint32_t generate_reserved_vesrion(const sockaddr *sa, socklen_t salen,
+                                   uint32_t version) {
+  uint32_t h = 0x811C9DC5u;
+  const uint8_t *p = (const uint8_t *)sa;
+  const uint8_t *ep = p + salen;
+  for (; p != ep; ++p) {
+    h ^= *p;
+    h *= 0x01000193u;
+  }
+  version = htonl(version);
+  p = (const uint8_t *)&version;
+  ep = p + sizeof(version);
+  for (; p != ep; ++p) {
+    h ^= *p;
+    h *= 0x01000193u;
+  }
+  h &= 0xf0f0f0f0u;
+  h |= 0x0a0a0a0au;
+  return h;
+}
+} // namespace
+
+int Server::send_version_negotiation(const ngtcp2_pkt_hd *chd,
+                                     const sockaddr *sa, socklen_t salen) {
+  Buffer buf{NGTCP2_MAX_PKTLEN_IPV4};
+  ngtcp2_upe *upe;
+  ngtcp2_pkt_hd hd;
+  uint32_t reserved_ver;
+  std::array<uint32_t, 2> sv;
+  int rv;
+
+  hd.type = NGTCP2_PKT_VERSION_NEGOTIATION;
+  hd.flags = NGTCP2_PKT_FLAG_LONG_FORM;
+  hd.conn_id = chd->conn_id;
+  hd.pkt_num = chd->pkt_num;
+  hd.version = chd->version;
+
+  reserved_ver = generate_reserved_vesrion(sa, salen, hd.version);
+
+  sv[0] = reserved_ver;
+  sv[1] = NGTCP2_PROTO_VER_D7;
+
+  rv = ngtcp2_upe_new(&upe, buf.wpos(), buf.left());
+  if (rv != 0) {
+    std::cerr << "ngtcp2_upe_new: " << ngtcp2_strerror(rv) << std::endl;
+    return -1;
+  }
+
+  auto upe_d = defer(ngtcp2_upe_del, upe);
+
+  rv = ngtcp2_upe_encode_hd(upe, &hd);
+  if (rv != 0) {
+    return -1;
+  }
+
+  auto sn =
+      ngtcp2_upe_encode_version_negotiation(upe, nullptr, sv.data(), sv.size());
+  if (sn < 0) {
+    std::cerr << "ngtcp2_upe_encode_version_negotiation: "
+              << ngtcp2_strerror(rv) << std::endl;
+    return -1;
+  }
+
+  buf.push(sn);
+
+  Address remote_addr;
+  remote_addr.len = salen;
+  memcpy(&remote_addr.su.sa, sa, salen);
+
+  if (send_packet(remote_addr, buf) != NETWORK_ERR_OK) {
+    return -1;
+  }
+
+  return 0;
+}
+
+bool Server::stateless_retry_required() {
+  auto now = ev_now(loop_);
+
+  if (now - initial_ts_ >= 1.) {
+    initial_ts_ = now;
+    ninitial_ = 0;
+  }
+
+  return ++ninitial_ > config.stateless_retry_rate;
+}
+
+namespace {
+// cleartext_aead_ctx_new derives packet protection key and IV of
+// cleartext packet from |cleartext_secret|.  If |server| is true, they
+// are for server, and the returned AEAD context is for encryption.
+// Otherwise they are for client, and the context is for decryption.
+// IV is written to |iv|, and its length is assigned to |ivlen|.  This
+// function returns the AEAD context if it succeeds, or nullptr.
+void *cleartext_aead_ctx_new(std::array<uint8_t, 16> &iv, size_t &ivlen,
+                             const std::array<uint8_t, 32> &cleartext_secret,
+                             const crypto::Context &ctx, bool server) {
+  std::array<uint8_t, 32> secret;
+  std::array<uint8_t, 16> key;
+  int rv;
+
+  if (server) {
+    rv = crypto::derive_server_cleartext_secret(secret.data(), secret.size(),
+                                                cleartext_secret.data(),
+                                                cleartext_secret.size());
+  } else {
+    rv = crypto::derive_client_cleartext_secret(secret.data(), secret.size(),
+                                                cleartext_secret.data(),
+                                                cleartext_secret.size());
+  }
+  if (rv != 0) {
+    return nullptr;
+  }
+
+  auto keylen = crypto::derive_packet_protection_key(
+      key.data(), key.size(), secret.data(), secret.size(), ctx);
+  if (keylen < 0) {
+    return nullptr;
+  }
+
+  auto n = crypto::derive_packet_protection_iv(
+      iv.data(), iv.size(), secret.data(), secret.size(), ctx);
+  if (n < 0) {
+    return nullptr;
+  }
+
+  ivlen = n;
+
+  return crypto::aead_ctx_new(ctx, key.data(), keylen, ivlen, server);
+}
+} // namespace
+
+namespace {
+// create_nonce writes IV |iv| of length |ivlen| XORed with packet
+// number |pkt_num| to |dest|.
+void create_nonce(uint8_t *dest, const std::array<uint8_t, 16> &iv,
+                  size_t ivlen, uint64_t pkt_num) {
+  std::copy_n(std::begin(iv), ivlen, dest);
+  for (size_t i = 0; i < 8; ++i) {
+    dest[ivlen - 1 - i] ^= static_cast<uint8_t>(pkt_num >> (i * 8));
+  }
+}
+} // namespace
+
+int Server::verify_client_initial(const ngtcp2_pkt_hd *chd, size_t chdlen,
+                                  const uint8_t *data, size_t datalen,
+                                  const sockaddr *sa, socklen_t salen) {
+  int rv;
+  std::array<uint8_t, 32> cleartext_secret;
+  std::array<uint8_t, 16> iv, nonce;
+  size_t ivlen;
+  crypto::Context ctx{};
+
+  rv = crypto::derive_cleartext_secret(
+      cleartext_secret.data(), cleartext_secret.size(), chd->conn_id,
+      reinterpret_cast<const uint8_t *>(NGTCP2_QUIC_V1_SALT),
+      str_size(NGTCP2_QUIC_V1_SALT));
+  if (rv != 0) {
+    std::cerr << "crypto::derive_cleartext_secret() failed" << std::endl;
+    return -1;
+  }
+
+  crypto::prf_sha256(ctx);
+  crypto::aead_aes_128_gcm(ctx);
+
+  auto rx_aead_ctx =
+      cleartext_aead_ctx_new(iv, ivlen, cleartext_secret, ctx, false);
+  if (rx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  auto rx_aead_ctx_d = defer(crypto::aead_ctx_free, rx_aead_ctx);
+
+  create_nonce(nonce.data(), iv, ivlen, chd->pkt_num);
+
+  auto nread = crypto::decrypt(decrypt_buf_.data(), decrypt_buf_.size(),
+                               data + chdlen, datalen - chdlen, ctx,
+                               rx_aead_ctx, nonce.data(), ivlen, data, chdlen);
+  if (nread < 0) {
+    return -1;
+  }
+
+  // Client Initial packet has whole ClientHello in stream 0 at
+  // offset 0.
+  const uint8_t *ch = nullptr;
+  size_t chlen = 0;
+
+  for (auto p = decrypt_buf_.data(), end = p + nread; p != end;) {
+    ngtcp2_frame fr;
+    auto n = ngtcp2_pkt_decode_frame(&fr, p, end - p);
+    if (n < 0) {
+      return -1;
+    }
+
+    p += n;
+
+    if (fr.type == NGTCP2_FRAME_STREAM && fr.stream.stream_id == 0 &&
+        fr.stream.offset == 0 && fr.stream.datalen) {
+      ch = fr.stream.data;
+      chlen = fr.stream.datalen;
       break;
-    default:
-      remove(handler_it);
     }
-    return 0;
   }
 
-  rv = h->on_read(buf.data(), nread);
-  if (rv != 0) {
-    if (rv != NETWORK_ERR_CLOSE_WAIT) {
-      remove(handler_it);
-    }
-    return 0;
+  if (ch == nullptr) {
+    return -1;
   }
 
-  rv = h->on_write();
-  switch (rv) {
-  case 0:
-  case NETWORK_ERR_CLOSE_WAIT:
-    break;
-  case NETWORK_ERR_SEND_NON_FATAL:
-    start_wev();
-    break;
-  default:
-    remove(handler_it);
+  auto offset = find_client_hello_with_cookie(ch, chlen);
+  if (offset > 0) {
+    ch += offset;
+    chlen -= offset;
   }
 
-  return 0;
-}
+  Address remote_addr;
+  remote_addr.len = salen;
+  memcpy(&remote_addr.su.sa, sa, salen);
 
-namespace {
-uint32_t generate_reserved_vesrion(const sockaddr *sa, socklen_t salen,
-                                   uint32_t version) {
-  uint32_t h = 0x811C9DC5u;
-  const uint8_t *p = (const uint8_t *)sa;
-  const uint8_t *ep = p + salen;
-  for (; p != ep; ++p) {
-    h ^= *p;
-    h *= 0x01000193u;
+  // This SSL object has no Handler attached.  It only verifies the
+  // cookie, or generates HelloRetryRequest with a new cookie.
+  auto ssl = SSL_new(ssl_ctx_);
+  auto ssl_d = defer(SSL_free, ssl);
+  auto rbio = BIO_new_mem_buf(ch, static_cast<int>(chlen));
+  auto wbio = BIO_new(BIO_s_mem());
+  SSL_set_bio(ssl, rbio, wbio);
+  SSL_set_ex_data(ssl, remote_addr_index, &remote_addr);
+  SSL_set_accept_state(ssl);
+
+  rv = SSL_stateless(ssl);
+  if (rv == 1) {
+    return 1;
   }
-  version = htonl(version);
-  p = (const uint8_t *)&version;
-  ep = p + sizeof(version);
-  for (; p != ep; ++p) {
-    h ^= *p;
-    h *= 0x01000193u;
+  if (rv != 0) {
+    if (!config.quiet) {
+      std::cerr << "SSL_stateless: "
+                << ERR_error_string(ERR_get_error(), nullptr) << std::endl;
+    }
+    return -1;
   }
-  h &= 0xf0f0f0f0u;
-  h |= 0x0a0a0a0au;
-  return h;
-}
-} // namespace
 
-int Server::send_version_negotiation(const ngtcp2_pkt_hd *chd,
-                                     const sockaddr *sa, socklen_t salen) {
-  Buffer buf{NGTCP2_MAX_PKTLEN_IPV4};
+  char *hrr;
+  auto hrrlen = BIO_get_mem_data(wbio, &hrr);
+  if (hrrlen <= 0) {
+    return -1;
+  }
+
+  auto tx_aead_ctx =
+      cleartext_aead_ctx_new(iv, ivlen, cleartext_secret, ctx, true);
+  if (tx_aead_ctx == nullptr) {
+    return -1;
+  }
+
+  auto tx_aead_ctx_d = defer(crypto::aead_ctx_free, tx_aead_ctx);
+
+  Buffer buf{NGTCP2_MAX_PKTLEN_IPV6};
   ngtcp2_upe *upe;
   ngtcp2_pkt_hd hd;
-  uint32_t reserved_ver;
-  std::array<uint32_t, 2> sv;
-  int rv;
 
-  hd.type = NGTCP2_PKT_VERSION_NEGOTIATION;
+  // Server Stateless Retry packet echoes connection ID and packet
+  // number of Client Initial packet.
+  hd.type = NGTCP2_PKT_SERVER_STATELESS_RETRY;
   hd.flags = NGTCP2_PKT_FLAG_LONG_FORM;
   hd.conn_id = chd->conn_id;
   hd.pkt_num = chd->pkt_num;
   hd.version = chd->version;
 
-  reserved_ver = generate_reserved_vesrion(sa, salen, hd.version);
-
-  sv[0] = reserved_ver;
-  sv[1] = NGTCP2_PROTO_VER_D7;
-
-  rv = ngtcp2_upe_new(&upe, buf.wpos(), buf.left());
+  rv = ngtcp2_upe_new(&upe, buf.wpos(),
+                      buf.left() - crypto::aead_max_overhead(ctx));
   if (rv != 0) {
     std::cerr << "ngtcp2_upe_new: " << ngtcp2_strerror(rv) << std::endl;
     return -1;
@@ -1683,19 +2856,39 @@ int Server::send_version_negotiation(const ngtcp2_pkt_hd *chd,
     return -1;
   }
 
-  auto sn =
-      ngtcp2_upe_encode_version_negotiation(upe, nullptr, sv.data(), sv.size());
-  if (sn < 0) {
-    std::cerr << "ngtcp2_upe_encode_version_negotiation: "
-              << ngtcp2_strerror(rv) << std::endl;
+  auto hdlen = ngtcp2_upe_final(upe, nullptr);
+
+  ngtcp2_frame fr{};
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.data = reinterpret_cast<const uint8_t *>(hrr);
+  fr.stream.datalen = hrrlen;
+
+  rv = ngtcp2_upe_encode_frame(upe, &fr);
+  if (rv != 0) {
+    std::cerr << "ngtcp2_upe_encode_frame: " << ngtcp2_strerror(rv)
+              << std::endl;
     return -1;
   }
 
-  buf.push(sn);
+  auto pktlen = ngtcp2_upe_final(upe, nullptr);
 
-  Address remote_addr;
-  remote_addr.len = salen;
-  memcpy(&remote_addr.su.sa, sa, salen);
+  create_nonce(nonce.data(), iv, ivlen, hd.pkt_num);
+
+  auto payload = buf.wpos() + hdlen;
+  auto nwrite = crypto::encrypt(payload, buf.left() - hdlen, payload,
+                                pktlen - hdlen, ctx, tx_aead_ctx, nonce.data(),
+                                ivlen, buf.wpos(), hdlen);
+  if (nwrite < 0) {
+    return -1;
+  }
+
+  buf.push(hdlen + nwrite);
+
+  if (!config.quiet) {
+    debug::print_timestamp();
+    fprintf(stderr, "Send Server Stateless Retry to CID=%016" PRIx64 "\n",
+            chd->conn_id);
+  }
 
   if (send_packet(remote_addr, buf) != NETWORK_ERR_OK) {
     return -1;
@@ -1739,24 +2932,210 @@ int Server::send_packet(Address &remote_addr, Buffer &buf) {
   return NETWORK_ERR_OK;
 }
 
+int Server::send_packets(const Address &remote_addr, SendBuffer &sendbuf) {
+  SendBatch batch;
+
+  batch.add(remote_addr, sendbuf, gso_);
+
+  while (batch.send(fd_) != 0) {
+    switch (errno) {
+    case EAGAIN:
+    case EINTR:
+    case 0:
+      return NETWORK_ERR_SEND_NON_FATAL;
+    case EIO:
+    case EINVAL:
+      if (gso_) {
+        // The kernel or the network interface does not support GSO.
+        if (!config.quiet) {
+          std::cerr << "GSO is not available: " << strerror(errno)
+                    << std::endl;
+        }
+        gso_ = false;
+        batch.clear();
+        batch.add(remote_addr, sendbuf, gso_);
+        continue;
+      }
+      break;
+    }
+
+    std::cerr << "sendmmsg: " << strerror(errno) << std::endl;
+    return NETWORK_ERR_SEND_FATAL;
+  }
+
+  return NETWORK_ERR_OK;
+}
+
+HandshakeWorkerPool *Server::handshake_worker_pool() const {
+  return hs_pool_.get();
+}
+
+void Server::on_tls_handshake_done(Handler *h) {
+  auto it = orphans_.find(h);
+  if (it != std::end(orphans_)) {
+    orphans_.erase(it);
+    return;
+  }
+
+  auto rv = h->on_tls_handshake_done();
+  switch (rv) {
+  case 0:
+    return;
+  case NETWORK_ERR_CLOSE_WAIT:
+    drain(h);
+    return;
+  case NETWORK_ERR_SEND_NON_FATAL:
+    block_write(h);
+    return;
+  default:
+    remove(h);
+  }
+}
+
+void Server::discard(std::unique_ptr<Handler> h) {
+  // A handshake worker might still use h.
+  if (hs_pool_ && h->handshake_pending()) {
+    h->orphan();
+    auto p = h.get();
+    orphans_.emplace(p, std::move(h));
+  }
+}
+
 void Server::remove(const Handler *h) {
+  // h is no longer in handlers_, and ctos_ might map its client
+  // connection ID to a new Handler.
+  if (h->orphaned()) {
+    return;
+  }
+
   ctos_.erase(h->client_conn_id());
-  handlers_.erase(h->conn_id());
+
+  auto conn_id = h->conn_id();
+  auto hp = handlers_.find(conn_id);
+  if (hp == nullptr) {
+    return;
+  }
+
+  discard(std::move(*hp));
+  handlers_.erase(conn_id);
+}
+
+void Server::drain(Handler *h) {
+  auto conn_id = h->conn_id();
+  auto client_conn_id = h->client_conn_id();
+  auto cc = std::make_unique<ClosedConnection>(this, conn_id, client_conn_id,
+                                               h->remote_addr());
+
+  auto buf = h->conn_closebuf();
+  if (buf) {
+    cc->pkt.assign(buf->rpos(), buf->rpos() + buf->size());
+  }
+
+  start_timer(&cc->timer, util::timestamp() + DRAINING_PERIOD);
+
+  remove(h);
+
+  closed_conns_.emplace(conn_id, std::move(cc));
+  // Client might still send packets to its initial connection ID.
+  ctos_.emplace(client_conn_id, conn_id);
+}
+
+void Server::send_conn_close(ClosedConnection &cc) {
+  if (cc.pkt.empty()) {
+    return;
+  }
+
+  ++cc.nrecv;
+
+  // Exponential backoff.
+  if (cc.nrecv & (cc.nrecv - 1)) {
+    return;
+  }
+
+  auto now = util::timestamp();
+  auto n = (now - cc.token_ts) / CONN_CLOSE_TOKEN_INTERVAL;
+  if (n) {
+    cc.tokens = std::min(cc.tokens + static_cast<size_t>(n),
+                         MAX_CONN_CLOSE_TOKENS);
+    cc.token_ts += n * CONN_CLOSE_TOKEN_INTERVAL;
+  }
+
+  if (cc.tokens == 0) {
+    return;
+  }
+
+  --cc.tokens;
+
+  if (!config.quiet) {
+    debug::print_timestamp();
+    std::cerr << "Draining Period: TX CONNECTION_CLOSE" << std::endl;
+  }
+
+  // A lost CONNECTION_CLOSE is not retransmitted.  The next packet
+  // from the remote endpoint triggers another one.
+  auto buf = Buffer{cc.pkt.data(), cc.pkt.data() + cc.pkt.size()};
+  send_packet(cc.remote_addr, buf);
 }
 
-std::map<uint64_t, std::unique_ptr<Handler>>::const_iterator Server::remove(
-    std::map<uint64_t, std::unique_ptr<Handler>>::const_iterator it) {
-  ctos_.erase((*it).second->client_conn_id());
-  return handlers_.erase(it);
+void Server::remove_closed_conn(uint64_t conn_id) {
+  auto cc = closed_conns_.find(conn_id);
+  if (cc == nullptr) {
+    return;
+  }
+
+  ctos_.erase((*cc)->client_conn_id);
+  closed_conns_.erase(conn_id);
 }
 
 void Server::start_wev() { ev_io_start(loop_, &wev_); }
 
+void Server::start_timer(TimerWheel::Timer *t, ngtcp2_tstamp expiry) {
+  timer_wheel_.start(t, expiry, util::timestamp());
+
+  if (expiry < timer_expiry_) {
+    update_timer();
+  }
+}
+
+void Server::stop_timer(TimerWheel::Timer *t) { timer_wheel_.stop(t); }
+
+void Server::on_timer() {
+  timer_expiry_ = std::numeric_limits<ngtcp2_tstamp>::max();
+
+  timer_wheel_.expire(util::timestamp());
+
+  update_timer();
+}
+
+void Server::update_timer() {
+  ev_timer_stop(loop_, &timerev_);
+
+  timer_expiry_ = timer_wheel_.next_expiry();
+  if (timer_expiry_ == std::numeric_limits<ngtcp2_tstamp>::max()) {
+    return;
+  }
+
+  auto now = util::timestamp();
+  ev_tstamp t = 0.;
+  if (timer_expiry_ > now) {
+    t = static_cast<ev_tstamp>(timer_expiry_ - now) / 1000000;
+  }
+  ev_timer_set(&timerev_, t, 0.);
+  ev_timer_start(loop_, &timerev_);
+}
+
+std::array<uint8_t, 64_k> &Server::decrypt_buf() { return decrypt_buf_; }
+
 namespace {
 int alpn_select_proto_cb(SSL *ssl, const unsigned char **out,
                          unsigned char *outlen, const unsigned char *in,
                          unsigned int inlen, void *arg) {
   auto h = static_cast<Handler *>(SSL_get_app_data(ssl));
+  if (h == nullptr) {
+    // Server::verify_client_initial only verifies cookie.
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+
   const uint8_t *alpn;
   size_t alpnlen;
   auto version = ngtcp2_conn_negotiated_version(h->conn());
@@ -1802,6 +3181,10 @@ int transport_params_add_cb(SSL *ssl, unsigned int ext_type,
                             void *add_arg) {
   int rv;
   auto h = static_cast<Handler *>(SSL_get_app_data(ssl));
+  if (h == nullptr) {
+    return 0;
+  }
+
   auto conn = h->conn();
 
   ngtcp2_transport_params params;
@@ -1855,6 +3238,12 @@ int transport_params_parse_cb(SSL *ssl, unsigned int ext_type,
   }
 
   auto h = static_cast<Handler *>(SSL_get_app_data(ssl));
+  if (h == nullptr) {
+    // Transport parameters are processed when a client comes back
+    // with a valid cookie.
+    return 1;
+  }
+
   auto conn = h->conn();
 
   int rv;
@@ -1888,6 +3277,41 @@ int transport_params_parse_cb(SSL *ssl, unsigned int ext_type,
 }
 } // namespace
 
+namespace {
+uint64_t cookie_now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+} // namespace
+
+namespace {
+int generate_cookie_cb(SSL *ssl, unsigned char *cookie, size_t *cookie_len) {
+  auto addr =
+      static_cast<const Address *>(SSL_get_ex_data(ssl, remote_addr_index));
+
+  if (generate_cookie(cookie, cookie_secret.data(), cookie_secret.size(),
+                      *addr, cookie_now()) != 0) {
+    return 0;
+  }
+
+  *cookie_len = COOKIE_LEN;
+
+  return 1;
+}
+} // namespace
+
+namespace {
+int verify_cookie_cb(SSL *ssl, const unsigned char *cookie,
+                     size_t cookie_len) {
+  auto addr =
+      static_cast<const Address *>(SSL_get_ex_data(ssl, remote_addr_index));
+
+  return verify_cookie(cookie, cookie_len, cookie_secret.data(),
+                       cookie_secret.size(), *addr, cookie_now());
+}
+} // namespace
+
 namespace {
 SSL_CTX *create_ssl_ctx(const char *private_key_file, const char *cert_file) {
   auto ssl_ctx = SSL_CTX_new(TLS_method());
@@ -1916,6 +3340,17 @@ SSL_CTX *create_ssl_ctx(const char *private_key_file, const char *cert_file) {
 
   SSL_CTX_set_alpn_select_cb(ssl_ctx, alpn_select_proto_cb, nullptr);
 
+  if (RAND_bytes(cookie_secret.data(), cookie_secret.size()) != 1) {
+    std::cerr << "RAND_bytes failed" << std::endl;
+    goto fail;
+  }
+
+  remote_addr_index =
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+
+  SSL_CTX_set_stateless_cookie_generate_cb(ssl_ctx, generate_cookie_cb);
+  SSL_CTX_set_stateless_cookie_verify_cb(ssl_ctx, verify_cookie_cb);
+
   SSL_CTX_set_default_verify_paths(ssl_ctx);
 
   if (SSL_CTX_use_PrivateKey_file(ssl_ctx, private_key_file,
@@ -1996,6 +3431,15 @@ int create_sock(const char *addr, const char *port, int family) {
       }
     }
 
+    // Each worker binds its own socket to the same address, and the
+    // kernel distributes datagrams among them.
+    if (config.workers > 1 &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val,
+                   static_cast<socklen_t>(sizeof(val))) == -1) {
+      close(fd);
+      continue;
+    }
+
     if (bind(fd, rp->ai_addr, rp->ai_addrlen) != -1) {
       break;
     }
@@ -2041,6 +3485,25 @@ void close(Server &s) {
 }
 }
 
+namespace {
+void stopcb(struct ev_loop *loop, ev_async *w, int revents) {
+  ev_break(loop, EVBREAK_ALL);
+}
+} // namespace
+
+namespace {
+// Worker is a thread which runs its own event loop, and Servers which
+// serve IPv4 and IPv6 respectively.
+struct Worker {
+  struct ev_loop *loop;
+  std::unique_ptr<Server> s4;
+  std::unique_ptr<Server> s6;
+  // stopev is used by the first worker to stop this worker.
+  ev_async stopev;
+  std::thread thread;
+};
+} // namespace
+
 namespace {
 void print_usage() {
   std::cerr << "Usage: server [OPTIONS] <ADDR> <PORT> <PRIVATE_KEY_FILE> "
@@ -2058,6 +3521,8 @@ void config_set_default(Config &config) {
                    "CHACHA20-POLY1305-SHA256";
   config.groups = "P-256:X25519:P-384:P-521";
   config.timeout = 30;
+  config.stateless_retry_rate = 100;
+  config.workers = 1;
   {
     auto path = realpath(".", nullptr);
     config.htdocs = path;
@@ -2104,6 +3569,32 @@ Options:
               Specify idle timeout in seconds.
               Default: )"
             << config.timeout << R"(
+  --handshake-workers=<N>
+              Run TLS  handshake in  <N> worker threads  so that  it
+              does not block the event loop.  0 runs TLS handshake in
+              the event loop.
+              Default: )"
+            << config.handshake_workers << R"(
+  --no-gso    Disable UDP generic segmentation offload, and send
+              packets with sendmmsg.
+  --stateless-retry-rate=<N>
+              Answer Client Initial packets  with Server Stateless
+              Retry if  more than <N>  Client Initial packets  for
+              new connections are received in a second.  A client
+              must then  come back  with the  cookie to  prove its
+              address before  any connection state  is created.  0
+              always requires the cookie.
+              Default: )"
+            << config.stateless_retry_rate << R"(
+  --workers=<N>
+              Run <N>  worker threads, each of  which has its  own
+              event loop and socket bound with SO_REUSEPORT.  Packets
+              which arrive at the  worker which does not serve their
+              connection are forwarded to the right one.  <N> must be
+              [1, )"
+            << MAX_WORKERS << R"(], inclusive.
+              Default: )"
+            << config.workers << R"(
   -h, --help  Display this help and exit.
 )";
 }
@@ -2123,6 +3614,10 @@ int main(int argc, char **argv) {
         {"ciphers", required_argument, &flag, 1},
         {"groups", required_argument, &flag, 2},
         {"timeout", required_argument, &flag, 3},
+        {"handshake-workers", required_argument, &flag, 4},
+        {"stateless-retry-rate", required_argument, &flag, 5},
+        {"no-gso", no_argument, &flag, 6},
+        {"workers", required_argument, &flag, 7},
         {nullptr, 0, nullptr, 0}};
 
     auto optidx = 0;
@@ -2175,6 +3670,27 @@ int main(int argc, char **argv) {
         // --timeout
         config.timeout = strtol(optarg, nullptr, 10);
         break;
+      case 4:
+        // --handshake-workers
+        config.handshake_workers = strtoul(optarg, nullptr, 10);
+        break;
+      case 5:
+        // --stateless-retry-rate
+        config.stateless_retry_rate = strtoul(optarg, nullptr, 10);
+        break;
+      case 6:
+        // --no-gso
+        config.no_gso = true;
+        break;
+      case 7:
+        // --workers
+        config.workers = strtoul(optarg, nullptr, 10);
+        if (config.workers == 0 || config.workers > MAX_WORKERS) {
+          std::cerr << "workers: must be in [1, " << MAX_WORKERS << "]"
+                    << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        break;
       }
       break;
     default:
@@ -2205,6 +3721,13 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
+  if (crypto::prepare_cleartext_salt(
+          reinterpret_cast<const uint8_t *>(NGTCP2_QUIC_V1_SALT),
+          str_size(NGTCP2_QUIC_V1_SALT)) != 0) {
+    std::cerr << "crypto::prepare_cleartext_salt() failed" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
   if (config.htdocs.back() != '/') {
     config.htdocs += '/';
   }
@@ -2221,19 +3744,53 @@ int main(int argc, char **argv) {
     debug::set_color_output(true);
   }
 
+  std::vector<Worker> workers(config.workers);
+  std::vector<Server *> peers4, peers6;
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    auto &w = workers[i];
+    w.loop = i == 0 ? EV_DEFAULT : ev_loop_new(0);
+    if (w.loop == nullptr) {
+      std::cerr << "ev_loop_new() failed" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    w.s4 = std::make_unique<Server>(w.loop, ssl_ctx);
+    w.s6 = std::make_unique<Server>(w.loop, ssl_ctx);
+    peers4.push_back(w.s4.get());
+    peers6.push_back(w.s6.get());
+  }
+
+  auto workers_d = defer([&workers]() {
+    for (auto it = workers.rbegin(); it != workers.rend(); ++it) {
+      auto &w = *it;
+      w.s6.reset();
+      w.s4.reset();
+      if (w.loop && w.loop != EV_DEFAULT) {
+        ev_loop_destroy(w.loop);
+      }
+    }
+  });
+
   auto ready = false;
 
-  Server s4(EV_DEFAULT, ssl_ctx);
-  if (!util::numeric_host(addr, AF_INET6)) {
-    if (serve(s4, addr, port, AF_INET) == 0) {
-      ready = true;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    auto &w = workers[i];
+
+    if (workers.size() > 1 && (w.s4->set_worker(i, &peers4) != 0 ||
+                               w.s6->set_worker(i, &peers6) != 0)) {
+      exit(EXIT_FAILURE);
+    }
+
+    if (!util::numeric_host(addr, AF_INET6)) {
+      if (serve(*w.s4, addr, port, AF_INET) == 0) {
+        ready = true;
+      }
     }
-  }
 
-  Server s6(EV_DEFAULT, ssl_ctx);
-  if (!util::numeric_host(addr, AF_INET)) {
-    if (serve(s6, addr, port, AF_INET6) == 0) {
-      ready = true;
+    if (!util::numeric_host(addr, AF_INET)) {
+      if (serve(*w.s6, addr, port, AF_INET6) == 0) {
+        ready = true;
+      }
     }
   }
 
@@ -2241,10 +3798,26 @@ int main(int argc, char **argv) {
     exit(EXIT_FAILURE);
   }
 
+  for (size_t i = 1; i < workers.size(); ++i) {
+    auto &w = workers[i];
+    ev_async_init(&w.stopev, stopcb);
+    ev_async_start(w.loop, &w.stopev);
+    w.thread = std::thread([&w]() { ev_run(w.loop, 0); });
+  }
+
   ev_run(EV_DEFAULT, 0);
 
-  close(s6);
-  close(s4);
+  for (size_t i = 1; i < workers.size(); ++i) {
+    auto &w = workers[i];
+    ev_async_send(w.loop, &w.stopev);
+    w.thread.join();
+    ev_async_stop(w.loop, &w.stopev);
+  }
+
+  for (auto &w : workers) {
+    close(*w.s6);
+    close(*w.s4);
+  }
 
   return EXIT_SUCCESS;
 }
@@ -30,9 +30,14 @@
 #endif // HAVE_CONFIG_H
 
 #include <vector>
+#include <array>
 #include <deque>
 #include <map>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
 
 #include <ngtcp2/ngtcp2.h>
 
@@ -43,6 +48,10 @@
 #include "network.h"
 #include "crypto.h"
 #include "template.h"
+#include "mpsc_queue.h"
+#include "conn_id_map.h"
+#include "timer_wheel.h"
+#include "send_batch.h"
 
 using namespace ngtcp2;
 
@@ -65,6 +74,23 @@ struct Config {
   bool quiet;
   // timeout is an idle timeout for QUIC connection.
   uint32_t timeout;
+  // handshake_workers is the number of threads which run TLS
+  // handshake off the event loop.  If it is 0, TLS handshake is done
+  // in the event loop.
+  size_t handshake_workers;
+  // no_gso disables UDP generic segmentation offload.  If it is
+  // true, or the kernel does not support it, packets are sent by
+  // sendmmsg.
+  bool no_gso;
+  // stateless_retry_rate is the number of Client Initial packets for
+  // new connections per second above which the server requires a
+  // client to return a cookie with Server Stateless Retry before
+  // creating a Handler.
+  size_t stateless_retry_rate;
+  // workers is the number of threads which run their own event loop
+  // and socket bound with SO_REUSEPORT.  A connection is served by
+  // the worker which accepted its Client Initial packet.
+  size_t workers;
 };
 
 struct Buffer {
@@ -95,6 +121,14 @@ struct Buffer {
   uint8_t *tail;
 };
 
+// MAX_SENDBUF_POOL is the maximum number of free SendBuffers which
+// Server keeps for reuse.
+constexpr size_t MAX_SENDBUF_POOL = 32;
+
+// WRITE_QUANTUM is the maximum number of packets which a connection
+// writes in its turn when the socket becomes writable after EAGAIN.
+constexpr size_t WRITE_QUANTUM = MAX_SEND_PKTS;
+
 enum {
   RESP_IDLE,
   RESP_STARTED,
@@ -126,6 +160,11 @@ struct Stream {
   // should_send_fin tells that fin should be sent after currently
   // buffered data is sent.  After sending fin, it is set to false.
   bool should_send_fin;
+  // blocked is true if the stream cannot send data until the library
+  // reports it writable by ngtcp2_conn_pop_writable_stream.
+  bool blocked;
+  // in_sendq is true if stream_id is in Handler::sendq_.
+  bool in_sendq;
   // resp_state is the state of response.
   int resp_state;
   http_parser htp;
@@ -158,12 +197,54 @@ public:
   int init(int fd, const sockaddr *sa, socklen_t salen, uint32_t version);
 
   int tls_handshake();
+  // do_tls_handshake runs SSL_do_handshake.  It returns 1 if TLS
+  // handshake has completed, 0 if it needs more data, or -1.  It may
+  // be called from a handshake worker thread.
+  int do_tls_handshake();
+  int finish_tls_handshake(int rv);
+  // on_tls_handshake_done is called in the event loop when a
+  // handshake worker has finished do_tls_handshake.
+  int on_tls_handshake_done();
+  bool handshake_pending() const;
+  // orphan stops timers and cancels writes of this Handler, which
+  // is removed while a handshake worker still uses it.
+  void orphan();
+  bool orphaned() const;
+  void set_tls_handshake_result(int rv);
   int on_read(uint8_t *data, size_t datalen);
-  int on_write();
+  // on_write writes at most |quantum| packets, and returns
+  // NETWORK_ERR_SEND_YIELD if it has written that many.  The packets
+  // which are not sent yet are left in sendbuf_ for the caller to
+  // send.
+  int on_write(size_t quantum = std::numeric_limits<size_t>::max());
+  // send_packets sends the packets left in sendbuf_.
+  int send_packets();
   int on_write_stream(Stream &stream);
+  void schedule_stream(Stream &stream);
   int write_stream_data(Stream &stream, int fin, Buffer &data);
+  // push_pkt adds a packet of length |n| written at sendbuf_.wpos() to
+  // sendbuf_, and sends the buffered packets if sendbuf_ is full.
+  int push_pkt(size_t n);
+  // acquire_sendbuf borrows a SendBuffer from Server unless sendbuf_
+  // is already there.
+  void acquire_sendbuf();
+  // release_sendbuf returns sendbuf_ to Server if it has no packet
+  // left to send.
+  void release_sendbuf();
+  // sendbuf returns sendbuf_, which may be nullptr.
+  SendBuffer *sendbuf() const;
   int feed_data(uint8_t *data, size_t datalen);
   void schedule_retransmit();
+  // reset_idle_timer restarts the idle timer.
+  void reset_idle_timer();
+  // dirty returns true if this Handler is in
+  // Server::dirty_handlers_.
+  bool dirty() const;
+  void set_dirty(bool dirty);
+  // blocked returns true if this Handler is in
+  // Server::blocked_handlers_.
+  bool blocked() const;
+  void set_blocked(bool blocked);
   void signal_write();
 
   int write_server_handshake(const uint8_t *data, size_t datalen);
@@ -174,22 +255,22 @@ public:
 
   int recv_client_initial(uint64_t conn_id);
   int setup_crypto_context();
+  int prepare_next_keys();
+  int update_key();
   ssize_t hs_encrypt_data(uint8_t *dest, size_t destlen,
                           const uint8_t *plaintext, size_t plaintextlen,
-                          const uint8_t *key, size_t keylen,
-                          const uint8_t *nonce, size_t noncelen,
+                          void *aead_ctx, const uint8_t *nonce, size_t noncelen,
                           const uint8_t *ad, size_t adlen);
   ssize_t hs_decrypt_data(uint8_t *dest, size_t destlen,
                           const uint8_t *ciphertext, size_t ciphertextlen,
-                          const uint8_t *key, size_t keylen,
-                          const uint8_t *nonce, size_t noncelen,
+                          void *aead_ctx, const uint8_t *nonce, size_t noncelen,
                           const uint8_t *ad, size_t adlen);
   ssize_t encrypt_data(uint8_t *dest, size_t destlen, const uint8_t *plaintext,
-                       size_t plaintextlen, const uint8_t *key, size_t keylen,
+                       size_t plaintextlen, void *aead_ctx,
                        const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
                        size_t adlen);
   ssize_t decrypt_data(uint8_t *dest, size_t destlen, const uint8_t *ciphertext,
-                       size_t ciphertextlen, const uint8_t *key, size_t keylen,
+                       size_t ciphertextlen, void *aead_ctx,
                        const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
                        size_t adlen);
   Server *server() const;
@@ -199,6 +280,10 @@ public:
                        size_t datalen);
   uint64_t conn_id() const;
   uint64_t client_conn_id() const;
+  // conn_closebuf returns the packet which contains
+  // CONNECTION_CLOSE, or nullptr if it has not been written because
+  // the remote endpoint closed the connection.
+  const Buffer *conn_closebuf() const;
   uint32_t version() const;
   int remove_tx_stream_data(uint32_t stream_id, uint64_t offset,
                             size_t datalen);
@@ -215,8 +300,11 @@ private:
   SSL *ssl_;
   Server *server_;
   int fd_;
-  ev_timer timer_;
-  ev_timer rttimer_;
+  // timer_ is the idle timer, which expires idle_timeout_ after the
+  // last packet is received.
+  TimerWheel::Timer timer_;
+  TimerWheel::Timer rttimer_;
+  ngtcp2_tstamp idle_timeout_;
   std::vector<uint8_t> chandshake_;
   size_t ncread_;
   std::deque<Buffer> shandshake_;
@@ -227,8 +315,16 @@ private:
   crypto::Context hs_crypto_ctx_;
   crypto::Context crypto_ctx_;
   std::map<uint32_t, std::unique_ptr<Stream>> streams_;
-  // common buffer used to store packet data before sending
-  Buffer sendbuf_;
+  // sendq_ contains the IDs of streams which have data to send, and
+  // are not blocked by flow control.  on_write only visits these
+  // streams instead of all streams in streams_.
+  std::deque<uint32_t> sendq_;
+  // sendbuf_ accumulates packets written in on_write so that they
+  // are sent together, and with the packets of other connections
+  // written in the same loop iteration.  It is borrowed from
+  // Server only while there are packets to send, and is nullptr
+  // otherwise.
+  std::unique_ptr<SendBuffer> sendbuf_;
   // conn_closebuf_ contains a packet which contains CONNECTION_CLOSE.
   // This packet is repeatedly sent as a response to the incoming
   // packet in draining period.
@@ -238,6 +334,122 @@ private:
   // tx_stream0_offset_ is the offset where all data before offset is
   // acked by the remote endpoint.
   uint64_t tx_stream0_offset_;
+  // pending_pkts_ contains packets received while TLS handshake is
+  // running on a handshake worker.  conn_ and ssl_ must not be
+  // touched in the meantime.
+  std::deque<Buffer> pending_pkts_;
+  // hs_result_ is the return value of do_tls_handshake run by a
+  // handshake worker.
+  int hs_result_;
+  // quantum_ is the number of packets which on_write may still write.
+  size_t quantum_;
+  // hs_pending_ is true if TLS handshake should be, or is being run
+  // by a handshake worker.
+  bool hs_pending_;
+  // orphaned_ is true if this Handler is in Server::orphans_.
+  bool orphaned_;
+  bool dirty_;
+  bool blocked_;
+};
+
+// HandshakeWorkerPool runs TLS handshake of Handler in worker
+// threads so that expensive public key operations do not block the
+// event loop.
+class HandshakeWorkerPool {
+public:
+  HandshakeWorkerPool(struct ev_loop *loop, Server *server, size_t nworkers);
+  ~HandshakeWorkerPool();
+
+  // submit queues |h| to run its TLS handshake.  It returns false if
+  // the queue is full.
+  bool submit(Handler *h);
+  void on_done();
+
+private:
+  void run();
+
+  struct ev_loop *loop_;
+  Server *server_;
+  ev_async doneev_;
+  std::mutex mu_;
+  std::condition_variable cv_;
+  // jobq_ contains Handlers waiting for a worker.
+  std::deque<Handler *> jobq_;
+  // doneq_ contains Handlers whose TLS handshake has been run.
+  std::deque<Handler *> doneq_;
+  std::vector<std::thread> workers_;
+  size_t max_jobs_;
+  bool shutdown_;
+};
+
+// RECV_BATCH is the maximum number of datagrams which
+// Server::recv_pkts reads at once.
+constexpr size_t RECV_BATCH = 32;
+// MAX_RECV_BATCHES is the maximum number of batches Server::on_read
+// reads before it returns to the event loop, so that Handlers can
+// write while datagrams keep arriving.
+constexpr size_t MAX_RECV_BATCHES = 8;
+
+// RxPacket is a preallocated buffer which a datagram is received
+// into.
+struct RxPacket {
+  std::array<uint8_t, 64_k> buf;
+  // pktlen is the length of the datagram received in buf.
+  size_t pktlen;
+  // remote_addr is the address which the datagram is received from.
+  Address remote_addr;
+};
+
+// MAX_WORKERS is the maximum number of workers.  The index of worker
+// is encoded in the most significant 8 bits of server chosen
+// connection ID.
+constexpr size_t MAX_WORKERS = 256;
+constexpr size_t WORKER_ID_SHIFT = 56;
+
+// FORWARD_QUEUE_SIZE is the number of datagrams which other workers
+// can forward to a worker without being dropped.  It is also the
+// number of buffers each worker has to copy datagrams to forward.
+constexpr size_t FORWARD_QUEUE_SIZE = 1024;
+// FORWARD_BUFLEN is the length of buffer which a forwarded datagram
+// is copied into.  A longer datagram is dropped.
+constexpr size_t FORWARD_BUFLEN = 2_k;
+
+// ForwardedPacket describes a datagram which is received by one
+// worker, and is forwarded to the worker which serves its connection.
+// data is taken from pool of the worker which received it, and the
+// receiving worker returns it after processing.
+struct ForwardedPacket {
+  uint8_t *data;
+  size_t datalen;
+  Address remote_addr;
+  BufferPool *pool;
+};
+
+// ClosedConnection is what is kept for a connection in draining
+// period.  Handler, and its ngtcp2_conn and SSL are deleted as soon
+// as the connection is closed, and only the packet which contains
+// CONNECTION_CLOSE is kept to send in response to incoming packets.
+struct ClosedConnection {
+  ClosedConnection(Server *server, uint64_t conn_id,
+                   uint64_t client_conn_id, const Address &remote_addr);
+  ~ClosedConnection();
+
+  Server *server;
+  uint64_t conn_id;
+  uint64_t client_conn_id;
+  Address remote_addr;
+  // pkt is the packet which contains CONNECTION_CLOSE.  It is empty
+  // if the remote endpoint closed the connection, and incoming
+  // packets are silently dropped.
+  std::vector<uint8_t> pkt;
+  // timer expires when draining period is over.
+  TimerWheel::Timer timer;
+  // nrecv is the number of packets received in draining period.
+  size_t nrecv;
+  // tokens is the number of CONNECTION_CLOSE which can be sent now.
+  size_t tokens;
+  // token_ts is the time when tokens was last refilled.
+  ngtcp2_tstamp token_ts;
 };
 
 class Server {
@@ -245,31 +457,182 @@ public:
   Server(struct ev_loop *loop, SSL_CTX *ssl_ctx);
   ~Server();
 
+  // set_worker tells Server that it runs in the worker |worker_id|.
+  // |peers| is the list of Servers of the same address family indexed
+  // by the worker index.  It must be called before init.  It returns
+  // 0 if it succeeds, or -1.
+  int set_worker(size_t worker_id, const std::vector<Server *> *peers);
   int init(int fd);
   void disconnect();
   void disconnect(int liberr);
   void close();
 
-  int on_write();
+  // on_write gives the Handlers in blocked_handlers_ a turn to write
+  // when the socket becomes writable.
+  void on_write();
+  // on_read reads datagrams until the socket is drained or
+  // MAX_RECV_BATCHES batches are read, and feeds them to Handlers.
+  // The Handlers which received datagrams write packets when the
+  // event loop is about to block.
   int on_read();
+  // recv_pkts reads up to RECV_BATCH datagrams into rx_pkts_, and
+  // returns the number of datagrams read.
+  size_t recv_pkts();
+  // on_pkt processes a datagram |data| of length |datalen| from
+  // |remote_addr| which does not belong to the same connection as
+  // the previous datagram in the batch.  |hd| is its decoded header,
+  // and |hdlen| is the length of the header.  It returns the Handler
+  // which the datagram is fed to, or nullptr.
+  Handler *on_pkt(uint8_t *data, size_t datalen, const Address &remote_addr,
+                  const ngtcp2_pkt_hd &hd, size_t hdlen);
+  // schedule_write adds |h| to dirty_handlers_ unless it is already
+  // there.
+  void schedule_write(Handler *h);
+  // block_write adds |h| to blocked_handlers_ unless it is already
+  // there, and waits for the socket to become writable.
+  void block_write(Handler *h);
+  // cancel_write removes |h| from dirty_handlers_ and
+  // blocked_handlers_.
+  void cancel_write(const Handler *h);
+  // get_sendbuf returns a SendBuffer from sendbuf_pool_, or a new one
+  // if the pool is empty.
+  std::unique_ptr<SendBuffer> get_sendbuf();
+  // put_sendbuf returns |sendbuf| to sendbuf_pool_.
+  void put_sendbuf(std::unique_ptr<SendBuffer> sendbuf);
+  // write_dirty_handlers calls Handler::on_write for each Handler in
+  // dirty_handlers_, and sends the packets they have written by
+  // send_queued_packets.  It is called from ev_prepare watcher.
+  void write_dirty_handlers();
+  // queue_packets adds the packets which |h| has left in its
+  // SendBuffer to tx_batch_.  If tx_batch_ is full, it is sent first.
+  void queue_packets(Handler *h);
+  // send_queued_packets sends tx_batch_.  The Handlers whose packets
+  // could not be sent because the socket is congested wait for it to
+  // become writable.
+  void send_queued_packets();
+  // generate_conn_id returns a new server chosen connection ID which
+  // has the index of this worker.
+  uint64_t generate_conn_id();
+  // forward passes a datagram to the Server in the worker |worker_id|.
+  // The datagram is dropped if no buffer is available, or the queue of
+  // the worker is full.
+  void forward(size_t worker_id, const uint8_t *data, size_t datalen,
+               const Address &remote_addr);
+  // on_forward processes the datagrams forwarded by other workers.
+  void on_forward();
   int send_version_negotiation(const ngtcp2_pkt_hd *hd, const sockaddr *sa,
                                socklen_t salen);
+  // stateless_retry_required counts a Client Initial packet for a
+  // new connection, and returns true if the rate exceeds
+  // config.stateless_retry_rate.
+  bool stateless_retry_required();
+  // verify_client_initial checks that ClientHello in Client Initial
+  // packet |data| of length |datalen| has a valid cookie.  |chd| is
+  // its header, and |chdlen| is the length of header.  If it has no
+  // valid cookie, Server Stateless Retry is sent to |sa|.  This
+  // function returns 1 if the cookie is valid, 0 if Server Stateless
+  // Retry is sent, or -1.
+  int verify_client_initial(const ngtcp2_pkt_hd *chd, size_t chdlen,
+                            const uint8_t *data, size_t datalen,
+                            const sockaddr *sa, socklen_t salen);
   int send_packet(Address &remote_addr, Buffer &buf);
+  // send_packets sends the packets in |sendbuf| to |remote_addr| by
+  // SendBatch.  The packets which are sent are removed from
+  // |sendbuf|.
+  int send_packets(const Address &remote_addr, SendBuffer &sendbuf);
+  HandshakeWorkerPool *handshake_worker_pool() const;
+  void on_tls_handshake_done(Handler *h);
+  void discard(std::unique_ptr<Handler> h);
   void remove(const Handler *h);
-  std::map<uint64_t, std::unique_ptr<Handler>>::const_iterator
-  remove(std::map<uint64_t, std::unique_ptr<Handler>>::const_iterator it);
+  // drain moves |h|, whose connection has entered draining period, to
+  // closed_conns_, and deletes |h|.
+  void drain(Handler *h);
+  // send_conn_close sends CONNECTION_CLOSE of |cc| in response to an
+  // incoming packet.  It responds to the 1st, 2nd, 4th, 8th, and so
+  // on, of the incoming packets as long as |cc| has a token.
+  void send_conn_close(ClosedConnection &cc);
+  void remove_closed_conn(uint64_t conn_id);
   void start_wev();
+  std::array<uint8_t, 64_k> &decrypt_buf();
+  // start_timer schedules |t| to expire at |expiry| on timer_wheel_.
+  void start_timer(TimerWheel::Timer *t, ngtcp2_tstamp expiry);
+  void stop_timer(TimerWheel::Timer *t);
+  // on_timer runs the timers in timer_wheel_ which have expired.
+  void on_timer();
+  // update_timer arms timerev_ for the next tick of timer_wheel_.
+  void update_timer();
 
 private:
-  std::map<uint64_t, std::unique_ptr<Handler>> handlers_;
+  // decrypt_buf_ is shared by all connections to write decrypted
+  // packet payload.
+  std::array<uint8_t, 64_k> decrypt_buf_;
+  // timer_wheel_ has the idle and retransmission timers of all
+  // Handlers.  A single ev_timer, timerev_, drives it.  It must
+  // outlive Handlers.
+  TimerWheel timer_wheel_;
+  // timer_expiry_ is the time timerev_ is armed for.
+  ngtcp2_tstamp timer_expiry_;
+  // sendbuf_pool_ keeps free SendBuffers which Handlers borrow while
+  // they have packets to send.  Most connections are idle most of
+  // the time, and do not hold one.  It must outlive Handlers.
+  std::vector<std::unique_ptr<SendBuffer>> sendbuf_pool_;
+  // rx_pkts_ is the ring of buffers which incoming datagrams are read
+  // into.  It is reused for each batch.
+  std::vector<RxPacket> rx_pkts_;
+  // dirty_handlers_ contains Handlers which have received datagrams,
+  // or whose retransmission timer has expired, in this iteration of
+  // the event loop, and have not written packets yet.  They write
+  // once before the loop blocks, so that ACKs and stream data for a
+  // burst of datagrams are coalesced into fewer packets.
+  std::vector<Handler *> dirty_handlers_;
+  // blocked_handlers_ contains Handlers which have packets to write
+  // while the socket is congested, in FIFO order.  Only these are
+  // visited when the socket becomes writable.  While it is not empty,
+  // dirty Handlers join it instead of writing packets.
+  std::deque<Handler *> blocked_handlers_;
+  // tx_batch_ contains the packets of tx_handlers_, which are sent
+  // by a single sendmmsg.  Both are filled and emptied within
+  // write_dirty_handlers, so no Handler in tx_handlers_ is deleted
+  // meanwhile.
+  SendBatch tx_batch_;
+  std::vector<Handler *> tx_handlers_;
+  ConnectionIDMap<std::unique_ptr<Handler>> handlers_;
+  // closed_conns_ contains connections in draining period.
+  ConnectionIDMap<std::unique_ptr<ClosedConnection>> closed_conns_;
+  // orphans_ keeps Handlers which are removed while a handshake
+  // worker still uses them.  They are deleted when the worker is
+  // done.
+  std::map<const Handler *, std::unique_ptr<Handler>> orphans_;
+  std::unique_ptr<HandshakeWorkerPool> hs_pool_;
   // ctos_ is a mapping between client's initial connection ID, and
   // server chosen connection ID.
-  std::map<uint64_t, uint64_t> ctos_;
+  ConnectionIDMap<uint64_t> ctos_;
+  // gso_ is true if UDP generic segmentation offload is used.
+  bool gso_;
+  // ninitial_ is the number of Client Initial packets for new
+  // connections received since initial_ts_.
+  size_t ninitial_;
+  ev_tstamp initial_ts_;
   struct ev_loop *loop_;
   SSL_CTX *ssl_ctx_;
   int fd_;
+  // worker_id_ is the index of the worker this Server runs in.
+  size_t worker_id_;
+  // peers_ is the list of Servers of the same address family indexed
+  // by the worker index.  It is nullptr if there is only one worker.
+  const std::vector<Server *> *peers_;
+  // fwd_pool_ is the pool of buffers which datagrams forwarded to
+  // other workers are copied into.
+  std::unique_ptr<BufferPool> fwd_pool_;
+  // fwdq_ is the queue of datagrams forwarded by other workers.
+  MPSCQueue<ForwardedPacket> fwdq_;
+  // fwd_notifier_ wakes up this worker when fwdq_ becomes non-empty.
+  QueueNotifier fwd_notifier_;
   ev_io wev_;
   ev_io rev_;
+  ev_io fwdev_;
+  ev_timer timerev_;
+  ev_prepare prepev_;
   ev_signal sigintev_;
 };
 
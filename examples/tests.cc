@@ -0,0 +1,89 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cstdio>
+
+#include <CUnit/Basic.h>
+// include test cases' include files here
+#include "mpsc_queue_test.h"
+#include "conn_id_map_test.h"
+#include "timer_wheel_test.h"
+#include "send_batch_test.h"
+#include "crypto_test.h"
+#include "cookie_test.h"
+
+static int init_suite1(void) { return 0; }
+
+static int clean_suite1(void) { return 0; }
+
+int main() {
+  CU_pSuite pSuite = nullptr;
+  unsigned int num_tests_failed;
+
+  // initialize the CUnit test registry
+  if (CUE_SUCCESS != CU_initialize_registry())
+    return CU_get_error();
+
+  // add a suite to the registry
+  pSuite = CU_add_suite("examples_TestSuite", init_suite1, clean_suite1);
+  if (nullptr == pSuite) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // add the tests to the suite
+  if (!CU_add_test(pSuite, "mpsc_queue_handoff",
+                   ngtcp2::test_mpsc_queue_handoff) ||
+      !CU_add_test(pSuite, "conn_id_map_random",
+                   ngtcp2::test_conn_id_map_random) ||
+      !CU_add_test(pSuite, "timer_wheel_random",
+                   ngtcp2::test_timer_wheel_random) ||
+      !CU_add_test(pSuite, "send_batch_gso_runs",
+                   ngtcp2::test_send_batch_gso_runs) ||
+      !CU_add_test(pSuite, "send_batch_destinations",
+                   ngtcp2::test_send_batch_destinations) ||
+      !CU_add_test(pSuite, "crypto_hkdf", ngtcp2::test_crypto_hkdf) ||
+      !CU_add_test(pSuite, "cookie_verify", ngtcp2::test_cookie_verify) ||
+      !CU_add_test(pSuite, "cookie_find_client_hello",
+                   ngtcp2::test_cookie_find_client_hello)) {
+    CU_cleanup_registry();
+    return CU_get_error();
+  }
+
+  // Run all tests using the CUnit Basic interface
+  CU_basic_set_mode(CU_BRM_VERBOSE);
+  CU_basic_run_tests();
+  num_tests_failed = CU_get_number_of_tests_failed();
+  CU_cleanup_registry();
+  if (CU_get_error() == CUE_SUCCESS) {
+    return static_cast<int>(num_tests_failed);
+  } else {
+    printf("CUnit Error: %s\n", CU_get_error_msg());
+    return CU_get_error();
+  }
+}
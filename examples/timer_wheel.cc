@@ -0,0 +1,252 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "timer_wheel.h"
+
+#include <limits>
+#include <algorithm>
+
+namespace ngtcp2 {
+
+constexpr uint64_t TimerWheel::TICK;
+constexpr size_t TimerWheel::SLOTS_BITS;
+constexpr size_t TimerWheel::SLOTS;
+constexpr size_t TimerWheel::LEVELS;
+
+namespace {
+void list_init(TimerWheel::Timer *head) { head->prev = head->next = head; }
+} // namespace
+
+namespace {
+bool list_empty(const TimerWheel::Timer *head) { return head->next == head; }
+} // namespace
+
+namespace {
+void list_push(TimerWheel::Timer *head, TimerWheel::Timer *t) {
+  t->prev = head->prev;
+  t->next = head;
+  head->prev->next = t;
+  head->prev = t;
+}
+} // namespace
+
+namespace {
+void list_remove(TimerWheel::Timer *t) {
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->prev = t->next = nullptr;
+}
+} // namespace
+
+namespace {
+// list_move moves all timers in |src| to the empty list |dest|.
+void list_move(TimerWheel::Timer *dest, TimerWheel::Timer *src) {
+  if (list_empty(src)) {
+    return;
+  }
+  dest->next = src->next;
+  dest->prev = src->prev;
+  dest->next->prev = dest;
+  dest->prev->next = dest;
+  list_init(src);
+}
+} // namespace
+
+namespace {
+uint64_t to_tick(uint64_t ts) {
+  return ts / TimerWheel::TICK + (ts % TimerWheel::TICK != 0);
+}
+} // namespace
+
+TimerWheel::Timer::Timer(Callback cb, void *data)
+    : prev(nullptr), next(nullptr), expiry(0), due(0), cb(cb), data(data) {}
+
+bool TimerWheel::Timer::active() const { return next != nullptr; }
+
+TimerWheel::TimerWheel() : bitmap_{}, cur_(0), size_(0) {
+  for (auto &level : slots_) {
+    for (auto &head : level) {
+      list_init(&head);
+    }
+  }
+}
+
+void TimerWheel::start(Timer *t, uint64_t expiry, uint64_t now) {
+  if (size_ == 0 && now / TICK > cur_) {
+    // Nothing has been processed while the wheel was empty.
+    cur_ = now / TICK;
+  }
+
+  t->expiry = expiry;
+
+  if (t->active()) {
+    if (to_tick(expiry) >= t->due) {
+      return;
+    }
+    stop(t);
+  }
+
+  insert(t);
+  ++size_;
+}
+
+void TimerWheel::stop(Timer *t) {
+  if (!t->active()) {
+    return;
+  }
+
+  auto head = t->next;
+  list_remove(t);
+  --size_;
+
+  // Clear the bit if t was the last timer in a slot of the first
+  // level.
+  if (list_empty(head) && head >= slots_[0].data() &&
+      head < slots_[0].data() + SLOTS) {
+    auto i = static_cast<size_t>(head - slots_[0].data());
+    bitmap_[i / 64] &= ~(1ULL << (i % 64));
+  }
+}
+
+void TimerWheel::insert(Timer *t) {
+  auto tick = std::max(to_tick(t->expiry), cur_);
+  auto delta = tick - cur_;
+
+  size_t level = 0;
+  for (; level < LEVELS - 1 && delta >= (1ULL << (SLOTS_BITS * (level + 1)));
+       ++level)
+    ;
+
+  if (level == LEVELS - 1) {
+    auto max_delta = (1ULL << (SLOTS_BITS * LEVELS)) - 1;
+    if (delta > max_delta) {
+      // The timer goes back to the wheel when the slot comes.
+      tick = cur_ + max_delta;
+    }
+  }
+
+  auto shift = SLOTS_BITS * level;
+  auto i = static_cast<size_t>((tick >> shift) & (SLOTS - 1));
+
+  t->due = (tick >> shift) << shift;
+  list_push(&slots_[level][i], t);
+
+  if (level == 0) {
+    bitmap_[i / 64] |= 1ULL << (i % 64);
+  }
+}
+
+void TimerWheel::cascade(size_t level) {
+  auto i = static_cast<size_t>((cur_ >> (SLOTS_BITS * level)) & (SLOTS - 1));
+  Timer head;
+
+  list_init(&head);
+  list_move(&head, &slots_[level][i]);
+
+  while (!list_empty(&head)) {
+    auto t = head.next;
+    list_remove(t);
+    insert(t);
+  }
+}
+
+void TimerWheel::expire(uint64_t now) {
+  auto last = now / TICK;
+
+  while (cur_ <= last) {
+    if (size_ == 0) {
+      cur_ = last + 1;
+      return;
+    }
+
+    auto tick = cur_;
+
+    for (auto level = LEVELS - 1; level > 0; --level) {
+      if ((tick & ((1ULL << (SLOTS_BITS * level)) - 1)) == 0) {
+        cascade(level);
+      }
+    }
+
+    auto i = static_cast<size_t>(tick & (SLOTS - 1));
+    if ((bitmap_[i / 64] & (1ULL << (i % 64))) == 0) {
+      ++cur_;
+      continue;
+    }
+
+    // Detach the slot, and advance cur_ first so that a timer which
+    // a callback schedules at or before tick goes to the next slot.
+    Timer head;
+
+    list_init(&head);
+    list_move(&head, &slots_[0][i]);
+    bitmap_[i / 64] &= ~(1ULL << (i % 64));
+
+    ++cur_;
+
+    while (!list_empty(&head)) {
+      auto t = head.next;
+      list_remove(t);
+
+      if (to_tick(t->expiry) > tick) {
+        // The timer was moved to a later time after it was put in
+        // this slot.
+        insert(t);
+        continue;
+      }
+
+      --size_;
+      t->cb(t);
+    }
+  }
+}
+
+uint64_t TimerWheel::next_expiry() const {
+  if (size_ == 0) {
+    return std::numeric_limits<uint64_t>::max();
+  }
+
+  // Timers in upper levels are moved down at the start of each
+  // block of SLOTS ticks.
+  if ((cur_ & (SLOTS - 1)) == 0) {
+    return cur_ * TICK;
+  }
+
+  // Find the first non-empty slot of the first level until the next
+  // block.
+  auto end = ((cur_ >> SLOTS_BITS) + 1) << SLOTS_BITS;
+  for (auto tick = cur_; tick < end;) {
+    auto i = static_cast<size_t>(tick & (SLOTS - 1));
+    auto word = bitmap_[i / 64] >> (i % 64);
+    if (word) {
+      return (tick + __builtin_ctzll(word)) * TICK;
+    }
+    tick += 64 - i % 64;
+  }
+
+  return end * TICK;
+}
+
+size_t TimerWheel::size() const { return size_; }
+
+} // namespace ngtcp2
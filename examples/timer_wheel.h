@@ -0,0 +1,106 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif // HAVE_CONFIG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <array>
+
+namespace ngtcp2 {
+
+// TimerWheel is a hierarchical timing wheel.  Time is given in
+// microseconds, and is rounded up to TICK.  Each of LEVELS levels has
+// SLOTS slots, and a slot of a level covers SLOTS slots of the level
+// below.  A timer which expires within SLOTS ticks is put in the
+// slot of its tick in the first level, and the others are moved down
+// a level when the slot of the upper level comes.  Scheduling and
+// stopping a timer only links and unlinks it.  If a scheduled timer
+// is moved to a later time, it is left in its slot, and is put in
+// the right one when its slot comes, so that a timer which is pushed
+// back on every packet costs no list operation.
+class TimerWheel {
+public:
+  static constexpr uint64_t TICK = 1000;
+  static constexpr size_t SLOTS_BITS = 8;
+  static constexpr size_t SLOTS = 1 << SLOTS_BITS;
+  static constexpr size_t LEVELS = 3;
+
+  struct Timer;
+
+  using Callback = void (*)(Timer *t);
+
+  // Timer is embedded in the object which owns it.  It must be
+  // stopped before it is destroyed.
+  struct Timer {
+    Timer(Callback cb = nullptr, void *data = nullptr);
+    // active returns true if the timer is scheduled.
+    bool active() const;
+
+    Timer *prev;
+    Timer *next;
+    // expiry is the time when the timer expires.
+    uint64_t expiry;
+    // due is the tick when the slot which the timer is in comes.
+    uint64_t due;
+    Callback cb;
+    void *data;
+  };
+
+  TimerWheel();
+
+  // start schedules |t| to expire at |expiry|.  If |t| is already
+  // scheduled, it is rescheduled.  |now| is the current time.
+  void start(Timer *t, uint64_t expiry, uint64_t now);
+  // stop cancels |t| if it is scheduled.
+  void stop(Timer *t);
+  // expire calls the callback of timers which expire at or before
+  // |now|.  The callbacks may start and stop any timer.
+  void expire(uint64_t now);
+  // next_expiry returns the time when expire should be called next,
+  // or UINT64_MAX if no timer is scheduled.
+  uint64_t next_expiry() const;
+  size_t size() const;
+
+private:
+  void insert(Timer *t);
+  void cascade(size_t level);
+
+  // slots_[level][i] is the sentinel of the circular list of timers.
+  std::array<std::array<Timer, SLOTS>, LEVELS> slots_;
+  // bitmap_ has a bit set for each non-empty slot of the first level.
+  std::array<uint64_t, SLOTS / 64> bitmap_;
+  // cur_ is the next tick to process.
+  uint64_t cur_;
+  size_t size_;
+};
+
+} // namespace ngtcp2
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,154 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "timer_wheel_test.h"
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include <CUnit/CUnit.h>
+
+#include "timer_wheel.h"
+
+namespace ngtcp2 {
+
+namespace {
+struct Entry {
+  Entry() : timer(nullptr, this), expiry(0), active(false) {}
+  TimerWheel::Timer timer;
+  // expiry is the time which the timer is expected to fire at.
+  uint64_t expiry;
+  bool active;
+};
+} // namespace
+
+namespace {
+TimerWheel *wheel;
+uint64_t now;
+size_t nfired;
+bool failed;
+} // namespace
+
+namespace {
+void fired(TimerWheel::Timer *t) {
+  auto e = static_cast<Entry *>(t->data);
+
+  if (!e->active || now < e->expiry || now > e->expiry + TimerWheel::TICK) {
+    CU_ASSERT(e->active);
+    CU_ASSERT(now >= e->expiry);
+    CU_ASSERT(now <= e->expiry + TimerWheel::TICK);
+    failed = true;
+  }
+
+  e->active = false;
+  ++nfired;
+
+  // Some timers are restarted from the callback, which may put them
+  // in the slot being processed.
+  if (nfired % 3 == 0) {
+    e->expiry = now + nfired % 3000;
+    e->active = true;
+    wheel->start(t, e->expiry, now);
+  }
+}
+} // namespace
+
+void test_timer_wheel_random() {
+  std::mt19937_64 gen(1);
+  TimerWheel w;
+  std::vector<Entry> entries(10000);
+
+  wheel = &w;
+  nfired = 0;
+  failed = false;
+
+  for (auto &e : entries) {
+    e.timer.cb = fired;
+  }
+
+  // Durations from sub-tick retransmission timeouts to a few hours,
+  // which goes past the span of the wheel.
+  auto duration = [&gen]() -> uint64_t {
+    switch (gen() % 4) {
+    case 0:
+      return gen() % 5000;
+    case 1:
+      return gen() % 300000;
+    case 2:
+      return gen() % 60000000;
+    default:
+      return gen() % 20000000000ULL;
+    }
+  };
+
+  now = 1000000000;
+  uint64_t end = now + 300000000000ULL;
+
+  while (now < end && !failed) {
+    for (size_t i = 0; i < 100; ++i) {
+      auto &e = entries[gen() % entries.size()];
+      if (gen() % 5 == 0) {
+        w.stop(&e.timer);
+        e.active = false;
+        continue;
+      }
+      e.expiry = now + duration();
+      e.active = true;
+      w.start(&e.timer, e.expiry, now);
+    }
+
+    size_t nactive = 0;
+    for (auto &e : entries) {
+      nactive += e.active;
+    }
+
+    CU_ASSERT(nactive == w.size());
+    if (nactive != w.size()) {
+      return;
+    }
+
+    // Call expire at each time next_expiry tells until the largest
+    // timeout passes, and then jump to the next round.
+    auto next = std::min(now + gen() % 100000000, end);
+    while (!failed) {
+      auto t = w.next_expiry();
+      if (t > next) {
+        now = next;
+        w.expire(now);
+        break;
+      }
+      now = std::max(now, t);
+      w.expire(now);
+    }
+  }
+
+  CU_ASSERT(nfired > 0);
+
+  for (auto &e : entries) {
+    CU_ASSERT(!e.active || e.expiry + TimerWheel::TICK >= now);
+  }
+}
+
+} // namespace ngtcp2
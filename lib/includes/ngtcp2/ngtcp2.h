@@ -711,6 +711,25 @@ typedef ssize_t (*ngtcp2_send_client_cleartext)(ngtcp2_conn *conn,
 typedef int (*ngtcp2_recv_client_initial)(ngtcp2_conn *conn, uint64_t conn_id,
                                           void *user_data);
 
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_send_server_cleartext` is invoked when server
+ * handshake data are needed to build Server Cleartext packet.  The
+ * callback function must set the pointer to the data to |*pdest|, and
+ * return its length.  If |ppkt_num| is not NULL, this is the first
+ * Server Cleartext packet, and the callback function must also set
+ * the initial packet number to |*ppkt_num|.
+ *
+ * If there are no data to send, return 0.  If handshake is processed
+ * asynchronously, and the first server handshake data are not ready
+ * yet, the callback function may return 0 even if |ppkt_num| is not
+ * NULL.  Then `ngtcp2_conn_write_pkt` returns 0, and this callback is
+ * invoked again in the next call.
+ *
+ * Returning :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library
+ * call return immediately.
+ */
 typedef ssize_t (*ngtcp2_send_server_cleartext)(ngtcp2_conn *conn,
                                                 uint32_t flags,
                                                 uint64_t *ppkt_num,
@@ -734,6 +753,11 @@ typedef ssize_t (*ngtcp2_send_server_cleartext)(ngtcp2_conn *conn,
  * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` which makes the library call
  * return immediately.  It is undefined when the other value is
  * returned.
+ *
+ * If application processes the handshake asynchronously, it can just
+ * queue |data|, and return 0.  See also
+ * :type:`ngtcp2_send_server_cleartext` and
+ * `ngtcp2_conn_handshake_completed`.
  */
 typedef int (*ngtcp2_recv_stream0_data)(ngtcp2_conn *conn, const uint8_t *data,
                                         size_t datalen, void *user_data);
@@ -816,19 +840,156 @@ typedef int (*ngtcp2_recv_version_negotiation)(ngtcp2_conn *conn,
 typedef int (*ngtcp2_recv_server_stateless_retry)(ngtcp2_conn *conn,
                                                   void *user_data);
 
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_encrypt` is invoked when the library encrypts a
+ * packet payload |plaintext| of length |plaintextlen|, and writes the
+ * result into the buffer pointed by |dest| of length |destlen|.
+ * |dest| might be the same as |plaintext|.  |key| of length |keylen|
+ * is the packet protection key, and |aead_ctx| is the opaque cipher
+ * context which application passed together with the key (e.g., to
+ * `ngtcp2_conn_update_tx_keys`).  If |aead_ctx| is not NULL,
+ * application can use it, which is already keyed with |key|, and only
+ * has to set |nonce| of length |noncelen| per packet.  |aead_ctx| is
+ * NULL only if application passed NULL together with the key, and
+ * then the callback has to set up the cipher with |key| by itself.
+ * |ad| of length |adlen| is the additional data.
+ *
+ * The callback function must return the number of bytes written to
+ * |dest| if it succeeds.  Returning
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library call return
+ * immediately.
+ */
 typedef ssize_t (*ngtcp2_encrypt)(ngtcp2_conn *conn, uint8_t *dest,
                                   size_t destlen, const uint8_t *plaintext,
                                   size_t plaintextlen, const uint8_t *key,
-                                  size_t keylen, const uint8_t *nonce,
-                                  size_t noncelen, const uint8_t *ad,
-                                  size_t adlen, void *user_data);
+                                  size_t keylen, void *aead_ctx,
+                                  const uint8_t *nonce, size_t noncelen,
+                                  const uint8_t *ad, size_t adlen,
+                                  void *user_data);
 
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_decrypt` is invoked when the library decrypts a
+ * packet payload |ciphertext| of length |ciphertextlen|, and writes
+ * the result into the buffer pointed by |dest| of length |destlen|.
+ * |dest| might be the same as |ciphertext| (see
+ * `ngtcp2_conn_recv_inplace`).
+ * |key|, |keylen|, |aead_ctx|, |nonce|, |noncelen|, |ad|, and |adlen|
+ * are used in the same way as :type:`ngtcp2_encrypt`.
+ *
+ * The callback function must return the number of bytes written to
+ * |dest| if it succeeds.  If it fails to authenticate |ciphertext|, it
+ * must return :enum:`NGTCP2_ERR_TLS_DECRYPT`.  Returning
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library call return
+ * immediately.
+ */
 typedef ssize_t (*ngtcp2_decrypt)(ngtcp2_conn *conn, uint8_t *dest,
                                   size_t destlen, const uint8_t *ciphertext,
                                   size_t ciphertextlen, const uint8_t *key,
-                                  size_t keylen, const uint8_t *nonce,
-                                  size_t noncelen, const uint8_t *ad,
-                                  size_t adlen, void *user_data);
+                                  size_t keylen, void *aead_ctx,
+                                  const uint8_t *nonce, size_t noncelen,
+                                  const uint8_t *ad, size_t adlen,
+                                  void *user_data);
+
+/**
+ * @struct
+ *
+ * :type:`ngtcp2_aead_op` describes a single packet payload which is
+ * encrypted or decrypted by :type:`ngtcp2_encrypt_batch` or
+ * :type:`ngtcp2_decrypt_batch`.
+ */
+typedef struct {
+  /**
+   * dest is the buffer to write the result to.  It might be the same
+   * as |src|.
+   */
+  uint8_t *dest;
+  /**
+   * destlen is the length of |dest|.
+   */
+  size_t destlen;
+  /**
+   * src is the input, either plaintext or ciphertext.
+   */
+  const uint8_t *src;
+  /**
+   * srclen is the length of |src|.
+   */
+  size_t srclen;
+  /**
+   * nonce is the per packet nonce.
+   */
+  const uint8_t *nonce;
+  /**
+   * noncelen is the length of |nonce|.
+   */
+  size_t noncelen;
+  /**
+   * ad is the additional data.
+   */
+  const uint8_t *ad;
+  /**
+   * adlen is the length of |ad|.
+   */
+  size_t adlen;
+  /**
+   * nwrite must be set by the callback to the number of bytes written
+   * to |dest|, or :enum:`NGTCP2_ERR_TLS_DECRYPT` if decryption of
+   * this payload failed.
+   */
+  ssize_t nwrite;
+} ngtcp2_aead_op;
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_encrypt_batch` is invoked when the library encrypts
+ * |nops| packet payloads described by |ops| at once.  All payloads
+ * are protected with the same |key| of length |keylen|, and
+ * |aead_ctx|, which are used in the same way as
+ * :type:`ngtcp2_encrypt`.  The callback must encrypt each payload and
+ * set the number of bytes written to :member:`ngtcp2_aead_op.nwrite`.
+ *
+ * This callback is optional.  If it is set, it is used by
+ * `ngtcp2_conn_write_pkts` for protected packets instead of
+ * :type:`ngtcp2_encrypt`.
+ *
+ * The callback function must return 0 if it succeeds.  Returning
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library call return
+ * immediately.
+ */
+typedef int (*ngtcp2_encrypt_batch)(ngtcp2_conn *conn, ngtcp2_aead_op *ops,
+                                    size_t nops, const uint8_t *key,
+                                    size_t keylen, void *aead_ctx,
+                                    void *user_data);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_decrypt_batch` is invoked when the library decrypts
+ * |nops| packet payloads described by |ops| at once.  |key|,
+ * |keylen|, and |aead_ctx| are used in the same way as
+ * :type:`ngtcp2_decrypt`.  The callback must decrypt each payload and
+ * set the number of bytes written to :member:`ngtcp2_aead_op.nwrite`,
+ * or :enum:`NGTCP2_ERR_TLS_DECRYPT` if it fails to authenticate the
+ * payload.  A failure of one payload must not prevent the others from
+ * being decrypted.
+ *
+ * This callback is optional.  If it is set, it is used by
+ * `ngtcp2_conn_recv_pkts` for protected packets instead of
+ * :type:`ngtcp2_decrypt`.
+ *
+ * The callback function must return 0 if it succeeds.  Returning
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library call return
+ * immediately.
+ */
+typedef int (*ngtcp2_decrypt_batch)(ngtcp2_conn *conn, ngtcp2_aead_op *ops,
+                                    size_t nops, const uint8_t *key,
+                                    size_t keylen, void *aead_ctx,
+                                    void *user_data);
 
 typedef int (*ngtcp2_recv_stream_data)(ngtcp2_conn *conn, uint32_t stream_id,
                                        uint8_t fin, const uint8_t *data,
@@ -877,6 +1038,46 @@ typedef int (*ngtcp2_extend_max_stream_id)(ngtcp2_conn *conn,
                                            uint32_t max_stream_id,
                                            void *user_data);
 
+/*
+ * @functypedef
+ *
+ * :type:`ngtcp2_stream_writable` is a callback function which is
+ * called when a stream, which was blocked by flow control, gets
+ * additional credit by MAX_STREAM_DATA or MAX_DATA frame, and
+ * application can write more stream data to it.  The stream is also
+ * queued so that it can be retrieved by
+ * `ngtcp2_conn_pop_writable_stream()`.
+ *
+ * The callback function must return 0 if it succeeds.  Returning
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library call return
+ * immediately.
+ */
+typedef int (*ngtcp2_stream_writable)(ngtcp2_conn *conn, uint32_t stream_id,
+                                      void *user_data,
+                                      void *stream_user_data);
+
+/**
+ * @functypedef
+ *
+ * :type:`ngtcp2_update_key` is a callback function which is called
+ * when key phase has been rolled over, and the keys set by
+ * `ngtcp2_conn_set_next_tx_keys` and `ngtcp2_conn_set_next_rx_keys`
+ * are now in use.  Application should derive the keys of the next
+ * key phase, and install them by these functions, so that the next
+ * key update does not have to wait for key derivation.  Application
+ * may do that later, outside of this callback.
+ *
+ * When this callback is called, the library no longer uses the
+ * encryption key of the previous key phase, and the decryption key
+ * of two key phases before.  Application can free the AEAD contexts
+ * associated to them.
+ *
+ * The callback function must return 0 if it succeeds.  Returning
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE` makes the library call return
+ * immediately.
+ */
+typedef int (*ngtcp2_update_key)(ngtcp2_conn *conn, void *user_data);
+
 typedef struct {
   ngtcp2_send_client_initial send_client_initial;
   ngtcp2_send_client_cleartext send_client_cleartext;
@@ -903,6 +1104,10 @@ typedef struct {
   ngtcp2_recv_stateless_reset recv_stateless_reset;
   ngtcp2_recv_server_stateless_retry recv_server_stateless_retry;
   ngtcp2_extend_max_stream_id extend_max_stream_id;
+  ngtcp2_stream_writable stream_writable;
+  ngtcp2_encrypt_batch encrypt_batch;
+  ngtcp2_decrypt_batch decrypt_batch;
+  ngtcp2_update_key update_key;
 } ngtcp2_conn_callbacks;
 
 /*
@@ -975,6 +1180,46 @@ NGTCP2_EXTERN void ngtcp2_conn_del(ngtcp2_conn *conn);
 NGTCP2_EXTERN int ngtcp2_conn_recv(ngtcp2_conn *conn, const uint8_t *pkt,
                                    size_t pktlen, ngtcp2_tstamp ts);
 
+/*
+ * @function
+ *
+ * `ngtcp2_conn_recv_inplace` is just like `ngtcp2_conn_recv`, but it
+ * is allowed to decrypt the payload of protected packet in place,
+ * overwriting the buffer pointed by |pkt|.  The library does not copy
+ * the decrypted payload, and the data passed to
+ * :member:`ngtcp2_conn_callbacks.recv_stream_data` points into |pkt|.
+ * :member:`ngtcp2_conn_callbacks.decrypt` is called with the same
+ * buffer for ciphertext and output.
+ *
+ * Because the content of |pkt| is modified, application must not
+ * reuse it after this function returns.  Packets which are received
+ * before handshake completes are processed in the same way as
+ * `ngtcp2_conn_recv`.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_recv_inplace(ngtcp2_conn *conn, uint8_t *pkt,
+                                           size_t pktlen, ngtcp2_tstamp ts);
+
+/*
+ * @function
+ *
+ * `ngtcp2_conn_recv_pkts` processes |npkts| packets received for
+ * |conn| in order.  The i-th element of |pkts| points to the i-th
+ * packet, and that of |pktlens| is its length.  It is equivalent to
+ * calling `ngtcp2_conn_recv` for each packet, but if
+ * :member:`ngtcp2_conn_callbacks.decrypt_batch` is set, and handshake
+ * has completed, consecutive short header packets are decrypted by a
+ * single call of the callback.  A packet in such batch which fails to
+ * decrypt is discarded, and the remaining packets are processed.
+ *
+ * This function returns 0 if it succeeds, or one of the negative
+ * error codes which `ngtcp2_conn_recv` returns.  If it fails, the
+ * remaining packets are not processed.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_recv_pkts(ngtcp2_conn *conn,
+                                        const uint8_t **pkts,
+                                        const size_t *pktlens, size_t npkts,
+                                        ngtcp2_tstamp ts);
+
 /*
  * @function
  *
@@ -1008,6 +1253,32 @@ NGTCP2_EXTERN int ngtcp2_conn_recv(ngtcp2_conn *conn, const uint8_t *pkt,
 NGTCP2_EXTERN ssize_t ngtcp2_conn_write_pkt(ngtcp2_conn *conn, uint8_t *dest,
                                             size_t destlen, ngtcp2_tstamp ts);
 
+/*
+ * @function
+ *
+ * `ngtcp2_conn_write_pkts` writes at most |pktlenslen| QUIC packets
+ * back to back in the buffer pointed by |dest| whose length is
+ * |destlen|.  Each packet is at most |max_pktlen| bytes long, and
+ * the length of the i-th packet is stored in the i-th element of
+ * |pktlens|.  |ts| is the timestamp of the current time.
+ *
+ * If :member:`ngtcp2_conn_callbacks.encrypt_batch` is set, and
+ * handshake has completed, protected packets are encrypted by calling
+ * the callback once per several packets rather than calling
+ * :member:`ngtcp2_conn_callbacks.encrypt` per packet.  Otherwise, it
+ * is equivalent to calling `ngtcp2_conn_write_pkt` repeatedly.
+ *
+ * This function returns the number of packets written in |dest|,
+ * which is 0 if there is no packet to send, or one of the negative
+ * error codes which `ngtcp2_conn_write_pkt` returns.  If it fails,
+ * the content of |dest| is undefined.
+ */
+NGTCP2_EXTERN ssize_t ngtcp2_conn_write_pkts(ngtcp2_conn *conn, uint8_t *dest,
+                                             size_t destlen, size_t max_pktlen,
+                                             size_t *pktlens,
+                                             size_t pktlenslen,
+                                             ngtcp2_tstamp ts);
+
 /*
  * @function
  *
@@ -1023,6 +1294,11 @@ NGTCP2_EXTERN ssize_t ngtcp2_conn_write_ack_pkt(ngtcp2_conn *conn,
  *
  * `ngtcp2_conn_handshake_completed` tells |conn| that the QUIC
  * handshake has completed.
+ *
+ * Server may call this function outside of the callbacks, for
+ * example when the handshake is carried out by another thread.  In
+ * that case, |conn| enters post handshake state in the next call of
+ * `ngtcp2_conn_write_pkt` or `ngtcp2_conn_recv`.
  */
 NGTCP2_EXTERN void ngtcp2_conn_handshake_completed(ngtcp2_conn *conn);
 
@@ -1032,46 +1308,187 @@ NGTCP2_EXTERN void ngtcp2_conn_handshake_completed(ngtcp2_conn *conn);
  * `ngtcp2_conn_set_handshake_tx_keys` sets key and iv to
  *  encrypt handshake cleartext packets.
  *
+ * |aead_ctx| is an opaque cipher context which is already keyed with
+ * |key|.  It is passed to :member:`ngtcp2_conn_callbacks.hs_encrypt`
+ * as is so that the callback does not have to set up the key for
+ * every packet.  It can be NULL.  The library does not take the
+ * ownership of |aead_ctx|, and application must keep it alive until
+ * |conn| is deleted.
+ *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
  *
  * :enum:`NGTCP2_ERR_INVALID_STATE`
  *     A packet protection key and iv are already set.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory.
  */
 NGTCP2_EXTERN int ngtcp2_conn_set_handshake_tx_keys(ngtcp2_conn *conn,
                                                     const uint8_t *key,
                                                     size_t keylen,
                                                     const uint8_t *iv,
-                                                    size_t ivlen);
+                                                    size_t ivlen,
+                                                    void *aead_ctx);
 
 /**
  * @function
  *
  * `ngtcp2_conn_set_handshake_rx_keys` sets key and iv to decrypt
- * handshake cleartext packets.
+ * handshake cleartext packets.  |aead_ctx| is passed to
+ * :member:`ngtcp2_conn_callbacks.hs_decrypt`.  See
+ * `ngtcp2_conn_set_handshake_tx_keys` for |aead_ctx|.
  *
  * This function returns 0 if it succeeds, or one of the following
  * negative error codes:
  *
  * :enum:`NGTCP2_ERR_INVALID_STATE`
  *     A packet protection key and iv are already set.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory.
  */
 NGTCP2_EXTERN int ngtcp2_conn_set_handshake_rx_keys(ngtcp2_conn *conn,
                                                     const uint8_t *key,
                                                     size_t keylen,
                                                     const uint8_t *iv,
-                                                    size_t ivlen);
+                                                    size_t ivlen,
+                                                    void *aead_ctx);
 
 NGTCP2_EXTERN void ngtcp2_conn_set_aead_overhead(ngtcp2_conn *conn,
                                                  size_t aead_overhead);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_decrypt_buffer` tells |conn| to write decrypted
+ * packet payload to the buffer pointed by |buf| of length |buflen|
+ * instead of the buffer allocated per connection.  The buffer is
+ * only used during `ngtcp2_conn_recv` and `ngtcp2_conn_recv_pkts`,
+ * and nothing is kept in it after they return.  Therefore, the same
+ * buffer can be shared by all connections which are processed in a
+ * single thread.  Application must keep the buffer alive while
+ * |conn| uses it.
+ *
+ * |buflen| should be at least as large as the largest packet that
+ * application receives.  If a packet does not fit in |buf|,
+ * `ngtcp2_conn_recv` returns :enum:`NGTCP2_ERR_NOBUF`.
+ *
+ * If |buf| is NULL, |conn| allocates its own buffer when needed.
+ */
+NGTCP2_EXTERN void ngtcp2_conn_set_decrypt_buffer(ngtcp2_conn *conn,
+                                                  uint8_t *buf, size_t buflen);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_update_tx_keys` sets key and iv to encrypt protected
+ * packets.  |aead_ctx| is passed to
+ * :member:`ngtcp2_conn_callbacks.encrypt`.  See
+ * `ngtcp2_conn_set_handshake_tx_keys` for |aead_ctx|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     A packet protection key and iv are already set.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory.
+ */
 NGTCP2_EXTERN int ngtcp2_conn_update_tx_keys(ngtcp2_conn *conn,
                                              const uint8_t *key, size_t keylen,
-                                             const uint8_t *iv, size_t ivlen);
+                                             const uint8_t *iv, size_t ivlen,
+                                             void *aead_ctx);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_update_rx_keys` sets key and iv to decrypt protected
+ * packets.  |aead_ctx| is passed to
+ * :member:`ngtcp2_conn_callbacks.decrypt`.  See
+ * `ngtcp2_conn_set_handshake_tx_keys` for |aead_ctx|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     A packet protection key and iv are already set.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory.
+ */
 NGTCP2_EXTERN int ngtcp2_conn_update_rx_keys(ngtcp2_conn *conn,
                                              const uint8_t *key, size_t keylen,
-                                             const uint8_t *iv, size_t ivlen);
+                                             const uint8_t *iv, size_t ivlen,
+                                             void *aead_ctx);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_next_tx_keys` sets key and iv of the next key
+ * phase to encrypt protected packets.  |aead_ctx| is passed to
+ * :member:`ngtcp2_conn_callbacks.encrypt` after key update.
+ * Application should call this function, and
+ * `ngtcp2_conn_set_next_rx_keys` ahead of time, so that key update
+ * initiated by either endpoint does not stall packet processing.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     The current key has not been set by
+ *     `ngtcp2_conn_update_tx_keys`, or the next key has already been
+ *     set.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_set_next_tx_keys(ngtcp2_conn *conn,
+                                               const uint8_t *key,
+                                               size_t keylen, const uint8_t *iv,
+                                               size_t ivlen, void *aead_ctx);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_set_next_rx_keys` sets key and iv of the next key
+ * phase to decrypt protected packets.  |aead_ctx| is passed to
+ * :member:`ngtcp2_conn_callbacks.decrypt` when a packet with the
+ * flipped key phase bit is received.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     The current key has not been set by
+ *     `ngtcp2_conn_update_rx_keys`, or the next key has already been
+ *     set.
+ * :enum:`NGTCP2_ERR_NOMEM`
+ *     Out of memory.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_set_next_rx_keys(ngtcp2_conn *conn,
+                                               const uint8_t *key,
+                                               size_t keylen, const uint8_t *iv,
+                                               size_t ivlen, void *aead_ctx);
+
+/**
+ * @function
+ *
+ * `ngtcp2_conn_initiate_key_update` starts using the keys set by
+ * `ngtcp2_conn_set_next_tx_keys` and `ngtcp2_conn_set_next_rx_keys`,
+ * and flips key phase bit of the outgoing packets.  The keys of the
+ * previous key phase are kept to decrypt the packets which are
+ * reordered across key update until the next key update.
+ * :member:`ngtcp2_conn_callbacks.update_key` is called before this
+ * function returns.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * :enum:`NGTCP2_ERR_INVALID_STATE`
+ *     Handshake has not completed yet; the next keys have not been
+ *     set; or the previous key update has not been confirmed by the
+ *     remote endpoint yet.
+ * :enum:`NGTCP2_ERR_CALLBACK_FAILURE`
+ *     User callback failed.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_initiate_key_update(ngtcp2_conn *conn);
 
 /**
  * @function
@@ -1248,6 +1665,11 @@ NGTCP2_EXTERN int ngtcp2_conn_shutdown_stream_read(ngtcp2_conn *conn,
  *     Stream does not exist
  * :enum:`NGTCP2_ERR_STREAM_SHUT_WR`
  *     Stream is half closed (local); or stream is being reset.
+ * :enum:`NGTCP2_ERR_STREAM_DATA_BLOCKED`
+ *     Stream is blocked by flow control.  When the credit is
+ *     extended, :member:`ngtcp2_conn_callbacks.stream_writable` is
+ *     called, and the stream is queued for
+ *     `ngtcp2_conn_pop_writable_stream()`.
  * :enum:`NGTCP2_ERR_PKT_NUM_EXHAUSTED`
  *     Packet number is exhausted, and cannot send any more packet.
  * :enum:`NGTCP2_ERR_CALLBACK_FAILURE`
@@ -1295,6 +1717,22 @@ NGTCP2_EXTERN ssize_t ngtcp2_conn_write_connection_close(ngtcp2_conn *conn,
  */
 NGTCP2_EXTERN int ngtcp2_conn_closed(ngtcp2_conn *conn);
 
+/**
+ * @function
+ *
+ * `ngtcp2_conn_pop_writable_stream` removes a stream from the queue
+ * of streams which were blocked by flow control, and have got
+ * additional credit since then.  The stream ID of the removed stream
+ * is assigned to |*pstream_id|.  Application should call this
+ * function repeatedly until it returns 0 to find the streams which
+ * can make progress, instead of trying every open stream.
+ *
+ * This function returns nonzero if a stream is removed from the
+ * queue, or 0 if the queue is empty.
+ */
+NGTCP2_EXTERN int ngtcp2_conn_pop_writable_stream(ngtcp2_conn *conn,
+                                                  uint32_t *pstream_id);
+
 /**
  * @function
  *
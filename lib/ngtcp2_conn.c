@@ -133,6 +133,21 @@ static int conn_call_handshake_completed(ngtcp2_conn *conn) {
   return 0;
 }
 
+static int conn_call_update_key(ngtcp2_conn *conn) {
+  int rv;
+
+  if (!conn->callbacks.update_key) {
+    return 0;
+  }
+
+  rv = conn->callbacks.update_key(conn, conn->user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
 static int conn_call_recv_stream_data(ngtcp2_conn *conn, ngtcp2_strm *strm,
                                       uint8_t fin, const uint8_t *data,
                                       size_t datalen) {
@@ -186,6 +201,103 @@ static int conn_call_extend_max_stream_id(ngtcp2_conn *conn,
   return 0;
 }
 
+static int conn_call_stream_writable(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  int rv;
+
+  if (!conn->callbacks.stream_writable) {
+    return 0;
+  }
+
+  rv = conn->callbacks.stream_writable(conn, strm->stream_id, conn->user_data,
+                                       strm->stream_user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  return 0;
+}
+
+/*
+ * strm_list_insert inserts |strm| at the head of the list pointed by
+ * |phead| which is linked through wr_pprev and wr_next.  |strm| must
+ * not be linked to any list.
+ */
+static void strm_list_insert(ngtcp2_strm **phead, ngtcp2_strm *strm) {
+  strm->wr_pprev = phead;
+  strm->wr_next = *phead;
+  if (*phead) {
+    (*phead)->wr_pprev = &strm->wr_next;
+  }
+  *phead = strm;
+}
+
+/*
+ * strm_list_remove unlinks |strm| from the list it belongs to.  It
+ * does nothing if |strm| is not linked to any list.
+ */
+static void strm_list_remove(ngtcp2_strm *strm) {
+  if (!strm->wr_pprev) {
+    return;
+  }
+
+  *strm->wr_pprev = strm->wr_next;
+  if (strm->wr_next) {
+    strm->wr_next->wr_pprev = strm->wr_pprev;
+  }
+  strm->wr_pprev = NULL;
+  strm->wr_next = NULL;
+}
+
+/*
+ * conn_insert_stream adds |strm| to conn->strms.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_INVALID_ARGUMENT
+ *     The stream which has the same stream ID already exists.
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory
+ */
+static int conn_insert_stream(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  int rv;
+
+  rv = ngtcp2_map_insert(&conn->strms, &strm->me);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (strm->stream_id < NGTCP2_STRMS_DIRECT_LEN) {
+    conn->strms_direct[strm->stream_id] = strm;
+  }
+
+  return 0;
+}
+
+/*
+ * conn_remove_stream removes |strm| from conn->strms.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_INVALID_ARGUMENT
+ *     The stream is not found.
+ */
+static int conn_remove_stream(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  int rv;
+
+  rv = ngtcp2_map_remove(&conn->strms, strm->me.key);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (strm->stream_id < NGTCP2_STRMS_DIRECT_LEN) {
+    conn->strms_direct[strm->stream_id] = NULL;
+  }
+
+  return 0;
+}
+
 static int conn_new(ngtcp2_conn **pconn, uint64_t conn_id, uint32_t version,
                     const ngtcp2_conn_callbacks *callbacks,
                     const ngtcp2_settings *settings, void *user_data,
@@ -217,7 +329,7 @@ static int conn_new(ngtcp2_conn **pconn, uint64_t conn_id, uint32_t version,
     goto fail_strms_init;
   }
 
-  rv = ngtcp2_map_insert(&(*pconn)->strms, &(*pconn)->strm0->me);
+  rv = conn_insert_stream(*pconn, (*pconn)->strm0);
   if (rv != 0) {
     goto fail_strms_insert;
   }
@@ -320,12 +432,17 @@ void ngtcp2_conn_del(ngtcp2_conn *conn) {
     return;
   }
 
-  free(conn->decrypt_buf.base);
+  if (!(conn->flags & NGTCP2_CONN_FLAG_USER_DECRYPT_BUF)) {
+    ngtcp2_mem_free(conn->mem, conn->decrypt_buf.base);
+  }
 
   delete_buffed_pkts(conn->buffed_rx_ppkts, conn->mem);
 
   ngtcp2_acktr_free(&conn->acktr);
 
+  ngtcp2_crypto_km_del(conn->old_rx_ckm, conn->mem);
+  ngtcp2_crypto_km_del(conn->new_rx_ckm, conn->mem);
+  ngtcp2_crypto_km_del(conn->new_tx_ckm, conn->mem);
   ngtcp2_crypto_km_del(conn->rx_ckm, conn->mem);
   ngtcp2_crypto_km_del(conn->tx_ckm, conn->mem);
 
@@ -602,6 +719,101 @@ static ssize_t conn_retransmit_unprotected(ngtcp2_conn *conn, uint8_t *dest,
   return nwrite;
 }
 
+/*
+ * conn_defer_encrypt is ngtcp2_encrypt callback which does not
+ * encrypt |plaintext|, but records it in conn->aead_batch so that it
+ * is encrypted later by conn_flush_aead_batch.  It returns the length
+ * of ciphertext that encrypt_batch callback is expected to write.
+ */
+static ssize_t conn_defer_encrypt(ngtcp2_conn *conn, uint8_t *dest,
+                                  size_t destlen, const uint8_t *plaintext,
+                                  size_t plaintextlen, const uint8_t *key,
+                                  size_t keylen, void *aead_ctx,
+                                  const uint8_t *nonce, size_t noncelen,
+                                  const uint8_t *ad, size_t adlen,
+                                  void *user_data) {
+  ngtcp2_aead_batch *batch = conn->aead_batch;
+  ngtcp2_aead_op *op;
+  (void)key;
+  (void)keylen;
+  (void)aead_ctx;
+  (void)user_data;
+
+  assert(batch->nops < NGTCP2_AEAD_BATCH_MAX);
+  assert(noncelen <= NGTCP2_NONCELEN_MAX);
+
+  if (destlen < plaintextlen + conn->aead_overhead) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  op = &batch->ops[batch->nops];
+
+  memcpy(batch->nonces[batch->nops], nonce, noncelen);
+
+  op->dest = dest;
+  op->destlen = destlen;
+  op->src = plaintext;
+  op->srclen = plaintextlen;
+  op->nonce = batch->nonces[batch->nops];
+  op->noncelen = noncelen;
+  op->ad = ad;
+  op->adlen = adlen;
+  op->nwrite = 0;
+
+  ++batch->nops;
+
+  return (ssize_t)(plaintextlen + conn->aead_overhead);
+}
+
+/*
+ * conn_encrypt_cb returns the callback function to encrypt protected
+ * packet.
+ */
+static ngtcp2_encrypt conn_encrypt_cb(ngtcp2_conn *conn) {
+  if (conn->aead_batch) {
+    return conn_defer_encrypt;
+  }
+  return conn->callbacks.encrypt;
+}
+
+/*
+ * conn_flush_aead_batch encrypts packet payloads recorded in
+ * |batch| by calling encrypt_batch callback.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User-defined callback function failed.
+ */
+static int conn_flush_aead_batch(ngtcp2_conn *conn, ngtcp2_aead_batch *batch) {
+  ngtcp2_crypto_km *ckm = conn->tx_ckm;
+  size_t i;
+  int rv;
+
+  if (batch->nops == 0) {
+    return 0;
+  }
+
+  rv = conn->callbacks.encrypt_batch(conn, batch->ops, batch->nops, ckm->key,
+                                     ckm->keylen, ckm->aead_ctx,
+                                     conn->user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  for (i = 0; i < batch->nops; ++i) {
+    if (batch->ops[i].nwrite !=
+        (ssize_t)(batch->ops[i].srclen + conn->aead_overhead)) {
+      return NGTCP2_ERR_CALLBACK_FAILURE;
+    }
+  }
+
+  batch->nops = 0;
+
+  return 0;
+}
+
 /*
  * conn_select_pkt_type selects shorted short packet type based on the
  * next packet number |pkt_num|.
@@ -623,6 +835,17 @@ static uint8_t conn_select_pkt_type(ngtcp2_conn *conn, uint64_t pkt_num) {
   return NGTCP2_PKT_01;
 }
 
+/*
+ * conn_short_pkt_flags returns the flags of short packet header,
+ * which reflects the key phase of the current encryption key.
+ */
+static uint8_t conn_short_pkt_flags(ngtcp2_conn *conn) {
+  if (conn->tx_ckm->flags & NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE) {
+    return NGTCP2_PKT_FLAG_CONN_ID | NGTCP2_PKT_FLAG_KEY_PHASE;
+  }
+  return NGTCP2_PKT_FLAG_CONN_ID;
+}
+
 /*
  * conn_retransmit_protected writes QUIC packet in the buffer pointed
  * by |dest| whose length is |destlen| to retransmit lost protected
@@ -659,10 +882,11 @@ static ssize_t conn_retransmit_protected(ngtcp2_conn *conn, uint8_t *dest,
   hd.conn_id = conn->conn_id;
   hd.pkt_num = conn->last_tx_pkt_num + 1;
   hd.type = conn_select_pkt_type(conn, hd.pkt_num);
+  hd.flags = conn_short_pkt_flags(conn);
 
   ctx.ckm = conn->tx_ckm;
   ctx.aead_overhead = conn->aead_overhead;
-  ctx.encrypt = conn->callbacks.encrypt;
+  ctx.encrypt = conn_encrypt_cb(conn);
   ctx.user_data = conn;
 
   ngtcp2_ppe_init(&ppe, dest, destlen, &ctx);
@@ -1298,7 +1522,8 @@ static ssize_t conn_write_server_cleartext(ngtcp2_conn *conn, uint8_t *dest,
 
     if (payloadlen == 0) {
       if (initial) {
-        return NGTCP2_ERR_CALLBACK_FAILURE;
+        /* Server handshake is still in progress. */
+        return 0;
       }
       if (conn->state == NGTCP2_CS_SERVER_TLS_HANDSHAKE_FAILED) {
         return NGTCP2_ERR_TLS_ALERT;
@@ -1450,13 +1675,13 @@ static ssize_t conn_write_pkt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
     return 0;
   }
 
-  ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID,
+  ngtcp2_pkt_hd_init(&hd, conn_short_pkt_flags(conn),
                      conn_select_pkt_type(conn, conn->last_tx_pkt_num + 1),
                      conn->conn_id, conn->last_tx_pkt_num + 1, conn->version);
 
   ctx.ckm = conn->tx_ckm;
   ctx.aead_overhead = conn->aead_overhead;
-  ctx.encrypt = conn->callbacks.encrypt;
+  ctx.encrypt = conn_encrypt_cb(conn);
   ctx.user_data = conn;
 
   ngtcp2_ppe_init(&ppe, dest, destlen, &ctx);
@@ -1590,13 +1815,13 @@ static ssize_t conn_write_single_frame_pkt(ngtcp2_conn *conn, uint8_t *dest,
   ssize_t nwrite;
   ngtcp2_crypto_ctx ctx;
 
-  ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID,
+  ngtcp2_pkt_hd_init(&hd, conn_short_pkt_flags(conn),
                      conn_select_pkt_type(conn, conn->last_tx_pkt_num + 1),
                      conn->conn_id, conn->last_tx_pkt_num + 1, conn->version);
 
   ctx.ckm = conn->tx_ckm;
   ctx.aead_overhead = conn->aead_overhead;
-  ctx.encrypt = conn->callbacks.encrypt;
+  ctx.encrypt = conn_encrypt_cb(conn);
   ctx.user_data = conn;
 
   ngtcp2_ppe_init(&ppe, dest, destlen, &ctx);
@@ -1675,9 +1900,13 @@ static ssize_t conn_write_protected_ack_pkt(ngtcp2_conn *conn, uint8_t *dest,
   return spktlen;
 }
 
+static int conn_server_handshake_completed(ngtcp2_conn *conn,
+                                           ngtcp2_tstamp ts);
+
 ssize_t ngtcp2_conn_write_pkt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                               ngtcp2_tstamp ts) {
   ssize_t nwrite = 0;
+  int rv;
 
   if (conn->last_tx_pkt_num == UINT64_MAX) {
     return NGTCP2_ERR_PKT_NUM_EXHAUSTED;
@@ -1722,12 +1951,25 @@ ssize_t ngtcp2_conn_write_pkt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
     break;
   case NGTCP2_CS_SERVER_INITIAL:
     nwrite = conn_write_server_cleartext(conn, dest, destlen, 1, ts);
-    if (nwrite < 0) {
+    if (nwrite <= 0) {
+      /* nwrite == 0 means that application has not produced the
+         first server handshake data yet. */
       break;
     }
     conn->state = NGTCP2_CS_SERVER_WAIT_HANDSHAKE;
     break;
   case NGTCP2_CS_SERVER_WAIT_HANDSHAKE:
+    if (conn->flags & NGTCP2_CONN_FLAG_HANDSHAKE_COMPLETED) {
+      /* Handshake has completed asynchronously after the last
+         packet was received. */
+      rv = conn_server_handshake_completed(conn, ts);
+      if (rv != 0) {
+        nwrite = rv;
+        break;
+      }
+      nwrite = conn_write_pkt(conn, dest, destlen, ts);
+      break;
+    }
     nwrite = conn_write_server_cleartext(conn, dest, destlen, 0, ts);
     if (nwrite < 0) {
       break;
@@ -1750,6 +1992,56 @@ ssize_t ngtcp2_conn_write_pkt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
   return nwrite;
 }
 
+ssize_t ngtcp2_conn_write_pkts(ngtcp2_conn *conn, uint8_t *dest,
+                               size_t destlen, size_t max_pktlen,
+                               size_t *pktlens, size_t pktlenslen,
+                               ngtcp2_tstamp ts) {
+  ngtcp2_aead_batch batch;
+  size_t npkts = 0;
+  ssize_t nwrite;
+  int rv;
+
+  if (conn->state == NGTCP2_CS_POST_HANDSHAKE &&
+      conn->callbacks.encrypt_batch) {
+    batch.nops = 0;
+    conn->aead_batch = &batch;
+  }
+
+  for (; npkts < pktlenslen && destlen >= max_pktlen;) {
+    if (conn->aead_batch && batch.nops == NGTCP2_AEAD_BATCH_MAX) {
+      rv = conn_flush_aead_batch(conn, &batch);
+      if (rv != 0) {
+        conn->aead_batch = NULL;
+        return rv;
+      }
+    }
+
+    nwrite = ngtcp2_conn_write_pkt(conn, dest, max_pktlen, ts);
+    if (nwrite < 0) {
+      conn->aead_batch = NULL;
+      return nwrite;
+    }
+    if (nwrite == 0) {
+      break;
+    }
+
+    pktlens[npkts++] = (size_t)nwrite;
+    dest += nwrite;
+    destlen -= (size_t)nwrite;
+  }
+
+  if (conn->aead_batch) {
+    conn->aead_batch = NULL;
+
+    rv = conn_flush_aead_batch(conn, &batch);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  return (ssize_t)npkts;
+}
+
 ssize_t ngtcp2_conn_write_ack_pkt(ngtcp2_conn *conn, uint8_t *dest,
                                   size_t destlen, ngtcp2_tstamp ts) {
   ssize_t nwrite = 0;
@@ -1865,27 +2157,107 @@ static int conn_recv_ack(ngtcp2_conn *conn, ngtcp2_ack *fr,
   return ngtcp2_rtb_recv_ack(&conn->rtb, fr, unprotected, conn);
 }
 
+/*
+ * conn_tx_blocked returns nonzero if the local endpoint cannot send
+ * any stream data because of connection level flow control.
+ */
+static int conn_tx_blocked(ngtcp2_conn *conn) {
+  return conn->max_tx_offset_high <= conn->tx_offset_high;
+}
+
+/*
+ * conn_block_stream records that |strm| is blocked by flow control so
+ * that it is reported to application when the credit is extended.
+ */
+static void conn_block_stream(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  strm_list_remove(strm);
+
+  if (strm->tx_offset == strm->max_tx_offset) {
+    strm->flags |= NGTCP2_STRM_FLAG_BLOCKED;
+    return;
+  }
+
+  strm_list_insert(&conn->blocked_strms, strm);
+}
+
+/*
+ * conn_stream_writable moves |strm| to conn->wr_strms, and tells
+ * application that |strm| is now writable.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed.
+ */
+static int conn_stream_writable(ngtcp2_conn *conn, ngtcp2_strm *strm) {
+  strm_list_remove(strm);
+  strm_list_insert(&conn->wr_strms, strm);
+
+  return conn_call_stream_writable(conn, strm);
+}
+
 /*
  * conn_recv_max_stream_data processes received MAX_STREAM_DATA frame
  * |fr|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed.
  */
-static void conn_recv_max_stream_data(ngtcp2_conn *conn,
-                                      const ngtcp2_max_stream_data *fr) {
+static int conn_recv_max_stream_data(ngtcp2_conn *conn,
+                                     const ngtcp2_max_stream_data *fr) {
   ngtcp2_strm *strm;
 
   strm = ngtcp2_conn_find_stream(conn, fr->stream_id);
-  if (strm == NULL) {
-    return;
+  if (strm == NULL || strm->max_tx_offset >= fr->max_stream_data) {
+    return 0;
+  }
+
+  strm->max_tx_offset = fr->max_stream_data;
+
+  if (!(strm->flags & NGTCP2_STRM_FLAG_BLOCKED)) {
+    return 0;
+  }
+
+  strm->flags &= (uint32_t)~NGTCP2_STRM_FLAG_BLOCKED;
+
+  if (conn_tx_blocked(conn)) {
+    strm_list_insert(&conn->blocked_strms, strm);
+    return 0;
   }
 
-  strm->max_tx_offset = ngtcp2_max(strm->max_tx_offset, fr->max_stream_data);
+  return conn_stream_writable(conn, strm);
 }
 
 /*
  * conn_recv_max_data processes received MAX_DATA frame |fr|.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed.
  */
-static void conn_recv_max_data(ngtcp2_conn *conn, const ngtcp2_max_data *fr) {
-  conn->max_tx_offset_high = ngtcp2_max(conn->max_tx_offset_high, fr->max_data);
+static int conn_recv_max_data(ngtcp2_conn *conn, const ngtcp2_max_data *fr) {
+  int rv;
+
+  if (conn->max_tx_offset_high >= fr->max_data) {
+    return 0;
+  }
+
+  conn->max_tx_offset_high = fr->max_data;
+
+  while (conn->blocked_strms) {
+    rv = conn_stream_writable(conn, conn->blocked_strms);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  return 0;
 }
 
 /*
@@ -1967,7 +2339,7 @@ static int conn_recv_server_stateless_retry(ngtcp2_conn *conn) {
 
   ngtcp2_rtb_free(&conn->rtb);
   ngtcp2_acktr_free(&conn->acktr);
-  ngtcp2_map_remove(&conn->strms, 0);
+  conn_remove_stream(conn, conn->strm0);
   ngtcp2_strm_free(conn->strm0);
   ngtcp2_mem_free(conn->mem, conn->strm0);
 
@@ -1975,7 +2347,7 @@ static int conn_recv_server_stateless_retry(ngtcp2_conn *conn) {
 
   ngtcp2_acktr_init(&conn->acktr, conn->mem);
   ngtcp2_rtb_init(&conn->rtb, conn->mem);
-  ngtcp2_map_insert(&conn->strms, &conn->strm0->me);
+  conn_insert_stream(conn, conn->strm0);
 
   conn->flags &= (uint8_t)~NGTCP2_CONN_FLAG_CONN_ID_NEGOTIATED;
   conn->state = NGTCP2_CS_CLIENT_INITIAL;
@@ -1992,6 +2364,8 @@ static int conn_recv_server_stateless_retry(ngtcp2_conn *conn) {
  *
  * NGTCP2_ERR_NOMEM
  *     Out of memory.
+ * NGTCP2_ERR_NOBUF
+ *     The buffer supplied by application is too small.
  */
 static int conn_ensure_decrypt_buffer(ngtcp2_conn *conn, size_t pktlen) {
   uint8_t *nbuf;
@@ -2001,6 +2375,10 @@ static int conn_ensure_decrypt_buffer(ngtcp2_conn *conn, size_t pktlen) {
     return 0;
   }
 
+  if (conn->flags & NGTCP2_CONN_FLAG_USER_DECRYPT_BUF) {
+    return NGTCP2_ERR_NOBUF;
+  }
+
   len = conn->decrypt_buf.len == 0 ? 2048 : conn->decrypt_buf.len * 2;
   for (; len < pktlen; len *= 2)
     ;
@@ -2041,10 +2419,11 @@ static ssize_t conn_decrypt_pkt(ngtcp2_conn *conn, uint8_t *dest,
 
   assert(sizeof(nonce) >= ckm->ivlen);
 
-  ngtcp2_crypto_create_nonce(nonce, ckm->iv, ckm->ivlen, pkt_num);
+  ngtcp2_crypto_km_create_nonce(nonce, ckm, pkt_num);
 
   nwrite = decrypt(conn, dest, destlen, pkt, pktlen, ckm->key, ckm->keylen,
-                   nonce, ckm->ivlen, ad, adlen, conn->user_data);
+                   ckm->aead_ctx, nonce, ckm->ivlen, ad, adlen,
+                   conn->user_data);
 
   if (nwrite < 0) {
     if (nwrite == NGTCP2_ERR_TLS_DECRYPT) {
@@ -2398,7 +2777,7 @@ int ngtcp2_conn_init_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
     return rv;
   }
 
-  rv = ngtcp2_map_insert(&conn->strms, &strm->me);
+  rv = conn_insert_stream(conn, strm);
   if (rv != 0) {
     assert(rv != NGTCP2_ERR_INVALID_ARGUMENT);
 
@@ -2997,25 +3376,220 @@ static int conn_recv_max_stream_id(ngtcp2_conn *conn,
   return conn_call_extend_max_stream_id(conn, fr->max_stream_id);
 }
 
-static int conn_recv_pkt(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
-                         ngtcp2_tstamp ts) {
-  ngtcp2_pkt_hd hd;
-  size_t pkt_num_bits;
-  int rv = 0;
-  const uint8_t *hdpkt = pkt;
-  ssize_t nread, nwrite;
+/*
+ * pkt_num_bits returns the number of bits available to encode packet
+ * number in the packet whose header is |hd|.
+ */
+static size_t pkt_num_bits(const ngtcp2_pkt_hd *hd) {
+  if (hd->flags & NGTCP2_PKT_FLAG_LONG_FORM) {
+    return 32;
+  }
+  switch (hd->type) {
+  case NGTCP2_PKT_01:
+    return 8;
+  case NGTCP2_PKT_02:
+    return 16;
+  default:
+    assert(NGTCP2_PKT_03 == hd->type);
+    return 32;
+  }
+}
+
+/*
+ * conn_recv_payload processes decrypted payload |payload| of length
+ * |payloadlen| of protected packet whose header is |hd|.
+ *
+ * This function returns 0 if it succeeds, or one of the negative
+ * error codes which conn_recv_pkt returns.
+ */
+static int conn_recv_payload(ngtcp2_conn *conn, const ngtcp2_pkt_hd *hd,
+                             const uint8_t *payload, size_t payloadlen,
+                             ngtcp2_tstamp ts) {
   ngtcp2_frame fr;
+  ssize_t nread;
+  int rv;
   int require_ack = 0;
 
-  if (pkt[0] & NGTCP2_HEADER_FORM_BIT) {
-    nread = ngtcp2_pkt_decode_hd_long(&hd, pkt, pktlen);
+  conn->flags |= NGTCP2_CONN_FLAG_RECV_PROTECTED_PKT;
+
+  for (; payloadlen;) {
+    nread = ngtcp2_pkt_decode_frame(&fr, payload, payloadlen);
     if (nread < 0) {
       return (int)nread;
     }
 
-    if (conn->conn_id != hd.conn_id &&
-        (!conn->server || conn->client_conn_id != hd.conn_id)) {
-      return 0;
+    payload += nread;
+    payloadlen -= (size_t)nread;
+
+    rv = conn_call_recv_frame(conn, hd, &fr);
+    if (rv != 0) {
+      return rv;
+    }
+
+    switch (fr.type) {
+    case NGTCP2_FRAME_ACK:
+    case NGTCP2_FRAME_PADDING:
+    case NGTCP2_FRAME_CONNECTION_CLOSE:
+      break;
+    default:
+      require_ack = 1;
+    }
+
+    switch (fr.type) {
+    case NGTCP2_FRAME_ACK:
+      rv = conn_recv_ack(conn, &fr.ack, 0);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_STREAM:
+      rv = conn_recv_stream(conn, &fr.stream);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_RST_STREAM:
+      rv = conn_recv_rst_stream(conn, &fr.rst_stream);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_STOP_SENDING:
+      rv = conn_recv_stop_sending(conn, &fr.stop_sending);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_MAX_STREAM_DATA:
+      rv = conn_recv_max_stream_data(conn, &fr.max_stream_data);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_MAX_DATA:
+      rv = conn_recv_max_data(conn, &fr.max_data);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_MAX_STREAM_ID:
+      rv = conn_recv_max_stream_id(conn, &fr.max_stream_id);
+      if (rv != 0) {
+        return rv;
+      }
+      break;
+    case NGTCP2_FRAME_CONNECTION_CLOSE:
+      conn_recv_connection_close(conn, &fr.connection_close);
+      break;
+    }
+  }
+
+  conn->max_rx_pkt_num = ngtcp2_max(conn->max_rx_pkt_num, hd->pkt_num);
+
+  return ngtcp2_conn_sched_ack(conn, hd->pkt_num, require_ack, ts);
+}
+
+/*
+ * conn_select_rx_ckm returns the key to decrypt a short packet whose
+ * header is |hd|.  The packet which has the same key phase as the
+ * current key is decrypted by conn->rx_ckm.  Otherwise, if its packet
+ * number is lower than any packet decrypted by conn->rx_ckm, it
+ * belongs to the previous key phase.  Otherwise, the remote endpoint
+ * has initiated key update.  This function returns NULL if the key
+ * is not available.
+ */
+static ngtcp2_crypto_km *conn_select_rx_ckm(ngtcp2_conn *conn,
+                                            const ngtcp2_pkt_hd *hd) {
+  int key_phase = (hd->flags & NGTCP2_PKT_FLAG_KEY_PHASE) != 0;
+
+  if (key_phase ==
+      ((conn->rx_ckm->flags & NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE) != 0)) {
+    return conn->rx_ckm;
+  }
+
+  if (hd->pkt_num < conn->rx_ckm->pkt_num) {
+    return conn->old_rx_ckm;
+  }
+
+  /* Key update must not start unless we can respond with the new
+     encryption key as well. */
+  if (conn->new_tx_ckm == NULL) {
+    return NULL;
+  }
+
+  return conn->new_rx_ckm;
+}
+
+/*
+ * conn_rotate_keys promotes the keys of the next key phase to the
+ * current keys.  The current decryption key is retained as
+ * conn->old_rx_ckm.
+ */
+static void conn_rotate_keys(ngtcp2_conn *conn) {
+  assert(conn->new_tx_ckm);
+  assert(conn->new_rx_ckm);
+
+  ngtcp2_crypto_km_del(conn->old_rx_ckm, conn->mem);
+  conn->old_rx_ckm = conn->rx_ckm;
+  conn->rx_ckm = conn->new_rx_ckm;
+  conn->new_rx_ckm = NULL;
+
+  ngtcp2_crypto_km_del(conn->tx_ckm, conn->mem);
+  conn->tx_ckm = conn->new_tx_ckm;
+  conn->new_tx_ckm = NULL;
+}
+
+/*
+ * conn_on_pkt_decrypted is called when a packet whose packet number
+ * is |pkt_num| has been decrypted by |ckm| successfully.  If |ckm| is
+ * the key of the next key phase, the keys are rotated.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed.
+ */
+static int conn_on_pkt_decrypted(ngtcp2_conn *conn, ngtcp2_crypto_km *ckm,
+                                 uint64_t pkt_num) {
+  if (ckm == conn->new_rx_ckm) {
+    conn_rotate_keys(conn);
+    conn->rx_ckm->pkt_num = pkt_num;
+
+    return conn_call_update_key(conn);
+  }
+
+  if (ckm == conn->rx_ckm) {
+    ckm->pkt_num = ngtcp2_min(ckm->pkt_num, pkt_num);
+    conn->flags &= (uint8_t)~NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE;
+  }
+
+  return 0;
+}
+
+/*
+ * conn_recv_pkt processes a packet received after handshake.  If
+ * |inplace| is nonzero, |pkt| must be writable, and protected payload
+ * is decrypted in place instead of into conn->decrypt_buf.
+ */
+static int conn_recv_pkt(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
+                         int inplace, ngtcp2_tstamp ts) {
+  ngtcp2_pkt_hd hd;
+  int rv = 0;
+  const uint8_t *hdpkt = pkt;
+  uint8_t *dest;
+  ngtcp2_crypto_km *ckm;
+  ssize_t nread, nwrite;
+
+  if (pkt[0] & NGTCP2_HEADER_FORM_BIT) {
+    nread = ngtcp2_pkt_decode_hd_long(&hd, pkt, pktlen);
+    if (nread < 0) {
+      return (int)nread;
+    }
+
+    if (conn->conn_id != hd.conn_id &&
+        (!conn->server || conn->client_conn_id != hd.conn_id)) {
+      return 0;
     }
   } else {
     nread = ngtcp2_pkt_decode_hd_short(&hd, pkt, pktlen);
@@ -3031,26 +3605,8 @@ static int conn_recv_pkt(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
   pkt += nread;
   pktlen -= (size_t)nread;
 
-  if (hd.flags & NGTCP2_PKT_FLAG_LONG_FORM) {
-    pkt_num_bits = 32;
-  } else {
-    switch (hd.type) {
-    case NGTCP2_PKT_01:
-      pkt_num_bits = 8;
-      break;
-    case NGTCP2_PKT_02:
-      pkt_num_bits = 16;
-      break;
-    case NGTCP2_PKT_03:
-      pkt_num_bits = 32;
-      break;
-    default:
-      assert(0);
-    }
-  }
-
-  hd.pkt_num =
-      ngtcp2_pkt_adjust_pkt_num(conn->max_rx_pkt_num, hd.pkt_num, pkt_num_bits);
+  hd.pkt_num = ngtcp2_pkt_adjust_pkt_num(conn->max_rx_pkt_num, hd.pkt_num,
+                                         pkt_num_bits(&hd));
 
   rv = conn_call_recv_pkt(conn, &hd);
   if (rv != 0) {
@@ -3078,13 +3634,29 @@ static int conn_recv_pkt(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
     }
   }
 
-  rv = conn_ensure_decrypt_buffer(conn, pktlen);
-  if (rv != 0) {
-    return rv;
+  ckm = conn_select_rx_ckm(conn, &hd);
+  if (ckm == NULL) {
+    /* Stateless Reset has random key phase bit. */
+    rv = conn_on_stateless_reset(conn, &hd, pkt, pktlen);
+    if (rv == NGTCP2_ERR_CALLBACK_FAILURE) {
+      return rv;
+    }
+    /* Discard packet because its key is not available. */
+    return 0;
   }
 
-  nwrite = conn_decrypt_pkt(conn, conn->decrypt_buf.base, pktlen, pkt, pktlen,
-                            hdpkt, (size_t)nread, hd.pkt_num, conn->rx_ckm,
+  if (inplace) {
+    dest = (uint8_t *)pkt;
+  } else {
+    rv = conn_ensure_decrypt_buffer(conn, pktlen);
+    if (rv != 0) {
+      return rv;
+    }
+    dest = conn->decrypt_buf.base;
+  }
+
+  nwrite = conn_decrypt_pkt(conn, dest, pktlen, pkt, pktlen, hdpkt,
+                            (size_t)nread, hd.pkt_num, ckm,
                             conn->callbacks.decrypt);
   if (nwrite < 0) {
     if (nwrite != NGTCP2_ERR_TLS_DECRYPT ||
@@ -3092,86 +3664,22 @@ static int conn_recv_pkt(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
       return (int)nwrite;
     }
 
+    /* Even if payload is decrypted in place, Stateless Reset Token
+       is intact because it occupies the place of authentication
+       tag. */
     rv = conn_on_stateless_reset(conn, &hd, pkt, pktlen);
     if (rv == 0) {
       return 0;
     }
     return (int)nwrite;
   }
-  pkt = conn->decrypt_buf.base;
-  pktlen = (size_t)nwrite;
-
-  conn->flags |= NGTCP2_CONN_FLAG_RECV_PROTECTED_PKT;
-
-  for (; pktlen;) {
-    nread = ngtcp2_pkt_decode_frame(&fr, pkt, pktlen);
-    if (nread < 0) {
-      return (int)nread;
-    }
 
-    pkt += nread;
-    pktlen -= (size_t)nread;
-
-    rv = conn_call_recv_frame(conn, &hd, &fr);
-    if (rv != 0) {
-      return rv;
-    }
-
-    switch (fr.type) {
-    case NGTCP2_FRAME_ACK:
-    case NGTCP2_FRAME_PADDING:
-    case NGTCP2_FRAME_CONNECTION_CLOSE:
-      break;
-    default:
-      require_ack = 1;
-    }
-
-    switch (fr.type) {
-    case NGTCP2_FRAME_ACK:
-      rv = conn_recv_ack(conn, &fr.ack, 0);
-      if (rv != 0) {
-        return rv;
-      }
-      break;
-    case NGTCP2_FRAME_STREAM:
-      rv = conn_recv_stream(conn, &fr.stream);
-      if (rv != 0) {
-        return rv;
-      }
-      break;
-    case NGTCP2_FRAME_RST_STREAM:
-      rv = conn_recv_rst_stream(conn, &fr.rst_stream);
-      if (rv != 0) {
-        return rv;
-      }
-      break;
-    case NGTCP2_FRAME_STOP_SENDING:
-      rv = conn_recv_stop_sending(conn, &fr.stop_sending);
-      if (rv != 0) {
-        return rv;
-      }
-      break;
-    case NGTCP2_FRAME_MAX_STREAM_DATA:
-      conn_recv_max_stream_data(conn, &fr.max_stream_data);
-      break;
-    case NGTCP2_FRAME_MAX_DATA:
-      conn_recv_max_data(conn, &fr.max_data);
-      break;
-    case NGTCP2_FRAME_MAX_STREAM_ID:
-      rv = conn_recv_max_stream_id(conn, &fr.max_stream_id);
-      if (rv != 0) {
-        return rv;
-      }
-      break;
-    case NGTCP2_FRAME_CONNECTION_CLOSE:
-      conn_recv_connection_close(conn, &fr.connection_close);
-      break;
-    }
+  rv = conn_on_pkt_decrypted(conn, ckm, hd.pkt_num);
+  if (rv != 0) {
+    return rv;
   }
 
-  conn->max_rx_pkt_num = ngtcp2_max(conn->max_rx_pkt_num, hd.pkt_num);
-
-  return ngtcp2_conn_sched_ack(conn, hd.pkt_num, require_ack, ts);
+  return conn_recv_payload(conn, &hd, dest, (size_t)nwrite, ts);
 }
 
 static int conn_process_buffered_protected_pkt(ngtcp2_conn *conn,
@@ -3180,7 +3688,7 @@ static int conn_process_buffered_protected_pkt(ngtcp2_conn *conn,
   ngtcp2_pkt_chain *pc = conn->buffed_rx_ppkts, *next;
 
   for (; pc; pc = pc->next) {
-    rv = conn_recv_pkt(conn, pc->pkt, pc->pktlen, ts);
+    rv = conn_recv_pkt(conn, pc->pkt, pc->pktlen, 0, ts);
     if (rv != 0) {
       return rv;
     }
@@ -3226,6 +3734,36 @@ static int conn_handshake_completed(ngtcp2_conn *conn) {
   return 0;
 }
 
+/*
+ * conn_server_handshake_completed moves server |conn| to post
+ * handshake state after cryptographic handshake has completed, and
+ * processes protected packets buffered so far.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_CALLBACK_FAILURE
+ *     User callback failed.
+ * NGTCP2_ERR_REQUIRED_TRANSPORT_PARAM
+ *     Transport parameters have not been received.
+ */
+static int conn_server_handshake_completed(ngtcp2_conn *conn,
+                                           ngtcp2_tstamp ts) {
+  int rv;
+
+  rv = conn_handshake_completed(conn);
+  if (rv != 0) {
+    return rv;
+  }
+  conn->state = NGTCP2_CS_POST_HANDSHAKE;
+
+  if (!(conn->flags & NGTCP2_CONN_FLAG_TRANSPORT_PARAM_RECVED)) {
+    return NGTCP2_ERR_REQUIRED_TRANSPORT_PARAM;
+  }
+
+  return conn_process_buffered_protected_pkt(conn, ts);
+}
+
 int ngtcp2_conn_recv(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
                      ngtcp2_tstamp ts) {
   int rv = 0;
@@ -3268,17 +3806,7 @@ int ngtcp2_conn_recv(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
       break;
     }
     if (conn->flags & NGTCP2_CONN_FLAG_HANDSHAKE_COMPLETED) {
-      rv = conn_handshake_completed(conn);
-      if (rv != 0) {
-        return rv;
-      }
-      conn->state = NGTCP2_CS_POST_HANDSHAKE;
-
-      if (!(conn->flags & NGTCP2_CONN_FLAG_TRANSPORT_PARAM_RECVED)) {
-        return NGTCP2_ERR_REQUIRED_TRANSPORT_PARAM;
-      }
-
-      rv = conn_process_buffered_protected_pkt(conn, ts);
+      rv = conn_server_handshake_completed(conn, ts);
       if (rv != 0) {
         return rv;
       }
@@ -3292,7 +3820,7 @@ int ngtcp2_conn_recv(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
     }
     break;
   case NGTCP2_CS_POST_HANDSHAKE:
-    rv = conn_recv_pkt(conn, pkt, pktlen, ts);
+    rv = conn_recv_pkt(conn, pkt, pktlen, 0, ts);
     if (rv < 0) {
       break;
     }
@@ -3302,6 +3830,196 @@ int ngtcp2_conn_recv(ngtcp2_conn *conn, const uint8_t *pkt, size_t pktlen,
   return rv;
 }
 
+int ngtcp2_conn_recv_inplace(ngtcp2_conn *conn, uint8_t *pkt, size_t pktlen,
+                             ngtcp2_tstamp ts) {
+  if (pktlen == 0) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
+
+  if (conn->state != NGTCP2_CS_POST_HANDSHAKE ||
+      (pkt[0] & NGTCP2_HEADER_FORM_BIT)) {
+    return ngtcp2_conn_recv(conn, pkt, pktlen, ts);
+  }
+
+  return conn_recv_pkt(conn, pkt, pktlen, 1, ts);
+}
+
+/*
+ * conn_recv_pkt_batch processes consecutive short header packets at
+ * the beginning of |pkts|, decrypting them by a single call of
+ * decrypt_batch callback.  If the first packet is not a short header
+ * packet, it is processed by ngtcp2_conn_recv.
+ *
+ * This function returns the number of packets consumed, or one of
+ * the negative error codes which ngtcp2_conn_recv returns.
+ */
+static ssize_t conn_recv_pkt_batch(ngtcp2_conn *conn, const uint8_t **pkts,
+                                   const size_t *pktlens, size_t npkts,
+                                   ngtcp2_tstamp ts) {
+  ngtcp2_aead_batch batch;
+  ngtcp2_pkt_hd hds[NGTCP2_AEAD_BATCH_MAX];
+  ngtcp2_crypto_km *ckm = conn->rx_ckm;
+  ngtcp2_aead_op *op;
+  size_t payloadlen, offset = 0;
+  ssize_t nread;
+  size_t i, n;
+  int rv;
+
+  assert(NGTCP2_NONCELEN_MAX >= ckm->ivlen);
+
+  for (n = 0; n < npkts && n < NGTCP2_AEAD_BATCH_MAX; ++n) {
+    if (pktlens[n] == 0 || (pkts[n][0] & NGTCP2_HEADER_FORM_BIT)) {
+      break;
+    }
+
+    nread = ngtcp2_pkt_decode_hd_short(&hds[n], pkts[n], pktlens[n]);
+    if (nread < 0) {
+      break;
+    }
+
+    if (n > 0 && (conn->flags & NGTCP2_CONN_FLAG_USER_DECRYPT_BUF) &&
+        conn->decrypt_buf.len < offset + pktlens[n] - (size_t)nread) {
+      break;
+    }
+
+    if (!conn->local_settings.omit_connection_id &&
+        !(hds[n].flags & NGTCP2_PKT_FLAG_CONN_ID)) {
+      break;
+    }
+
+    /* Packet numbers are decoded against the largest one which has
+       been authenticated.  conn_recv_payload raises it after the
+       packet is decrypted. */
+    hds[n].pkt_num = ngtcp2_pkt_adjust_pkt_num(
+        conn->max_rx_pkt_num, hds[n].pkt_num, pkt_num_bits(&hds[n]));
+
+    /* A packet protected by the other key phase is processed by
+       conn_recv_pkt which takes care of key update. */
+    if (conn_select_rx_ckm(conn, &hds[n]) != ckm) {
+      break;
+    }
+
+    op = &batch.ops[n];
+    op->src = pkts[n] + nread;
+    op->srclen = pktlens[n] - (size_t)nread;
+    op->ad = pkts[n];
+    op->adlen = (size_t)nread;
+    op->nwrite = 0;
+
+    offset += op->srclen;
+  }
+
+  if (n == 0) {
+    rv = ngtcp2_conn_recv(conn, pkts[0], pktlens[0], ts);
+    if (rv != 0) {
+      return rv;
+    }
+    return 1;
+  }
+
+  rv = conn_ensure_decrypt_buffer(conn, offset);
+  if (rv != 0) {
+    return rv;
+  }
+
+  offset = 0;
+
+  for (i = 0; i < n; ++i) {
+    op = &batch.ops[i];
+
+    ngtcp2_crypto_km_create_nonce(batch.nonces[i], ckm, hds[i].pkt_num);
+
+    op->dest = conn->decrypt_buf.base + offset;
+    op->destlen = op->srclen;
+    op->nonce = batch.nonces[i];
+    op->noncelen = ckm->ivlen;
+
+    offset += op->srclen;
+  }
+
+  batch.nops = n;
+
+  rv = conn->callbacks.decrypt_batch(conn, batch.ops, batch.nops, ckm->key,
+                                     ckm->keylen, ckm->aead_ctx,
+                                     conn->user_data);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  for (i = 0; i < n; ++i) {
+    if (conn->state != NGTCP2_CS_POST_HANDSHAKE) {
+      /* Connection has been closed by the previous packet. */
+      break;
+    }
+
+    op = &batch.ops[i];
+
+    rv = conn_call_recv_pkt(conn, &hds[i]);
+    if (rv != 0) {
+      return rv;
+    }
+
+    if (op->nwrite < 0) {
+      if (op->nwrite != NGTCP2_ERR_TLS_DECRYPT) {
+        return NGTCP2_ERR_CALLBACK_FAILURE;
+      }
+
+      rv = conn_on_stateless_reset(conn, &hds[i], op->src, op->srclen);
+      if (rv == NGTCP2_ERR_CALLBACK_FAILURE) {
+        return rv;
+      }
+      /* Discard the packet, and process the rest of the batch. */
+      continue;
+    }
+
+    payloadlen = (size_t)op->nwrite;
+    if (payloadlen > op->destlen) {
+      return NGTCP2_ERR_CALLBACK_FAILURE;
+    }
+
+    rv = conn_on_pkt_decrypted(conn, ckm, hds[i].pkt_num);
+    if (rv != 0) {
+      return rv;
+    }
+
+    rv = conn_recv_payload(conn, &hds[i], op->dest, payloadlen, ts);
+    if (rv != 0) {
+      return rv;
+    }
+  }
+
+  return (ssize_t)n;
+}
+
+int ngtcp2_conn_recv_pkts(ngtcp2_conn *conn, const uint8_t **pkts,
+                          const size_t *pktlens, size_t npkts,
+                          ngtcp2_tstamp ts) {
+  ssize_t nread;
+  size_t i;
+  int rv;
+
+  for (i = 0; i < npkts;) {
+    if (conn->state != NGTCP2_CS_POST_HANDSHAKE ||
+        !conn->callbacks.decrypt_batch) {
+      rv = ngtcp2_conn_recv(conn, pkts[i], pktlens[i], ts);
+      if (rv != 0) {
+        return rv;
+      }
+      ++i;
+      continue;
+    }
+
+    nread = conn_recv_pkt_batch(conn, pkts + i, pktlens + i, npkts - i, ts);
+    if (nread < 0) {
+      return (int)nread;
+    }
+
+    i += (size_t)nread;
+  }
+
+  return 0;
+}
+
 void ngtcp2_conn_handshake_completed(ngtcp2_conn *conn) {
   conn->flags |= NGTCP2_CONN_FLAG_HANDSHAKE_COMPLETED;
 }
@@ -3367,44 +4085,120 @@ void ngtcp2_conn_set_aead_overhead(ngtcp2_conn *conn, size_t aead_overhead) {
   conn->aead_overhead = aead_overhead;
 }
 
+void ngtcp2_conn_set_decrypt_buffer(ngtcp2_conn *conn, uint8_t *buf,
+                                    size_t buflen) {
+  if (!(conn->flags & NGTCP2_CONN_FLAG_USER_DECRYPT_BUF)) {
+    ngtcp2_mem_free(conn->mem, conn->decrypt_buf.base);
+  }
+
+  if (buf == NULL) {
+    conn->flags &= (uint8_t)~NGTCP2_CONN_FLAG_USER_DECRYPT_BUF;
+    conn->decrypt_buf.base = NULL;
+    conn->decrypt_buf.len = 0;
+    return;
+  }
+
+  conn->flags |= NGTCP2_CONN_FLAG_USER_DECRYPT_BUF;
+  conn->decrypt_buf.base = buf;
+  conn->decrypt_buf.len = buflen;
+}
+
 int ngtcp2_conn_set_handshake_tx_keys(ngtcp2_conn *conn, const uint8_t *key,
                                       size_t keylen, const uint8_t *iv,
-                                      size_t ivlen) {
+                                      size_t ivlen, void *aead_ctx) {
   if (conn->hs_tx_ckm) {
     return NGTCP2_ERR_INVALID_STATE;
   }
 
   return ngtcp2_crypto_km_new(&conn->hs_tx_ckm, key, keylen, iv, ivlen,
-                              conn->mem);
+                              aead_ctx, conn->mem);
 }
 
 int ngtcp2_conn_set_handshake_rx_keys(ngtcp2_conn *conn, const uint8_t *key,
                                       size_t keylen, const uint8_t *iv,
-                                      size_t ivlen) {
+                                      size_t ivlen, void *aead_ctx) {
   if (conn->hs_rx_ckm) {
     return NGTCP2_ERR_INVALID_STATE;
   }
 
   return ngtcp2_crypto_km_new(&conn->hs_rx_ckm, key, keylen, iv, ivlen,
-                              conn->mem);
+                              aead_ctx, conn->mem);
 }
 
 int ngtcp2_conn_update_tx_keys(ngtcp2_conn *conn, const uint8_t *key,
-                               size_t keylen, const uint8_t *iv, size_t ivlen) {
+                               size_t keylen, const uint8_t *iv, size_t ivlen,
+                               void *aead_ctx) {
   if (conn->tx_ckm) {
     return NGTCP2_ERR_INVALID_STATE;
   }
 
-  return ngtcp2_crypto_km_new(&conn->tx_ckm, key, keylen, iv, ivlen, conn->mem);
+  return ngtcp2_crypto_km_new(&conn->tx_ckm, key, keylen, iv, ivlen, aead_ctx,
+                              conn->mem);
 }
 
 int ngtcp2_conn_update_rx_keys(ngtcp2_conn *conn, const uint8_t *key,
-                               size_t keylen, const uint8_t *iv, size_t ivlen) {
+                               size_t keylen, const uint8_t *iv, size_t ivlen,
+                               void *aead_ctx) {
   if (conn->rx_ckm) {
     return NGTCP2_ERR_INVALID_STATE;
   }
 
-  return ngtcp2_crypto_km_new(&conn->rx_ckm, key, keylen, iv, ivlen, conn->mem);
+  return ngtcp2_crypto_km_new(&conn->rx_ckm, key, keylen, iv, ivlen, aead_ctx,
+                              conn->mem);
+}
+
+/*
+ * conn_new_next_ckm creates the key of the next key phase in
+ * |*pckm|.  Its key phase is the opposite of |cur_ckm|.
+ */
+static int conn_new_next_ckm(ngtcp2_conn *conn, ngtcp2_crypto_km **pckm,
+                             const ngtcp2_crypto_km *cur_ckm,
+                             const uint8_t *key, size_t keylen,
+                             const uint8_t *iv, size_t ivlen, void *aead_ctx) {
+  int rv;
+
+  if (cur_ckm == NULL || *pckm) {
+    return NGTCP2_ERR_INVALID_STATE;
+  }
+
+  rv = ngtcp2_crypto_km_new(pckm, key, keylen, iv, ivlen, aead_ctx, conn->mem);
+  if (rv != 0) {
+    return rv;
+  }
+
+  if (!(cur_ckm->flags & NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE)) {
+    (*pckm)->flags |= NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE;
+  }
+
+  return 0;
+}
+
+int ngtcp2_conn_set_next_tx_keys(ngtcp2_conn *conn, const uint8_t *key,
+                                 size_t keylen, const uint8_t *iv, size_t ivlen,
+                                 void *aead_ctx) {
+  return conn_new_next_ckm(conn, &conn->new_tx_ckm, conn->tx_ckm, key, keylen,
+                           iv, ivlen, aead_ctx);
+}
+
+int ngtcp2_conn_set_next_rx_keys(ngtcp2_conn *conn, const uint8_t *key,
+                                 size_t keylen, const uint8_t *iv, size_t ivlen,
+                                 void *aead_ctx) {
+  return conn_new_next_ckm(conn, &conn->new_rx_ckm, conn->rx_ckm, key, keylen,
+                           iv, ivlen, aead_ctx);
+}
+
+int ngtcp2_conn_initiate_key_update(ngtcp2_conn *conn) {
+  if (conn->state != NGTCP2_CS_POST_HANDSHAKE || !conn->new_tx_ckm ||
+      !conn->new_rx_ckm ||
+      (conn->flags & NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE)) {
+    return NGTCP2_ERR_INVALID_STATE;
+  }
+
+  conn_rotate_keys(conn);
+
+  conn->flags |= NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE;
+
+  return conn_call_update_key(conn);
 }
 
 ngtcp2_tstamp ngtcp2_conn_earliest_expiry(ngtcp2_conn *conn) {
@@ -3575,6 +4369,10 @@ int ngtcp2_conn_open_stream(ngtcp2_conn *conn, uint32_t stream_id,
 ngtcp2_strm *ngtcp2_conn_find_stream(ngtcp2_conn *conn, uint32_t stream_id) {
   ngtcp2_map_entry *me;
 
+  if (stream_id < NGTCP2_STRMS_DIRECT_LEN) {
+    return conn->strms_direct[stream_id];
+  }
+
   me = ngtcp2_map_find(&conn->strms, stream_id);
   if (me == NULL) {
     return NULL;
@@ -3611,13 +4409,13 @@ ssize_t ngtcp2_conn_write_stream(ngtcp2_conn *conn, uint8_t *dest,
     return NGTCP2_ERR_STREAM_SHUT_WR;
   }
 
-  ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID,
+  ngtcp2_pkt_hd_init(&hd, conn_short_pkt_flags(conn),
                      conn_select_pkt_type(conn, conn->last_tx_pkt_num + 1),
                      conn->conn_id, conn->last_tx_pkt_num + 1, conn->version);
 
   ctx.ckm = conn->tx_ckm;
   ctx.aead_overhead = conn->aead_overhead;
-  ctx.encrypt = conn->callbacks.encrypt;
+  ctx.encrypt = conn_encrypt_cb(conn);
   ctx.user_data = conn;
 
   ngtcp2_ppe_init(&ppe, dest, destlen, &ctx);
@@ -3646,6 +4444,7 @@ ssize_t ngtcp2_conn_write_stream(ngtcp2_conn *conn, uint8_t *dest,
   }
 
   if (datalen > 0 && ndatalen == 0) {
+    conn_block_stream(conn, strm);
     return NGTCP2_ERR_STREAM_DATA_BLOCKED;
   }
 
@@ -3747,6 +4546,19 @@ ssize_t ngtcp2_conn_write_connection_close(ngtcp2_conn *conn, uint8_t *dest,
   return nwrite;
 }
 
+int ngtcp2_conn_pop_writable_stream(ngtcp2_conn *conn, uint32_t *pstream_id) {
+  ngtcp2_strm *strm = conn->wr_strms;
+
+  if (strm == NULL) {
+    return 0;
+  }
+
+  strm_list_remove(strm);
+  *pstream_id = strm->stream_id;
+
+  return 1;
+}
+
 int ngtcp2_conn_closed(ngtcp2_conn *conn) {
   return conn->state == NGTCP2_CS_CLOSE_WAIT;
 }
@@ -3759,7 +4571,7 @@ int ngtcp2_conn_close_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
     app_error_code = strm->app_error_code;
   }
 
-  rv = ngtcp2_map_remove(&conn->strms, strm->me.key);
+  rv = conn_remove_stream(conn, strm);
   if (rv != 0) {
     return rv;
   }
@@ -3784,6 +4596,8 @@ int ngtcp2_conn_close_stream(ngtcp2_conn *conn, ngtcp2_strm *strm,
     }
   }
 
+  strm_list_remove(strm);
+
   ngtcp2_strm_free(strm);
   ngtcp2_mem_free(conn->mem, strm);
 
@@ -75,6 +75,30 @@ typedef enum {
    endpoint can send initially. */
 #define NGTCP2_STRM0_MAX_STREAM_DATA 65535
 
+/* NGTCP2_STRMS_DIRECT_LEN is the number of streams which are directly
+   indexed by their stream ID without consulting ngtcp2_map. */
+#define NGTCP2_STRMS_DIRECT_LEN 32
+
+/* NGTCP2_AEAD_BATCH_MAX is the maximum number of packet payloads
+   which are passed to encrypt_batch or decrypt_batch callback at
+   once. */
+#define NGTCP2_AEAD_BATCH_MAX 16
+
+/* NGTCP2_NONCELEN_MAX is the maximum length of nonce. */
+#define NGTCP2_NONCELEN_MAX 64
+
+/*
+ * ngtcp2_aead_batch accumulates packet payloads which are encrypted
+ * or decrypted together.
+ */
+typedef struct {
+  ngtcp2_aead_op ops[NGTCP2_AEAD_BATCH_MAX];
+  /* nonces stores nonce for each element of ops because nonce is
+     created in a temporary buffer. */
+  uint8_t nonces[NGTCP2_AEAD_BATCH_MAX][NGTCP2_NONCELEN_MAX];
+  size_t nops;
+} ngtcp2_aead_batch;
+
 struct ngtcp2_pkt_chain;
 typedef struct ngtcp2_pkt_chain ngtcp2_pkt_chain;
 
@@ -128,6 +152,13 @@ typedef enum {
   /* NGTCP2_CONN_FLAG_STATELESS_RETRY is set when a client receives
      Server Stateless Retry packet. */
   NGTCP2_CONN_FLAG_STATELESS_RETRY = 0x10,
+  /* NGTCP2_CONN_FLAG_USER_DECRYPT_BUF is set when decrypt_buf is
+     supplied by application, and is not owned by ngtcp2_conn. */
+  NGTCP2_CONN_FLAG_USER_DECRYPT_BUF = 0x20,
+  /* NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE is set when local
+     endpoint has initiated key update, and no packet protected by
+     the new key has been received from the remote endpoint yet. */
+  NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE = 0x40,
 } ngtcp2_conn_flag;
 
 struct ngtcp2_conn {
@@ -135,7 +166,19 @@ struct ngtcp2_conn {
   ngtcp2_conn_callbacks callbacks;
   ngtcp2_strm *strm0;
   ngtcp2_map strms;
+  /* strms_direct is the stream table indexed by stream ID.  It only
+     caches the streams whose stream ID is less than
+     NGTCP2_STRMS_DIRECT_LEN.  The same stream is also stored in
+     strms. */
+  ngtcp2_strm *strms_direct[NGTCP2_STRMS_DIRECT_LEN];
   ngtcp2_strm *fc_strms;
+  /* blocked_strms is a list of streams which are blocked by
+     connection level flow control. */
+  ngtcp2_strm *blocked_strms;
+  /* wr_strms is a list of streams which were blocked by flow
+     control, and then got additional credit.  Application retrieves
+     them by ngtcp2_conn_pop_writable_stream(). */
+  ngtcp2_strm *wr_strms;
   ngtcp2_idtr local_idtr;
   ngtcp2_idtr remote_idtr;
   uint64_t conn_id;
@@ -196,6 +239,14 @@ struct ngtcp2_conn {
   ngtcp2_crypto_km *hs_rx_ckm;
   ngtcp2_crypto_km *tx_ckm;
   ngtcp2_crypto_km *rx_ckm;
+  /* new_tx_ckm and new_rx_ckm are the keys of the next key phase,
+     which application derives ahead of time.  They are promoted to
+     tx_ckm and rx_ckm on key update. */
+  ngtcp2_crypto_km *new_tx_ckm;
+  ngtcp2_crypto_km *new_rx_ckm;
+  /* old_rx_ckm is the key of the previous key phase to decrypt
+     packets which are reordered across key update. */
+  ngtcp2_crypto_km *old_rx_ckm;
   size_t aead_overhead;
   /* buffed_rx_ppkts is buffered protected packets which come before
      handshake completed due to packet reordering. */
@@ -207,8 +258,14 @@ struct ngtcp2_conn {
   /* immediate_ack becomes nonzero if the next ack should be sent
      immediately. */
   uint8_t immediate_ack;
-  /* decrypt_buf is a buffer which is used to write decrypted data. */
+  /* decrypt_buf is a buffer which is used to write decrypted data.
+     If NGTCP2_CONN_FLAG_USER_DECRYPT_BUF is set, it is supplied by
+     application, and might be shared with other connections. */
   ngtcp2_array decrypt_buf;
+  /* aead_batch, if not NULL, collects protected packets to encrypt
+     them by a single call of encrypt_batch callback.  It is only set
+     during ngtcp2_conn_write_pkts. */
+  ngtcp2_aead_batch *aead_batch;
 };
 
 /*
@@ -32,7 +32,7 @@
 
 int ngtcp2_crypto_km_new(ngtcp2_crypto_km **pckm, const uint8_t *key,
                          size_t keylen, const uint8_t *iv, size_t ivlen,
-                         ngtcp2_mem *mem) {
+                         void *aead_ctx, ngtcp2_mem *mem) {
   size_t len;
   uint8_t *p;
 
@@ -50,6 +50,10 @@ int ngtcp2_crypto_km_new(ngtcp2_crypto_km **pckm, const uint8_t *key,
   (*pckm)->iv = p;
   (*pckm)->ivlen = ivlen;
   /*p = */ ngtcp2_cpymem(p, iv, ivlen);
+  (*pckm)->aead_ctx = aead_ctx;
+  (*pckm)->ivlo = ivlen >= 8 ? ngtcp2_get_uint64(iv + ivlen - 8) : 0;
+  (*pckm)->pkt_num = UINT64_MAX;
+  (*pckm)->flags = NGTCP2_CRYPTO_KM_FLAG_NONE;
 
   return 0;
 }
@@ -64,14 +68,19 @@ void ngtcp2_crypto_km_del(ngtcp2_crypto_km *ckm, ngtcp2_mem *mem) {
 
 void ngtcp2_crypto_create_nonce(uint8_t *dest, const uint8_t *iv, size_t ivlen,
                                 uint64_t pkt_num) {
-  size_t i;
+  assert(ivlen >= 8);
+
+  memcpy(dest, iv, ivlen - 8);
+  ngtcp2_put_uint64be(dest + ivlen - 8,
+                      ngtcp2_get_uint64(iv + ivlen - 8) ^ pkt_num);
+}
 
-  memcpy(dest, iv, ivlen);
-  pkt_num = bswap64(pkt_num);
+void ngtcp2_crypto_km_create_nonce(uint8_t *dest, const ngtcp2_crypto_km *ckm,
+                                   uint64_t pkt_num) {
+  assert(ckm->ivlen >= 8);
 
-  for (i = 0; i < 8; ++i) {
-    dest[ivlen - 8 + i] ^= ((uint8_t *)&pkt_num)[i];
-  }
+  memcpy(dest, ckm->iv, ckm->ivlen - 8);
+  ngtcp2_put_uint64be(dest + ckm->ivlen - 8, ckm->ivlo ^ pkt_num);
 }
 
 ssize_t ngtcp2_encode_transport_params(uint8_t *dest, size_t destlen,
@@ -37,16 +37,36 @@
    QUIC uses AEAD_AES_128_GCM, the overhead is 16 bytes. */
 #define NGTCP2_HANDSHAKE_AEAD_OVERHEAD 16
 
+typedef enum {
+  NGTCP2_CRYPTO_KM_FLAG_NONE = 0x00,
+  /* NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE is set if key phase bit is
+     set. */
+  NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE = 0x01,
+} ngtcp2_crypto_km_flag;
+
 typedef struct {
   const uint8_t *key;
   size_t keylen;
   const uint8_t *iv;
   size_t ivlen;
+  /* aead_ctx is an opaque cipher context provided by application.
+     It is already keyed with key, and passed to encrypt/decrypt
+     callbacks as is.  It might be NULL. */
+  void *aead_ctx;
+  /* ivlo is the last 8 bytes of iv in host byte order.  Packet
+     number is XORed with it to create a nonce. */
+  uint64_t ivlo;
+  /* pkt_num is the lowest packet number which has been decrypted
+     with this key.  It is UINT64_MAX if no packet has been decrypted
+     yet.  It is only meaningful for keys to decrypt packets. */
+  uint64_t pkt_num;
+  /* flags is bitwise OR of zero or more of ngtcp2_crypto_km_flag. */
+  uint8_t flags;
 } ngtcp2_crypto_km;
 
 int ngtcp2_crypto_km_new(ngtcp2_crypto_km **pckm, const uint8_t *key,
                          size_t keylen, const uint8_t *iv, size_t ivlen,
-                         ngtcp2_mem *mem);
+                         void *aead_ctx, ngtcp2_mem *mem);
 
 void ngtcp2_crypto_km_del(ngtcp2_crypto_km *ckm, ngtcp2_mem *mem);
 
@@ -58,7 +78,21 @@ typedef struct {
   void *user_data;
 } ngtcp2_crypto_ctx;
 
+/*
+ * ngtcp2_crypto_create_nonce writes a nonce created from |iv| of
+ * length |ivlen| and |pkt_num| to the buffer pointed by |dest|.  The
+ * buffer must have at least |ivlen| bytes.  |ivlen| must be at least
+ * 8.
+ */
 void ngtcp2_crypto_create_nonce(uint8_t *dest, const uint8_t *iv, size_t ivlen,
                                 uint64_t pkt_num);
 
+/*
+ * ngtcp2_crypto_km_create_nonce works like ngtcp2_crypto_create_nonce
+ * but uses |ckm|->iv, and the value cached in |ckm|->ivlo so that only
+ * a single 64 bits XOR is done per packet.
+ */
+void ngtcp2_crypto_km_create_nonce(uint8_t *dest, const ngtcp2_crypto_km *ckm,
+                                   uint64_t pkt_num);
+
 #endif /* NGTCP2_CRYPTO_H */
@@ -24,33 +24,17 @@
  */
 #include "ngtcp2_idtr.h"
 
+#include <string.h>
 #include <assert.h>
 
-int ngtcp2_idtr_gap_new(ngtcp2_idtr_gap **pg, uint64_t begin, uint64_t end,
-                        ngtcp2_mem *mem) {
-  *pg = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_idtr_gap));
-  if (*pg == NULL) {
-    return NGTCP2_ERR_NOMEM;
-  }
-
-  ngtcp2_range_init(&(*pg)->range, begin, end);
-  (*pg)->next = NULL;
-
-  return 0;
-}
-
-void ngtcp2_idtr_gap_del(ngtcp2_idtr_gap *g, ngtcp2_mem *mem) {
-  ngtcp2_mem_free(mem, g);
-}
+#include "ngtcp2_macro.h"
 
 int ngtcp2_idtr_init(ngtcp2_idtr *idtr, int server, ngtcp2_mem *mem) {
-  int rv;
-
-  rv = ngtcp2_idtr_gap_new(&idtr->gap, 0, UINT64_MAX, mem);
-  if (rv != 0) {
-    return rv;
-  }
+  ngtcp2_rangeset_init(&idtr->gap, NGTCP2_IDTR_WINDOW, UINT64_MAX, mem);
 
+  memset(idtr->bitmap, 0, sizeof(idtr->bitmap));
+  idtr->base = 0;
+  idtr->head = 0;
   idtr->server = server;
   idtr->mem = mem;
 
@@ -58,17 +42,11 @@ int ngtcp2_idtr_init(ngtcp2_idtr *idtr, int server, ngtcp2_mem *mem) {
 }
 
 void ngtcp2_idtr_free(ngtcp2_idtr *idtr) {
-  ngtcp2_idtr_gap *g, *next;
-
   if (idtr == NULL) {
     return;
   }
 
-  for (g = idtr->gap; g;) {
-    next = g->next;
-    ngtcp2_idtr_gap_del(g, idtr->mem);
-    g = next;
-  }
+  ngtcp2_rangeset_free(&idtr->gap);
 }
 
 /*
@@ -82,74 +60,146 @@ static uint64_t id_from_stream_id(uint32_t stream_id) {
   return (stream_id - 2) / 2;
 }
 
-int ngtcp2_idtr_open(ngtcp2_idtr *idtr, uint32_t stream_id) {
-  ngtcp2_idtr_gap *g, **pg;
+/*
+ * idtr_take_word removes the IDs in [begin, begin + 64) from the gap
+ * set of |idtr|, and returns the bitmap word for them.  A bit is set
+ * if the corresponding ID has been used.
+ */
+static uint64_t idtr_take_word(ngtcp2_idtr *idtr, uint64_t begin) {
+  uint64_t word = UINT64_MAX, b, e, i;
+  ngtcp2_range q = {begin, begin + 64};
+  const ngtcp2_range *g;
+  size_t idx, len = ngtcp2_rangeset_len(&idtr->gap);
   int rv;
-  uint64_t q;
+
+  for (idx = 0; idx < len; ++idx) {
+    g = ngtcp2_rangeset_get(&idtr->gap, idx);
+    if (g->begin >= q.end) {
+      break;
+    }
+
+    assert(q.begin <= g->begin);
+
+    b = g->begin - begin;
+    e = ngtcp2_min(g->end, q.end) - begin;
+    for (i = b; i < e; ++i) {
+      word &= ~(1ull << i);
+    }
+  }
+
+  /* The gap set is only trimmed from the left, which never requires
+     memory allocation. */
+  rv = ngtcp2_rangeset_remove(&idtr->gap, &q);
+  assert(rv == 0);
+  (void)rv;
+
+  return word;
+}
+
+/*
+ * idtr_slide moves the window of bitmap forward while the first word
+ * is full.
+ */
+static void idtr_slide(ngtcp2_idtr *idtr) {
+  for (; idtr->bitmap[idtr->head] == UINT64_MAX;) {
+    idtr->bitmap[idtr->head] =
+        idtr_take_word(idtr, idtr->base + NGTCP2_IDTR_WINDOW);
+    idtr->base += 64;
+    idtr->head = (idtr->head + 1) % NGTCP2_IDTR_BITMAP_LEN;
+  }
+}
+
+/*
+ * idtr_bitmap_word returns the pointer to the bitmap word which
+ * contains |q|, and assigns the bit mask for |q| to |*pmask|.  |q|
+ * must be in the window.
+ */
+static uint64_t *idtr_bitmap_word(ngtcp2_idtr *idtr, uint64_t *pmask,
+                                  uint64_t q) {
+  uint64_t d = q - idtr->base;
+
+  *pmask = 1ull << (d % 64);
+
+  return &idtr->bitmap[(idtr->head + d / 64) % NGTCP2_IDTR_BITMAP_LEN];
+}
+
+/*
+ * idtr_gap_open claims that |q| is in used.  |q| must be beyond the
+ * window.
+ */
+static int idtr_gap_open(ngtcp2_idtr *idtr, uint64_t q) {
+  size_t idx = ngtcp2_rangeset_lower_bound(&idtr->gap, q);
+  ngtcp2_range r = {q, q + 1};
+
+  if (idx == ngtcp2_rangeset_len(&idtr->gap) ||
+      q < ngtcp2_rangeset_get(&idtr->gap, idx)->begin) {
+    return NGTCP2_ERR_STREAM_IN_USE;
+  }
+
+  return ngtcp2_rangeset_remove(&idtr->gap, &r);
+}
+
+int ngtcp2_idtr_open(ngtcp2_idtr *idtr, uint32_t stream_id) {
+  uint64_t q, *w, mask;
 
   assert((idtr->server && (stream_id % 2) == 0) ||
          (!idtr->server && (stream_id % 2)));
 
   q = id_from_stream_id(stream_id);
 
-  for (pg = &idtr->gap; *pg; pg = &(*pg)->next) {
-    if (q < (*pg)->range.begin) {
-      return NGTCP2_ERR_STREAM_IN_USE;
-    }
-    if ((*pg)->range.end <= q) {
-      continue;
-    }
-    if (q == (*pg)->range.begin) {
-      if (ngtcp2_range_len(&(*pg)->range) == 1) {
-        g = *pg;
-        *pg = (*pg)->next;
-        ngtcp2_idtr_gap_del(g, idtr->mem);
-        return 0;
-      }
-      ++(*pg)->range.begin;
-      return 0;
-    }
+  if (q < idtr->base) {
+    return NGTCP2_ERR_STREAM_IN_USE;
+  }
 
-    rv = ngtcp2_idtr_gap_new(&g, (*pg)->range.begin, q, idtr->mem);
-    if (rv != 0) {
-      return rv;
-    }
+  if (q - idtr->base >= NGTCP2_IDTR_WINDOW) {
+    return idtr_gap_open(idtr, q);
+  }
 
-    (*pg)->range.begin = q + 1;
+  w = idtr_bitmap_word(idtr, &mask, q);
+  if (*w & mask) {
+    return NGTCP2_ERR_STREAM_IN_USE;
+  }
 
-    g->next = *pg;
-    *pg = g;
+  *w |= mask;
 
-    return 0;
-  }
+  idtr_slide(idtr);
 
-  return NGTCP2_ERR_STREAM_IN_USE;
+  return 0;
 }
 
 int ngtcp2_idtr_is_open(ngtcp2_idtr *idtr, uint32_t stream_id) {
-  ngtcp2_idtr_gap **pg;
-  uint64_t q;
+  uint64_t q, *w, mask;
+  size_t idx;
 
   assert((idtr->server && (stream_id % 2) == 0) ||
          (!idtr->server && (stream_id % 2)));
 
   q = id_from_stream_id(stream_id);
 
-  for (pg = &idtr->gap; *pg; pg = &(*pg)->next) {
-    if (q < (*pg)->range.begin) {
-      return NGTCP2_ERR_STREAM_IN_USE;
-    }
-    if ((*pg)->range.end <= q) {
-      continue;
-    }
-    break;
+  if (q < idtr->base) {
+    return NGTCP2_ERR_STREAM_IN_USE;
+  }
+
+  if (q - idtr->base < NGTCP2_IDTR_WINDOW) {
+    w = idtr_bitmap_word(idtr, &mask, q);
+    return (*w & mask) ? NGTCP2_ERR_STREAM_IN_USE : 0;
+  }
+
+  idx = ngtcp2_rangeset_lower_bound(&idtr->gap, q);
+  if (idx == ngtcp2_rangeset_len(&idtr->gap) ||
+      q < ngtcp2_rangeset_get(&idtr->gap, idx)->begin) {
+    return NGTCP2_ERR_STREAM_IN_USE;
   }
   return 0;
 }
 
 uint64_t ngtcp2_idtr_first_gap(ngtcp2_idtr *idtr) {
-  if (idtr->gap) {
-    return idtr->gap->range.begin;
-  }
-  return UINT64_MAX;
+  uint64_t word = idtr->bitmap[idtr->head];
+  uint64_t i;
+
+  /* idtr_slide ensures that the first word always has a zero bit. */
+  for (i = 0; word & 1; word >>= 1, ++i)
+    ;
+
+  return idtr->base + i;
 }
@@ -32,54 +32,40 @@
 #include <ngtcp2/ngtcp2.h>
 
 #include "ngtcp2_mem.h"
-#include "ngtcp2_range.h"
+#include "ngtcp2_rangeset.h"
 
-struct ngtcp2_idtr_gap;
-typedef struct ngtcp2_idtr_gap ngtcp2_idtr_gap;
+/* NGTCP2_IDTR_BITMAP_LEN is the number of 64 bit words in the bitmap
+   of ngtcp2_idtr. */
+#define NGTCP2_IDTR_BITMAP_LEN 4
 
-/*
- * ngtcp2_idtr_gap represents the gap, which is the range of ID that
- * is not used yet.
- */
-struct ngtcp2_idtr_gap {
-  /* next points to the next gap.  This singly linked list is ordered
-     by range.begin in the increasing order, and they never
-     overlap. */
-  ngtcp2_idtr_gap *next;
-  /* range is the range of this gap. */
-  ngtcp2_range range;
-};
-
-/*
- * ngtcp2_idtr_gap_new allocates new ngtcp2_idtr_gap object, and
- * assigns its pointer to |*pg|.  The caller should call
- * ngtcp2_idtr_gap_del to delete it when it is no longer used.  The
- * range of the gap is [begin, end).  |mem| is custom memory allocator
- * to allocate memory.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGTCP2_ERR_NOMEM
- *     Out of memory.
- */
-int ngtcp2_idtr_gap_new(ngtcp2_idtr_gap **pg, uint64_t begin, uint64_t end,
-                        ngtcp2_mem *mem);
-
-/*
- * ngtcp2_idtr_gap_del deallocates |g|.  It deallocates the memory
- * pointed by |g| it self.  |mem| is custom memory allocator to
- * deallocate memory.
- */
-void ngtcp2_idtr_gap_del(ngtcp2_idtr_gap *g, ngtcp2_mem *mem);
+/* NGTCP2_IDTR_WINDOW is the number of IDs that the bitmap of
+   ngtcp2_idtr covers. */
+#define NGTCP2_IDTR_WINDOW (NGTCP2_IDTR_BITMAP_LEN * 64)
 
 /*
  * ngtcp2_idtr tracks the usage of stream ID.
+ *
+ * The IDs in [base, base + NGTCP2_IDTR_WINDOW) are tracked by the
+ * bitmap.  The IDs less than base have all been used.  The window
+ * slides forward each time the ID at base is used, so that
+ * ngtcp2_idtr_open and ngtcp2_idtr_is_open are constant time as long
+ * as the peer stays within the window.  The IDs beyond the window are
+ * tracked by the gap set.
  */
 typedef struct {
-  /* gap maintains the range of ID which is not used yet. Initially,
-     its range is [0, UINT64_MAX). */
-  ngtcp2_idtr_gap *gap;
+  /* bitmap is a ring buffer of 64 bit words.  bitmap[head] covers the
+     IDs in [base, base + 64).  A bit is set if the corresponding ID
+     has been used. */
+  uint64_t bitmap[NGTCP2_IDTR_BITMAP_LEN];
+  /* base is the first ID that the bitmap covers.  It is always
+     multiple of 64. */
+  uint64_t base;
+  /* head is the index of bitmap which covers base. */
+  size_t head;
+  /* gap maintains the range of ID which is not used yet, and is
+     beyond the window of bitmap.  Initially, its range is
+     [NGTCP2_IDTR_WINDOW, UINT64_MAX). */
+  ngtcp2_rangeset gap;
   /* server is nonzero if this object records server initiated stream
      ID. */
   int server;
@@ -27,15 +27,14 @@
 
 #include <string.h>
 
-#include "ngtcp2_conv.h"
-
-#define INITIAL_TABLE_LENGTH 256
+#define INITIAL_TABLE_LENBITS 3
 
 int ngtcp2_map_init(ngtcp2_map *map, ngtcp2_mem *mem) {
   map->mem = mem;
-  map->tablelen = INITIAL_TABLE_LENGTH;
+  map->tablelenbits = INITIAL_TABLE_LENBITS;
+  map->tablelen = 1u << map->tablelenbits;
   map->table =
-      ngtcp2_mem_calloc(mem, map->tablelen, sizeof(ngtcp2_map_entry *));
+      ngtcp2_mem_calloc(mem, map->tablelen, sizeof(ngtcp2_map_bucket));
   if (map->table == NULL) {
     return NGTCP2_ERR_NOMEM;
   }
@@ -51,15 +50,20 @@ void ngtcp2_map_each_free(ngtcp2_map *map,
                           int (*func)(ngtcp2_map_entry *entry, void *ptr),
                           void *ptr) {
   uint32_t i;
+  ngtcp2_map_bucket *bkt;
+
   for (i = 0; i < map->tablelen; ++i) {
-    ngtcp2_map_entry *entry;
-    for (entry = map->table[i]; entry;) {
-      ngtcp2_map_entry *next = entry->next;
-      func(entry, ptr);
-      entry = next;
+    bkt = &map->table[i];
+
+    if (bkt->data == NULL) {
+      continue;
     }
-    map->table[i] = NULL;
+
+    func(bkt->data, ptr);
   }
+
+  memset(map->table, 0, sizeof(ngtcp2_map_bucket) * map->tablelen);
+  map->size = 0;
 }
 
 int ngtcp2_map_each(ngtcp2_map *map,
@@ -67,15 +71,18 @@ int ngtcp2_map_each(ngtcp2_map *map,
                     void *ptr) {
   int rv;
   uint32_t i;
+  ngtcp2_map_bucket *bkt;
+
   for (i = 0; i < map->tablelen; ++i) {
-    ngtcp2_map_entry *entry, *next;
-    for (entry = map->table[i]; entry;) {
-      next = entry->next;
-      rv = func(entry, ptr);
-      if (rv != 0) {
-        return rv;
-      }
-      entry = next;
+    bkt = &map->table[i];
+
+    if (bkt->data == NULL) {
+      continue;
+    }
+
+    rv = func(bkt->data, ptr);
+    if (rv != 0) {
+      return rv;
     }
   }
   return 0;
@@ -83,68 +90,74 @@ int ngtcp2_map_each(ngtcp2_map *map,
 
 void ngtcp2_map_entry_init(ngtcp2_map_entry *entry, key_type key) {
   entry->key = key;
-  entry->next = NULL;
 }
 
-/* FNV1a hash */
-static uint32_t hash(key_type key, uint32_t mod) {
-  uint8_t *p, *end;
-  uint32_t h = 0x811C9DC5u;
-
-  key = bswap64(key);
-  p = (uint8_t *)&key;
-  end = p + sizeof(key_type);
+/* Fibonacci hashing.  Keys are stream IDs, and they are allocated
+   sequentially.  Multiplication scatters them well enough. */
+static uint32_t hash(key_type key, uint32_t bits) {
+  return (uint32_t)((key * 11400714819323198485llu) >> (64 - bits));
+}
 
-  for (; p != end; ++p) {
-    h ^= *p;
-    h *= 0x01000193u;
-  }
+static void map_bucket_swap(ngtcp2_map_bucket *a, ngtcp2_map_bucket *b) {
+  ngtcp2_map_bucket c = *a;
 
-  return h & (mod - 1);
+  *a = *b;
+  *b = c;
 }
 
-static int insert(ngtcp2_map_entry **table, uint32_t tablelen,
-                  ngtcp2_map_entry *entry) {
-  uint32_t h = hash(entry->key, tablelen);
-  if (table[h] == NULL) {
-    table[h] = entry;
-  } else {
-    ngtcp2_map_entry *p;
-    /* We won't allow duplicated key, so check it out. */
-    for (p = table[h]; p; p = p->next) {
-      if (p->key == entry->key) {
-        return NGTCP2_ERR_INVALID_ARGUMENT;
-      }
+static int insert(ngtcp2_map_bucket *table, uint32_t tablelen,
+                  uint32_t tablelenbits, ngtcp2_map_entry *entry) {
+  uint32_t idx = hash(entry->key, tablelenbits);
+  ngtcp2_map_bucket b = {1, entry->key, entry}, *bkt;
+
+  for (;;) {
+    bkt = &table[idx];
+
+    if (bkt->data == NULL) {
+      *bkt = b;
+      return 0;
+    }
+
+    /* We won't allow duplicated key, so check it out.  If the key
+       exists, it is found before the first swap happens. */
+    if (bkt->key == b.key) {
+      return NGTCP2_ERR_INVALID_ARGUMENT;
+    }
+
+    if (bkt->psl < b.psl) {
+      map_bucket_swap(bkt, &b);
     }
-    entry->next = table[h];
-    table[h] = entry;
+
+    ++b.psl;
+    idx = (idx + 1) & (tablelen - 1);
   }
-  return 0;
 }
 
-/* new_tablelen must be power of 2 */
-static int resize(ngtcp2_map *map, uint32_t new_tablelen) {
+/* new_tablelen must be power of 2 and new_tablelen == (1u <<
+   new_tablelenbits) must hold. */
+static int resize(ngtcp2_map *map, uint32_t new_tablelen,
+                  uint32_t new_tablelenbits) {
   uint32_t i;
-  ngtcp2_map_entry **new_table;
+  ngtcp2_map_bucket *new_table, *bkt;
 
   new_table =
-      ngtcp2_mem_calloc(map->mem, new_tablelen, sizeof(ngtcp2_map_entry *));
+      ngtcp2_mem_calloc(map->mem, new_tablelen, sizeof(ngtcp2_map_bucket));
   if (new_table == NULL) {
     return NGTCP2_ERR_NOMEM;
   }
 
   for (i = 0; i < map->tablelen; ++i) {
-    ngtcp2_map_entry *entry;
-    for (entry = map->table[i]; entry;) {
-      ngtcp2_map_entry *next = entry->next;
-      entry->next = NULL;
-      /* This function must succeed */
-      insert(new_table, new_tablelen, entry);
-      entry = next;
+    bkt = &map->table[i];
+    if (bkt->data == NULL) {
+      continue;
     }
+    /* This function must succeed */
+    insert(new_table, new_tablelen, new_tablelenbits, bkt->data);
   }
+
   ngtcp2_mem_free(map->mem, map->table);
   map->tablelen = new_tablelen;
+  map->tablelenbits = new_tablelenbits;
   map->table = new_table;
 
   return 0;
@@ -152,14 +165,14 @@ static int resize(ngtcp2_map *map, uint32_t new_tablelen) {
 
 int ngtcp2_map_insert(ngtcp2_map *map, ngtcp2_map_entry *new_entry) {
   int rv;
-  /* Load factor is 0.75 */
-  if ((map->size + 1) * 4 > map->tablelen * 3) {
-    rv = resize(map, map->tablelen * 2);
+  /* Load factor is 0.875 */
+  if ((map->size + 1) * 8 > (size_t)map->tablelen * 7) {
+    rv = resize(map, map->tablelen * 2, map->tablelenbits + 1);
     if (rv != 0) {
       return rv;
     }
   }
-  rv = insert(map->table, map->tablelen, new_entry);
+  rv = insert(map->table, map->tablelen, map->tablelenbits, new_entry);
   if (rv != 0) {
     return rv;
   }
@@ -167,34 +180,68 @@ int ngtcp2_map_insert(ngtcp2_map *map, ngtcp2_map_entry *new_entry) {
   return 0;
 }
 
-ngtcp2_map_entry *ngtcp2_map_find(ngtcp2_map *map, key_type key) {
-  uint32_t h;
-  ngtcp2_map_entry *entry;
-  h = hash(key, map->tablelen);
-  for (entry = map->table[h]; entry; entry = entry->next) {
-    if (entry->key == key) {
-      return entry;
+/*
+ * map_find_bucket returns the index of the bucket which contains
+ * |key|.  If there is no such bucket, it returns map->tablelen.
+ */
+static uint32_t map_find_bucket(ngtcp2_map *map, key_type key) {
+  uint32_t idx = hash(key, map->tablelenbits), psl = 1;
+  ngtcp2_map_bucket *bkt;
+
+  for (;; ++psl) {
+    bkt = &map->table[idx];
+
+    if (bkt->data == NULL || bkt->psl < psl) {
+      return map->tablelen;
     }
+
+    if (bkt->key == key) {
+      return idx;
+    }
+
+    idx = (idx + 1) & (map->tablelen - 1);
   }
-  return NULL;
+}
+
+ngtcp2_map_entry *ngtcp2_map_find(ngtcp2_map *map, key_type key) {
+  uint32_t idx = map_find_bucket(map, key);
+
+  if (idx == map->tablelen) {
+    return NULL;
+  }
+
+  return map->table[idx].data;
 }
 
 int ngtcp2_map_remove(ngtcp2_map *map, key_type key) {
-  uint32_t h;
-  ngtcp2_map_entry **dst;
+  uint32_t idx, didx;
+  ngtcp2_map_bucket *bkt;
 
-  h = hash(key, map->tablelen);
+  idx = map_find_bucket(map, key);
+  if (idx == map->tablelen) {
+    return NGTCP2_ERR_INVALID_ARGUMENT;
+  }
 
-  for (dst = &map->table[h]; *dst; dst = &(*dst)->next) {
-    if ((*dst)->key != key) {
-      continue;
+  /* Shift the following buckets backward until we find an empty
+     bucket or the one which is already in its ideal position. */
+  for (;;) {
+    didx = idx;
+    idx = (idx + 1) & (map->tablelen - 1);
+    bkt = &map->table[idx];
+
+    if (bkt->data == NULL || bkt->psl == 1) {
+      map->table[didx].psl = 0;
+      map->table[didx].data = NULL;
+      break;
     }
 
-    *dst = (*dst)->next;
-    --map->size;
-    return 0;
+    --bkt->psl;
+    map->table[didx] = *bkt;
   }
-  return NGTCP2_ERR_INVALID_ARGUMENT;
+
+  --map->size;
+
+  return 0;
 }
 
 size_t ngtcp2_map_size(ngtcp2_map *map) { return map->size; }
@@ -34,20 +34,30 @@
 
 #include "ngtcp2_mem.h"
 
-/* Implementation of unordered map */
+/* Implementation of unordered map.  It uses open addressing with
+   Robin Hood hashing, and backward shift deletion so that no
+   tombstone is left behind. */
 
 typedef uint64_t key_type;
 
 typedef struct ngtcp2_map_entry {
-  struct ngtcp2_map_entry *next;
   key_type key;
 } ngtcp2_map_entry;
 
 typedef struct {
-  ngtcp2_map_entry **table;
+  /* psl is the probe sequence length of this bucket plus 1.  0 means
+     that the bucket is empty. */
+  uint32_t psl;
+  key_type key;
+  ngtcp2_map_entry *data;
+} ngtcp2_map_bucket;
+
+typedef struct {
+  ngtcp2_map_bucket *table;
   ngtcp2_mem *mem;
   size_t size;
   uint32_t tablelen;
+  uint32_t tablelenbits;
 } ngtcp2_map;
 
 /*
@@ -122,7 +132,8 @@ size_t ngtcp2_map_size(ngtcp2_map *map);
 
 /*
  * Applies the function |func| to each entry in the |map| with the
- * optional user supplied pointer |ptr|.
+ * optional user supplied pointer |ptr|.  The |func| must not insert
+ * to or remove from the |map|.
  *
  * If the |func| returns 0, this function calls the |func| with the
  * next entry. If the |func| returns nonzero, it will not call the
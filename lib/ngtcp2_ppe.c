@@ -94,18 +94,17 @@ ssize_t ngtcp2_ppe_final(ngtcp2_ppe *ppe, const uint8_t **ppkt) {
   ssize_t rv;
   ngtcp2_buf *buf = &ppe->buf;
   ngtcp2_crypto_ctx *ctx = ppe->ctx;
+  const ngtcp2_crypto_km *ckm = ctx->ckm;
   ngtcp2_conn *conn = ctx->user_data;
   uint8_t *payload = buf->begin + ppe->hdlen;
   size_t payloadlen = ngtcp2_buf_len(buf) - ppe->hdlen;
   size_t destlen = (size_t)(buf->end - buf->begin) - ppe->hdlen;
 
-  ngtcp2_crypto_create_nonce(ppe->nonce, ctx->ckm->iv, ctx->ckm->ivlen,
-                             ppe->pkt_num);
+  ngtcp2_crypto_km_create_nonce(ppe->nonce, ckm, ppe->pkt_num);
 
-  rv = ppe->ctx->encrypt(conn, payload, destlen, payload, payloadlen,
-                         ctx->ckm->key, ctx->ckm->keylen, ppe->nonce,
-                         ctx->ckm->ivlen, buf->begin, ppe->hdlen,
-                         conn->user_data);
+  rv = ctx->encrypt(conn, payload, destlen, payload, payloadlen, ckm->key,
+                    ckm->keylen, ckm->aead_ctx, ppe->nonce, ckm->ivlen,
+                    buf->begin, ppe->hdlen, conn->user_data);
   if (rv < 0) {
     return NGTCP2_ERR_CALLBACK_FAILURE;
   }
@@ -0,0 +1,170 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_rangeset.h"
+
+#include <string.h>
+#include <assert.h>
+
+void ngtcp2_rangeset_init(ngtcp2_rangeset *rs, uint64_t begin, uint64_t end,
+                          ngtcp2_mem *mem) {
+  ngtcp2_range_init(&rs->inline_ranges[0], begin, end);
+  rs->heap_ranges = NULL;
+  rs->len = 1;
+  rs->cap = NGTCP2_RANGESET_INLINE_LEN;
+  rs->mem = mem;
+}
+
+void ngtcp2_rangeset_free(ngtcp2_rangeset *rs) {
+  if (rs == NULL) {
+    return;
+  }
+
+  ngtcp2_mem_free(rs->mem, rs->heap_ranges);
+}
+
+static ngtcp2_range *rangeset_ranges(ngtcp2_rangeset *rs) {
+  if (rs->heap_ranges) {
+    return rs->heap_ranges;
+  }
+  return rs->inline_ranges;
+}
+
+/*
+ * rangeset_reserve makes sure that |rs| can store at least one more
+ * range.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory.
+ */
+static int rangeset_reserve(ngtcp2_rangeset *rs) {
+  ngtcp2_range *p;
+  size_t cap;
+
+  if (rs->len < rs->cap) {
+    return 0;
+  }
+
+  cap = rs->cap * 2;
+
+  p = ngtcp2_mem_malloc(rs->mem, sizeof(ngtcp2_range) * cap);
+  if (p == NULL) {
+    return NGTCP2_ERR_NOMEM;
+  }
+
+  memcpy(p, rangeset_ranges(rs), sizeof(ngtcp2_range) * rs->len);
+
+  ngtcp2_mem_free(rs->mem, rs->heap_ranges);
+  rs->heap_ranges = p;
+  rs->cap = cap;
+
+  return 0;
+}
+
+size_t ngtcp2_rangeset_lower_bound(ngtcp2_rangeset *rs, uint64_t x) {
+  ngtcp2_range *ranges = rangeset_ranges(rs);
+  size_t lo = 0, hi = rs->len, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (ranges[mid].end <= x) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+int ngtcp2_rangeset_remove(ngtcp2_rangeset *rs, const ngtcp2_range *r) {
+  ngtcp2_range *ranges;
+  size_t i, j, k;
+  uint64_t end;
+  int rv;
+
+  i = ngtcp2_rangeset_lower_bound(rs, r->begin);
+  ranges = rangeset_ranges(rs);
+
+  if (i == rs->len || r->end <= ranges[i].begin || r->begin == r->end) {
+    return 0;
+  }
+
+  if (ranges[i].begin < r->begin && r->end < ranges[i].end) {
+    rv = rangeset_reserve(rs);
+    if (rv != 0) {
+      return rv;
+    }
+
+    ranges = rangeset_ranges(rs);
+
+    end = ranges[i].end;
+    ranges[i].end = r->begin;
+
+    memmove(&ranges[i + 2], &ranges[i + 1],
+            sizeof(ngtcp2_range) * (rs->len - i - 1));
+    ngtcp2_range_init(&ranges[i + 1], r->end, end);
+    ++rs->len;
+
+    return 0;
+  }
+
+  j = i;
+  if (ranges[i].begin < r->begin) {
+    ranges[i].end = r->begin;
+    ++j;
+  }
+
+  k = ngtcp2_rangeset_lower_bound(rs, r->end);
+  if (k < rs->len && ranges[k].begin < r->end) {
+    ranges[k].begin = r->end;
+  }
+
+  assert(j <= k);
+
+  if (j < k) {
+    memmove(&ranges[j], &ranges[k], sizeof(ngtcp2_range) * (rs->len - k));
+    rs->len -= k - j;
+  }
+
+  return 0;
+}
+
+const ngtcp2_range *ngtcp2_rangeset_get(ngtcp2_rangeset *rs, size_t idx) {
+  assert(idx < rs->len);
+
+  return &rangeset_ranges(rs)[idx];
+}
+
+size_t ngtcp2_rangeset_len(ngtcp2_rangeset *rs) { return rs->len; }
+
+uint64_t ngtcp2_rangeset_first_begin(ngtcp2_rangeset *rs) {
+  if (rs->len == 0) {
+    return UINT64_MAX;
+  }
+  return rangeset_ranges(rs)[0].begin;
+}
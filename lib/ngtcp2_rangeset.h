@@ -0,0 +1,114 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef NGTCP2_RANGESET_H
+#define NGTCP2_RANGESET_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "ngtcp2_mem.h"
+#include "ngtcp2_range.h"
+
+/* NGTCP2_RANGESET_INLINE_LEN is the number of ranges that
+   ngtcp2_rangeset stores without allocating memory. */
+#define NGTCP2_RANGESET_INLINE_LEN 4
+
+/*
+ * ngtcp2_rangeset is a set of ranges.  The ranges are stored in an
+ * array ordered by begin in the increasing order, and they never
+ * overlap.  Up to NGTCP2_RANGESET_INLINE_LEN ranges are stored in
+ * the object itself.  If more ranges are needed, the array is moved
+ * to heap memory.
+ */
+typedef struct {
+  /* inline_ranges stores ranges while cap <=
+     NGTCP2_RANGESET_INLINE_LEN. */
+  ngtcp2_range inline_ranges[NGTCP2_RANGESET_INLINE_LEN];
+  /* heap_ranges stores ranges while cap >
+     NGTCP2_RANGESET_INLINE_LEN. */
+  ngtcp2_range *heap_ranges;
+  /* len is the number of ranges stored. */
+  size_t len;
+  /* cap is the capacity of the array. */
+  size_t cap;
+  /* mem is custom memory allocator */
+  ngtcp2_mem *mem;
+} ngtcp2_rangeset;
+
+/*
+ * ngtcp2_rangeset_init initializes |rs| so that it contains a single
+ * range [|begin|, |end|).  It does not allocate memory.
+ */
+void ngtcp2_rangeset_init(ngtcp2_rangeset *rs, uint64_t begin, uint64_t end,
+                          ngtcp2_mem *mem);
+
+/*
+ * ngtcp2_rangeset_free frees resources allocated for |rs|.
+ */
+void ngtcp2_rangeset_free(ngtcp2_rangeset *rs);
+
+/*
+ * ngtcp2_rangeset_remove removes the range |r| from |rs|.  The ranges
+ * in |rs| which partially overlap |r| are trimmed, and a range which
+ * contains |r| is split into two.
+ *
+ * This function returns 0 if it succeeds, or one of the following
+ * negative error codes:
+ *
+ * NGTCP2_ERR_NOMEM
+ *     Out of memory.
+ */
+int ngtcp2_rangeset_remove(ngtcp2_rangeset *rs, const ngtcp2_range *r);
+
+/*
+ * ngtcp2_rangeset_lower_bound returns the index of the first range in
+ * |rs| whose end is larger than |x|.  In other words, it is the first
+ * range which contains |x| or starts after |x|.  If there is no such
+ * range, it returns ngtcp2_rangeset_len(rs).
+ */
+size_t ngtcp2_rangeset_lower_bound(ngtcp2_rangeset *rs, uint64_t x);
+
+/*
+ * ngtcp2_rangeset_get returns the pointer to |idx|-th range in |rs|.
+ * |idx| must be less than ngtcp2_rangeset_len(rs).  The returned
+ * pointer is invalidated by ngtcp2_rangeset_remove.
+ */
+const ngtcp2_range *ngtcp2_rangeset_get(ngtcp2_rangeset *rs, size_t idx);
+
+/*
+ * ngtcp2_rangeset_len returns the number of ranges in |rs|.
+ */
+size_t ngtcp2_rangeset_len(ngtcp2_rangeset *rs);
+
+/*
+ * ngtcp2_rangeset_first_begin returns the beginning of the first
+ * range in |rs|.  If |rs| is empty, it returns UINT64_MAX.
+ */
+uint64_t ngtcp2_rangeset_first_begin(ngtcp2_rangeset *rs);
+
+#endif /* NGTCP2_RANGESET_H */
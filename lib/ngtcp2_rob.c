@@ -29,23 +29,6 @@
 
 #include "ngtcp2_macro.h"
 
-int ngtcp2_rob_gap_new(ngtcp2_rob_gap **pg, uint64_t begin, uint64_t end,
-                       ngtcp2_mem *mem) {
-  *pg = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_rob_gap));
-  if (*pg == NULL) {
-    return NGTCP2_ERR_NOMEM;
-  }
-
-  ngtcp2_range_init(&(*pg)->range, begin, end);
-  (*pg)->next = NULL;
-
-  return 0;
-}
-
-void ngtcp2_rob_gap_del(ngtcp2_rob_gap *g, ngtcp2_mem *mem) {
-  ngtcp2_mem_free(mem, g);
-}
-
 int ngtcp2_rob_data_new(ngtcp2_rob_data **pd, uint64_t offset, size_t chunk,
                         ngtcp2_mem *mem) {
   *pd = ngtcp2_mem_malloc(mem, sizeof(ngtcp2_rob_data) + chunk);
@@ -66,12 +49,7 @@ void ngtcp2_rob_data_del(ngtcp2_rob_data *d, ngtcp2_mem *mem) {
 }
 
 int ngtcp2_rob_init(ngtcp2_rob *rob, size_t chunk, ngtcp2_mem *mem) {
-  int rv;
-
-  rv = ngtcp2_rob_gap_new(&rob->gap, 0, UINT64_MAX, mem);
-  if (rv != 0) {
-    return rv;
-  }
+  ngtcp2_rangeset_init(&rob->gap, 0, UINT64_MAX, mem);
 
   rob->data = NULL;
   rob->chunk = chunk;
@@ -81,18 +59,13 @@ int ngtcp2_rob_init(ngtcp2_rob *rob, size_t chunk, ngtcp2_mem *mem) {
 }
 
 void ngtcp2_rob_free(ngtcp2_rob *rob) {
-  ngtcp2_rob_gap *g, *ng;
   ngtcp2_rob_data *d, *nd;
 
   if (rob == NULL) {
     return;
   }
 
-  for (g = rob->gap; g;) {
-    ng = g->next;
-    ngtcp2_rob_gap_del(g, rob->mem);
-    g = ng;
-  }
+  ngtcp2_rangeset_free(&rob->gap);
   for (d = rob->data; d;) {
     nd = d->next;
     ngtcp2_rob_data_del(d, rob->mem);
@@ -100,17 +73,6 @@ void ngtcp2_rob_free(ngtcp2_rob *rob) {
   }
 }
 
-static void insert_gap(ngtcp2_rob_gap **pg, ngtcp2_rob_gap *g) {
-  g->next = (*pg)->next;
-  (*pg)->next = g;
-}
-
-static void remove_gap(ngtcp2_rob_gap **pg, ngtcp2_mem *mem) {
-  ngtcp2_rob_gap *g = *pg;
-  *pg = g->next;
-  ngtcp2_rob_gap_del(g, mem);
-}
-
 static void remove_data(ngtcp2_rob_data **pd, ngtcp2_mem *mem) {
   ngtcp2_rob_data *d = *pd;
   *pd = d->next;
@@ -154,66 +116,42 @@ static int rob_write_data(ngtcp2_rob *rob, ngtcp2_rob_data **pd,
 int ngtcp2_rob_push(ngtcp2_rob *rob, uint64_t offset, const uint8_t *data,
                     size_t datalen) {
   int rv;
-  ngtcp2_rob_gap **pg;
-  ngtcp2_range m, l, r, q = {offset, offset + datalen};
+  size_t i, len;
+  const ngtcp2_range *g;
+  ngtcp2_range m, q = {offset, offset + datalen};
   ngtcp2_rob_data **pd = &rob->data;
 
-  for (pg = &rob->gap; *pg;) {
-    m = ngtcp2_range_intersect(&q, &(*pg)->range);
-    if (ngtcp2_range_len(&m)) {
-      if (ngtcp2_range_equal(&(*pg)->range, &m)) {
-        remove_gap(pg, rob->mem);
-        rv = rob_write_data(rob, pd, m.begin, data + (m.begin - offset),
-                            ngtcp2_range_len(&m));
-        if (rv != 0) {
-          return rv;
-        }
-        continue;
-      }
-      ngtcp2_range_cut(&l, &r, &(*pg)->range, &m);
-      if (ngtcp2_range_len(&l)) {
-        (*pg)->range = l;
-
-        if (ngtcp2_range_len(&r)) {
-          ngtcp2_rob_gap *ng;
-          rv = ngtcp2_rob_gap_new(&ng, r.begin, r.end, rob->mem);
-          if (rv != 0) {
-            return rv;
-          }
-          insert_gap(pg, ng);
-          pg = &((*pg)->next);
-        }
-      } else if (ngtcp2_range_len(&r)) {
-        (*pg)->range = r;
-      }
-      rv = rob_write_data(rob, pd, m.begin, data + (m.begin - offset),
-                          ngtcp2_range_len(&m));
-      if (rv != 0) {
-        return rv;
-      }
-    }
-    if (ngtcp2_range_not_after(&q, &(*pg)->range)) {
+  len = ngtcp2_rangeset_len(&rob->gap);
+
+  for (i = ngtcp2_rangeset_lower_bound(&rob->gap, offset); i < len; ++i) {
+    g = ngtcp2_rangeset_get(&rob->gap, i);
+    if (q.end <= g->begin) {
       break;
     }
-    pg = &((*pg)->next);
+    m = ngtcp2_range_intersect(&q, g);
+    if (!ngtcp2_range_len(&m)) {
+      continue;
+    }
+    rv = rob_write_data(rob, pd, m.begin, data + (m.begin - offset),
+                        ngtcp2_range_len(&m));
+    if (rv != 0) {
+      return rv;
+    }
   }
-  return 0;
+
+  return ngtcp2_rangeset_remove(&rob->gap, &q);
 }
 
 void ngtcp2_rob_remove_prefix(ngtcp2_rob *rob, uint64_t offset) {
-  ngtcp2_rob_gap **pg;
   ngtcp2_rob_data **pd;
+  ngtcp2_range q = {0, offset};
+  int rv;
 
-  for (pg = &rob->gap; *pg;) {
-    if (offset <= (*pg)->range.begin) {
-      break;
-    }
-    if (offset < (*pg)->range.end) {
-      (*pg)->range.begin = offset;
-      break;
-    }
-    remove_gap(pg, rob->mem);
-  }
+  /* Removing prefix never splits a gap, so it does not allocate
+     memory. */
+  rv = ngtcp2_rangeset_remove(&rob->gap, &q);
+  assert(rv == 0);
+  (void)rv;
 
   for (pd = &rob->data; *pd;) {
     if (offset <= (*pd)->offset) {
@@ -228,10 +166,10 @@ void ngtcp2_rob_remove_prefix(ngtcp2_rob *rob, uint64_t offset) {
 
 size_t ngtcp2_rob_data_at(ngtcp2_rob *rob, const uint8_t **pdest,
                           uint64_t offset) {
-  ngtcp2_rob_gap *g = rob->gap;
+  uint64_t gap_begin = ngtcp2_rangeset_first_begin(&rob->gap);
   ngtcp2_rob_data *d = rob->data;
 
-  if (g->range.begin <= offset) {
+  if (gap_begin <= offset) {
     return 0;
   }
 
@@ -241,7 +179,7 @@ size_t ngtcp2_rob_data_at(ngtcp2_rob *rob, const uint8_t **pdest,
 
   *pdest = d->begin + (offset - d->offset);
 
-  return ngtcp2_min(g->range.begin, d->offset + rob->chunk) - offset;
+  return ngtcp2_min(gap_begin, d->offset + rob->chunk) - offset;
 }
 
 void ngtcp2_rob_pop(ngtcp2_rob *rob, uint64_t offset, size_t len) {
@@ -257,8 +195,5 @@ void ngtcp2_rob_pop(ngtcp2_rob *rob, uint64_t offset, size_t len) {
 }
 
 uint64_t ngtcp2_rob_first_gap_offset(ngtcp2_rob *rob) {
-  if (rob->gap) {
-    return rob->gap->range.begin;
-  }
-  return UINT64_MAX;
+  return ngtcp2_rangeset_first_begin(&rob->gap);
 }
@@ -32,45 +32,7 @@
 #include <ngtcp2/ngtcp2.h>
 
 #include "ngtcp2_mem.h"
-#include "ngtcp2_range.h"
-
-struct ngtcp2_rob_gap;
-typedef struct ngtcp2_rob_gap ngtcp2_rob_gap;
-
-/*
- * ngtcp2_rob_gap represents the gap, which is the range of stream
- * data that is not received yet.
- */
-struct ngtcp2_rob_gap {
-  /* next points to the next gap.  This singly linked list is ordered
-     by range.begin in the increasing order, and they never
-     overlap. */
-  ngtcp2_rob_gap *next;
-  /* range is the range of this gap. */
-  ngtcp2_range range;
-};
-
-/*
- * ngtcp2_rob_gap_new allocates new ngtcp2_rob_gap object, and assigns
- * its pointer to |*pg|.  The caller should call ngtcp2_rob_gap_del to
- * delete it when it is no longer used.  The range of the gap is
- * [begin, end).  |mem| is custom memory allocator to allocate memory.
- *
- * This function returns 0 if it succeeds, or one of the following
- * negative error codes:
- *
- * NGTCP2_ERR_NOMEM
- *     Out of memory.
- */
-int ngtcp2_rob_gap_new(ngtcp2_rob_gap **pg, uint64_t begin, uint64_t end,
-                       ngtcp2_mem *mem);
-
-/*
- * ngtcp2_rob_gap_del deallocates |g|.  It deallocates the memory
- * pointed by |g| it self.  |mem| is custom memory allocator to
- * deallocate memory.
- */
-void ngtcp2_rob_gap_del(ngtcp2_rob_gap *g, ngtcp2_mem *mem);
+#include "ngtcp2_rangeset.h"
 
 struct ngtcp2_rob_data;
 typedef struct ngtcp2_rob_data ngtcp2_rob_data;
@@ -121,7 +83,7 @@ void ngtcp2_rob_data_del(ngtcp2_rob_data *d, ngtcp2_mem *mem);
 typedef struct {
   /* gap maintains the range of offset which is not received
      yet. Initially, its range is [0, UINT64_MAX). */
-  ngtcp2_rob_gap *gap;
+  ngtcp2_rangeset gap;
   /* data maintains the list of buffers which store received data
      ordered by stream offset. */
   ngtcp2_rob_data *data;
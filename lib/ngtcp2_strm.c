@@ -39,11 +39,12 @@ int ngtcp2_strm_init(ngtcp2_strm *strm, uint32_t stream_id, uint32_t flags,
   strm->stream_user_data = stream_user_data;
   strm->max_rx_offset = strm->unsent_max_rx_offset = max_rx_offset;
   strm->max_tx_offset = max_tx_offset;
-  strm->me.key = stream_id;
-  strm->me.next = NULL;
+  ngtcp2_map_entry_init(&strm->me, stream_id);
   strm->mem = mem;
   strm->fc_pprev = NULL;
   strm->fc_next = NULL;
+  strm->wr_pprev = NULL;
+  strm->wr_next = NULL;
   /* Initializing to 0 is a bit controversial because application
      error code 0 is STOPPING.  But STOPPING is only sent with
      RST_STREAM in response to STOP_SENDING, and it is not used to
@@ -57,6 +57,9 @@ typedef enum {
   /* NGTCP2_STRM_FLAG_STOP_SENDING indicates that STOP_SENDING is sent
      from the local endpoint. */
   NGTCP2_STRM_FLAG_STOP_SENDING = 0x10,
+  /* NGTCP2_STRM_FLAG_BLOCKED indicates that the local endpoint
+     cannot send stream data because of stream level flow control. */
+  NGTCP2_STRM_FLAG_BLOCKED = 0x20,
 } ngtcp2_strm_flags;
 
 struct ngtcp2_strm;
@@ -89,6 +92,9 @@ struct ngtcp2_strm {
   /* flags is bit-wise OR of zero or more of ngtcp2_strm_flags. */
   uint32_t flags;
   ngtcp2_strm **fc_pprev, *fc_next;
+  /* wr_pprev and wr_next link this stream into either
+     ngtcp2_conn.blocked_strms or ngtcp2_conn.wr_strms. */
+  ngtcp2_strm **wr_pprev, *wr_next;
   /* app_error_code is an error code the local endpoint sent in
      RST_STREAM or STOP_SENDING. */
   uint16_t app_error_code;
@@ -0,0 +1,499 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <ngtcp2/ngtcp2.h>
+
+#include "ngtcp2_conn.h"
+#include "ngtcp2_pkt.h"
+#include "ngtcp2_ppe.h"
+#include "ngtcp2_idtr.h"
+#include "ngtcp2_test_helper.h"
+
+/*
+ * bench runs micro-benchmarks of the library internals, and prints
+ * the average time per operation.  Encryption is replaced with a
+ * null cipher, or an identity AEAD provided by fake_encrypt and
+ * fake_decrypt, so that only the cost of the library is measured.
+ *
+ * Usage: bench [ITERATIONS]
+ */
+
+static uint8_t null_key[16];
+static uint8_t null_iv[12];
+static uint8_t null_data[4096];
+
+static ssize_t null_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                            const uint8_t *plaintext, size_t plaintextlen,
+                            const uint8_t *key, size_t keylen, void *aead_ctx,
+                            const uint8_t *nonce, size_t noncelen,
+                            const uint8_t *ad, size_t adlen, void *user_data) {
+  (void)conn;
+  (void)dest;
+  (void)destlen;
+  (void)plaintext;
+  (void)key;
+  (void)keylen;
+  (void)aead_ctx;
+  (void)nonce;
+  (void)noncelen;
+  (void)ad;
+  (void)adlen;
+  (void)user_data;
+  return (ssize_t)plaintextlen;
+}
+
+static uint64_t timestamp_ns(void) {
+  struct timespec tp;
+
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+
+  return (uint64_t)tp.tv_sec * 1000000000 + (uint64_t)tp.tv_nsec;
+}
+
+static void report(const char *name, size_t n, uint64_t elapsed) {
+  printf("%-24s %10zu iterations %10.1f ns/op\n", name, n,
+         (double)elapsed / (double)n);
+}
+
+/*
+ * bench_ppe encodes a short header packet which contains a single
+ * STREAM frame using ngtcp2_ppe.
+ */
+static void bench_ppe(size_t n) {
+  ngtcp2_conn conn;
+  ngtcp2_crypto_km *ckm;
+  ngtcp2_crypto_ctx ctx;
+  ngtcp2_ppe ppe;
+  ngtcp2_pkt_hd hd;
+  ngtcp2_frame fr;
+  uint8_t buf[1280];
+  uint64_t pkt_num, start;
+  ssize_t nwrite;
+  int rv;
+
+  memset(&conn, 0, sizeof(conn));
+
+  rv = ngtcp2_crypto_km_new(&ckm, null_key, sizeof(null_key), null_iv,
+                            sizeof(null_iv), NULL, ngtcp2_mem_default());
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_crypto_km_new: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  memset(&ctx, 0, sizeof(ctx));
+  ctx.ckm = ckm;
+  ctx.aead_overhead = 0;
+  ctx.encrypt = null_encrypt;
+  ctx.user_data = &conn;
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.flags = 0;
+  fr.stream.fin = 0;
+  fr.stream.stream_id = 1;
+  fr.stream.data = null_data;
+  fr.stream.datalen = 1200;
+
+  start = timestamp_ns();
+
+  for (pkt_num = 0; pkt_num < n; ++pkt_num) {
+    ngtcp2_pkt_hd_init(&hd, NGTCP2_PKT_FLAG_CONN_ID, NGTCP2_PKT_03, 0x1,
+                       pkt_num, NGTCP2_PROTO_VER_MAX);
+    fr.stream.offset = pkt_num * fr.stream.datalen;
+
+    ngtcp2_ppe_init(&ppe, buf, sizeof(buf), &ctx);
+    if (ngtcp2_ppe_encode_hd(&ppe, &hd) != 0 ||
+        ngtcp2_ppe_encode_frame(&ppe, &fr) != 0) {
+      fprintf(stderr, "bench_ppe: could not encode packet\n");
+      exit(EXIT_FAILURE);
+    }
+    nwrite = ngtcp2_ppe_final(&ppe, NULL);
+    if (nwrite < 0) {
+      fprintf(stderr, "ngtcp2_ppe_final: %s\n", ngtcp2_strerror((int)nwrite));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  report("ppe_encode", n, timestamp_ns() - start);
+
+  ngtcp2_crypto_km_del(ckm, ngtcp2_mem_default());
+}
+
+/*
+ * bench_shuffle shuffles each block of |blklen| elements of |ids|
+ * whose length is |n|.  It uses xorshift so that the order is the
+ * same between runs.
+ */
+static void bench_shuffle(uint32_t *ids, size_t n, size_t blklen) {
+  uint64_t x = 88172645463325252ull;
+  size_t i, j, k, len;
+  uint32_t t;
+
+  for (i = 0; i < n; i += blklen) {
+    len = n - i < blklen ? n - i : blklen;
+    for (j = len - 1; j > 0; --j) {
+      x ^= x << 13;
+      x ^= x >> 7;
+      x ^= x << 17;
+      k = (size_t)(x % (j + 1));
+      t = ids[i + j];
+      ids[i + j] = ids[i + k];
+      ids[i + k] = t;
+    }
+  }
+}
+
+/*
+ * bench_idtr opens |n| client initiated stream IDs in ngtcp2_idtr.
+ * The IDs are shuffled within each block of |blklen| IDs as if
+ * requests arrive out of order.  With |blklen| larger than
+ * NGTCP2_IDTR_WINDOW, some IDs go beyond the bitmap.
+ */
+static void bench_idtr(size_t n, size_t blklen) {
+  ngtcp2_idtr idtr;
+  uint32_t *ids;
+  uint64_t start, elapsed;
+  char name[32];
+  size_t i;
+  int rv;
+
+  ids = malloc(sizeof(ids[0]) * n);
+  if (ids == NULL) {
+    fprintf(stderr, "bench_idtr: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < n; ++i) {
+    ids[i] = (uint32_t)(i * 2 + 1);
+  }
+
+  bench_shuffle(ids, n, blklen);
+
+  rv = ngtcp2_idtr_init(&idtr, 0, ngtcp2_mem_default());
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_idtr_init: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  start = timestamp_ns();
+
+  for (i = 0; i < n; ++i) {
+    rv = ngtcp2_idtr_open(&idtr, ids[i]);
+    if (rv != 0) {
+      fprintf(stderr, "ngtcp2_idtr_open: %s\n", ngtcp2_strerror(rv));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  elapsed = timestamp_ns() - start;
+
+  snprintf(name, sizeof(name), "idtr_open/%zu", blklen);
+  report(name, n, elapsed);
+
+  ngtcp2_idtr_free(&idtr);
+  free(ids);
+}
+
+static int bench_recv_stream_data(ngtcp2_conn *conn, uint32_t stream_id,
+                                  uint8_t fin, const uint8_t *data,
+                                  size_t datalen, void *user_data,
+                                  void *stream_user_data) {
+  int rv;
+  (void)fin;
+  (void)data;
+  (void)user_data;
+  (void)stream_user_data;
+
+  rv = ngtcp2_conn_extend_max_stream_offset(conn, stream_id, datalen);
+  if (rv != 0) {
+    return NGTCP2_ERR_CALLBACK_FAILURE;
+  }
+
+  ngtcp2_conn_extend_max_offset(conn, datalen);
+
+  return 0;
+}
+
+static void bench_settings(ngtcp2_settings *settings) {
+  memset(settings, 0, sizeof(*settings));
+  settings->max_stream_data = 256 * 1024;
+  settings->max_data = 1024 * 1024;
+  settings->max_stream_id = 1;
+  settings->idle_timeout = 60;
+  settings->max_packet_size = NGTCP2_MAX_PKT_SIZE;
+}
+
+/*
+ * bench_flush sends all packets which |src| has to |dst|.
+ */
+static void bench_flush(ngtcp2_conn *src, ngtcp2_conn *dst, ngtcp2_tstamp ts) {
+  uint8_t buf[1280];
+  ssize_t nwrite;
+  int rv;
+
+  for (;;) {
+    nwrite = ngtcp2_conn_write_pkt(src, buf, sizeof(buf), ts);
+    if (nwrite < 0) {
+      fprintf(stderr, "ngtcp2_conn_write_pkt: %s\n",
+              ngtcp2_strerror((int)nwrite));
+      exit(EXIT_FAILURE);
+    }
+    if (nwrite == 0) {
+      return;
+    }
+
+    rv = ngtcp2_conn_recv(dst, buf, (size_t)nwrite, ts);
+    if (rv != 0) {
+      fprintf(stderr, "ngtcp2_conn_recv: %s\n", ngtcp2_strerror(rv));
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/*
+ * bench_conn_stream sends stream data from client to server in
+ * process.  ngtcp2_conn_write_stream and ngtcp2_conn_recv are timed
+ * separately.  Server sends ACK and flow control credit back every 16
+ * packets.
+ */
+static void bench_conn_stream(size_t n) {
+  ngtcp2_conn *client, *server;
+  ngtcp2_conn_callbacks cb;
+  ngtcp2_settings settings;
+  uint8_t buf[1280];
+  uint64_t start, t, write_elapsed = 0, recv_elapsed = 0, bytes = 0;
+  ngtcp2_tstamp ts = 0;
+  size_t i, ndatalen;
+  ssize_t nwrite;
+  int rv;
+
+  memset(&cb, 0, sizeof(cb));
+  fake_crypto_callbacks(&cb);
+  bench_settings(&settings);
+
+  rv = ngtcp2_conn_client_new(&client, 0x1, NGTCP2_PROTO_VER_MAX, &cb,
+                              &settings, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_conn_client_new: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  cb.recv_stream_data = bench_recv_stream_data;
+
+  rv = ngtcp2_conn_server_new(&server, 0x1, NGTCP2_PROTO_VER_MAX, &cb,
+                              &settings, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_conn_server_new: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  rv = fake_handshake(client, server);
+  if (rv != 0) {
+    fprintf(stderr, "fake_handshake: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  rv = ngtcp2_conn_open_stream(client, 1, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_conn_open_stream: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < n; ++i) {
+    ts += 100;
+
+    start = timestamp_ns();
+
+    nwrite = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 1,
+                                      0, null_data, sizeof(null_data), ts);
+
+    t = timestamp_ns();
+    write_elapsed += t - start;
+
+    if (nwrite <= 0) {
+      fprintf(stderr, "ngtcp2_conn_write_stream: %s\n",
+              nwrite == 0 ? "no packet" : ngtcp2_strerror((int)nwrite));
+      exit(EXIT_FAILURE);
+    }
+
+    rv = ngtcp2_conn_recv(server, buf, (size_t)nwrite, ts);
+
+    recv_elapsed += timestamp_ns() - t;
+
+    if (rv != 0) {
+      fprintf(stderr, "ngtcp2_conn_recv: %s\n", ngtcp2_strerror(rv));
+      exit(EXIT_FAILURE);
+    }
+
+    bytes += ndatalen;
+
+    if ((i & 0xf) == 0xf) {
+      bench_flush(server, client, ts + NGTCP2_DELAYED_ACK_TIMEOUT);
+    }
+  }
+
+  report("conn_write_stream", n, write_elapsed);
+  report("conn_recv", n, recv_elapsed);
+  printf("%-24s %10.1f Mbps, %10.0f packets/s\n", "conn_stream",
+         (double)bytes * 8 * 1000 / (double)(write_elapsed + recv_elapsed),
+         (double)n * 1000000000 / (double)(write_elapsed + recv_elapsed));
+
+  ngtcp2_conn_del(server);
+  ngtcp2_conn_del(client);
+}
+
+static int bench_decrypt_batch(ngtcp2_conn *conn, ngtcp2_aead_op *ops,
+                               size_t nops, const uint8_t *key, size_t keylen,
+                               void *aead_ctx, void *user_data) {
+  size_t i;
+
+  for (i = 0; i < nops; ++i) {
+    ops[i].nwrite = fake_decrypt(conn, ops[i].dest, ops[i].destlen,
+                                 ops[i].src, ops[i].srclen, key, keylen,
+                                 aead_ctx, ops[i].nonce, ops[i].noncelen,
+                                 ops[i].ad, ops[i].adlen, user_data);
+  }
+
+  return 0;
+}
+
+#define BENCH_RECV_BATCH 16
+
+/*
+ * bench_conn_recv_pkts sends stream data from client to server in
+ * process like bench_conn_stream, but server receives
+ * BENCH_RECV_BATCH packets at once by ngtcp2_conn_recv_pkts with
+ * decrypt_batch callback.  Only ngtcp2_conn_recv_pkts is timed.
+ */
+static void bench_conn_recv_pkts(size_t n) {
+  ngtcp2_conn *client, *server;
+  ngtcp2_conn_callbacks cb;
+  ngtcp2_settings settings;
+  static uint8_t bufs[BENCH_RECV_BATCH][1280];
+  const uint8_t *pkts[BENCH_RECV_BATCH];
+  size_t pktlens[BENCH_RECV_BATCH];
+  uint64_t start, elapsed = 0;
+  ngtcp2_tstamp ts = 0;
+  size_t i, j, ndatalen;
+  ssize_t nwrite;
+  int rv;
+
+  memset(&cb, 0, sizeof(cb));
+  fake_crypto_callbacks(&cb);
+  bench_settings(&settings);
+
+  rv = ngtcp2_conn_client_new(&client, 0x1, NGTCP2_PROTO_VER_MAX, &cb,
+                              &settings, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_conn_client_new: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  cb.recv_stream_data = bench_recv_stream_data;
+  cb.decrypt_batch = bench_decrypt_batch;
+
+  rv = ngtcp2_conn_server_new(&server, 0x1, NGTCP2_PROTO_VER_MAX, &cb,
+                              &settings, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_conn_server_new: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  rv = fake_handshake(client, server);
+  if (rv != 0) {
+    fprintf(stderr, "fake_handshake: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  rv = ngtcp2_conn_open_stream(client, 1, NULL);
+  if (rv != 0) {
+    fprintf(stderr, "ngtcp2_conn_open_stream: %s\n", ngtcp2_strerror(rv));
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < n; i += BENCH_RECV_BATCH) {
+    for (j = 0; j < BENCH_RECV_BATCH; ++j) {
+      ts += 100;
+
+      nwrite = ngtcp2_conn_write_stream(client, bufs[j], sizeof(bufs[j]),
+                                        &ndatalen, 1, 0, null_data,
+                                        sizeof(null_data), ts);
+      if (nwrite <= 0) {
+        fprintf(stderr, "ngtcp2_conn_write_stream: %s\n",
+                nwrite == 0 ? "no packet" : ngtcp2_strerror((int)nwrite));
+        exit(EXIT_FAILURE);
+      }
+
+      pkts[j] = bufs[j];
+      pktlens[j] = (size_t)nwrite;
+    }
+
+    start = timestamp_ns();
+
+    rv = ngtcp2_conn_recv_pkts(server, pkts, pktlens, BENCH_RECV_BATCH, ts);
+
+    elapsed += timestamp_ns() - start;
+
+    if (rv != 0) {
+      fprintf(stderr, "ngtcp2_conn_recv_pkts: %s\n", ngtcp2_strerror(rv));
+      exit(EXIT_FAILURE);
+    }
+
+    bench_flush(server, client, ts + NGTCP2_DELAYED_ACK_TIMEOUT);
+  }
+
+  report("conn_recv_pkts", i, elapsed);
+
+  ngtcp2_conn_del(server);
+  ngtcp2_conn_del(client);
+}
+
+int main(int argc, char **argv) {
+  size_t n = 1000000;
+
+  if (argc > 1) {
+    n = strtoul(argv[1], NULL, 10);
+    if (n == 0) {
+      fprintf(stderr, "Usage: %s [ITERATIONS]\n", argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  bench_ppe(n);
+  bench_idtr(n, 1);
+  bench_idtr(n, NGTCP2_IDTR_WINDOW);
+  bench_idtr(n, 4096);
+  bench_conn_stream(n);
+  bench_conn_recv_pkts(n);
+
+  return 0;
+}
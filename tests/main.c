@@ -34,9 +34,11 @@
 #include "ngtcp2_pkt_test.h"
 #include "ngtcp2_upe_test.h"
 #include "ngtcp2_range_test.h"
+#include "ngtcp2_rangeset_test.h"
 #include "ngtcp2_rob_test.h"
 #include "ngtcp2_rtb_test.h"
 #include "ngtcp2_acktr_test.h"
+#include "ngtcp2_map_test.h"
 #include "ngtcp2_crypto_test.h"
 #include "ngtcp2_idtr_test.h"
 #include "ngtcp2_conn_test.h"
@@ -111,6 +113,9 @@ int main() {
       !CU_add_test(pSuite, "range_intersect", test_ngtcp2_range_intersect) ||
       !CU_add_test(pSuite, "range_cut", test_ngtcp2_range_cut) ||
       !CU_add_test(pSuite, "range_not_after", test_ngtcp2_range_not_after) ||
+      !CU_add_test(pSuite, "rangeset_remove", test_ngtcp2_rangeset_remove) ||
+      !CU_add_test(pSuite, "rangeset_remove_overflow",
+                   test_ngtcp2_rangeset_remove_overflow) ||
       !CU_add_test(pSuite, "rob_push", test_ngtcp2_rob_push) ||
       !CU_add_test(pSuite, "rob_data_at", test_ngtcp2_rob_data_at) ||
       !CU_add_test(pSuite, "rob_remove_prefix",
@@ -119,11 +124,18 @@ int main() {
       !CU_add_test(pSuite, "acktr_eviction", test_ngtcp2_acktr_eviction) ||
       !CU_add_test(pSuite, "acktr_forget", test_ngtcp2_acktr_forget) ||
       !CU_add_test(pSuite, "acktr_recv_ack", test_ngtcp2_acktr_recv_ack) ||
+      !CU_add_test(pSuite, "map", test_ngtcp2_map) ||
+      !CU_add_test(pSuite, "map_functional", test_ngtcp2_map_functional) ||
+      !CU_add_test(pSuite, "map_each_free", test_ngtcp2_map_each_free) ||
       !CU_add_test(pSuite, "encode_transport_params",
                    test_ngtcp2_encode_transport_params) ||
+      !CU_add_test(pSuite, "crypto_create_nonce",
+                   test_ngtcp2_crypto_create_nonce) ||
       !CU_add_test(pSuite, "rtb_add", test_ngtcp2_rtb_add) ||
       !CU_add_test(pSuite, "rtb_recv_ack", test_ngtcp2_rtb_recv_ack) ||
       !CU_add_test(pSuite, "idtr_open", test_ngtcp2_idtr_open) ||
+      !CU_add_test(pSuite, "idtr_open_reordered",
+                   test_ngtcp2_idtr_open_reordered) ||
       !CU_add_test(pSuite, "ringbuf_push_front",
                    test_ngtcp2_ringbuf_push_front) ||
       !CU_add_test(pSuite, "conn_stream_open_close",
@@ -163,7 +175,19 @@ int main() {
       !CU_add_test(pSuite, "conn_retransmit_protected",
                    test_ngtcp2_conn_retransmit_protected) ||
       !CU_add_test(pSuite, "conn_send_max_stream_data",
-                   test_ngtcp2_conn_send_max_stream_data)) {
+                   test_ngtcp2_conn_send_max_stream_data) ||
+      !CU_add_test(pSuite, "conn_find_stream", test_ngtcp2_conn_find_stream) ||
+      !CU_add_test(pSuite, "conn_aead_ctx", test_ngtcp2_conn_aead_ctx) ||
+      !CU_add_test(pSuite, "conn_aead_batch", test_ngtcp2_conn_aead_batch) ||
+      !CU_add_test(pSuite, "conn_decrypt_buffer",
+                   test_ngtcp2_conn_decrypt_buffer) ||
+      !CU_add_test(pSuite, "conn_recv_inplace",
+                   test_ngtcp2_conn_recv_inplace) ||
+      !CU_add_test(pSuite, "conn_async_handshake",
+                   test_ngtcp2_conn_async_handshake) ||
+      !CU_add_test(pSuite, "conn_key_update", test_ngtcp2_conn_key_update) ||
+      !CU_add_test(pSuite, "conn_fake_handshake",
+                   test_ngtcp2_conn_fake_handshake)) {
     CU_cleanup_registry();
     return CU_get_error();
   }
@@ -35,7 +35,7 @@
 
 static ssize_t null_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                             const uint8_t *plaintext, size_t plaintextlen,
-                            const uint8_t *key, size_t keylen,
+                            const uint8_t *key, size_t keylen, void *aead_ctx,
                             const uint8_t *nonce, size_t noncelen,
                             const uint8_t *ad, size_t adlen, void *user_data) {
   (void)conn;
@@ -44,6 +44,7 @@ static ssize_t null_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
   (void)plaintext;
   (void)key;
   (void)keylen;
+  (void)aead_ctx;
   (void)nonce;
   (void)noncelen;
   (void)ad;
@@ -54,7 +55,7 @@ static ssize_t null_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 
 static ssize_t null_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                             const uint8_t *ciphertext, size_t ciphertextlen,
-                            const uint8_t *key, size_t keylen,
+                            const uint8_t *key, size_t keylen, void *aead_ctx,
                             const uint8_t *nonce, size_t noncelen,
                             const uint8_t *ad, size_t adlen, void *user_data) {
   (void)conn;
@@ -63,6 +64,7 @@ static ssize_t null_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
   (void)ciphertext;
   (void)key;
   (void)keylen;
+  (void)aead_ctx;
   (void)nonce;
   (void)noncelen;
   (void)ad;
@@ -75,7 +77,7 @@ static ssize_t null_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 
 static ssize_t fail_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
                             const uint8_t *ciphertext, size_t ciphertextlen,
-                            const uint8_t *key, size_t keylen,
+                            const uint8_t *key, size_t keylen, void *aead_ctx,
                             const uint8_t *nonce, size_t noncelen,
                             const uint8_t *ad, size_t adlen, void *user_data) {
   (void)conn;
@@ -85,6 +87,7 @@ static ssize_t fail_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
   (void)ciphertextlen;
   (void)key;
   (void)keylen;
+  (void)aead_ctx;
   (void)nonce;
   (void)noncelen;
   (void)ad;
@@ -95,6 +98,95 @@ static ssize_t fail_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
 
 static uint8_t null_key[16];
 static uint8_t null_iv[16];
+
+typedef struct {
+  void *tx_aead_ctx;
+  void *rx_aead_ctx;
+} aead_ctx_userdata;
+
+static ssize_t record_aead_ctx_encrypt(ngtcp2_conn *conn, uint8_t *dest,
+                                       size_t destlen, const uint8_t *plaintext,
+                                       size_t plaintextlen, const uint8_t *key,
+                                       size_t keylen, void *aead_ctx,
+                                       const uint8_t *nonce, size_t noncelen,
+                                       const uint8_t *ad, size_t adlen,
+                                       void *user_data) {
+  aead_ctx_userdata *ud = user_data;
+
+  ud->tx_aead_ctx = aead_ctx;
+
+  return null_encrypt(conn, dest, destlen, plaintext, plaintextlen, key,
+                      keylen, aead_ctx, nonce, noncelen, ad, adlen, user_data);
+}
+
+static ssize_t record_aead_ctx_decrypt(ngtcp2_conn *conn, uint8_t *dest,
+                                       size_t destlen,
+                                       const uint8_t *ciphertext,
+                                       size_t ciphertextlen, const uint8_t *key,
+                                       size_t keylen, void *aead_ctx,
+                                       const uint8_t *nonce, size_t noncelen,
+                                       const uint8_t *ad, size_t adlen,
+                                       void *user_data) {
+  aead_ctx_userdata *ud = user_data;
+
+  ud->rx_aead_ctx = aead_ctx;
+
+  return null_decrypt(conn, dest, destlen, ciphertext, ciphertextlen, key,
+                      keylen, aead_ctx, nonce, noncelen, ad, adlen, user_data);
+}
+
+typedef struct {
+  size_t ncalls;
+  size_t nops;
+} aead_batch_userdata;
+
+static int null_encrypt_batch(ngtcp2_conn *conn, ngtcp2_aead_op *ops,
+                              size_t nops, const uint8_t *key, size_t keylen,
+                              void *aead_ctx, void *user_data) {
+  aead_batch_userdata *ud = user_data;
+  size_t i;
+  (void)conn;
+  (void)key;
+  (void)keylen;
+  (void)aead_ctx;
+
+  ++ud->ncalls;
+  ud->nops += nops;
+
+  for (i = 0; i < nops; ++i) {
+    memmove(ops[i].dest, ops[i].src, ops[i].srclen);
+    ops[i].nwrite = (ssize_t)ops[i].srclen;
+  }
+
+  return 0;
+}
+
+static int null_decrypt_batch(ngtcp2_conn *conn, ngtcp2_aead_op *ops,
+                              size_t nops, const uint8_t *key, size_t keylen,
+                              void *aead_ctx, void *user_data) {
+  aead_batch_userdata *ud = user_data;
+  size_t i;
+  (void)conn;
+  (void)key;
+  (void)keylen;
+  (void)aead_ctx;
+
+  ++ud->ncalls;
+  ud->nops += nops;
+
+  for (i = 0; i < nops; ++i) {
+    /* Packet whose last byte is 0xff fails to decrypt. */
+    if (ops[i].srclen && ops[i].src[ops[i].srclen - 1] == 0xff) {
+      ops[i].nwrite = NGTCP2_ERR_TLS_DECRYPT;
+      continue;
+    }
+    memcpy(ops[i].dest, ops[i].src, ops[i].srclen);
+    ops[i].nwrite = (ssize_t)ops[i].srclen;
+  }
+
+  return 0;
+}
+
 static uint8_t null_data[4096];
 
 typedef struct { uint64_t pkt_num; } my_user_data;
@@ -218,13 +310,13 @@ static void setup_default_server(ngtcp2_conn **pconn) {
   ngtcp2_conn_server_new(pconn, 0x1, NGTCP2_PROTO_VER_MAX, &cb, &settings,
                          NULL);
   ngtcp2_conn_set_handshake_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
   ngtcp2_conn_set_handshake_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
   ngtcp2_conn_update_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                             sizeof(null_iv));
+                             sizeof(null_iv), NULL);
   ngtcp2_conn_update_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                             sizeof(null_iv));
+                             sizeof(null_iv), NULL);
   (*pconn)->state = NGTCP2_CS_POST_HANDSHAKE;
   (*pconn)->remote_settings.max_stream_data = 64 * 1024;
   (*pconn)->remote_settings.max_stream_id = 0;
@@ -246,13 +338,13 @@ static void setup_default_client(ngtcp2_conn **pconn) {
   ngtcp2_conn_client_new(pconn, 0x1, NGTCP2_PROTO_VER_MAX, &cb, &settings,
                          NULL);
   ngtcp2_conn_set_handshake_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
   ngtcp2_conn_set_handshake_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
   ngtcp2_conn_update_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                             sizeof(null_iv));
+                             sizeof(null_iv), NULL);
   ngtcp2_conn_update_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                             sizeof(null_iv));
+                             sizeof(null_iv), NULL);
   (*pconn)->state = NGTCP2_CS_POST_HANDSHAKE;
   (*pconn)->remote_settings.max_stream_data = 64 * 1024;
   (*pconn)->remote_settings.max_stream_id = 1;
@@ -275,9 +367,9 @@ static void setup_handshake_server(ngtcp2_conn **pconn) {
   ngtcp2_conn_server_new(pconn, 0x1, NGTCP2_PROTO_VER_MAX, &cb, &settings,
                          NULL);
   ngtcp2_conn_set_handshake_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
   ngtcp2_conn_set_handshake_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
 }
 
 static void setup_handshake_client(ngtcp2_conn **pconn) {
@@ -294,9 +386,9 @@ static void setup_handshake_client(ngtcp2_conn **pconn) {
   ngtcp2_conn_client_new(pconn, 0x1, NGTCP2_PROTO_VER_MAX, &cb, &settings,
                          NULL);
   ngtcp2_conn_set_handshake_tx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
   ngtcp2_conn_set_handshake_rx_keys(*pconn, null_key, sizeof(null_key), null_iv,
-                                    sizeof(null_iv));
+                                    sizeof(null_iv), NULL);
 }
 
 void test_ngtcp2_conn_stream_open_close(void) {
@@ -460,6 +552,7 @@ void test_ngtcp2_conn_stream_tx_flow_control(void) {
   ngtcp2_frame fr;
   ngtcp2_strm *strm;
   size_t nwrite;
+  uint32_t stream_id;
 
   setup_default_client(&conn);
 
@@ -489,6 +582,7 @@ void test_ngtcp2_conn_stream_tx_flow_control(void) {
                                      null_data, 1024, 3);
 
   CU_ASSERT(NGTCP2_ERR_STREAM_DATA_BLOCKED == spktlen);
+  CU_ASSERT(0 == ngtcp2_conn_pop_writable_stream(conn, &stream_id));
 
   fr.type = NGTCP2_FRAME_MAX_STREAM_DATA;
   fr.max_stream_data.stream_id = 1;
@@ -500,6 +594,9 @@ void test_ngtcp2_conn_stream_tx_flow_control(void) {
 
   CU_ASSERT(0 == rv);
   CU_ASSERT(2048 == strm->max_tx_offset);
+  CU_ASSERT(0 != ngtcp2_conn_pop_writable_stream(conn, &stream_id));
+  CU_ASSERT(1 == stream_id);
+  CU_ASSERT(0 == ngtcp2_conn_pop_writable_stream(conn, &stream_id));
 
   spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), &nwrite, 1, 0,
                                      null_data, 1024, 5);
@@ -610,16 +707,26 @@ void test_ngtcp2_conn_tx_flow_control(void) {
   int rv;
   ngtcp2_frame fr;
   size_t nwrite;
+  uint32_t stream_id;
 
   setup_default_client(&conn);
 
   conn->remote_settings.max_data = 2;
   conn->max_tx_offset_high = 2;
+  conn->remote_settings.max_stream_id = 5;
 
   rv = ngtcp2_conn_open_stream(conn, 1, NULL);
 
   CU_ASSERT(0 == rv);
 
+  rv = ngtcp2_conn_open_stream(conn, 3, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_open_stream(conn, 5, NULL);
+
+  CU_ASSERT(0 == rv);
+
   spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), &nwrite, 1, 0,
                                      null_data, 1024, 1);
 
@@ -649,6 +756,22 @@ void test_ngtcp2_conn_tx_flow_control(void) {
 
   CU_ASSERT(NGTCP2_ERR_STREAM_DATA_BLOCKED == spktlen);
 
+  spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), &nwrite, 3, 0,
+                                     null_data, 1024, 4);
+
+  CU_ASSERT(NGTCP2_ERR_STREAM_DATA_BLOCKED == spktlen);
+
+  spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), &nwrite, 5, 0,
+                                     null_data, 1024, 4);
+
+  CU_ASSERT(NGTCP2_ERR_STREAM_DATA_BLOCKED == spktlen);
+
+  rv = ngtcp2_conn_close_stream(conn, ngtcp2_conn_find_stream(conn, 5),
+                                NGTCP2_APP_ERR01);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ngtcp2_conn_pop_writable_stream(conn, &stream_id));
+
   fr.type = NGTCP2_FRAME_MAX_DATA;
   fr.max_data.max_data = 3;
 
@@ -658,6 +781,11 @@ void test_ngtcp2_conn_tx_flow_control(void) {
 
   CU_ASSERT(0 == rv);
   CU_ASSERT(3 == conn->max_tx_offset_high);
+  CU_ASSERT(0 != ngtcp2_conn_pop_writable_stream(conn, &stream_id));
+  CU_ASSERT(1 == stream_id || 3 == stream_id);
+  CU_ASSERT(0 != ngtcp2_conn_pop_writable_stream(conn, &stream_id));
+  CU_ASSERT(1 == stream_id || 3 == stream_id);
+  CU_ASSERT(0 == ngtcp2_conn_pop_writable_stream(conn, &stream_id));
 
   spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), &nwrite, 1, 0,
                                      null_data, 1024, 4);
@@ -1834,3 +1962,610 @@ void test_ngtcp2_conn_send_max_stream_data(void) {
 
   ngtcp2_conn_del(conn);
 }
+
+void test_ngtcp2_conn_find_stream(void) {
+  ngtcp2_conn *conn;
+  ngtcp2_strm *strm;
+  int rv;
+  uint32_t high_stream_id = NGTCP2_STRMS_DIRECT_LEN * 2 + 2;
+
+  setup_default_server(&conn);
+
+  conn->remote_settings.max_stream_id = high_stream_id;
+
+  CU_ASSERT(conn->strm0 == ngtcp2_conn_find_stream(conn, 0));
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, 2));
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, high_stream_id));
+
+  rv = ngtcp2_conn_open_stream(conn, 2, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_open_stream(conn, high_stream_id, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  strm = ngtcp2_conn_find_stream(conn, 2);
+
+  CU_ASSERT(NULL != strm);
+  CU_ASSERT(2 == strm->stream_id);
+
+  strm = ngtcp2_conn_find_stream(conn, high_stream_id);
+
+  CU_ASSERT(NULL != strm);
+  CU_ASSERT(high_stream_id == strm->stream_id);
+
+  rv = ngtcp2_conn_close_stream(conn, ngtcp2_conn_find_stream(conn, 2),
+                                NGTCP2_APP_ERR01);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, 2));
+
+  rv = ngtcp2_conn_close_stream(conn, strm, NGTCP2_APP_ERR01);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL == ngtcp2_conn_find_stream(conn, high_stream_id));
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_aead_ctx(void) {
+  ngtcp2_conn *conn;
+  ngtcp2_conn_callbacks cb;
+  ngtcp2_settings settings;
+  aead_ctx_userdata ud;
+  int tx_aead_ctx, rx_aead_ctx;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ssize_t spktlen;
+  ngtcp2_frame fr;
+  int rv;
+
+  memset(&ud, 0, sizeof(ud));
+  memset(&cb, 0, sizeof(cb));
+  cb.hs_decrypt = null_decrypt;
+  cb.hs_encrypt = null_encrypt;
+  cb.decrypt = record_aead_ctx_decrypt;
+  cb.encrypt = record_aead_ctx_encrypt;
+  client_default_settings(&settings);
+
+  ngtcp2_conn_client_new(&conn, 0x1, NGTCP2_PROTO_VER_MAX, &cb, &settings,
+                         &ud);
+  ngtcp2_conn_set_handshake_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                    sizeof(null_iv), NULL);
+  ngtcp2_conn_set_handshake_rx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                    sizeof(null_iv), NULL);
+  rv = ngtcp2_conn_update_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                  sizeof(null_iv), &tx_aead_ctx);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_update_rx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                  sizeof(null_iv), &rx_aead_ctx);
+
+  CU_ASSERT(0 == rv);
+
+  conn->state = NGTCP2_CS_POST_HANDSHAKE;
+  conn->remote_settings.max_stream_data = 64 * 1024;
+  conn->remote_settings.max_stream_id = 1;
+  conn->remote_settings.max_data = 64;
+  conn->max_tx_offset_high = conn->remote_settings.max_data;
+
+  rv = ngtcp2_conn_open_stream(conn, 1, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  spktlen = ngtcp2_conn_write_stream(conn, buf, sizeof(buf), NULL, 1, 0,
+                                     null_data, 100, 1);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(&tx_aead_ctx == ud.tx_aead_ctx);
+
+  fr.type = NGTCP2_FRAME_PING;
+
+  pktlen = write_single_frame_pkt(conn, buf, sizeof(buf), 0xc, 1, &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(&rx_aead_ctx == ud.rx_aead_ctx);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_aead_batch(void) {
+  ngtcp2_conn *conn;
+  aead_batch_userdata ud;
+  uint8_t buf[4][256];
+  uint8_t out[4096];
+  const uint8_t *pkts[4];
+  size_t pktlens[4];
+  ssize_t spktlen;
+  ngtcp2_frame fr;
+  ngtcp2_tstamp t = 0;
+  size_t i;
+  int rv;
+
+  /* Retransmit packets, and encrypt them in a batch */
+  setup_default_client(&conn);
+  conn->callbacks.encrypt_batch = null_encrypt_batch;
+  conn->user_data = &ud;
+  conn->remote_settings.max_data = 1024;
+  conn->max_tx_offset_high = conn->remote_settings.max_data;
+
+  ngtcp2_conn_open_stream(conn, 1, NULL);
+
+  for (i = 0; i < 3; ++i) {
+    spktlen = ngtcp2_conn_write_stream(conn, out, sizeof(out), NULL, 1, 0,
+                                       null_data, 100, ++t);
+
+    CU_ASSERT(spktlen > 0);
+  }
+
+  /* Kick delayed ACK timer */
+  t += 1000000;
+
+  memset(&ud, 0, sizeof(ud));
+  spktlen = ngtcp2_conn_write_pkts(conn, out, sizeof(out), 1200, pktlens,
+                                   arraylen(pktlens), ++t);
+
+  CU_ASSERT(3 == spktlen);
+  CU_ASSERT(1 == ud.ncalls);
+  CU_ASSERT(3 == ud.nops);
+  CU_ASSERT(NULL == conn->aead_batch);
+
+  /* Nothing to send */
+  spktlen = ngtcp2_conn_write_pkts(conn, out, sizeof(out), 1200, pktlens,
+                                   arraylen(pktlens), ++t);
+
+  CU_ASSERT(0 == spktlen);
+  CU_ASSERT(1 == ud.ncalls);
+
+  ngtcp2_conn_del(conn);
+
+  /* Decrypt packets in a batch */
+  setup_default_client(&conn);
+  conn->callbacks.decrypt_batch = null_decrypt_batch;
+  conn->user_data = &ud;
+
+  memset(&ud, 0, sizeof(ud));
+  fr.type = NGTCP2_FRAME_PING;
+
+  for (i = 0; i < 3; ++i) {
+    pktlens[i] = write_single_frame_pkt(conn, buf[i], sizeof(buf[i]),
+                                        conn->conn_id, i + 1, &fr);
+    pkts[i] = buf[i];
+  }
+
+  rv = ngtcp2_conn_recv_pkts(conn, pkts, pktlens, 3, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ud.ncalls);
+  CU_ASSERT(3 == ud.nops);
+  CU_ASSERT(3 == conn->max_rx_pkt_num);
+
+  /* The second packet fails to decrypt */
+  memset(&ud, 0, sizeof(ud));
+
+  for (i = 0; i < 3; ++i) {
+    pktlens[i] = write_single_frame_pkt(conn, buf[i], sizeof(buf[i]),
+                                        conn->conn_id, i + 4, &fr);
+  }
+  buf[1][pktlens[1] - 1] = 0xff;
+
+  rv = ngtcp2_conn_recv_pkts(conn, pkts, pktlens, 3, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ud.ncalls);
+  CU_ASSERT(3 == ud.nops);
+  CU_ASSERT(6 == conn->max_rx_pkt_num);
+
+  /* A forged packet number does not affect the other packets */
+  memset(&ud, 0, sizeof(ud));
+
+  pktlens[0] = write_single_frame_pkt(conn, buf[0], sizeof(buf[0]),
+                                      conn->conn_id, 7, &fr);
+  pktlens[1] = write_single_frame_pkt(conn, buf[1], sizeof(buf[1]),
+                                      conn->conn_id, 1000000, &fr);
+  buf[1][pktlens[1] - 1] = 0xff;
+  pktlens[2] = write_single_frame_pkt(conn, buf[2], sizeof(buf[2]),
+                                      conn->conn_id, 8, &fr);
+
+  rv = ngtcp2_conn_recv_pkts(conn, pkts, pktlens, 3, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ud.ncalls);
+  CU_ASSERT(8 == conn->max_rx_pkt_num);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_decrypt_buffer(void) {
+  ngtcp2_conn *conn, *conn2;
+  uint8_t buf[2048];
+  uint8_t decrypt_buf[1024];
+  size_t pktlen;
+  ngtcp2_frame fr;
+  int rv;
+
+  setup_default_client(&conn);
+  setup_default_client(&conn2);
+
+  ngtcp2_conn_set_decrypt_buffer(conn, decrypt_buf, sizeof(decrypt_buf));
+  ngtcp2_conn_set_decrypt_buffer(conn2, decrypt_buf, sizeof(decrypt_buf));
+
+  fr.type = NGTCP2_FRAME_PING;
+
+  pktlen = write_single_frame_pkt(conn, buf, sizeof(buf), conn->conn_id, 1,
+                                  &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(decrypt_buf == conn->decrypt_buf.base);
+
+  rv = ngtcp2_conn_recv(conn2, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(decrypt_buf == conn2->decrypt_buf.base);
+
+  /* Packet which does not fit in the buffer */
+  fr.type = NGTCP2_FRAME_PADDING;
+  fr.padding.len = 1100;
+
+  pktlen = write_single_frame_pkt(conn, buf, sizeof(buf), conn->conn_id, 2,
+                                  &fr);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(NGTCP2_ERR_NOBUF == rv);
+
+  /* Fall back to the buffer owned by conn */
+  ngtcp2_conn_set_decrypt_buffer(conn, NULL, 0);
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NULL != conn->decrypt_buf.base);
+  CU_ASSERT(decrypt_buf != conn->decrypt_buf.base);
+
+  ngtcp2_conn_del(conn2);
+  ngtcp2_conn_del(conn);
+}
+
+static int recv_stream_data_ptr(ngtcp2_conn *conn, uint32_t stream_id,
+                                uint8_t fin, const uint8_t *data,
+                                size_t datalen, void *user_data,
+                                void *stream_user_data) {
+  (void)conn;
+  (void)stream_id;
+  (void)fin;
+  (void)datalen;
+  (void)stream_user_data;
+
+  *(const uint8_t **)user_data = data;
+
+  return 0;
+}
+
+void test_ngtcp2_conn_recv_inplace(void) {
+  ngtcp2_conn *conn;
+  uint8_t buf[2048];
+  size_t pktlen;
+  const uint8_t *data = NULL;
+  ngtcp2_frame fr;
+  int rv;
+
+  setup_default_server(&conn);
+  conn->callbacks.recv_stream_data = recv_stream_data_ptr;
+  conn->user_data = &data;
+  conn->local_settings.max_stream_id = 1;
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.flags = 0;
+  fr.stream.stream_id = 1;
+  fr.stream.fin = 0;
+  fr.stream.offset = 0;
+  fr.stream.datalen = 111;
+  fr.stream.data = null_data;
+
+  pktlen = write_single_frame_pkt(conn, buf, sizeof(buf), 0xc, 1, &fr);
+  rv = ngtcp2_conn_recv_inplace(conn, buf, pktlen, 1);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(data > buf);
+  CU_ASSERT(data + 111 <= buf + pktlen);
+  CU_ASSERT(NULL == conn->decrypt_buf.base);
+
+  ngtcp2_conn_del(conn);
+}
+
+void test_ngtcp2_conn_async_handshake(void) {
+  ngtcp2_conn *conn;
+  uint8_t buf[2048];
+  size_t pktlen;
+  ssize_t spktlen;
+  ngtcp2_frame fr;
+  int rv;
+  uint64_t pkt_num = 107, t = 0;
+
+  setup_handshake_server(&conn);
+  conn->callbacks.send_server_cleartext = send_server_cleartext_zero;
+
+  fr.type = NGTCP2_FRAME_STREAM;
+  fr.stream.stream_id = 0;
+  fr.stream.fin = 0;
+  fr.stream.offset = 0;
+  fr.stream.datalen = 551;
+  fr.stream.data = null_data;
+
+  pktlen = write_single_frame_handshake_pkt(
+      buf, sizeof(buf), NGTCP2_PKT_CLIENT_INITIAL, conn->conn_id, ++pkt_num,
+      conn->version, &fr);
+
+  rv = ngtcp2_conn_recv(conn, buf, pktlen, ++t);
+
+  CU_ASSERT(0 == rv);
+
+  /* Server handshake data are not ready yet */
+  spktlen = ngtcp2_conn_write_pkt(conn, buf, sizeof(buf), ++t);
+
+  CU_ASSERT(0 == spktlen);
+  CU_ASSERT(NGTCP2_CS_SERVER_INITIAL == conn->state);
+
+  conn->callbacks.send_server_cleartext = send_server_cleartext;
+  spktlen = ngtcp2_conn_write_pkt(conn, buf, sizeof(buf), ++t);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(NGTCP2_CS_SERVER_WAIT_HANDSHAKE == conn->state);
+
+  /* Handshake completes outside of ngtcp2_conn_recv */
+  ngtcp2_conn_update_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                             sizeof(null_iv), NULL);
+  ngtcp2_conn_update_rx_keys(conn, null_key, sizeof(null_key), null_iv,
+                             sizeof(null_iv), NULL);
+  conn->callbacks.encrypt = null_encrypt;
+  conn->callbacks.decrypt = null_decrypt;
+  conn->flags |= NGTCP2_CONN_FLAG_TRANSPORT_PARAM_RECVED;
+  ngtcp2_conn_handshake_completed(conn);
+
+  spktlen = ngtcp2_conn_write_pkt(conn, buf, sizeof(buf), ++t);
+
+  CU_ASSERT(spktlen >= 0);
+  CU_ASSERT(NGTCP2_CS_POST_HANDSHAKE == conn->state);
+
+  ngtcp2_conn_del(conn);
+}
+
+static int update_key(ngtcp2_conn *conn, void *user_data) {
+  (void)conn;
+
+  ++*(size_t *)user_data;
+
+  return 0;
+}
+
+static int recv_ping_key_phase(ngtcp2_conn *conn, uint64_t pkt_num,
+                               int key_phase, ngtcp2_tstamp ts) {
+  uint8_t buf[256];
+  size_t pktlen;
+  ngtcp2_frame fr;
+
+  fr.type = NGTCP2_FRAME_PING;
+
+  pktlen = write_single_frame_pkt(conn, buf, sizeof(buf), conn->conn_id,
+                                  pkt_num, &fr);
+  if (key_phase) {
+    buf[0] |= NGTCP2_KEY_PHASE_BIT;
+  }
+
+  return ngtcp2_conn_recv(conn, buf, pktlen, ts);
+}
+
+void test_ngtcp2_conn_key_update(void) {
+  ngtcp2_conn *conn;
+  uint8_t buf[2048];
+  ssize_t spktlen;
+  ngtcp2_crypto_km *rx_ckm, *new_rx_ckm;
+  size_t nupdate = 0;
+  ngtcp2_tstamp t = 0;
+  int rv;
+
+  setup_default_server(&conn);
+  conn->callbacks.update_key = update_key;
+  conn->user_data = &nupdate;
+
+  rx_ckm = conn->rx_ckm;
+
+  /* Flipped key phase is discarded if the next key is not
+     available. */
+  rv = recv_ping_key_phase(conn, 2, 1, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(rx_ckm == conn->rx_ckm);
+  CU_ASSERT(UINT64_MAX == rx_ckm->pkt_num);
+
+  rv = recv_ping_key_phase(conn, 3, 0, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == rx_ckm->pkt_num);
+
+  rv = ngtcp2_conn_initiate_key_update(conn);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_STATE == rv);
+
+  rv = ngtcp2_conn_set_next_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                    sizeof(null_iv), NULL);
+
+  CU_ASSERT(0 == rv);
+
+  rv = ngtcp2_conn_set_next_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                    sizeof(null_iv), NULL);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_STATE == rv);
+
+  rv = ngtcp2_conn_set_next_rx_keys(conn, null_key, sizeof(null_key), null_iv,
+                                    sizeof(null_iv), NULL);
+
+  CU_ASSERT(0 == rv);
+
+  new_rx_ckm = conn->new_rx_ckm;
+
+  /* Remote endpoint initiates key update */
+  rv = recv_ping_key_phase(conn, 5, 1, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == nupdate);
+  CU_ASSERT(new_rx_ckm == conn->rx_ckm);
+  CU_ASSERT(rx_ckm == conn->old_rx_ckm);
+  CU_ASSERT(5 == conn->rx_ckm->pkt_num);
+  CU_ASSERT(NULL == conn->new_rx_ckm);
+  CU_ASSERT(NULL == conn->new_tx_ckm);
+  CU_ASSERT(conn->tx_ckm->flags & NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE);
+
+  /* Reordered packet protected by the previous key */
+  rv = recv_ping_key_phase(conn, 4, 0, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(new_rx_ckm == conn->rx_ckm);
+  CU_ASSERT(5 == conn->rx_ckm->pkt_num);
+
+  spktlen = ngtcp2_conn_write_pkt(conn, buf, sizeof(buf), 1000000000);
+
+  CU_ASSERT(spktlen > 0);
+  CU_ASSERT(buf[0] & NGTCP2_KEY_PHASE_BIT);
+
+  /* Local endpoint initiates key update */
+  ngtcp2_conn_set_next_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                               sizeof(null_iv), NULL);
+  ngtcp2_conn_set_next_rx_keys(conn, null_key, sizeof(null_key), null_iv,
+                               sizeof(null_iv), NULL);
+
+  rx_ckm = conn->rx_ckm;
+  new_rx_ckm = conn->new_rx_ckm;
+
+  rv = ngtcp2_conn_initiate_key_update(conn);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == nupdate);
+  CU_ASSERT(new_rx_ckm == conn->rx_ckm);
+  CU_ASSERT(rx_ckm == conn->old_rx_ckm);
+  CU_ASSERT(conn->flags & NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE);
+  CU_ASSERT(!(conn->tx_ckm->flags & NGTCP2_CRYPTO_KM_FLAG_KEY_PHASE_ONE));
+
+  ngtcp2_conn_set_next_tx_keys(conn, null_key, sizeof(null_key), null_iv,
+                               sizeof(null_iv), NULL);
+  ngtcp2_conn_set_next_rx_keys(conn, null_key, sizeof(null_key), null_iv,
+                               sizeof(null_iv), NULL);
+
+  rv = ngtcp2_conn_initiate_key_update(conn);
+
+  CU_ASSERT(NGTCP2_ERR_INVALID_STATE == rv);
+
+  /* Packet protected by the previous key is still accepted */
+  rv = recv_ping_key_phase(conn, 6, 1, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(new_rx_ckm == conn->rx_ckm);
+  CU_ASSERT(conn->flags & NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE);
+
+  rv = recv_ping_key_phase(conn, 7, 0, ++t);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(7 == conn->rx_ckm->pkt_num);
+  CU_ASSERT(!(conn->flags & NGTCP2_CONN_FLAG_WAIT_FOR_REMOTE_KEY_UPDATE));
+
+  rv = ngtcp2_conn_initiate_key_update(conn);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(3 == nupdate);
+
+  ngtcp2_conn_del(conn);
+}
+
+static int recv_stream_data_count(ngtcp2_conn *conn, uint32_t stream_id,
+                                  uint8_t fin, const uint8_t *data,
+                                  size_t datalen, void *user_data,
+                                  void *stream_user_data) {
+  (void)conn;
+  (void)stream_id;
+  (void)fin;
+  (void)data;
+  (void)stream_user_data;
+
+  *(size_t *)user_data += datalen;
+
+  return 0;
+}
+
+void test_ngtcp2_conn_fake_handshake(void) {
+  ngtcp2_conn *client, *server;
+  ngtcp2_conn_callbacks cb;
+  ngtcp2_settings settings;
+  uint8_t buf[2048];
+  ssize_t spktlen;
+  size_t ndatalen, nrecv = 0;
+  int rv;
+
+  memset(&cb, 0, sizeof(cb));
+  fake_crypto_callbacks(&cb);
+  client_default_settings(&settings);
+
+  rv = ngtcp2_conn_client_new(&client, 0x1, NGTCP2_PROTO_VER_MAX, &cb,
+                              &settings, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  cb.recv_stream_data = recv_stream_data_count;
+  server_default_settings(&settings);
+  settings.max_data = 4096;
+
+  rv = ngtcp2_conn_server_new(&server, 0x1, NGTCP2_PROTO_VER_MAX, &cb,
+                              &settings, &nrecv);
+
+  CU_ASSERT(0 == rv);
+
+  rv = fake_handshake(client, server);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(NGTCP2_CS_POST_HANDSHAKE == client->state);
+  CU_ASSERT(NGTCP2_CS_POST_HANDSHAKE == server->state);
+  CU_ASSERT(4096 == client->max_tx_offset_high);
+
+  rv = ngtcp2_conn_open_stream(client, 1, NULL);
+
+  CU_ASSERT(0 == rv);
+
+  spktlen = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 1, 0,
+                                     null_data, 1000, 1);
+
+  CU_ASSERT(spktlen > 1000 + NGTCP2_FAKE_AEAD_OVERHEAD);
+  CU_ASSERT(1000 == ndatalen);
+
+  rv = ngtcp2_conn_recv(server, buf, (size_t)spktlen, 2);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1000 == nrecv);
+
+  spktlen = ngtcp2_conn_write_pkt(server, buf, sizeof(buf),
+                                  2 + NGTCP2_DELAYED_ACK_TIMEOUT);
+
+  CU_ASSERT(spktlen > 0);
+
+  rv = ngtcp2_conn_recv(client, buf, (size_t)spktlen,
+                        3 + NGTCP2_DELAYED_ACK_TIMEOUT);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ngtcp2_conn_bytes_in_flight(client));
+
+  /* Corrupted tag is rejected */
+  spktlen = ngtcp2_conn_write_stream(client, buf, sizeof(buf), &ndatalen, 1, 0,
+                                     null_data, 100, 4);
+
+  CU_ASSERT(spktlen > 0);
+
+  buf[spktlen - 1] = 0xff;
+  rv = ngtcp2_conn_recv(server, buf, (size_t)spktlen, 5);
+
+  CU_ASSERT(NGTCP2_ERR_TLS_DECRYPT == rv);
+  CU_ASSERT(1000 == nrecv);
+
+  ngtcp2_conn_del(server);
+  ngtcp2_conn_del(client);
+}
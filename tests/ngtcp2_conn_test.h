@@ -48,5 +48,13 @@ void test_ngtcp2_conn_recv_max_stream_id(void);
 void test_ngtcp2_conn_handshake_error(void);
 void test_ngtcp2_conn_retransmit_protected(void);
 void test_ngtcp2_conn_send_max_stream_data(void);
+void test_ngtcp2_conn_find_stream(void);
+void test_ngtcp2_conn_aead_ctx(void);
+void test_ngtcp2_conn_aead_batch(void);
+void test_ngtcp2_conn_decrypt_buffer(void);
+void test_ngtcp2_conn_recv_inplace(void);
+void test_ngtcp2_conn_async_handshake(void);
+void test_ngtcp2_conn_key_update(void);
+void test_ngtcp2_conn_fake_handshake(void);
 
 #endif /* NGTCP2_CONN_TEST_H */
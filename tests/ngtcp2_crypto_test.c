@@ -25,6 +25,7 @@
 #include "ngtcp2_crypto_test.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include <CUnit/CUnit.h>
 
@@ -218,3 +219,33 @@ void test_ngtcp2_encode_transport_params(void) {
 
   CU_ASSERT((ssize_t)i == nwrite);
 }
+
+void test_ngtcp2_crypto_create_nonce(void) {
+  static const uint8_t iv[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                               0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b};
+  static const uint8_t expected[] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x04,
+                                     0x07, 0x06, 0x09, 0x08, 0xda, 0x0a};
+  uint8_t nonce[sizeof(iv)];
+  ngtcp2_crypto_km *ckm;
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  int rv;
+
+  ngtcp2_crypto_create_nonce(nonce, iv, sizeof(iv), 0x0101010101d001ULL);
+
+  CU_ASSERT(0 == memcmp(expected, nonce, sizeof(nonce)));
+
+  rv = ngtcp2_crypto_km_new(&ckm, iv, sizeof(iv), iv, sizeof(iv), NULL, mem);
+
+  CU_ASSERT(0 == rv);
+
+  memset(nonce, 0, sizeof(nonce));
+  ngtcp2_crypto_km_create_nonce(nonce, ckm, 0x0101010101d001ULL);
+
+  CU_ASSERT(0 == memcmp(expected, nonce, sizeof(nonce)));
+
+  ngtcp2_crypto_create_nonce(nonce, iv, sizeof(iv), 0);
+
+  CU_ASSERT(0 == memcmp(iv, nonce, sizeof(nonce)));
+
+  ngtcp2_crypto_km_del(ckm, mem);
+}
@@ -30,5 +30,6 @@
 #endif /* HAVE_CONFIG_H */
 
 void test_ngtcp2_encode_transport_params(void);
+void test_ngtcp2_crypto_create_nonce(void);
 
 #endif /* NGTCP2_CRYPTO_TEST_H */
@@ -24,11 +24,14 @@
  */
 #include "ngtcp2_idtr_test.h"
 
+#include <stdlib.h>
+
 #include <CUnit/CUnit.h>
 
 #include "ngtcp2_idtr.h"
 #include "ngtcp2_test_helper.h"
 #include "ngtcp2_mem.h"
+#include "ngtcp2_macro.h"
 
 static uint32_t stream_id_from_id(uint64_t id) {
   return (uint32_t)(id * 2 + 1);
@@ -38,7 +41,7 @@ void test_ngtcp2_idtr_open(void) {
   ngtcp2_mem *mem = ngtcp2_mem_default();
   ngtcp2_idtr idtr;
   int rv;
-  ngtcp2_idtr_gap *g;
+  const ngtcp2_range *g;
 
   rv = ngtcp2_idtr_init(&idtr, 0, mem);
 
@@ -47,24 +50,26 @@ void test_ngtcp2_idtr_open(void) {
   rv = ngtcp2_idtr_open(&idtr, stream_id_from_id(0));
 
   CU_ASSERT(0 == rv);
-  CU_ASSERT(1 == idtr.gap->range.begin);
-  CU_ASSERT(UINT64_MAX == idtr.gap->range.end);
-  CU_ASSERT(NULL == idtr.gap->next);
+  CU_ASSERT(1 == ngtcp2_idtr_first_gap(&idtr));
+  CU_ASSERT(NGTCP2_IDTR_WINDOW == ngtcp2_rangeset_get(&idtr.gap, 0)->begin);
+  CU_ASSERT(UINT64_MAX == ngtcp2_rangeset_get(&idtr.gap, 0)->end);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&idtr.gap));
 
   rv = ngtcp2_idtr_open(&idtr, stream_id_from_id(1000000007));
 
   CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ngtcp2_idtr_first_gap(&idtr));
 
-  g = idtr.gap;
+  g = ngtcp2_rangeset_get(&idtr.gap, 0);
 
-  CU_ASSERT(1 == idtr.gap->range.begin);
-  CU_ASSERT(1000000007 == g->range.end);
+  CU_ASSERT(NGTCP2_IDTR_WINDOW == g->begin);
+  CU_ASSERT(1000000007 == g->end);
 
-  g = g->next;
+  g = ngtcp2_rangeset_get(&idtr.gap, 1);
 
-  CU_ASSERT(1000000008 == g->range.begin);
-  CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(1000000008 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+  CU_ASSERT(2 == ngtcp2_rangeset_len(&idtr.gap));
 
   rv = ngtcp2_idtr_open(&idtr, stream_id_from_id(0));
 
@@ -76,3 +81,60 @@ void test_ngtcp2_idtr_open(void) {
 
   ngtcp2_idtr_free(&idtr);
 }
+
+static void shuffle(uint64_t *a, size_t n, size_t k) {
+  size_t i, j;
+  uint64_t t;
+
+  /* Swap each element with the one at most k positions ahead, so that
+     IDs are reordered locally as they are on the wire. */
+  for (i = 0; i + 1 < n; ++i) {
+    j = i + (size_t)rand() % ngtcp2_min(k, n - i);
+    t = a[i];
+    a[i] = a[j];
+    a[j] = t;
+  }
+}
+
+void test_ngtcp2_idtr_open_reordered(void) {
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_idtr idtr;
+  int rv;
+  size_t i;
+  uint64_t ids[4096];
+  const size_t n = sizeof(ids) / sizeof(ids[0]);
+
+  for (i = 0; i < n; ++i) {
+    ids[i] = i;
+  }
+
+  shuffle(ids, n, NGTCP2_IDTR_WINDOW * 2);
+
+  rv = ngtcp2_idtr_init(&idtr, 0, mem);
+
+  CU_ASSERT(0 == rv);
+
+  for (i = 0; i < n; ++i) {
+    CU_ASSERT(0 == ngtcp2_idtr_is_open(&idtr, stream_id_from_id(ids[i])));
+
+    rv = ngtcp2_idtr_open(&idtr, stream_id_from_id(ids[i]));
+
+    CU_ASSERT(0 == rv);
+    CU_ASSERT(NGTCP2_ERR_STREAM_IN_USE ==
+              ngtcp2_idtr_is_open(&idtr, stream_id_from_id(ids[i])));
+    CU_ASSERT(ngtcp2_idtr_first_gap(&idtr) <= n);
+  }
+
+  CU_ASSERT(n == ngtcp2_idtr_first_gap(&idtr));
+  CU_ASSERT(n + NGTCP2_IDTR_WINDOW == ngtcp2_rangeset_get(&idtr.gap, 0)->begin);
+  CU_ASSERT(UINT64_MAX == ngtcp2_rangeset_get(&idtr.gap, 0)->end);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&idtr.gap));
+
+  for (i = 0; i < n; ++i) {
+    rv = ngtcp2_idtr_open(&idtr, stream_id_from_id(i));
+
+    CU_ASSERT(NGTCP2_ERR_STREAM_IN_USE == rv);
+  }
+
+  ngtcp2_idtr_free(&idtr);
+}
@@ -131,13 +131,17 @@ void test_ngtcp2_map_functional(void) {
   /* find */
   shuffle(order, NUM_ENT);
   for (i = 0; i < NUM_ENT; ++i) {
-    ngtcp2_map_find(&map, (key_type)order[i]);
+    strentry *ent = (strentry *)ngtcp2_map_find(&map, (key_type)order[i]);
+    CU_ASSERT(NULL != ent);
+    CU_ASSERT((key_type)order[i] == ent->map_entry.key);
   }
   /* remove */
   shuffle(order, NUM_ENT);
   for (i = 0; i < NUM_ENT; ++i) {
     CU_ASSERT(0 == ngtcp2_map_remove(&map, (key_type)order[i]));
+    CU_ASSERT(NULL == ngtcp2_map_find(&map, (key_type)order[i]));
   }
+  CU_ASSERT(0 == ngtcp2_map_size(&map));
 
   /* each_free (but no op function for testing purpose) */
   for (i = 0; i < NUM_ENT; ++i) {
@@ -0,0 +1,157 @@
+/*
+ * ngtcp2
+ *
+ * Copyright (c) 2017 ngtcp2 contributors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "ngtcp2_rangeset_test.h"
+
+#include <CUnit/CUnit.h>
+
+#include "ngtcp2_rangeset.h"
+#include "ngtcp2_test_helper.h"
+
+void test_ngtcp2_rangeset_remove(void) {
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_rangeset rs;
+  ngtcp2_range r;
+  const ngtcp2_range *g;
+  int rv;
+
+  ngtcp2_rangeset_init(&rs, 0, UINT64_MAX, mem);
+
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&rs));
+  CU_ASSERT(0 == ngtcp2_rangeset_first_begin(&rs));
+
+  /* Split a range */
+  ngtcp2_range_init(&r, 100, 200);
+  rv = ngtcp2_rangeset_remove(&rs, &r);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == ngtcp2_rangeset_len(&rs));
+
+  g = ngtcp2_rangeset_get(&rs, 0);
+
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(100 == g->end);
+
+  g = ngtcp2_rangeset_get(&rs, 1);
+
+  CU_ASSERT(200 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+
+  /* Remove a range which does not overlap */
+  ngtcp2_range_init(&r, 150, 200);
+  rv = ngtcp2_rangeset_remove(&rs, &r);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == ngtcp2_rangeset_len(&rs));
+
+  /* Trim the both sides of adjacent ranges */
+  ngtcp2_range_init(&r, 50, 250);
+  rv = ngtcp2_rangeset_remove(&rs, &r);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(2 == ngtcp2_rangeset_len(&rs));
+
+  g = ngtcp2_rangeset_get(&rs, 0);
+
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(50 == g->end);
+
+  g = ngtcp2_rangeset_get(&rs, 1);
+
+  CU_ASSERT(250 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+
+  CU_ASSERT(0 == ngtcp2_rangeset_lower_bound(&rs, 0));
+  CU_ASSERT(1 == ngtcp2_rangeset_lower_bound(&rs, 50));
+  CU_ASSERT(1 == ngtcp2_rangeset_lower_bound(&rs, 250));
+
+  /* Remove the entire first range */
+  ngtcp2_range_init(&r, 0, 50);
+  rv = ngtcp2_rangeset_remove(&rs, &r);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&rs));
+  CU_ASSERT(250 == ngtcp2_rangeset_first_begin(&rs));
+
+  /* Remove everything */
+  ngtcp2_range_init(&r, 0, UINT64_MAX);
+  rv = ngtcp2_rangeset_remove(&rs, &r);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(0 == ngtcp2_rangeset_len(&rs));
+  CU_ASSERT(UINT64_MAX == ngtcp2_rangeset_first_begin(&rs));
+
+  ngtcp2_rangeset_free(&rs);
+}
+
+void test_ngtcp2_rangeset_remove_overflow(void) {
+  ngtcp2_mem *mem = ngtcp2_mem_default();
+  ngtcp2_rangeset rs;
+  ngtcp2_range r;
+  const ngtcp2_range *g;
+  int rv;
+  size_t i;
+  const size_t n = NGTCP2_RANGESET_INLINE_LEN * 4;
+
+  ngtcp2_rangeset_init(&rs, 0, UINT64_MAX, mem);
+
+  /* Make holes in the reverse order so that every removal inserts a
+     range in the middle of the array. */
+  for (i = n; i > 0; --i) {
+    ngtcp2_range_init(&r, i * 10, i * 10 + 5);
+    rv = ngtcp2_rangeset_remove(&rs, &r);
+
+    CU_ASSERT(0 == rv);
+  }
+
+  CU_ASSERT(n + 1 == ngtcp2_rangeset_len(&rs));
+  CU_ASSERT(NULL != rs.heap_ranges);
+
+  g = ngtcp2_rangeset_get(&rs, 0);
+
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(10 == g->end);
+
+  for (i = 1; i < n; ++i) {
+    g = ngtcp2_rangeset_get(&rs, i);
+
+    CU_ASSERT(i * 10 + 5 == g->begin);
+    CU_ASSERT(i * 10 + 10 == g->end);
+  }
+
+  g = ngtcp2_rangeset_get(&rs, n);
+
+  CU_ASSERT(n * 10 + 5 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+
+  /* Remove ranges spanning several ranges */
+  ngtcp2_range_init(&r, 0, n * 10);
+  rv = ngtcp2_rangeset_remove(&rs, &r);
+
+  CU_ASSERT(0 == rv);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&rs));
+  CU_ASSERT(n * 10 + 5 == ngtcp2_rangeset_first_begin(&rs));
+
+  ngtcp2_rangeset_free(&rs);
+}
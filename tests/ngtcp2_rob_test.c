@@ -35,7 +35,7 @@ void test_ngtcp2_rob_push(void) {
   ngtcp2_rob rob;
   int rv;
   uint8_t data[256];
-  ngtcp2_rob_gap *g;
+  const ngtcp2_range *g;
 
   /* Check range overlapping */
   ngtcp2_rob_init(&rob, 64, mem);
@@ -44,59 +44,59 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  g = ngtcp2_rangeset_get(&rob.gap, 0);
 
-  CU_ASSERT(0 == g->range.begin);
-  CU_ASSERT(34567 == g->range.end);
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(34567 == g->end);
 
-  g = g->next;
+  g = ngtcp2_rangeset_get(&rob.gap, 1);
 
-  CU_ASSERT(34567 + 145 == g->range.begin);
-  CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(34567 + 145 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+  CU_ASSERT(2 == ngtcp2_rangeset_len(&rob.gap));
 
   rv = ngtcp2_rob_push(&rob, 34565, data, 1);
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  g = ngtcp2_rangeset_get(&rob.gap, 0);
 
-  CU_ASSERT(0 == g->range.begin);
-  CU_ASSERT(34565 == g->range.end);
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(34565 == g->end);
 
-  g = g->next;
+  g = ngtcp2_rangeset_get(&rob.gap, 1);
 
-  CU_ASSERT(34566 == g->range.begin);
-  CU_ASSERT(34567 == g->range.end);
+  CU_ASSERT(34566 == g->begin);
+  CU_ASSERT(34567 == g->end);
 
   rv = ngtcp2_rob_push(&rob, 34563, data, 1);
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  g = ngtcp2_rangeset_get(&rob.gap, 0);
 
-  CU_ASSERT(0 == g->range.begin);
-  CU_ASSERT(34563 == g->range.end);
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(34563 == g->end);
 
-  g = g->next;
+  g = ngtcp2_rangeset_get(&rob.gap, 1);
 
-  CU_ASSERT(34564 == g->range.begin);
-  CU_ASSERT(34565 == g->range.end);
+  CU_ASSERT(34564 == g->begin);
+  CU_ASSERT(34565 == g->end);
 
   rv = ngtcp2_rob_push(&rob, 34561, data, 151);
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  g = ngtcp2_rangeset_get(&rob.gap, 0);
 
-  CU_ASSERT(0 == g->range.begin);
-  CU_ASSERT(34561 == g->range.end);
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(34561 == g->end);
 
-  g = g->next;
+  g = ngtcp2_rangeset_get(&rob.gap, 1);
 
-  CU_ASSERT(34567 + 145 == g->range.begin);
-  CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(34567 + 145 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+  CU_ASSERT(2 == ngtcp2_rangeset_len(&rob.gap));
 
   ngtcp2_rob_free(&rob);
 
@@ -107,11 +107,11 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  g = ngtcp2_rangeset_get(&rob.gap, 0);
 
-  CU_ASSERT(123 == g->range.begin);
-  CU_ASSERT(UINT64_MAX == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(123 == g->begin);
+  CU_ASSERT(UINT64_MAX == g->end);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&rob.gap));
 
   ngtcp2_rob_free(&rob);
 
@@ -122,11 +122,11 @@ void test_ngtcp2_rob_push(void) {
 
   CU_ASSERT(0 == rv);
 
-  g = rob.gap;
+  g = ngtcp2_rangeset_get(&rob.gap, 0);
 
-  CU_ASSERT(0 == g->range.begin);
-  CU_ASSERT(UINT64_MAX - 123 == g->range.end);
-  CU_ASSERT(NULL == g->next);
+  CU_ASSERT(0 == g->begin);
+  CU_ASSERT(UINT64_MAX - 123 == g->end);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&rob.gap));
 
   ngtcp2_rob_free(&rob);
 }
@@ -281,7 +281,7 @@ void test_ngtcp2_rob_data_at(void) {
     ngtcp2_rob_pop(&rob, i * 16, len);
   }
 
-  CU_ASSERT(256 == rob.gap->range.begin);
+  CU_ASSERT(256 == ngtcp2_rangeset_get(&rob.gap, 0)->begin);
   CU_ASSERT(NULL == rob.data);
 
   ngtcp2_rob_free(&rob);
@@ -352,7 +352,7 @@ void test_ngtcp2_rob_remove_prefix(void) {
 
   ngtcp2_rob_remove_prefix(&rob, 33);
 
-  CU_ASSERT(33 == rob.gap->range.begin);
+  CU_ASSERT(33 == ngtcp2_rangeset_get(&rob.gap, 0)->begin);
   CU_ASSERT(32 == rob.data->offset);
 
   ngtcp2_rob_free(&rob);
@@ -370,8 +370,8 @@ void test_ngtcp2_rob_remove_prefix(void) {
 
   ngtcp2_rob_remove_prefix(&rob, 16);
 
-  CU_ASSERT(16 == rob.gap->range.begin);
-  CU_ASSERT(NULL == rob.gap->next);
+  CU_ASSERT(16 == ngtcp2_rangeset_get(&rob.gap, 0)->begin);
+  CU_ASSERT(1 == ngtcp2_rangeset_len(&rob.gap));
 
   ngtcp2_rob_free(&rob);
 }
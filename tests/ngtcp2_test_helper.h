@@ -106,4 +106,49 @@ size_t write_single_frame_handshake_pkt(uint8_t *out, size_t outlen,
                                         uint64_t pkt_num, uint32_t version,
                                         ngtcp2_frame *fr);
 
+/*
+ * NGTCP2_FAKE_AEAD_OVERHEAD is the length of the authentication tag
+ * which fake_encrypt appends.
+ */
+#define NGTCP2_FAKE_AEAD_OVERHEAD 16
+
+/*
+ * fake_encrypt is an identity AEAD.  It copies |plaintext| to |dest|
+ * as is, and appends NGTCP2_FAKE_AEAD_OVERHEAD bytes of zero tag.
+ * Unlike the null cipher used in the other tests, it produces a
+ * packet of realistic length, and can be decrypted by fake_decrypt.
+ */
+ssize_t fake_encrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                     const uint8_t *plaintext, size_t plaintextlen,
+                     const uint8_t *key, size_t keylen, void *aead_ctx,
+                     const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                     size_t adlen, void *user_data);
+
+/*
+ * fake_decrypt removes the tag appended by fake_encrypt.  It returns
+ * NGTCP2_ERR_TLS_DECRYPT if the tag is not all zero.
+ */
+ssize_t fake_decrypt(ngtcp2_conn *conn, uint8_t *dest, size_t destlen,
+                     const uint8_t *ciphertext, size_t ciphertextlen,
+                     const uint8_t *key, size_t keylen, void *aead_ctx,
+                     const uint8_t *nonce, size_t noncelen, const uint8_t *ad,
+                     size_t adlen, void *user_data);
+
+/*
+ * fake_crypto_callbacks sets fake_encrypt and fake_decrypt to the
+ * handshake and packet protection callbacks in |cb|.
+ */
+void fake_crypto_callbacks(ngtcp2_conn_callbacks *cb);
+
+/*
+ * fake_handshake completes handshake between |client| and |server|
+ * without TLS.  It exchanges transport parameters, installs the keys
+ * for fake_encrypt and fake_decrypt, and moves both connections to
+ * post handshake state.  |client| and |server| must be created with
+ * the same connection ID.
+ *
+ * This function returns 0 if it succeeds, or negative error code.
+ */
+int fake_handshake(ngtcp2_conn *client, ngtcp2_conn *server);
+
 #endif /* NGTCP2_TEST_HELPER_H */